@@ -37,67 +37,19 @@ void MM_Digital_Out::begin(bool useEEPROM, uint8_t cfgId){
 
 bool MM_Digital_Out::process(MM_Packet &pkg){
     if(checkMsg(pkg)){
-        uint8_t len = 0;
         uint8_t data[8];
         switch (pkg.data[0]){
             case BOOL:
                 switchOutput(bool(pkg.data[1]));
                 break;
             case CFG_RESET:
-                if(_controller == NULL) return;
-                if(_useEEPROM){
-                    EEPROM.update(_controller->getEEPROMAddress(_cfgId), 0);
-                }
+                if(_controller == NULL) return false;
+                invalidateConfig();
                 data[0] = MM_CMD::ACK;
                 data[1] = MM_CMD::CFG_RESET;
                 _controller->Send(Broadcast, 0, 2, data);
                 _controller->reboot();
                 break;
-            case CFG_REG_SET:
-                if(pkg.data[1] == 1 && pkg.len == 3){
-                    _config.inverted = bool(pkg.data[2]);
-                    writeConfig(_config);
-                    data[0] = MM_CMD::CFG_REG_COMMIT;
-                    data[1] = 1;
-                    data[2] = pkg.data[2];
-                    len = 3;
-                }
-                else if(pkg.data[1] == 2 && pkg.len == 3){
-                    _config.powerBack = ON_MODE(pkg.data[2]);
-                    writeConfig(_config);
-                    data[0] = MM_CMD::CFG_REG_COMMIT;
-                    data[1] = 2;
-                    data[2] = pkg.data[2];
-                    len = 3;
-                }
-                else{
-                    returnErrorMsg(pkg);
-                }
-                if(_controller != NULL){
-                    _controller->Send(Broadcast, 0 , len, data);
-                }
-                break;
-            case CFG_REG_GET:
-                if(pkg.data[1] == 1){
-                    data[0] = MM_CMD::CFG_REG_COMMIT;
-                    data[1] = 1;
-                    data[2] = _config.inverted;
-                    len = 3;
-                }
-                else if(pkg.data[1] == 2){
-                    data[0] = MM_CMD::CFG_REG_COMMIT;
-                    data[1] = 2;
-                    data[2] = _config.powerBack;
-                    len = 3;
-                }
-                else{
-                    returnErrorMsg(pkg);
-                    return;
-                }
-                if(_controller != NULL){
-                    _controller->Send(Broadcast, 0 , len, data);
-                }
-                break;
             default:
                 break;
         }
@@ -105,6 +57,39 @@ bool MM_Digital_Out::process(MM_Packet &pkg){
     return true;
 }
 
+uint8_t MM_Digital_Out::registerCount(){
+    return 2;
+}
+
+bool MM_Digital_Out::getRegister(uint8_t reg, uint8_t &value){
+    switch (reg){
+        case 1:
+            value = _config.inverted;
+            return true;
+        case 2:
+            value = _config.powerBack;
+            return true;
+    }
+    return false;
+}
+
+bool MM_Digital_Out::setRegister(uint8_t reg, uint8_t value){
+    switch (reg){
+        case 1:
+            _config.inverted = bool(value);
+            return true;
+        case 2:
+            if(value > ON_MODE::On) return false;
+            _config.powerBack = ON_MODE(value);
+            return true;
+    }
+    return false;
+}
+
+bool MM_Digital_Out::saveConfig(){
+    return writeConfig(_config);
+}
+
 bool MM_Digital_Out::loop(){
     return true;
 }
@@ -126,5 +111,8 @@ void MM_Digital_Out::switchOutput(bool power){
     }
     _config.state = power;
     broadcastState();
-    writeConfig(_config);
+    //The state only has to survive a reboot with LastState, the EEPROM write is deferred
+    if(_config.powerBack == LastState){
+        markConfigDirty();
+    }
 }
\ No newline at end of file
@@ -13,7 +13,7 @@ private:
         On,
     };
 
-    typedef struct cfg
+    struct cfg
     {
         bool state;
         bool inverted;
@@ -43,6 +43,14 @@ public:
     bool loop();
     bool broadcastState();
     void switchOutput(bool power);
+
+    /**
+     * Registers: 1 - inverted (0/1), 2 - power back mode (0 = Off, 1 = LastState, 2 = On)
+     */
+    uint8_t registerCount();
+    bool getRegister(uint8_t reg, uint8_t &value);
+    bool setRegister(uint8_t reg, uint8_t value);
+    bool saveConfig();
 };
 
 #endif
\ No newline at end of file
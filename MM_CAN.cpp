@@ -1,26 +1,130 @@
 #include "MM_CAN.h"
 
-volatile bool MM_CANIntReq = false;
+//Keep the compiler from reordering ring buffer accesses around the index updates
+#define MM_CAN_BARRIER() __asm__ __volatile__("" ::: "memory")
 
-void MM_CANInt() {
-    MM_CANIntReq=true;
+MM_CAN *MM_CAN::_instances[MM_CAN_MAX_INSTANCES];
+
+void MM_CAN::isr0() {
+    _instances[0]->handleInterrupt();
+}
+
+void MM_CAN::isr1() {
+    _instances[MM_CAN_MAX_INSTANCES - 1]->handleInterrupt();
 }
 
 MM_CAN::MM_CAN(uint8_t cs, uint8_t speed, uint8_t clockspd, uint8_t interrupt) : 
 _interface(cs) {
     pinMode(interrupt, INPUT_PULLUP);
-    attachInterrupt(digitalPinToInterrupt(interrupt), MM_CANInt, FALLING);
     _csPin = cs;
     _intPin = interrupt;
     _speed = speed;
     _clockspd = clockspd;
+
+    //Reserve an interrupt slot, the interrupt itself is attached in begin()
+    if (digitalPinToInterrupt(interrupt) != NOT_AN_INTERRUPT) {
+        for (uint8_t i = 0; i < MM_CAN_MAX_INSTANCES && i < 2; i++) {
+            if (_instances[i] == NULL) {
+                _instances[i] = this;
+                _slot = i;
+                break;
+            }
+        }
+    }
     //Begin doesn't work here!
 }
 
 bool MM_CAN::begin() {
-    lastErr = _interface.begin(MCP_ANY, _speed, _clockspd);
+    //Extended frames only, the masks start cleared (accept everything) until setFilter()
+    lastErr = _interface.begin(MCP_EXT, _speed, _clockspd);
     _interface.setMode(MCP_NORMAL);
-    return (lastErr == 0);
+    if (lastErr != 0) return false;
+
+    if (_slot < MM_CAN_MAX_INSTANCES) {
+        //Mask our interrupt during SPI transactions of the main code
+        SPI.usingInterrupt(digitalPinToInterrupt(_intPin));
+        attachInterrupt(digitalPinToInterrupt(_intPin), _slot == 0 ? isr0 : isr1, FALLING);
+    }
+    return true;
+}
+
+void MM_CAN::drain() {
+    MM_CANFrame frame;
+
+    while (_interface.checkReceive() == CAN_MSGAVAIL) {
+        if (_interface.readMsgBuf(&frame.id, &frame.len, frame.data) != CAN_OK) break;
+
+        uint8_t next = (_rxHead + 1) & (MM_CAN_RX_BUFFER - 1);
+        if (next == _rxTail) {
+            _overruns++;
+            continue;
+        }
+        _rxRing[_rxHead] = frame;
+        MM_CAN_BARRIER();
+        _rxHead = next;
+    }
+}
+
+void MM_CAN::handleInterrupt() {
+    //The main code is using the controller right now, Receive() picks the frames up later
+    if (_spiBusy) return;
+    drain();
+}
+
+bool MM_CAN::setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count) {
+    uint32_t masks[2] = {0, 0};
+    uint32_t filters[6] = {0, 0, 0, 0, 0, 0};
+
+    if (nodeID != 0 && groups != NULL) {
+        uint16_t low[3];
+        uint8_t used = 0;
+        bool fits = true;
+
+        for (uint8_t i = 0; i < count && fits; i++) {
+            uint16_t addr = groups[i] & 0x7FF;
+            bool known = (addr == nodeID);
+            for (uint8_t j = 0; j < used && !known; j++) {
+                known = (low[j] == addr);
+            }
+            if (known) continue;
+            if (used >= 3) {
+                fits = false;
+            }else{
+                low[used++] = addr;
+            }
+        }
+
+        if (fits) {
+            //Type bit 28 set: Broadcast and Streaming
+            masks[0] = (uint32_t)1 << 28;
+            filters[0] = (uint32_t)1 << 28;
+            filters[1] = (uint32_t)1 << 28;
+
+            //Type bit 28 clear: Unicast and Multicast, low 11 bits of the target
+            masks[1] = ((uint32_t)1 << 28) | ((uint32_t)0x7FF << 11);
+            filters[2] = (uint32_t)nodeID << 11;
+            for (uint8_t i = 0; i < 3; i++) {
+                filters[3 + i] = (i < used) ? ((uint32_t)low[i] << 11) : filters[2];
+            }
+        }
+    }
+
+    _spiBusy = true;
+    uint8_t err = 0;
+    for (uint8_t i = 0; i < 2; i++) {
+        err |= _interface.init_Mask(i, 1, masks[i]);
+    }
+    for (uint8_t i = 0; i < 6; i++) {
+        err |= _interface.init_Filt(i, 1, filters[i]);
+    }
+    _spiBusy = false;
+
+    lastErr = err;
+    return (err == 0);
+}
+
+uint16_t MM_CAN::overruns() {
+    return _overruns;
 }
 
 MM_Meta MM_CAN::CanAddrParse(uint32_t canAddr) {
@@ -43,6 +147,11 @@ MM_Meta MM_CAN::CanAddrParse(uint32_t canAddr) {
         temp.port = ((canAddr >> 23) & 0x1F);
         temp.target &= 0x7FF;
     }
+    else if(temp.type == Streaming) {
+        //The upper port bit is the low type bit, streams use ports 0-15
+        temp.port = ((canAddr >> 23) & 0x0F);
+        temp.target &= 0x7FF;
+    }
 
     return temp;
 }
@@ -87,29 +196,36 @@ bool MM_CAN::Send(MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t
     uint32_t addr = CanAddrAssemble(msgType, target, source, port);
     if(addr == 0) return false;
 
+    //The library keeps the frame in members between SPI transactions, don't let the interrupt read in between
+    _spiBusy = true;
     lastErr = _interface.sendMsgBuf(addr, 1, len, data);
+    _spiBusy = false;
     if(lastErr != CAN_OK) return false;
     return true;
 }
 
 bool MM_CAN::Receive(MM_Packet &pkg) {
 
-    uint32_t rxId;
-    uint8_t ext = 1;
-    uint8_t len = 0;
-    uint8_t rxBuf[8];
-
-    if(_interface.checkReceive() != CAN_MSGAVAIL) return false;
-
-    uint8_t state = _interface.readMsgBuf(&rxId, &len, rxBuf);
+    if(_rxHead == _rxTail) {
+        //Polling mode, or the interrupt was deferred while we used the controller (INT is still low)
+        if(_slot >= MM_CAN_MAX_INSTANCES || digitalRead(_intPin) == LOW) {
+            _spiBusy = true;
+            drain();
+            _spiBusy = false;
+        }
+        if(_rxHead == _rxTail) return false;
+    }
 
+    MM_CAN_BARRIER();
+    MM_CANFrame &frame = _rxRing[_rxTail];
 
-    if(state != CAN_OK) return false;
+    pkg.meta = CanAddrParse(frame.id);
+    pkg.len = frame.len;
 
-    pkg.meta = CanAddrParse(rxId);
-    pkg.len = len;
+    for(uint8_t i=0; i<frame.len && i<8; i++) pkg.data[i] = frame.data[i];
 
-    for(uint8_t i=0; i<len; i++) pkg.data[i] = rxBuf[i];
+    MM_CAN_BARRIER();
+    _rxTail = (_rxTail + 1) & (MM_CAN_RX_BUFFER - 1);
 
     return true;
 }
\ No newline at end of file
@@ -27,17 +27,24 @@
 #include "MM_Module.h"
 
 
-/**
- * Global variable indicating a CAN-bus got a message
- * This is currently shared amongst all CAN-interfaces!
- */
-extern volatile bool MM_CANIntReq;
+//Number of received frames buffered per interface, must be a power of two
+#ifndef MM_CAN_RX_BUFFER
+    #define MM_CAN_RX_BUFFER 8
+#endif
+
+//Max number of interrupt driven MM_CAN interfaces (1 or 2), further interfaces are polled
+#ifndef MM_CAN_MAX_INSTANCES
+    #define MM_CAN_MAX_INSTANCES 2
+#endif
 
 /**
- * Global interrupt function called on CAN interrupts
- * This is currently shared amongst all CAN-interfaces!
+ * Raw CAN frame as read from the controller
  */
-void MM_CANInt(void);
+struct MM_CANFrame {
+    uint32_t id;
+    uint8_t len;
+    uint8_t data[8];
+};
 
 /**
  * CAN Communication Interface
@@ -64,6 +71,52 @@ private:
      * CAN Crystal Frequency
      */
     uint8_t _clockspd = 0;
+
+    /**
+     * Interrupt slot of this interface, MM_CAN_MAX_INSTANCES = no interrupt (polling)
+     */
+    uint8_t _slot = MM_CAN_MAX_INSTANCES;
+
+    /**
+     * Frames read from the controller, filled by the interrupt, emptied by Receive()
+     */
+    MM_CANFrame _rxRing[MM_CAN_RX_BUFFER];
+
+    /**
+     * Write index of _rxRing (interrupt)
+     */
+    volatile uint8_t _rxHead = 0;
+
+    /**
+     * Read index of _rxRing (Receive)
+     */
+    volatile uint8_t _rxTail = 0;
+
+    /**
+     * Frames lost because _rxRing was full
+     */
+    volatile uint16_t _overruns = 0;
+
+    /**
+     * Set while the main code talks to the controller, the interrupt is deferred then
+     */
+    volatile bool _spiBusy = false;
+
+    /**
+     * Read all pending frames of the controller (both RX buffers) into _rxRing
+     */
+    void drain();
+
+    /**
+     * Interfaces by interrupt slot
+     */
+    static MM_CAN *_instances[MM_CAN_MAX_INSTANCES];
+
+    /**
+     * Interrupt functions of the slots
+     */
+    static void isr0();
+    static void isr1();
 public:
     /**
      * CAN-Bus object
@@ -76,6 +129,9 @@ public:
 
     /**
      * Constructor for Interrupt based operation
+     * The interrupt reads received frames into a ring buffer of MM_CAN_RX_BUFFER frames.
+     * If the pin has no interrupt or more than MM_CAN_MAX_INSTANCES interfaces exist,
+     * the controller is polled in Receive() instead
      * @param cs pin used for CHIP_SELECT
      * @param speed CAN bus speed definition from mcp_can_dfs.h (bottom)
      * @param clockspd MCP crystal frequency from mcp_can_dfs.h (bootom)
@@ -137,7 +193,7 @@ public:
     /**
      * Receive a message from the CAN-bus
      *
-     * This polls the CAN-Controller for new messages.
+     * This takes the oldest frame from the ring buffer filled by the interrupt.
      * The received message will be passed to &pkg, if no message
      * is available the function will return false.
      *
@@ -145,6 +201,28 @@ public:
      * @return true if a message was received
      */
     bool Receive(MM_Packet &pkg);
+
+    /**
+     * Program the MCP2515 masks and filters
+     * RXB0 (mask 0, filter 0-1) accepts broadcast and streaming frames,
+     * RXB1 (mask 1, filter 2-5) accepts unicast/multicast frames whose 11 low target bits
+     * match the node-id or one of up to 3 groups. With more groups, nodeID 0 or groups == NULL
+     * the masks are cleared and every frame is accepted.
+     * Multicast groups that share the low 11 bits also pass, MM_Module filters them in software.
+     * @see MM_Interface::setFilter
+     */
+    bool setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count);
+
+    /**
+     * Interrupt handler, reads the received frames from the controller
+     * Called from the interrupt of the INT pin
+     */
+    void handleInterrupt();
+
+    /**
+     * @return number of frames lost because the ring buffer was full
+     */
+    uint16_t overruns();
 };
 
 
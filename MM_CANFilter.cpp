@@ -0,0 +1,93 @@
+#include "MM_CANFilter.h"
+
+//Address layout of MM_CAN::CanAddrAssemble
+#define MM_CANFILTER_TYPE_HIGH   ((uint32_t)1 << 28)
+#define MM_CANFILTER_TYPE        ((uint32_t)3 << 27)
+#define MM_CANFILTER_TARGET11    ((uint32_t)0x7FF << 11)
+#define MM_CANFILTER_TARGET16    ((uint32_t)0xFFFF << 11)
+
+static uint8_t bitCount(uint32_t value){
+    uint8_t bits = 0;
+    while (value) {
+        value &= value - 1;
+        bits++;
+    }
+    return bits;
+}
+
+static MM_CANMask merge(const MM_CANMask &a, const MM_CANMask &b){
+    MM_CANMask m;
+    m.mask = a.mask & b.mask & ~(a.id ^ b.id);
+    m.id = a.id & m.mask;
+    return m;
+}
+
+static bool covers(const MM_CANMask &a, const MM_CANMask &b){
+    //a accepts everything b accepts
+    return (a.mask & ~b.mask) == 0 && ((a.id ^ b.id) & a.mask) == 0;
+}
+
+static void add(MM_CANMask *masks, uint8_t &used, uint8_t maxMasks, MM_CANMask entry){
+    for (uint8_t i = 0; i < used; i++) {
+        if (covers(masks[i], entry)) return;
+    }
+
+    if (used < maxMasks) {
+        masks[used++] = entry;
+        return;
+    }
+
+    //No free bank, merge the pair (including the new entry) that keeps the most mask bits
+    uint8_t bestA = 0;
+    uint8_t bestB = used;
+    int8_t bestBits = -1;
+    for (uint8_t a = 0; a < used; a++) {
+        for (uint8_t b = a + 1; b <= used; b++) {
+            MM_CANMask m = merge(masks[a], b == used ? entry : masks[b]);
+            int8_t bits = bitCount(m.mask);
+            if (bits > bestBits) {
+                bestBits = bits;
+                bestA = a;
+                bestB = b;
+            }
+        }
+    }
+    MM_CANMask merged = merge(masks[bestA], bestB == used ? entry : masks[bestB]);
+    if (bestB != used) {
+        //Two existing banks merged, the new entry takes the freed bank
+        masks[bestB] = entry;
+    }
+    masks[bestA] = merged;
+}
+
+uint8_t MM_CANFilterPlan(uint16_t nodeID, const uint16_t *groups, uint8_t count, MM_CANMask *masks, uint8_t maxMasks){
+    if (maxMasks == 0) return 0;
+
+    if (nodeID == 0 || groups == 0) {
+        masks[0].id = 0;
+        masks[0].mask = 0;
+        return 1;
+    }
+
+    uint8_t used = 0;
+    MM_CANMask entry;
+
+    //Broadcast and Streaming
+    entry.id = MM_CANFILTER_TYPE_HIGH;
+    entry.mask = MM_CANFILTER_TYPE_HIGH;
+    add(masks, used, maxMasks, entry);
+
+    //Unicast to this node, any port
+    entry.id = (uint32_t)nodeID << 11;
+    entry.mask = MM_CANFILTER_TYPE_HIGH | MM_CANFILTER_TARGET11;
+    add(masks, used, maxMasks, entry);
+
+    //Multicast groups, full 16 bit target
+    for (uint8_t i = 0; i < count; i++) {
+        entry.id = ((uint32_t)1 << 27) | ((uint32_t)groups[i] << 11);
+        entry.mask = MM_CANFILTER_TYPE | MM_CANFILTER_TARGET16;
+        add(masks, used, maxMasks, entry);
+    }
+
+    return used;
+}
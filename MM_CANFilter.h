@@ -0,0 +1,52 @@
+/*
+    MM_Sysbus CAN acceptance filter
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_CANFilter__
+#define __MM_CANFilter__
+
+#include <stdint.h>
+
+/**
+ * One id/mask pair of a CAN acceptance filter (29 bit extended id)
+ * A frame passes if (frameId & mask) == (id & mask)
+ */
+struct MM_CANMask {
+    uint32_t id;
+    uint32_t mask;
+};
+
+/**
+ * Compute the id/mask pairs a node needs, based on the MM_CAN address layout
+ *
+ * The plan contains one pair for broadcast and streaming frames, one for unicast
+ * frames to nodeID and one exact pair per multicast group. If there are more pairs
+ * than maxMasks, the two pairs that lose the fewest mask bits are merged until they fit,
+ * so the filter gets wider but never drops a frame the node needs.
+ *
+ * This function has no hardware dependencies.
+ *
+ * @param nodeID node-id, 0 = accept everything
+ * @param groups multicast addresses, NULL = accept everything
+ * @param count number of groups
+ * @param masks array to store the plan
+ * @param maxMasks size of masks (number of filter banks), at least 1
+ * @return number of pairs stored in masks, a single pair with mask 0 accepts everything
+ */
+uint8_t MM_CANFilterPlan(uint16_t nodeID, const uint16_t *groups, uint8_t count, MM_CANMask *masks, uint8_t maxMasks);
+
+#endif
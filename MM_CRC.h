@@ -0,0 +1,42 @@
+/*
+    MM_Sysbus CRC
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_CRC__
+#define __MM_CRC__
+
+#include <stdint.h>
+
+//Start value of MM_CRC16
+#define MM_CRC16_INIT 0xFFFF
+
+/**
+ * CRC-16/CCITT (polynom 0x1021) update without lookup table
+ * @param crc current crc, start with MM_CRC16_INIT
+ * @param data next byte
+ * @return updated crc
+ */
+inline uint16_t MM_CRC16(uint16_t crc, uint8_t data){
+    crc = (crc >> 8) | (crc << 8);
+    crc ^= data;
+    crc ^= (crc & 0xFF) >> 4;
+    crc ^= crc << 12;
+    crc ^= (crc & 0xFF) << 5;
+    return crc;
+}
+
+#endif
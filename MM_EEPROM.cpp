@@ -0,0 +1,164 @@
+#include "MM_EEPROM.h"
+
+#ifdef MM_EEPROM_USE_ISR
+    #ifndef EEMPE
+        #define EEMPE EEMWE
+        #define EEPE EEWE
+    #endif
+
+    //Disable interrupts, keeps the previous state (flush() may be called from an ISR)
+    #define MM_EEPROM_LOCK() uint8_t sreg = SREG; cli()
+    #define MM_EEPROM_UNLOCK() SREG = sreg
+    #define MM_EEPROM_WRITING() (EECR & _BV(EEPE))
+
+    ISR(EE_READY_vect){
+        MM_EEPROM::handleInterrupt();
+    }
+#else
+    #define MM_EEPROM_LOCK()
+    #define MM_EEPROM_UNLOCK()
+    #define MM_EEPROM_WRITING() false
+#endif
+
+MM_EEPROMWrite MM_EEPROM::_queue[MM_EEPROM_QUEUE_SIZE];
+volatile uint8_t MM_EEPROM::_head = 0;
+volatile uint8_t MM_EEPROM::_tail = 0;
+volatile uint8_t MM_EEPROM::_fenced = 0;
+
+//Byte currently written by the hardware
+static volatile uint16_t _flightAddr = 0xFFFF;
+static volatile uint8_t _flightValue = 0;
+
+uint8_t MM_EEPROM::find(uint16_t addr){
+    uint8_t found = MM_EEPROM_QUEUE_SIZE;
+    for(uint8_t i = _tail; i != _head; i = (i + 1) % MM_EEPROM_QUEUE_SIZE){
+        if(_queue[i].addr == addr) found = i;
+    }
+    return found;
+}
+
+uint8_t MM_EEPROM::read(uint16_t addr){
+    while(true){
+        MM_EEPROM_LOCK();
+        uint8_t i = find(addr);
+        if(i != MM_EEPROM_QUEUE_SIZE){
+            uint8_t value = _queue[i].value;
+            MM_EEPROM_UNLOCK();
+            return value;
+        }
+        if(!MM_EEPROM_WRITING()){
+            uint8_t value = EEPROM.read(addr);
+            MM_EEPROM_UNLOCK();
+            return value;
+        }
+        if(addr == _flightAddr){
+            uint8_t value = _flightValue;
+            MM_EEPROM_UNLOCK();
+            return value;
+        }
+        //The EEPROM can't be read during a write, let interrupts run and try again
+        MM_EEPROM_UNLOCK();
+    }
+}
+
+void MM_EEPROM::update(uint16_t addr, uint8_t value){
+    while(true){
+        MM_EEPROM_LOCK();
+        uint8_t i = find(addr);
+        if(i != MM_EEPROM_QUEUE_SIZE){
+            if(_queue[i].value == value){
+                MM_EEPROM_UNLOCK();
+                return;
+            }
+            //Only entries behind the last barrier may be changed in place
+            if((uint8_t)((i + MM_EEPROM_QUEUE_SIZE - _tail) % MM_EEPROM_QUEUE_SIZE) >= _fenced){
+                _queue[i].value = value;
+                MM_EEPROM_UNLOCK();
+                return;
+            }
+        }
+        //Compare now if possible, otherwise the byte is compared before it gets written
+        else if(!MM_EEPROM_WRITING() && EEPROM.read(addr) == value){
+            MM_EEPROM_UNLOCK();
+            return;
+        }
+        uint8_t next = (_head + 1) % MM_EEPROM_QUEUE_SIZE;
+        if(next != _tail){
+            _queue[_head].addr = addr;
+            _queue[_head].value = value;
+            _head = next;
+            #ifdef MM_EEPROM_USE_ISR
+                EECR |= _BV(EERIE);
+            #endif
+            MM_EEPROM_UNLOCK();
+            return;
+        }
+        MM_EEPROM_UNLOCK();
+
+        //Queue full
+        #ifdef MM_DEBUG
+            Serial.println("EEPROM queue full");
+        #endif
+        writeNext();
+    }
+}
+
+uint16_t MM_EEPROM::length(){
+    return EEPROM.length();
+}
+
+void MM_EEPROM::tick(){
+    #ifndef MM_EEPROM_USE_ISR
+        if(_head != _tail) handleInterrupt();
+    #endif
+}
+
+void MM_EEPROM::barrier(){
+    MM_EEPROM_LOCK();
+    _fenced = (_head + MM_EEPROM_QUEUE_SIZE - _tail) % MM_EEPROM_QUEUE_SIZE;
+    MM_EEPROM_UNLOCK();
+}
+
+bool MM_EEPROM::busy(){
+    return _head != _tail || MM_EEPROM_WRITING();
+}
+
+void MM_EEPROM::flush(){
+    while(busy()){
+        writeNext();
+    }
+}
+
+void MM_EEPROM::writeNext(){
+    MM_EEPROM_LOCK();
+    if(!MM_EEPROM_WRITING()){
+        handleInterrupt();
+    }
+    MM_EEPROM_UNLOCK();
+}
+
+void MM_EEPROM::handleInterrupt(){
+    while(_tail != _head){
+        MM_EEPROMWrite w = _queue[_tail];
+        _tail = (_tail + 1) % MM_EEPROM_QUEUE_SIZE;
+        if(_fenced > 0) _fenced--;
+        if(EEPROM.read(w.addr) == w.value) continue;
+
+        #ifdef MM_EEPROM_USE_ISR
+            //Start the write, the interrupt fires again when it is done
+            _flightAddr = w.addr;
+            _flightValue = w.value;
+            EEAR = w.addr;
+            EEDR = w.value;
+            EECR |= _BV(EEMPE);
+            EECR |= _BV(EEPE);
+        #else
+            EEPROM.write(w.addr, w.value);
+        #endif
+        return;
+    }
+    _flightAddr = 0xFFFF;
+    #ifdef MM_EEPROM_USE_ISR
+        EECR &= ~_BV(EERIE);
+    #endif
+}
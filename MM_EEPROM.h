@@ -0,0 +1,148 @@
+/*
+    MM_Sysbus EEPROM
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_EEPROM__
+#define __MM_EEPROM__
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+//Number of bytes that can wait for the EEPROM, if full the oldest byte is written blocking
+#ifndef MM_EEPROM_QUEUE_SIZE
+    #define MM_EEPROM_QUEUE_SIZE 32
+#endif
+
+//On AVR the queue is fed by the EEPROM-ready interrupt, define MM_EEPROM_NO_ISR to use tick() instead
+#if defined(__AVR__) && defined(EE_READY_vect) && !defined(MM_EEPROM_NO_ISR)
+    #define MM_EEPROM_USE_ISR
+#endif
+
+/**
+ * Byte waiting to be written
+ */
+struct MM_EEPROMWrite {
+    uint16_t addr;
+    uint8_t value;
+};
+
+/**
+ * Non-blocking EEPROM access
+ * Writes are queued and fed to the EEPROM byte by byte, from the EEPROM-ready
+ * interrupt on AVR or from tick() (called by MM_Sysbus::loop()) on other cores.
+ * Reads return the queued value of a byte that isn't written yet.
+ * Only bytes that differ from the EEPROM (or the queue) are queued, a byte that is
+ * already queued is changed in place unless a barrier() lies between.
+ */
+class MM_EEPROM {
+public:
+    /**
+     * Read a byte, coherent with pending writes
+     * @param addr EEPROM address
+     * @return value
+     */
+    static uint8_t read(uint16_t addr);
+
+    /**
+     * Queue a byte if it differs from the current value
+     * @param addr EEPROM address
+     * @param value new value
+     */
+    static void update(uint16_t addr, uint8_t value);
+
+    /**
+     * Read an object, coherent with pending writes
+     */
+    template <typename T> static T &get(uint16_t addr, T &t){
+        uint8_t *p = (uint8_t*)&t;
+        for(uint16_t i = 0; i < sizeof(T); i++){
+            p[i] = read(addr + i);
+        }
+        return t;
+    }
+
+    /**
+     * Queue the changed bytes of an object
+     */
+    template <typename T> static const T &put(uint16_t addr, const T &t){
+        const uint8_t *p = (const uint8_t*)&t;
+        for(uint16_t i = 0; i < sizeof(T); i++){
+            update(addr + i, p[i]);
+        }
+        return t;
+    }
+
+    /**
+     * @return size of the EEPROM
+     */
+    static uint16_t length();
+
+    /**
+     * Write the next queued byte if the EEPROM is ready, does nothing with MM_EEPROM_USE_ISR
+     */
+    static void tick();
+
+    /**
+     * Order the writes for power loss safety
+     * Bytes queued after the barrier reach the EEPROM after all bytes queued before it,
+     * an address that is already queued gets a new entry instead of being changed in place.
+     */
+    static void barrier();
+
+    /**
+     * @return true if writes are pending
+     */
+    static bool busy();
+
+    /**
+     * Write all queued bytes, blocking
+     */
+    static void flush();
+
+    /**
+     * Called by the EEPROM-ready interrupt
+     */
+    static void handleInterrupt();
+
+private:
+    /**
+     * Pending writes (ring buffer)
+     */
+    static MM_EEPROMWrite _queue[MM_EEPROM_QUEUE_SIZE];
+    static volatile uint8_t _head;
+    static volatile uint8_t _tail;
+
+    /**
+     * Entries from _tail on that were queued before the last barrier()
+     */
+    static volatile uint8_t _fenced;
+
+    /**
+     * Find the newest queued write of an address
+     * Interrupts must be disabled
+     * @return index in _queue, MM_EEPROM_QUEUE_SIZE if not queued
+     */
+    static uint8_t find(uint16_t addr);
+
+    /**
+     * Write the oldest queued byte, blocking
+     */
+    static void writeNext();
+};
+
+#endif
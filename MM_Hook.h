@@ -52,12 +52,12 @@ struct MM_Hook{
      * Command to listen
      * ALL_CMDS = everything
      */
-    MM_CMD cmd;
+    MM_CMD cmd = ALL_CMDS;
 
     /**
      * Function to call
      */
-    void (*execute)(MM_Packet &pkg);
+    void (*execute)(MM_Packet &pkg) = NULL;
 
 };
 
@@ -20,7 +20,7 @@
 #ifndef __MM_Interface__
 #define __MM_Interface__
 
-#include "MM_protocol.h"
+#include "MM_Protocol.h"
 
 /**
  * Base class for any communication interface
@@ -34,6 +34,8 @@ public:
      */
     uint8_t lastErr = 0;
 
+    virtual ~MM_Interface() {}
+
     /**
      * Initialize Interface
      * @return true if all ok
@@ -52,12 +54,42 @@ public:
      */
     virtual bool Send(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data) = 0;
 
+    /**
+     * Send several packets at once
+     * Interfaces that can pack frames (e.g. into one serial write) override this,
+     * the default sends the packets one by one.
+     * @param pkgs packets to send
+     * @param count number of packets
+     * @return number of packets sent, stops at the first failed packet
+     */
+    virtual uint8_t SendBatch(MM_Packet *pkgs, uint8_t count){
+        for(uint8_t i = 0; i < count; i++){
+            if(!Send(pkgs[i].meta.type, pkgs[i].meta.target, pkgs[i].meta.source, pkgs[i].meta.port, pkgs[i].len, pkgs[i].data)){
+                return i;
+            }
+        }
+        return count;
+    }
+
     /**
      * Receive a message from the interface
      * @param pkg reference to store received packet
      * @return true if a message was received
      */
     virtual bool Receive(MM_Packet &pkg)=0;
+
+    /**
+     * Set the acceptance filter of the interface
+     * Interfaces with hardware filters only accept packets for this node (unicast to nodeID,
+     * broadcast, streaming and the multicast groups), all other interfaces ignore this.
+     * @param nodeID node-id of this controller, 0 = accept everything
+     * @param groups multicast addresses the node listens to, NULL = accept everything
+     * @param count number of groups
+     * @return true if the interface programmed its filter
+     */
+    virtual bool setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count){
+        return false;
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "MM_Journal.h"
+
+void MM_Journal::begin(uint16_t start, uint16_t size){
+    _start = start;
+    _bankSize = size / 2;
+    _indexed = false;
+}
+
+uint16_t MM_Journal::bankStart(uint8_t bank){
+    return _start + bank * _bankSize;
+}
+
+void MM_Journal::buildIndex(){
+    _indexed = true;
+
+    bool valid[2];
+    uint8_t gen[2];
+    for(uint8_t b = 0; b < 2; b++){
+        valid[b] = MM_EEPROM::read(bankStart(b)) == MM_JOURNAL_MAGIC;
+        gen[b] = MM_EEPROM::read(bankStart(b) + 1);
+    }
+
+    if(valid[0] && valid[1]){
+        //Generations wrap around, the newer one is ahead by less than 128
+        _bank = (int8_t)(gen[1] - gen[0]) > 0 ? 1 : 0;
+    }
+    else if(valid[0] || valid[1]){
+        _bank = valid[1] ? 1 : 0;
+    }
+    else{
+        #ifdef MM_DEBUG
+            Serial.println("Format journal");
+        #endif
+        _bank = 0;
+        //Invalidate old data behind the header, then validate the header
+        MM_EEPROM::update(bankStart(0) + MM_JOURNAL_HEADER, 0);
+        MM_EEPROM::update(bankStart(0) + 1, 1);
+        MM_EEPROM::barrier();
+        MM_EEPROM::update(bankStart(0), MM_JOURNAL_MAGIC);
+        gen[0] = 1;
+    }
+    _gen = gen[_bank];
+    scan();
+}
+
+void MM_Journal::scan(){
+    for(uint8_t i = 0; i < MM_JOURNAL_KEYS; i++){
+        _index[i] = 0;
+    }
+
+    uint16_t pos = bankStart(_bank) + MM_JOURNAL_HEADER;
+    uint16_t end = bankStart(_bank) + _bankSize;
+    while(pos + MM_JOURNAL_OVERHEAD <= end){
+        uint8_t key = MM_EEPROM::read(pos);
+        uint8_t len = MM_EEPROM::read(pos + 1);
+        if(key == 0 || key > MM_JOURNAL_KEYS || pos + MM_JOURNAL_OVERHEAD + len > end) break;
+
+        uint16_t stored = ((uint16_t)MM_EEPROM::read(pos + 2 + len) << 8) | MM_EEPROM::read(pos + 3 + len);
+        if(stored != crc(pos, _gen)) break;
+
+        _index[key - 1] = len > 0 ? pos : 0;
+        pos += MM_JOURNAL_OVERHEAD + len;
+    }
+    _end = pos;
+}
+
+uint16_t MM_Journal::crc(uint16_t addr, uint8_t gen){
+    uint16_t c = MM_CRC16_INIT ^ gen;
+    uint8_t len = MM_EEPROM::read(addr + 1);
+    for(uint16_t i = 0; i < 2 + len; i++){
+        c = MM_CRC16(c, MM_EEPROM::read(addr + i));
+    }
+    return c;
+}
+
+void MM_Journal::writeRecord(uint16_t addr, uint8_t gen, uint8_t key, const uint8_t *data, uint16_t dataAddr, uint8_t len){
+    uint16_t c = MM_CRC16(MM_CRC16(MM_CRC16_INIT ^ gen, key), len);
+    MM_EEPROM::update(addr, key);
+    MM_EEPROM::update(addr + 1, len);
+    for(uint8_t i = 0; i < len; i++){
+        uint8_t b = data != NULL ? data[i] : MM_EEPROM::read(dataAddr + i);
+        MM_EEPROM::update(addr + 2 + i, b);
+        c = MM_CRC16(c, b);
+    }
+    MM_EEPROM::update(addr + 2 + len, highByte(c));
+    MM_EEPROM::update(addr + 3 + len, lowByte(c));
+}
+
+bool MM_Journal::write(uint8_t key, const uint8_t *data, uint8_t len){
+    if(key == 0 || key > MM_JOURNAL_KEYS || _bankSize == 0) return false;
+    if(!_indexed) buildIndex();
+
+    //Skip records that don't change anything
+    uint16_t old = _index[key - 1];
+    if(old == 0 && len == 0) return true;
+    if(old != 0 && MM_EEPROM::read(old + 1) == len){
+        uint8_t i = 0;
+        while(i < len && MM_EEPROM::read(old + 2 + i) == data[i]) i++;
+        if(i == len) return true;
+    }
+
+    if(_end + MM_JOURNAL_OVERHEAD + len > bankStart(_bank) + _bankSize){
+        //The new record replaces the old one in the compacted bank
+        if(!compact(key, data, len)){
+            #ifdef MM_DEBUG
+                Serial.println("Journal full");
+            #endif
+            return false;
+        }
+        return true;
+    }
+
+    writeRecord(_end, _gen, key, data, 0, len);
+    _index[key - 1] = len > 0 ? _end : 0;
+    _end += MM_JOURNAL_OVERHEAD + len;
+
+    //Terminate the log, in case the next bytes look like a record of this generation
+    if(_end < bankStart(_bank) + _bankSize){
+        MM_EEPROM::update(_end, 0);
+    }
+    return true;
+}
+
+uint8_t MM_Journal::read(uint8_t key, uint8_t *data, uint8_t maxLen){
+    if(key == 0 || key > MM_JOURNAL_KEYS || _bankSize == 0) return 0;
+    if(!_indexed) buildIndex();
+
+    uint16_t pos = _index[key - 1];
+    if(pos == 0) return 0;
+    uint8_t len = MM_EEPROM::read(pos + 1);
+    if(len > maxLen) return 0;
+    for(uint8_t i = 0; i < len; i++){
+        data[i] = MM_EEPROM::read(pos + 2 + i);
+    }
+    return len;
+}
+
+bool MM_Journal::erase(uint8_t key){
+    return write(key, NULL, 0);
+}
+
+bool MM_Journal::compact(){
+    return compact(0, NULL, 0);
+}
+
+bool MM_Journal::compact(uint8_t key, const uint8_t *data, uint8_t len){
+    if(_bankSize == 0) return false;
+    if(!_indexed) buildIndex();
+
+    uint8_t bank = _bank ^ 1;
+    uint8_t gen = _gen + 1;
+    uint16_t pos = bankStart(bank) + MM_JOURNAL_HEADER;
+    uint16_t end = bankStart(bank) + _bankSize;
+    uint16_t index[MM_JOURNAL_KEYS];
+
+    #ifdef MM_DEBUG
+        Serial.print("Compact journal, generation ");
+        Serial.println(gen);
+    #endif
+
+    //Invalidate the target bank, the header is written after all records
+    MM_EEPROM::update(bankStart(bank), 0);
+    MM_EEPROM::barrier();
+
+    for(uint8_t k = 0; k < MM_JOURNAL_KEYS; k++){
+        index[k] = 0;
+        if(k + 1 == key){
+            if(len == 0) continue;
+            if(pos + MM_JOURNAL_OVERHEAD + len > end) return false;
+            writeRecord(pos, gen, key, data, 0, len);
+        }
+        else{
+            if(_index[k] == 0) continue;
+            uint8_t l = MM_EEPROM::read(_index[k] + 1);
+            if(pos + MM_JOURNAL_OVERHEAD + l > end) return false;
+            writeRecord(pos, gen, k + 1, NULL, _index[k] + 2, l);
+        }
+        index[k] = pos;
+        pos += MM_JOURNAL_OVERHEAD + MM_EEPROM::read(pos + 1);
+    }
+    if(pos < end){
+        MM_EEPROM::update(pos, 0);
+    }
+    //Barriers keep the queue from moving the header in front of the records
+    MM_EEPROM::barrier();
+    MM_EEPROM::update(bankStart(bank) + 1, gen);
+    MM_EEPROM::barrier();
+    MM_EEPROM::update(bankStart(bank), MM_JOURNAL_MAGIC);
+
+    _bank = bank;
+    _gen = gen;
+    _end = pos;
+    for(uint8_t k = 0; k < MM_JOURNAL_KEYS; k++){
+        _index[k] = index[k];
+    }
+    return true;
+}
+
+void MM_Journal::invalidate(){
+    MM_EEPROM::update(bankStart(0), 0);
+    MM_EEPROM::update(bankStart(1), 0);
+    _indexed = false;
+}
+
+uint16_t MM_Journal::available(){
+    if(_bankSize == 0) return 0;
+    if(!_indexed) buildIndex();
+    return bankStart(_bank) + _bankSize - _end;
+}
+
+uint8_t MM_Journal::generation(){
+    if(!_indexed) buildIndex();
+    return _gen;
+}
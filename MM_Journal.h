@@ -0,0 +1,180 @@
+/*
+    MM_Sysbus Journal
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Journal__
+#define __MM_Journal__
+
+#include <Arduino.h>
+#include "MM_EEPROM.h"
+#include "MM_CRC.h"
+
+//Number of distinct record keys (1..MM_JOURNAL_KEYS)
+#ifndef MM_JOURNAL_KEYS
+    #define MM_JOURNAL_KEYS 16
+#endif
+
+//First byte of a valid bank header
+#define MM_JOURNAL_MAGIC 0xA5
+
+//Bytes of a bank header (magic, generation)
+#define MM_JOURNAL_HEADER 2
+
+//Bytes a record needs besides its data (key, len, crc)
+#define MM_JOURNAL_OVERHEAD 4
+
+/**
+ * Log-structured record store in EEPROM
+ *
+ * The region is split into two banks, only one is active. A bank starts with
+ * [MM_JOURNAL_MAGIC][generation] followed by records:
+ *  [key][len][len bytes data][crc high][crc low]
+ * The CRC-16 covers key, len and data and is seeded with the generation, so
+ * records of older generations and torn writes end the log.
+ * A changed record is appended instead of rewriting its old place, which spreads
+ * the writes over the whole bank. When the bank is full the live records are
+ * compacted into the other bank with the next generation, the header is written last.
+ * The position of the newest record of every key is indexed in RAM on first access.
+ */
+class MM_Journal {
+public:
+    /**
+     * Set the EEPROM region of the journal, nothing is read until the first access
+     * @param start first EEPROM address
+     * @param size bytes, split into two banks
+     */
+    void begin(uint16_t start, uint16_t size);
+
+    /**
+     * Append a record if it differs from the stored one
+     * @param key 1..MM_JOURNAL_KEYS
+     * @param data record data
+     * @param len length of data, 0 deletes the record
+     * @return false if the key is invalid or the record doesn't fit
+     */
+    bool write(uint8_t key, const uint8_t *data, uint8_t len);
+
+    /**
+     * Read the newest record of a key
+     * @param key 1..MM_JOURNAL_KEYS
+     * @param data buffer
+     * @param maxLen size of the buffer
+     * @return length of the record, 0 if not found
+     */
+    uint8_t read(uint8_t key, uint8_t *data, uint8_t maxLen);
+
+    /**
+     * Delete a record
+     * @param key 1..MM_JOURNAL_KEYS
+     * @return true if successful
+     */
+    bool erase(uint8_t key);
+
+    /**
+     * Copy the live records into the other bank
+     * @return false if they don't fit
+     */
+    bool compact();
+
+    /**
+     * Invalidate both bank headers, the journal is formatted on the next access
+     */
+    void invalidate();
+
+    /**
+     * @return free bytes in the active bank
+     */
+    uint16_t available();
+
+    /**
+     * @return generation of the active bank (counts compactions)
+     */
+    uint8_t generation();
+
+private:
+    /**
+     * Region of the journal
+     */
+    uint16_t _start = 0;
+    uint16_t _bankSize = 0;
+
+    /**
+     * Active bank (0/1) and its generation
+     */
+    uint8_t _bank = 0;
+    uint8_t _gen = 0;
+
+    /**
+     * Write position in the active bank (EEPROM address)
+     */
+    uint16_t _end = 0;
+
+    /**
+     * Index was built
+     */
+    bool _indexed = false;
+
+    /**
+     * EEPROM address of the newest record of each key, 0 = none
+     */
+    uint16_t _index[MM_JOURNAL_KEYS];
+
+    /**
+     * First EEPROM address of a bank
+     */
+    uint16_t bankStart(uint8_t bank);
+
+    /**
+     * Select the newest valid bank and index its records, formats the region if no bank is valid
+     */
+    void buildIndex();
+
+    /**
+     * Index the records of the active bank and find the write position
+     */
+    void scan();
+
+    /**
+     * Copy the live records into the other bank, replacing the record of key
+     * @param key record to replace, 0 = none
+     * @param data new data of the record
+     * @param len length of data, 0 drops the record
+     * @return false if the records don't fit, the active bank stays unchanged
+     */
+    bool compact(uint8_t key, const uint8_t *data, uint8_t len);
+
+    /**
+     * CRC of a record stored in EEPROM
+     * @param addr EEPROM address of the record
+     * @param gen generation the CRC is seeded with
+     */
+    uint16_t crc(uint16_t addr, uint8_t gen);
+
+    /**
+     * Write a record
+     * @param addr EEPROM address
+     * @param gen generation the CRC is seeded with
+     * @param key record key
+     * @param data record data, read from EEPROM at dataAddr if NULL
+     * @param dataAddr EEPROM address of the data if data is NULL
+     * @param len length of data
+     */
+    void writeRecord(uint16_t addr, uint8_t gen, uint8_t key, const uint8_t *data, uint16_t dataAddr, uint8_t len);
+};
+
+#endif
@@ -0,0 +1,299 @@
+#include "MM_Sysbus.h"
+#include <stddef.h>
+
+void MM_Layout::begin(uint16_t start, uint16_t size){
+    _start = start;
+    _size = size;
+    _loaded = false;
+}
+
+void MM_Layout::format(){
+    for(uint8_t i = 0; i < MAX_MODULES; i++){
+        _dir[i] = MM_LayoutEntry();
+        _dir[i].crc = checksum(_dir[i]);
+        MM_EEPROM::put(entryAddress(i, 0), _dir[i]);
+
+        //The second copy must not pass the check
+        MM_LayoutEntry invalid = _dir[i];
+        invalid.crc++;
+        MM_EEPROM::put(entryAddress(i, 1), invalid);
+        _copy[i] = 0;
+    }
+    MM_EEPROM::barrier();
+    _loaded = true;
+}
+
+uint16_t MM_Layout::checksum(const MM_LayoutEntry &entry){
+    uint16_t c = MM_CRC16_INIT;
+    for(uint8_t k = 0; k < MM_LAYOUT_KINDS; k++){
+        c = MM_CRC16(c, highByte(entry.offset[k]));
+        c = MM_CRC16(c, lowByte(entry.offset[k]));
+        c = MM_CRC16(c, entry.size[k]);
+    }
+    c = MM_CRC16(c, entry.type);
+    c = MM_CRC16(c, entry.flags);
+    return MM_CRC16(c, entry.seq);
+}
+
+void MM_Layout::load(){
+    for(uint8_t i = 0; i < MAX_MODULES; i++){
+        MM_LayoutEntry copies[2];
+        bool valid[2];
+        for(uint8_t c = 0; c < 2; c++){
+            MM_EEPROM::get(entryAddress(i, c), copies[c]);
+            valid[c] = copies[c].crc == checksum(copies[c]);
+        }
+
+        //The newer valid copy, seq wraps around
+        if(valid[0] && valid[1]){
+            _copy[i] = (int8_t)(copies[1].seq - copies[0].seq) > 0 ? 1 : 0;
+        }
+        else{
+            _copy[i] = valid[1] ? 1 : 0;
+        }
+        _dir[i] = copies[_copy[i]];
+
+        bool ok = valid[0] || valid[1];
+        for(uint8_t k = 0; k < MM_LAYOUT_KINDS && ok; k++){
+            //A record outside of the region can't be valid
+            if(_dir[i].size[k] > 0 && (_dir[i].offset[k] < dataStart() || _dir[i].offset[k] + _dir[i].size[k] > _start + _size)){
+                ok = false;
+            }
+        }
+        if(!ok || _dir[i].type == 0){
+            #ifdef MM_DEBUG
+                if(!ok) Serial.println("ERROR: Invalid EEPROM directory entry");
+            #endif
+            uint8_t seq = _dir[i].seq;
+            _dir[i] = MM_LayoutEntry();
+            _dir[i].seq = seq;
+        }
+    }
+    _loaded = true;
+}
+
+void MM_Layout::saveEntry(uint8_t cfgId){
+    MM_LayoutEntry &entry = _dir[cfgId];
+    entry.seq++;
+    entry.crc = checksum(entry);
+    _copy[cfgId] ^= 1;
+
+    MM_EEPROM::barrier();
+    MM_EEPROM::put(entryAddress(cfgId, _copy[cfgId]), entry);
+    MM_EEPROM::barrier();
+}
+
+uint16_t MM_Layout::entryAddress(uint8_t cfgId, uint8_t copy){
+    return _start + (cfgId * 2 + copy) * sizeof(MM_LayoutEntry);
+}
+
+uint16_t MM_Layout::dataStart(){
+    return _start + MAX_MODULES * 2 * sizeof(MM_LayoutEntry);
+}
+
+uint16_t MM_Layout::used(){
+    if(!_loaded) load();
+    uint16_t bytes = dataStart() - _start;
+    for(uint8_t i = 0; i < MAX_MODULES; i++){
+        for(uint8_t k = 0; k < MM_LAYOUT_KINDS; k++){
+            bytes += _dir[i].size[k];
+        }
+    }
+    return bytes;
+}
+
+bool MM_Layout::isFree(uint16_t addr, uint16_t len){
+    if(addr < dataStart() || (uint32_t)addr + len > (uint32_t)_start + _size) return false;
+    for(uint8_t i = 0; i < MAX_MODULES; i++){
+        for(uint8_t k = 0; k < MM_LAYOUT_KINDS; k++){
+            uint16_t from = _dir[i].offset[k];
+            uint8_t size = _dir[i].size[k];
+            if(size > 0 && addr < from + size && from < addr + len) return false;
+        }
+    }
+    return true;
+}
+
+bool MM_Layout::findGap(uint16_t len, uint16_t &addr, uint16_t below){
+    //A gap starts at the beginning of the data or behind a record
+    bool found = false;
+    for(int8_t i = -1; i < MAX_MODULES; i++){
+        for(uint8_t k = 0; k < MM_LAYOUT_KINDS; k++){
+            uint16_t candidate;
+            if(i < 0){
+                if(k > 0) break;
+                candidate = dataStart();
+            }
+            else{
+                if(_dir[i].size[k] == 0) continue;
+                candidate = _dir[i].offset[k] + _dir[i].size[k];
+            }
+            if(candidate < below && (!found || candidate < addr) && isFree(candidate, len)){
+                addr = candidate;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+void MM_Layout::defragment(){
+    #ifdef MM_DEBUG
+        Serial.println("Defragment EEPROM layout");
+    #endif
+    bool moved = true;
+    while(moved){
+        moved = false;
+        for(uint8_t i = 0; i < MAX_MODULES; i++){
+            for(uint8_t k = 0; k < MM_LAYOUT_KINDS; k++){
+                uint8_t size = _dir[i].size[k];
+                uint16_t from = _dir[i].offset[k];
+                uint16_t to;
+                //The old place counts as allocated, so the copy never overwrites it
+                if(size == 0 || !findGap(size, to, from)) continue;
+
+                for(uint8_t b = 0; b < size; b++){
+                    MM_EEPROM::update(to + b, MM_EEPROM::read(from + b));
+                }
+                _dir[i].offset[k] = to;
+                saveEntry(i);
+                moved = true;
+            }
+        }
+    }
+}
+
+bool MM_Layout::place(uint8_t cfgId, uint8_t kind, uint8_t len, bool extend, uint16_t &addr){
+    MM_LayoutEntry &entry = _dir[cfgId];
+    uint8_t old = entry.size[kind];
+    addr = entry.offset[kind];
+
+    if(extend && old > 0 && isFree(addr + old, len - old)) return true;
+
+    //Searched with the old place still allocated, it is freed by the new entry
+    if(findGap(len, addr, 0xFFFF)) return true;
+    defragment();
+    if(findGap(len, addr, 0xFFFF)) return true;
+
+    //No room for a copy, defragment() may have moved the record
+    addr = entry.offset[kind];
+    return old > 0 && len <= old;
+}
+
+bool MM_Layout::write(uint8_t cfgId, uint8_t kind, uint8_t type, const uint8_t *data, uint8_t len){
+    if(cfgId >= MAX_MODULES || kind >= MM_LAYOUT_KINDS) return false;
+    if(!_loaded) load();
+
+    //Records of a previous module type are dropped
+    MM_LayoutEntry &entry = _dir[cfgId];
+    if(entry.type != type){
+        entry.type = type;
+        entry.flags = 0;
+    }
+    else if((entry.flags & (1 << kind)) && entry.size[kind] == len){
+        //An unchanged record is left where it is
+        uint8_t i = 0;
+        while(i < len && MM_EEPROM::read(entry.offset[kind] + i) == data[i]) i++;
+        if(i == len) return true;
+    }
+
+    uint16_t addr;
+    if(!place(cfgId, kind, len, false, addr)){
+        saveEntry(cfgId);
+        #ifdef MM_DEBUG
+            Serial.println("ERROR: EEPROM full!");
+        #endif
+        return false;
+    }
+
+    for(uint8_t i = 0; i < len; i++){
+        MM_EEPROM::update(addr + i, data[i]);
+    }
+    entry.offset[kind] = addr;
+    entry.size[kind] = len;
+    entry.flags |= 1 << kind;
+    saveEntry(cfgId);
+    return true;
+}
+
+bool MM_Layout::writePart(uint8_t cfgId, uint8_t kind, uint8_t type, uint8_t offset, const uint8_t *data, uint8_t len){
+    if(cfgId >= MAX_MODULES || kind >= MM_LAYOUT_KINDS) return false;
+    if(!_loaded) load();
+
+    MM_LayoutEntry &entry = _dir[cfgId];
+    if(entry.type != type || !(entry.flags & (1 << kind))) return false;
+
+    uint8_t size = entry.size[kind];
+    uint16_t addr = entry.offset[kind];
+    if(offset + len > size){
+        if(offset + len > 0xFF) return false;
+
+        //Appended parts may grow the record in place, they don't touch its old bytes
+        uint16_t to;
+        if(!place(cfgId, kind, offset + len, offset >= size, to)) return false;
+        if(to != addr){
+            //Copy the bytes in front of the part, the old record stays valid until the entry is switched
+            for(uint8_t i = 0; i < size && i < offset; i++){
+                MM_EEPROM::update(to + i, MM_EEPROM::read(addr + i));
+            }
+        }
+        //Bytes between the old end and the part
+        for(uint8_t i = size; i < offset; i++){
+            MM_EEPROM::update(to + i, 0);
+        }
+        for(uint8_t i = 0; i < len; i++){
+            MM_EEPROM::update(to + offset + i, data[i]);
+        }
+        entry.offset[kind] = to;
+        entry.size[kind] = offset + len;
+        saveEntry(cfgId);
+        return true;
+    }
+
+    for(uint8_t i = 0; i < len; i++){
+        MM_EEPROM::update(addr + offset + i, data[i]);
+    }
+    return true;
+}
+
+uint8_t MM_Layout::read(uint8_t cfgId, uint8_t kind, uint8_t type, uint8_t *data, uint8_t maxLen){
+    if(cfgId >= MAX_MODULES || kind >= MM_LAYOUT_KINDS) return 0;
+    if(!_loaded) load();
+
+    MM_LayoutEntry &entry = _dir[cfgId];
+    if(entry.type != type || !(entry.flags & (1 << kind)) || entry.size[kind] > maxLen) return 0;
+
+    uint16_t addr = entry.offset[kind];
+    for(uint8_t i = 0; i < entry.size[kind]; i++){
+        data[i] = MM_EEPROM::read(addr + i);
+    }
+    return entry.size[kind];
+}
+
+bool MM_Layout::erase(uint8_t cfgId, uint8_t kind){
+    if(cfgId >= MAX_MODULES || kind >= MM_LAYOUT_KINDS) return false;
+    if(!_loaded) load();
+
+    _dir[cfgId].flags &= ~(1 << kind);
+    saveEntry(cfgId);
+    return true;
+}
+
+void MM_Layout::invalidate(uint8_t cfgId){
+    if(cfgId >= MAX_MODULES) return;
+    if(!_loaded) load();
+
+    //Break the CRC of both copies, the older one must not come back
+    for(uint8_t c = 0; c < 2; c++){
+        MM_LayoutEntry stored;
+        MM_EEPROM::get(entryAddress(cfgId, c), stored);
+        uint16_t crc = ~checksum(stored);
+        MM_EEPROM::put(entryAddress(cfgId, c) + offsetof(MM_LayoutEntry, crc), crc);
+    }
+    //The space of the records may be reused from now on
+    MM_EEPROM::barrier();
+
+    uint8_t seq = _dir[cfgId].seq;
+    _dir[cfgId] = MM_LayoutEntry();
+    _dir[cfgId].seq = seq;
+}
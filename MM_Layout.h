@@ -0,0 +1,229 @@
+/*
+    MM_Sysbus Layout
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Layout__
+#define __MM_Layout__
+
+#include <Arduino.h>
+#include "MM_EEPROM.h"
+#include "MM_CRC.h"
+
+//Max number of modules
+#ifndef MAX_MODULES
+    #define MAX_MODULES 5
+#endif
+
+//Number of record kinds per module (config, multicast targets)
+#define MM_LAYOUT_KINDS 2
+
+/**
+ * Directory entry of a module
+ * Every module has two copies of its entry, the valid one with the newer seq is used.
+ */
+struct MM_LayoutEntry {
+    /**
+     * EEPROM address of each record kind
+     */
+    uint16_t offset[MM_LAYOUT_KINDS] = {0, 0};
+
+    /**
+     * CRC-16 of the other fields, a torn entry doesn't match
+     */
+    uint16_t crc = 0;
+
+    /**
+     * Module type the records belong to, 0 = unused
+     */
+    uint8_t type = 0;
+
+    /**
+     * Bit n set = record of kind n is valid
+     */
+    uint8_t flags = 0;
+
+    /**
+     * Bytes allocated for each record kind
+     */
+    uint8_t size[MM_LAYOUT_KINDS] = {0, 0};
+
+    /**
+     * Incremented with every change of the entry
+     */
+    uint8_t seq = 0;
+};
+
+/**
+ * EEPROM layout with power loss safe directory updates
+ *
+ * A directory with two copies of a MM_LayoutEntry per cfgId is followed by the records.
+ * A changed entry is written to the older copy, so a torn write leaves the previous one.
+ * write() puts a changed record into a free gap and only then the directory entry points to it,
+ * so a torn write leaves the previous record. If no gap is big enough, records are moved to lower
+ * free gaps that don't overlap their old place (copy, then switch the entry) and the search is repeated.
+ * Only if there is still no room, a record that doesn't grow is rewritten in place and can tear.
+ * writePart() appends behind the record if those bytes are free, but overwrites the bytes of a
+ * part inside the record in place: a torn write can leave that part half written.
+ * Only the directory and the allocated bytes are read.
+ */
+class MM_Layout {
+public:
+    /**
+     * Set the EEPROM region, the directory is read on the first access
+     * @param start first EEPROM address
+     * @param size bytes
+     */
+    void begin(uint16_t start, uint16_t size);
+
+    /**
+     * Clear the directory, all records are dropped
+     */
+    void format();
+
+    /**
+     * Store a record in a new place, an unchanged record is not written
+     * @param cfgId the Id of the Module
+     * @param kind record kind (MM_RecordType)
+     * @param type module type
+     * @param data record data
+     * @param len length of data
+     * @return false if the region is full
+     */
+    bool write(uint8_t cfgId, uint8_t kind, uint8_t type, const uint8_t *data, uint8_t len);
+
+    /**
+     * Overwrite a part of a valid record in place, the record grows if the part ends behind it
+     * @param cfgId the Id of the Module
+     * @param kind record kind (MM_RecordType)
+     * @param type module type the record must belong to
+     * @param offset first byte in the record
+     * @param data new bytes
+     * @param len number of bytes
+     * @return false if there is no valid record of this type or the region is full
+     */
+    bool writePart(uint8_t cfgId, uint8_t kind, uint8_t type, uint8_t offset, const uint8_t *data, uint8_t len);
+
+    /**
+     * Read a record
+     * @param cfgId the Id of the Module
+     * @param kind record kind (MM_RecordType)
+     * @param type module type the record must belong to
+     * @param data buffer
+     * @param maxLen size of the buffer
+     * @return length of the record, 0 if not found
+     */
+    uint8_t read(uint8_t cfgId, uint8_t kind, uint8_t type, uint8_t *data, uint8_t maxLen);
+
+    /**
+     * Invalidate a record, the space stays allocated
+     * @param cfgId the Id of the Module
+     * @param kind record kind (MM_RecordType)
+     * @return true if successful
+     */
+    bool erase(uint8_t cfgId, uint8_t kind);
+
+    /**
+     * Drop the records of a module
+     * Only breaks the CRC of both directory copies, the entry is rewritten with the next record
+     * @param cfgId the Id of the Module
+     */
+    void invalidate(uint8_t cfgId);
+
+    /**
+     * @return bytes used by the directory and the records
+     */
+    uint16_t used();
+
+private:
+    /**
+     * Region
+     */
+    uint16_t _start = 0;
+    uint16_t _size = 0;
+
+    /**
+     * Directory was read from EEPROM
+     */
+    bool _loaded = false;
+
+    /**
+     * Copy of the directory
+     */
+    MM_LayoutEntry _dir[MAX_MODULES];
+
+    /**
+     * Directory copy (0/1) each entry was read from or last written to
+     */
+    uint8_t _copy[MAX_MODULES];
+
+    /**
+     * Read the directory
+     */
+    void load();
+
+    /**
+     * Write a directory entry to its older copy
+     * Barriers keep the entry behind the record data written before
+     * and the data written after it (e.g. into space it freed) behind the entry.
+     */
+    void saveEntry(uint8_t cfgId);
+
+    /**
+     * EEPROM address of a directory copy
+     */
+    uint16_t entryAddress(uint8_t cfgId, uint8_t copy);
+
+    /**
+     * CRC of a directory entry
+     */
+    static uint16_t checksum(const MM_LayoutEntry &entry);
+
+    /**
+     * First EEPROM address behind the directory
+     */
+    uint16_t dataStart();
+
+    /**
+     * true if no allocated record overlaps the range and it lies in the region
+     */
+    bool isFree(uint16_t addr, uint16_t len);
+
+    /**
+     * Lowest free range of len bytes
+     * @param addr returns the EEPROM address
+     * @param below only ranges starting below this address
+     * @return false if there is none
+     */
+    bool findGap(uint16_t len, uint16_t &addr, uint16_t below);
+
+    /**
+     * Move records to lower free gaps, each one is copied before its entry is switched
+     */
+    void defragment();
+
+    /**
+     * Find a new place for a record, a free gap that doesn't overlap the old one
+     * In place only if the region has no room for a copy and the record doesn't grow
+     * @param extend use the free bytes behind the record, only if the old bytes stay untouched
+     * @param addr returns the EEPROM address
+     * @return false if the region is full
+     */
+    bool place(uint8_t cfgId, uint8_t kind, uint8_t len, bool extend, uint16_t &addr);
+};
+
+#endif
@@ -10,14 +10,26 @@ void MM_Module::begin(bool useEEPROM, uint8_t cfgId){
     broadcastModuleType();
 }
 
+void MM_Module::invalidateConfig(){
+    discardConfig();
+    if(!_useEEPROM) return;
+    _controller->eraseRecord(_cfgId, MM_RECORD_CONFIG);
+}
+
 bool MM_Module::cfgReset(){
-    if(_useEEPROM){
-        EEPROM.update(_controller->getEEPROMAddress(_cfgId), 0);
-    }
+    invalidateConfig();
     _controller->reboot();
     return false;
 }
 
+bool MM_Module::writeConfigData(const uint8_t *data, uint8_t len){
+    return _controller->storeRecord(_cfgId, MM_RECORD_CONFIG, _moduleType, data, len);
+}
+
+uint8_t MM_Module::readConfigData(uint8_t *data, uint8_t len){
+    return _controller->loadRecord(_cfgId, MM_RECORD_CONFIG, _moduleType, data, len);
+}
+
 bool MM_Module::checkMsg(MM_Packet &pkg){
 
     if (pkg.meta.type == MM_MsgType::Streaming && pkg.meta.port == _port) {
@@ -105,12 +117,39 @@ bool MM_Module::checkMsg(MM_Packet &pkg){
             }
             return false;
         }
+        else if(registerCount() > 0 && (pkg.data[0] == CFG_REG_SET || pkg.data[0] == CFG_REG_GET ||
+                pkg.data[0] == CFG_REG_GET_RANGE || pkg.data[0] == CFG_REG_SET_MULTI || pkg.data[0] == CFG_REG_DUMP)){
+            processRegisters(pkg);
+            return false;
+        }
+        else if(pkg.data[0] == GROUPS_BATCH){
+            if(pkg.len != 2){
+                returnErrorMsg(pkg);
+                return false;
+            }
+            bool successfull = true;
+            if(pkg.data[1]){
+                beginGroupBatch();
+            }
+            else{
+                successfull = endGroupBatch();
+            }
+            if(!successfull){
+                returnErrorMsg(pkg);
+            }
+            else if(_controller != NULL){
+                uint8_t data[] = {MM_CMD::ACK, MM_CMD::GROUPS_BATCH, pkg.data[1]};
+                _controller->Send(MM_MsgType::Broadcast, pkg.meta.source, 3, data);
+            }
+            return false;
+        }
         else if(pkg.data[0] == GROUPS_CLEAR){
             clearMulticastTargets();
             if(_controller != NULL){
                 uint8_t data[] = {MM_CMD::ACK, MM_CMD::GROUPS_CLEAR};
                 _controller->Send(MM_MsgType::Broadcast, pkg.meta.source, 2, data);
             }
+            return false;
         }
         else{
             return true;
@@ -133,14 +172,244 @@ MM_ModuleType MM_Module::moduleType(){
     return _moduleType;
 }
 
+const MM_Target *MM_Module::multicastTargets(){
+    return _multicastTargets;
+}
+
 void MM_Module::broadcastModuleType(){
     if(_controller == NULL) return;
     uint8_t typeMsg[] = {MOD_TYPE, _moduleType, _useEEPROM};
     _controller->Send(Broadcast, 0, _port, 3, typeMsg);
 }
 
+//-----------Config registers---------------------
+
+uint8_t MM_Module::registerCount(){
+    return 0;
+}
+
+bool MM_Module::getRegister(uint8_t reg, uint8_t &value){
+    return false;
+}
+
+bool MM_Module::setRegister(uint8_t reg, uint8_t value){
+    return false;
+}
+
+bool MM_Module::saveConfig(){
+    return true;
+}
+
+void MM_Module::processRegisters(MM_Packet &pkg){
+    if(_controller == NULL) return;
+    uint8_t count = registerCount();
+    uint8_t value;
+
+    switch(pkg.data[0]){
+        case CFG_REG_SET:
+            if(pkg.len != 3 || !setRegister(pkg.data[1], pkg.data[2])){
+                returnErrorMsg(pkg);
+                return;
+            }
+            markConfigDirty();
+            //fall through - answer with the stored value
+        case CFG_REG_GET:{
+            if(pkg.len < 2 || !getRegister(pkg.data[1], value)){
+                returnErrorMsg(pkg);
+                return;
+            }
+            uint8_t data[] = {MM_CMD::CFG_REG_COMMIT, pkg.data[1], value};
+            _controller->Send(MM_MsgType::Broadcast, 0, 3, data);
+            break;
+        }
+        case CFG_REG_GET_RANGE:{
+            if(pkg.len != 3 || pkg.data[1] < 1 || pkg.data[1] > count){
+                returnErrorMsg(pkg);
+                return;
+            }
+            uint8_t available = count - pkg.data[1] + 1;
+            uint8_t n = (pkg.data[2] == 0 || pkg.data[2] > available) ? available : pkg.data[2];
+            sendRegisters(pkg.meta.source, pkg.data[1], n);
+            break;
+        }
+        case CFG_REG_SET_MULTI:{
+            if(pkg.len < 3 || (pkg.len - 1) % 2 != 0){
+                returnErrorMsg(pkg);
+                return;
+            }
+            //Check all registers first and keep their values, so a bad pair doesn't leave a half applied set
+            uint8_t previous[3];
+            for(uint8_t i = 1; i < pkg.len; i += 2){
+                if(!getRegister(pkg.data[i], previous[i / 2])){
+                    returnErrorMsg(pkg);
+                    return;
+                }
+            }
+            for(uint8_t i = 1; i < pkg.len; i += 2){
+                if(!setRegister(pkg.data[i], pkg.data[i + 1])){
+                    //Value rejected, restore the pairs applied so far in reverse order
+                    while(i > 1){
+                        i -= 2;
+                        setRegister(pkg.data[i], previous[i / 2]);
+                    }
+                    returnErrorMsg(pkg);
+                    return;
+                }
+            }
+            markConfigDirty();
+            uint8_t data[] = {MM_CMD::ACK, MM_CMD::CFG_REG_SET_MULTI, (uint8_t)((pkg.len - 1) / 2)};
+            _controller->Send(MM_MsgType::Broadcast, pkg.meta.source, _port, 3, data);
+            break;
+        }
+        case CFG_REG_DUMP:
+            sendRegisters(pkg.meta.source, 1, count);
+            break;
+    }
+}
+
+bool MM_Module::sendRegisters(uint16_t target, uint8_t first, uint8_t count){
+    if(_controller == NULL) return false;
+    uint8_t data[8];
+    uint8_t len = 0;
+
+    for(uint16_t reg = first; reg < (uint16_t)first + count; reg++){
+        if(len == 0){
+            data[0] = MM_CMD::CFG_REG_RANGE;
+            data[1] = reg;
+            len = 2;
+        }
+        if(!getRegister(reg, data[len])){
+            data[len] = 0;
+        }
+        len++;
+        if(len == 8){
+            if(!_controller->Send(MM_MsgType::Broadcast, target, _port, len, data)) return false;
+            len = 0;
+        }
+    }
+    if(len > 0){
+        return _controller->Send(MM_MsgType::Broadcast, target, _port, len, data);
+    }
+    return true;
+}
+
+//-----------Config write-back---------------------
+
+void MM_Module::markConfigDirty(){
+    uint32_t now = millis();
+    if(!configDirty()){
+        _configDirtySince = now;
+    }
+    _configDirty = true;
+    _configChanged = now;
+}
+
+bool MM_Module::configDirty(){
+    return _configDirty || _targetsDirty != 0;
+}
+
+bool MM_Module::configDue(bool idle){
+    if(!configDirty()) return false;
+    //Target slots are small, they go out right away
+    if(_targetsDirty != 0 && !_groupBatch) return true;
+    uint32_t now = millis();
+    return (idle && now - _configChanged >= CONFIG_COMMIT_DELAY) || now - _configDirtySince >= CONFIG_COMMIT_MAX_DELAY;
+}
+
+bool MM_Module::commitConfig(){
+    if(_groupBatch){
+        //A batch that never ended
+        endGroupBatch();
+    }
+    if(_targetsDirty != 0){
+        return commitTarget();
+    }
+    return flushConfig();
+}
+
+bool MM_Module::flushConfig(){
+    bool ok = true;
+    if(_groupBatch){
+        endGroupBatch();
+    }
+    while(_targetsDirty != 0){
+        ok &= commitTarget();
+    }
+    if(!_configDirty) return ok;
+    _configDirty = false;
+    if(!_useEEPROM) return ok;
+    #ifdef MM_DEBUG
+        Serial.print("Commit config of module ");
+        Serial.println(_port);
+    #endif
+    return saveConfig() && ok;
+}
+
+void MM_Module::discardConfig(){
+    _configDirty = false;
+    _targetsDirty = 0;
+    _groupBatch = false;
+}
+
 //-----------MulticastTargets---------------------
 
+void MM_Module::beginGroupBatch(){
+    _groupBatch = true;
+}
+
+bool MM_Module::endGroupBatch(){
+    _groupBatch = false;
+    if(_targetsDirty != 0 && _controller != NULL){
+        _controller->updateFilters();
+    }
+    return true;
+}
+
+bool MM_Module::targetChanged(uint8_t index){
+    uint32_t now = millis();
+    if(!configDirty()){
+        _configDirtySince = now;
+    }
+    _configChanged = now;
+    if(index < MULTICAST_TARGETS){
+        _targetsDirty |= (uint32_t)1 << index;
+    }
+    else{
+        _targetsDirty = 0xFFFFFFFF >> (32 - MULTICAST_TARGETS);
+    }
+    //Filters follow at the end of the batch
+    if(!_groupBatch && _controller != NULL){
+        _controller->updateFilters();
+    }
+    return true;
+}
+
+bool MM_Module::commitTarget(){
+    uint8_t index = 0;
+    while(!(_targetsDirty & ((uint32_t)1 << index))) index++;
+    uint32_t bit = (uint32_t)1 << index;
+    _targetsDirty &= ~bit;
+    if(!_useEEPROM){
+        _targetsDirty = 0;
+        return true;
+    }
+    if(_controller->storeRecordPart(_cfgId, MM_RECORD_TARGETS, _moduleType,
+            index * sizeof(MM_Target), (const uint8_t*)&_multicastTargets[index], sizeof(MM_Target))){
+        return true;
+    }
+    //No record to write into. If no stored target is still valid, create it up to this slot
+    //(the lower slots are unused), the next slots are appended by the next calls
+    uint8_t used = usedTargets();
+    uint32_t usedMask = used == 32 ? 0xFFFFFFFF : ((uint32_t)1 << used) - 1;
+    if((usedMask & ~(_targetsDirty | bit)) == 0){
+        return _controller->storeRecord(_cfgId, MM_RECORD_TARGETS, _moduleType,
+            (const uint8_t*)_multicastTargets, (index + 1) * sizeof(MM_Target));
+    }
+    //Backend without partial writes (journal)
+    _targetsDirty = 0;
+    return saveMulticastTargets();
+}
+
 bool MM_Module::addMulticastTarget(uint16_t addr, MM_CMD filter){
     for (int i = 0; i < MULTICAST_TARGETS; i++) {
         if (_multicastTargets[i].address == addr && _multicastTargets[i].filter == filter){
@@ -157,7 +426,7 @@ bool MM_Module::addMulticastTarget(uint16_t addr, MM_CMD filter){
     t.address = addr;
     t.filter = filter;
     for (int i = 0; i < MULTICAST_TARGETS; i++) {
-        if (_multicastTargets[i].address == NULL && _multicastTargets[i].filter == NULL) {
+        if (_multicastTargets[i].address == 0 && _multicastTargets[i].filter == 0) {
             _multicastTargets[i] = t;
             #ifdef MM_DEBUG
                 Serial.print("Add Multicast target: ");
@@ -175,12 +444,7 @@ bool MM_Module::addMulticastTarget(uint16_t addr, MM_CMD filter){
                     Serial.println(_multicastTargets[i].filter);
                 }
             #endif
-            if(_useEEPROM){
-                return saveMulticastTargets();
-            }
-            else{
-                return true;
-            }
+            return targetChanged(i);
         }
     }
     #ifdef MM_DEBUG
@@ -198,8 +462,8 @@ bool MM_Module::removeMulticastTarget(uint16_t addr, MM_CMD filter){
                 Serial.print(",  ");
                 Serial.println(filter);
             #endif
-            _multicastTargets[i].address = NULL;
-            _multicastTargets[i].filter = NULL;
+            _multicastTargets[i].address = 0;
+            _multicastTargets[i].filter = (MM_CMD)0;
             #ifdef MM_DEBUG
                 Serial.println("Multicast-Targets:");
                 for(int i = 0; i < MULTICAST_TARGETS; i++){
@@ -210,12 +474,7 @@ bool MM_Module::removeMulticastTarget(uint16_t addr, MM_CMD filter){
                     Serial.println(_multicastTargets[i].filter);
                 }
             #endif
-            if(_useEEPROM){
-                return saveMulticastTargets();
-            }
-            else{
-                return true;
-            }
+            return targetChanged(i);
         }
     }
     #ifdef MM_DEBUG
@@ -241,15 +500,10 @@ bool MM_Module::clearMulticastTargets(){
         Serial.println("Clear Multicast targets...");
     #endif
     for (int i = 0; i < MULTICAST_TARGETS; i++) {
-        _multicastTargets[i].address = NULL;
-        _multicastTargets[i].filter = NULL;
-    }
-    if(_useEEPROM){
-        return saveMulticastTargets();
-    }
-    else{
-        return true;
+        _multicastTargets[i].address = 0;
+        _multicastTargets[i].filter = (MM_CMD)0;
     }
+    return targetChanged(MULTICAST_TARGETS);
 }
 
 bool MM_Module::saveMulticastTargets(){
@@ -259,17 +513,16 @@ bool MM_Module::saveMulticastTargets(){
         #endif
         return false;
     }
-    int eepromAddr = _controller->getEEPROMAddress(_cfgId) + 1 + MAX_CONFIG_SIZE;
-    if(eepromAddr+1+sizeof(_multicastTargets) > EEPROM.length()){
-        return false;
-    }
-    EEPROM.update(eepromAddr, _moduleType);
-    eepromAddr++;
-    for(int i = 0; i < MULTICAST_TARGETS; i++){
-        EEPROM.put(eepromAddr, _multicastTargets[i]);
-        eepromAddr += sizeof(MM_Target);
+    //Only the targets up to the last used one are stored
+    return _controller->storeRecord(_cfgId, MM_RECORD_TARGETS, _moduleType, (const uint8_t*)_multicastTargets, usedTargets() * sizeof(MM_Target));
+}
+
+uint8_t MM_Module::usedTargets(){
+    uint8_t used = MULTICAST_TARGETS;
+    while(used > 0 && _multicastTargets[used - 1].address == 0 && _multicastTargets[used - 1].filter == 0){
+        used--;
     }
-    return true;
+    return used;
 }
 
 bool MM_Module::loadMulticastTargets(){
@@ -279,19 +532,11 @@ bool MM_Module::loadMulticastTargets(){
         #endif
         return false;
     }
-    int eepromAddr = _controller->getEEPROMAddress(_cfgId) + 1 + MAX_CONFIG_SIZE;
-    if(eepromAddr+1+sizeof(_multicastTargets) > EEPROM.length()){
-        return false;
-    }
-    if(EEPROM.read(eepromAddr) == _moduleType){
-        eepromAddr++;
-        for(int i = 0; i < MULTICAST_TARGETS; i++){
-            EEPROM.get(eepromAddr, _multicastTargets[i]);
-            eepromAddr += sizeof(MM_Target);
-        }
-        return true;
+    for(int i = 0; i < MULTICAST_TARGETS; i++){
+        _multicastTargets[i].address = 0;
+        _multicastTargets[i].filter = (MM_CMD)0;
     }
-    return false;
+    return _controller->loadRecord(_cfgId, MM_RECORD_TARGETS, _moduleType, (uint8_t*)_multicastTargets, sizeof(_multicastTargets)) > 0;
 }
 
 void MM_Module::returnErrorMsg(MM_Packet &pkg){
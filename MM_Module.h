@@ -21,9 +21,9 @@
 #define __MM_Module__
 
 #include <Arduino.h>
-#include <EEPROM.h>
 
 #include "MM_Protocol.h"
+#include "MM_EEPROM.h"
 
 /**
  * Because MM_Sysbus has not been defined yet
@@ -34,10 +34,35 @@ class MM_Sysbus;
     #define MULTICAST_TARGETS 10
 #endif
 
+#if MULTICAST_TARGETS > 32
+    #error "MULTICAST_TARGETS must not exceed 32 (one dirty bit per target)"
+#endif
+
 #ifndef MAX_CONFIG_SIZE
     #define MAX_CONFIG_SIZE 64
 #endif
 
+//Store configs and multicast targets in a wear-leveled journal (MM_Journal) instead of fixed EEPROM slots
+//#define MM_USE_JOURNAL
+
+//Milliseconds without a config change (and an idle bus) until a dirty config is written to EEPROM
+#ifndef CONFIG_COMMIT_DELAY
+    #define CONFIG_COMMIT_DELAY 2000
+#endif
+
+//Milliseconds after which a dirty config is written even if the bus never gets idle
+#ifndef CONFIG_COMMIT_MAX_DELAY
+    #define CONFIG_COMMIT_MAX_DELAY 30000
+#endif
+
+/**
+ * Kind of a stored module record
+ */
+enum MM_RecordType {
+    MM_RECORD_CONFIG = 0,
+    MM_RECORD_TARGETS = 1,
+};
+
 /**
  * Target-struct
  */
@@ -54,11 +79,12 @@ struct MM_Target
  */
 class MM_Module{
     public:
+        virtual ~MM_Module() {}
 
         /**
          * Pointer to our Controller
          */
-        MM_Sysbus *_controller;
+        MM_Sysbus *_controller = NULL;
 
         /**
          * return the port of the module
@@ -86,25 +112,73 @@ class MM_Module{
          * @param pkg Pack
          * @return bool true if successful
          */
-        virtual bool process(MM_Packet &pkg);
+        virtual bool process(MM_Packet &pkg) = 0;
 
         /**
          * Main loop
          * @return bool true if successful
          */
-        virtual bool loop();
+        virtual bool loop() = 0;
 
         /**
          * Broadcast the state/states of the module
          * @return return true if successful
          */
-        virtual bool broadcastState();
+        virtual bool broadcastState() = 0;
 
         /**
          * Broadcast the Module Type if _controller != NULL 
          */
         void broadcastModuleType();
 
+        /**
+         * return the multicast targets of the module (MULTICAST_TARGETS entries, address 0 = unused)
+         */
+        const MM_Target *multicastTargets();
+
+        /**
+         * return true if the config or the targets in RAM have changes that aren't stored in EEPROM yet
+         */
+        bool configDirty();
+
+        /**
+         * Check if a dirty config should be written now
+         * @param idle true if the bus is idle (nothing received, nothing queued)
+         * @return true if changed targets wait outside a group batch, the debounce time passed on an idle bus
+         *         or the max delay is reached
+         */
+        bool configDue(bool idle);
+
+        /**
+         * Write the next part of the dirty config: one changed target slot or, once the targets are stored,
+         * the module config. Called by MM_Sysbus::loop() when configDue(), so a commit stays small
+         * @return false if saving failed
+         */
+        bool commitConfig();
+
+        /**
+         * Write a dirty config and all changed targets to EEPROM now
+         * @return false if saving failed, true if saved or nothing to do
+         */
+        bool flushConfig();
+
+        /**
+         * Drop pending config changes without writing them (used before a factory reset)
+         */
+        void discardConfig();
+
+        /**
+         * Start a group batch, GROUP_ADD/GROUP_REM/GROUPS_CLEAR only change the targets in RAM
+         * until endGroupBatch(), which updates the filters once and releases the changed slots to commitConfig()
+         */
+        void beginGroupBatch();
+
+        /**
+         * End a group batch, the changed targets are stored by the next loop() calls, one slot each
+         * @return true
+         */
+        bool endGroupBatch();
+
 
     protected:
         /**
@@ -129,11 +203,87 @@ class MM_Module{
          * indicates if we use EEPROM
          */
         bool _useEEPROM = false;
+
+        /**
+         * Config in RAM differs from EEPROM
+         */
+        bool _configDirty = false;
+
+        /**
+         * Bit n is set if multicast target n in RAM differs from EEPROM
+         */
+        uint32_t _targetsDirty = 0;
+
+        /**
+         * Group batch is active
+         */
+        bool _groupBatch = false;
+
+        /**
+         * Time(millis()) of the first unsaved change
+         */
+        uint32_t _configDirtySince = 0;
+
+        /**
+         * Time(millis()) of the last change
+         */
+        uint32_t _configChanged = 0;
         
         /**
          * Targets for Multicast Messages
          */
-        MM_Target _multicastTargets[MULTICAST_TARGETS];
+        MM_Target _multicastTargets[MULTICAST_TARGETS] = {};
+
+        /**
+         * Number of config-registers of the module, registers are indexed 1..registerCount()
+         * Modules returning 0 handle CFG_REG_SET/CFG_REG_GET themselves
+         * @return number of registers
+         */
+        virtual uint8_t registerCount();
+
+        /**
+         * Read a config-register
+         * @param reg Register-index
+         * @param value reference to store the value
+         * @return false if the register doesn't exist
+         */
+        virtual bool getRegister(uint8_t reg, uint8_t &value);
+
+        /**
+         * Write a config-register, only in RAM - the config gets marked dirty and stored later
+         * A rejected CFG_REG_SET_MULTI writes the previous values of the pairs applied before back
+         * @param reg Register-index
+         * @param value new value
+         * @return false if the register doesn't exist or the value is invalid
+         */
+        virtual bool setRegister(uint8_t reg, uint8_t value);
+
+        /**
+         * Store the module config (e.g. writeConfig(_config)), called by flushConfig()
+         * @return true if successful
+         */
+        virtual bool saveConfig();
+
+        /**
+         * Mark the config as changed, it gets written to EEPROM when the bus is idle,
+         * CONFIG_COMMIT_DELAY ms after the last change, or on flushConfig()
+         */
+        void markConfigDirty();
+
+        /**
+         * Handle CFG_REG_SET, CFG_REG_GET, CFG_REG_GET_RANGE, CFG_REG_SET_MULTI and CFG_REG_DUMP
+         * @param pkg the received Package
+         */
+        void processRegisters(MM_Packet &pkg);
+
+        /**
+         * Send registers packed into as few CFG_REG_RANGE messages as possible (6 per message)
+         * @param target address of the requester
+         * @param first first Register-index
+         * @param count number of registers
+         * @return false if a message couldn't be sent
+         */
+        bool sendRegisters(uint16_t target, uint8_t first, uint8_t count);
 
         /**
          * Add a Target to the list
@@ -162,6 +312,24 @@ class MM_Module{
          */
         bool clearMulticastTargets();
 
+        /**
+         * A target changed, update the filters (after the group batch) and mark its slot for commitConfig()
+         * @param index of the changed target, MULTICAST_TARGETS = all targets changed
+         * @return true
+         */
+        bool targetChanged(uint8_t index);
+
+        /**
+         * Store the lowest changed target slot
+         * @return true if successful
+         */
+        bool commitTarget();
+
+        /**
+         * @return number of targets up to the last used one
+         */
+        uint8_t usedTargets();
+
         /**
          * store the targets in EEPROM
          */
@@ -182,6 +350,7 @@ class MM_Module{
   
         /**
          * Write the config to EEPROM
+         * Only sizeof(config) bytes are allocated for it
          * @param config struct
          */
         template <typename T> bool writeConfig(const T& config){
@@ -191,17 +360,13 @@ class MM_Module{
                 #endif
                 return false;
             }
-            int eepromAddr = _controller->getEEPROMAddress(_cfgId);
-            if(sizeof(config) > MAX_CONFIG_SIZE || eepromAddr+2+MAX_CONFIG_SIZE+sizeof(_multicastTargets) > EEPROM.length()){
+            if(sizeof(config) > MAX_CONFIG_SIZE){
                 #ifdef MM_DEBUG
                     Serial.println("ERROR: Size of the config is to large!");
                 #endif
                 return false;
             }
-    
-            EEPROM.update(eepromAddr, _moduleType);
-            EEPROM.put(eepromAddr + 1, config);
-            return true;
+            return writeConfigData((const uint8_t*)&config, sizeof(config));
         }
         /**
          * Read the config from EEPROM
@@ -214,25 +379,33 @@ class MM_Module{
                 #endif
                 return false;
             }
-            int eepromAddr = _controller->getEEPROMAddress(_cfgId);
-            if(sizeof(config) > MAX_CONFIG_SIZE || eepromAddr+2+MAX_CONFIG_SIZE+sizeof(_multicastTargets) > EEPROM.length()){
-                #ifdef MM_DEBUG
-                    Serial.println("ERROR: Size of the config is to large!");
-                #endif
-                return false;
-            } 
-            if(EEPROM.read(eepromAddr) == _moduleType){
-                EEPROM.get(eepromAddr + 1, config);
+            //A config of another size belongs to an other firmware version
+            if(readConfigData((uint8_t*)&config, sizeof(config)) == sizeof(config)){
                 return true;
-            }else{
-                #ifdef MM_DEBUG
-                    Serial.println("ERROR: No config for this module found!");
-                #endif
-                return false;
             }
-            
+            #ifdef MM_DEBUG
+                Serial.println("ERROR: No config for this module found!");
+            #endif
+            return false;
         }
 
+        /**
+         * Invalidate the stored config, the module starts with its defaults after a reboot
+         */
+        void invalidateConfig();
+
+        /**
+         * Store the config record (MM_Sysbus is incomplete in the templates above)
+         * @return true if stored
+         */
+        bool writeConfigData(const uint8_t *data, uint8_t len);
+
+        /**
+         * Load the config record
+         * @return length of the stored record, 0 if there is none
+         */
+        uint8_t readConfigData(uint8_t *data, uint8_t len);
+
         /**
          * Reset current configuration and reboot the node
          * @return bool false if failed
@@ -43,12 +43,19 @@ enum MM_CMD{
     CFG_REG_SET     = 0x12, //Set a config-register, 1st byte Register-index and 1-6 bytes config data
     CFG_REG_GET     = 0x13, //Request config, 1 byte Register-index
     CFG_REG_COMMIT  = 0x14, //Send back the requestet config-Register, 1st byte Register-index and 1-6 bytes register data
+    CFG_REG_GET_RANGE = 0x15, //Request config-registers, 1st byte first Register-index, 2nd byte count (0 = up to the last register)
+    CFG_REG_SET_MULTI = 0x16, //Set up to 3 config-registers, pairs of Register-index and 1 byte config data
+    CFG_REG_DUMP    = 0x17, //Request all config-registers of the module
+    CFG_REG_RANGE   = 0x18, //Send back requested config-registers, 1st byte first Register-index and 1-6 consecutive register values
 
+    GROUPS_BATCH= 0x19, //1 byte, 1 = start a group batch (filters and EEPROM follow at the end), 0 = end and store the changed groups
     GROUPS_CLEAR= 0x1A, //Remove all Multicast addresses
     GROUP_ADD   = 0x1B, //Add a Multicast address, 2-byte-address + (optional) 1 byte filter(MM_CMD)
     GROUP_REM   = 0x1C, //Remove a Multicast address, 2-byte-address,  + (optional) 1 byte filter(MM_CMD)
     GROUP_GET   = 0x1D, //Request a Target by id, 1 byte target-id
     GROUP_RETURN= 0x1E, //Return the requestet target, 1-byte target-id, 2-byte-address, 1 byte filter(MM_CMD)    
+
+    STREAM_DATA = 0x20, //Consecutive frame of a stream, low nibble sequence number (0x20-0x2F), 1-7 bytes data
     
     BOOL        = 0x51, //1-Bit, on/off
 
@@ -102,16 +109,28 @@ enum MM_CMD{
     GR          = 0xF0, //Weight in gramm, float value (4 bytes)
     KG          = 0xF1, //Weight in kilogramm, float value (4 bytes)
     TON         = 0xF2, //Weight in tonns, float value (4 bytes)
-    STREAM_START= 0xFC, //Start a Stream of type, MM_Stream (1 byte)
+    STREAM_START= 0xFC, //Start a Stream of type, MM_Stream (1 byte), 2-byte total length, 0-4 bytes data
+    STREAM_FC   = 0xFD, //Flow control of a stream, 1 byte MM_StreamFlow, 1 byte block size (0 = unlimited), 1 byte separation time (ms), 1 byte block counter
     STREAM_END  = 0xFE, //Terminate the stream
     ALL_CMDS    = 0xFF,  //For filter only to execute on every cmd
 };
 
 /**
- * 
+ * Type of a stream (segmented transfer of more than 8 bytes)
  */
 enum MM_Stream {
+    STREAM_RAW      = 0x00, //Unspecified data
+    STREAM_CONFIG   = 0x01, //Config blob
+    STREAM_READOUT  = 0x02, //Bulk readout
+};
 
+/**
+ * Flow status of a STREAM_FC message
+ */
+enum MM_StreamFlow {
+    FLOW_CONTINUE   = 0x00, //Send the next block
+    FLOW_WAIT       = 0x01, //Wait for the next flow control
+    FLOW_OVERFLOW   = 0x02, //The stream doesn't fit, abort
 };
 
 /**
@@ -0,0 +1,126 @@
+#include "MM_Routing.h"
+
+void MM_RoutingTable::learn(uint16_t node, signed char busId){
+    if(node == 0 || busId < 0) return;
+
+    uint32_t now = millis();
+    uint8_t oldest = 0;
+    uint8_t free = ROUTING_TABLE_SIZE;
+
+    for(uint8_t i = 0; i < ROUTING_TABLE_SIZE; i++){
+        if(_routes[i].node == node){
+            if(_routes[i].busId != busId){
+                _routes[i].busId = busId;
+                stats.learned++;
+            }
+            _routes[i].lastSeen = now;
+            return;
+        }
+        if(_routes[i].node == 0){
+            if(free == ROUTING_TABLE_SIZE) free = i;
+        }
+        else if(now - _routes[i].lastSeen > now - _routes[oldest].lastSeen || _routes[oldest].node == 0){
+            oldest = i;
+        }
+    }
+
+    //Table full, replace the oldest route
+    if(free == ROUTING_TABLE_SIZE) free = oldest;
+
+    _routes[free].node = node;
+    _routes[free].busId = busId;
+    _routes[free].lastSeen = now;
+    stats.learned++;
+}
+
+signed char MM_RoutingTable::lookup(uint16_t node){
+    if(node == 0) return -1;
+
+    for(uint8_t i = 0; i < ROUTING_TABLE_SIZE; i++){
+        if(_routes[i].node == node){
+            if(millis() - _routes[i].lastSeen > _agingTime){
+                //Route expired
+                _routes[i].node = 0;
+                _routes[i].busId = -1;
+                return -1;
+            }
+            return _routes[i].busId;
+        }
+    }
+    return -1;
+}
+
+void MM_RoutingTable::forget(signed char busId){
+    for(uint8_t i = 0; i < ROUTING_TABLE_SIZE; i++){
+        if(_routes[i].busId == busId){
+            _routes[i].node = 0;
+            _routes[i].busId = -1;
+        }
+    }
+}
+
+void MM_RoutingTable::clear(){
+    for(uint8_t i = 0; i < ROUTING_TABLE_SIZE; i++){
+        _routes[i].node = 0;
+        _routes[i].busId = -1;
+    }
+}
+
+void MM_RoutingTable::setAgingTime(uint32_t ms){
+    _agingTime = ms;
+}
+
+//-----------Duplicate cache---------------------
+
+uint32_t MM_DupCache::hash(const MM_Packet &pkg){
+    uint32_t h = 2166136261UL;
+    uint8_t head[6] = {
+        (uint8_t)pkg.meta.type,
+        pkg.meta.port,
+        highByte(pkg.meta.target),
+        lowByte(pkg.meta.target),
+        highByte(pkg.meta.source),
+        lowByte(pkg.meta.source)
+    };
+
+    for(uint8_t i = 0; i < sizeof(head); i++){
+        h ^= head[i];
+        h *= 16777619UL;
+    }
+    h ^= (uint8_t)pkg.len;
+    h *= 16777619UL;
+    for(int8_t i = 0; i < pkg.len && i < 8; i++){
+        h ^= pkg.data[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+bool MM_DupCache::check(const MM_Packet &pkg){
+    if(_window == 0) return false;
+
+    uint32_t h = hash(pkg);
+    uint16_t tag = h >> 16;
+    if(tag == 0) tag = 1;   //0 marks a free entry
+    uint16_t now = millis();
+
+    MM_DupEntry &entry = _entries[h & (DUP_CACHE_SIZE - 1)];
+    if(entry.tag == tag && (uint16_t)(now - entry.time) < _window){
+        //Same interface: the sender repeated the packet, not a loop
+        if(entry.busId != pkg.meta.busId) return true;
+    }
+    entry.tag = tag;
+    entry.time = now;
+    entry.busId = pkg.meta.busId;
+    return false;
+}
+
+void MM_DupCache::setWindow(uint16_t ms){
+    _window = ms;
+}
+
+void MM_DupCache::clear(){
+    for(uint8_t i = 0; i < DUP_CACHE_SIZE; i++){
+        _entries[i].tag = 0;
+    }
+}
@@ -0,0 +1,223 @@
+/*
+    MM_Sysbus Routing
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Routing__
+#define __MM_Routing__
+
+#include <Arduino.h>
+#include "MM_Protocol.h"
+
+//Max number of learned routes
+#ifndef ROUTING_TABLE_SIZE
+    #define ROUTING_TABLE_SIZE 16
+#endif
+
+//Milliseconds after which a learned route expires
+#ifndef ROUTING_AGING_TIME
+    #define ROUTING_AGING_TIME 300000
+#endif
+
+//Number of entries of the duplicate cache, must be a power of two
+#ifndef DUP_CACHE_SIZE
+    #define DUP_CACHE_SIZE 32
+#endif
+
+#if DUP_CACHE_SIZE <= 0 || (DUP_CACHE_SIZE & (DUP_CACHE_SIZE - 1)) != 0
+    #error "DUP_CACHE_SIZE must be a power of two"
+#endif
+
+//Milliseconds in which an identical packet is treated as duplicate
+#ifndef DUP_CACHE_WINDOW
+    #define DUP_CACHE_WINDOW 250
+#endif
+
+/**
+ * Route entry
+ * Node address and the interface-id it was last seen on
+ */
+struct MM_Route {
+    /**
+     * Node address, 0 = free entry
+     */
+    uint16_t node = 0;
+
+    /**
+     * Interface-id the node was last seen on
+     */
+    signed char busId = -1;
+
+    /**
+     * Time(millis()) the node was last seen
+     */
+    uint32_t lastSeen = 0;
+};
+
+/**
+ * Routing counters
+ */
+struct MM_RoutingStats {
+    /**
+     * Number of routes learned (new or moved nodes)
+     */
+    uint32_t learned = 0;
+
+    /**
+     * Unicast packets sent only to the learned interface
+     */
+    uint32_t routed = 0;
+
+    /**
+     * Packets sent to every interface (broadcast, multicast or unknown target)
+     */
+    uint32_t flooded = 0;
+
+    /**
+     * Interface sends saved by the routing table
+     */
+    uint32_t framesSaved = 0;
+
+    /**
+     * Received packets dropped as duplicates (loops between gateways)
+     */
+    uint32_t duplicates = 0;
+};
+
+/**
+ * Learning routing table
+ * Maps the source address of received packets to the interface they came from,
+ * so unicast packets only have to be sent to the interface of the target node.
+ */
+class MM_RoutingTable {
+public:
+    /**
+     * Routing counters
+     */
+    MM_RoutingStats stats;
+
+    /**
+     * Learn (or refresh) the interface a node is reachable on
+     * If the table is full the oldest route is replaced
+     * @param node source address of the received packet, 0 is ignored
+     * @param busId interface-id the packet was received on
+     */
+    void learn(uint16_t node, signed char busId);
+
+    /**
+     * Lookup the interface of a node
+     * @param node target address
+     * @return interface-id, -1 if the node is unknown or the route expired
+     */
+    signed char lookup(uint16_t node);
+
+    /**
+     * Remove all routes pointing to an interface
+     * @param busId interface-id
+     */
+    void forget(signed char busId);
+
+    /**
+     * Remove all routes
+     */
+    void clear();
+
+    /**
+     * Set the time after which a route expires
+     * @param ms aging time in milliseconds
+     */
+    void setAgingTime(uint32_t ms);
+
+private:
+    /**
+     * Learned routes
+     */
+    MM_Route _routes[ROUTING_TABLE_SIZE];
+
+    /**
+     * Aging time in milliseconds
+     */
+    uint32_t _agingTime = ROUTING_AGING_TIME;
+};
+
+/**
+ * Entry of the duplicate cache
+ */
+struct MM_DupEntry {
+    /**
+     * Upper 16 bit of the packet hash, 0 = free entry
+     */
+    uint16_t tag = 0;
+
+    /**
+     * Lower 16 bit of millis() when the packet was seen
+     */
+    uint16_t time = 0;
+
+    /**
+     * Interface-id the packet was first received on
+     */
+    signed char busId = -1;
+};
+
+/**
+ * Recently seen packets
+ * Direct mapped cache of packet hashes (meta + payload) to suppress packets
+ * looping between multiple gateways that bridge the same segments.
+ * Only a copy arriving on another interface than the first one is a duplicate,
+ * a node repeating a packet on the same segment is passed on.
+ * Uses DUP_CACHE_SIZE * 6 bytes of RAM and needs one lookup per packet.
+ */
+class MM_DupCache {
+public:
+    /**
+     * Check if the packet was seen on another interface within the time window and remember it
+     * @param pkg received packet, meta.busId is the interface it arrived on
+     * @return true if the packet is a duplicate
+     */
+    bool check(const MM_Packet &pkg);
+
+    /**
+     * Set the duplicate time window
+     * @param ms window in milliseconds, 0 disables the cache
+     */
+    void setWindow(uint16_t ms);
+
+    /**
+     * Remove all entries
+     */
+    void clear();
+
+    /**
+     * Hash of the packet (FNV-1a over type, port, target, source, len and data)
+     * The interface-id is not part of the hash
+     */
+    static uint32_t hash(const MM_Packet &pkg);
+
+private:
+    /**
+     * Recently seen packets
+     */
+    MM_DupEntry _entries[DUP_CACHE_SIZE];
+
+    /**
+     * Time window in milliseconds
+     */
+    uint16_t _window = DUP_CACHE_WINDOW;
+};
+
+#endif
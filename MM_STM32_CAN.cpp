@@ -7,7 +7,24 @@ MM_STM32_CAN::MM_STM32_CAN(BitRate bitRate, BusType busType){
 
 bool MM_STM32_CAN::begin() {
     _can.begin(EXT_ID_LEN, _bitRate, _busType); // 29b IDs, set bit rate, no transceiver chip, portA pins 11,12
-    _can.filterMask16Init(0, 0, 0x7ff, 0, 0);
+    _can.filterMask32Init(0, 0, 0); //Accept everything until setFilter()
+    _banksUsed = 1;
+    return true;
+}
+
+bool MM_STM32_CAN::setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count){
+    MM_CANMask masks[MM_STM32_CAN_FILTER_BANKS];
+    uint8_t used = MM_CANFilterPlan(nodeID, groups, count, masks, MM_STM32_CAN_FILTER_BANKS);
+    if(used == 0) return false;
+
+    for(uint8_t bank = 0; bank < used; bank++){
+        _can.filterMask32Init(bank, masks[bank].id, masks[bank].mask);
+    }
+    //Banks of a previous, larger plan are still active, repeat the first pair
+    for(uint8_t bank = used; bank < _banksUsed; bank++){
+        _can.filterMask32Init(bank, masks[0].id, masks[0].mask);
+    }
+    if(used > _banksUsed) _banksUsed = used;
     return true;
 }
 
@@ -23,6 +23,12 @@
 #include <MM_Sysbus.h>
 #include <eXoCAN.h>
 #include "MM_CAN.h"
+#include "MM_CANFilter.h"
+
+//Number of filter banks of the bxCAN peripheral
+#ifndef MM_STM32_CAN_FILTER_BANKS
+    #define MM_STM32_CAN_FILTER_BANKS 14
+#endif
 
 class MM_STM32_CAN : public MM_Interface {
 private:
@@ -36,6 +42,11 @@ private:
      * CAN Crystal Frequency
      */
     BusType _busType;
+
+    /**
+     * Number of filter banks programmed by the last setFilter()
+     */
+    uint8_t _banksUsed = 1;
 public:
     /**
      * CAN-Bus object
@@ -77,6 +88,15 @@ public:
      * @return true if a message was received
      */
     bool Receive(MM_Packet &pkg);
+
+    /**
+     * Program the filter banks (32 bit mask mode) from the node-id and groups
+     * Every bank holds one id/mask pair of MM_CANFilterPlan(), if there are more groups
+     * than banks the pairs are merged into wider masks.
+     * Exact id list mode isn't usable, the source address is part of the CAN id.
+     * @see MM_Interface::setFilter
+     */
+    bool setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count);
 };
 
 
@@ -1,6 +1,7 @@
 #include "MM_Sysbus.h"
 
 MM_Sysbus::MM_Sysbus(uint16_t nodeID) {
+    _transport._controller = this;
     _useEEPROM = false;
     setNodeId(nodeID);
     _firstboot = true;
@@ -11,14 +12,16 @@ MM_Sysbus::MM_Sysbus(uint16_t nodeID) {
 }
 
 MM_Sysbus::MM_Sysbus(uint16_t nodeID, uint16_t EEPROMstart){
+    _transport._controller = this;
     _useEEPROM = true;
     _EEPROMaddr = EEPROMstart;
     uint16_t id = 0;
 
     uint8_t cfg;
-    EEPROM.get(_EEPROMaddr, cfg);
-    if (cfg == 99) {
-        EEPROM.get(_EEPROMaddr + 1, id);
+    MM_EEPROM::get(_EEPROMaddr, cfg);
+    beginStorage(cfg);
+    if (cfg == MM_NODE_MARKER || cfg == MM_NODE_MARKER_PACKED || cfg == MM_NODE_MARKER_SLOTS) {
+        MM_EEPROM::get(_EEPROMaddr + 1, id);
         _initialized = true;
         _firstboot = false;
     }
@@ -34,18 +37,20 @@ MM_Sysbus::MM_Sysbus(uint16_t nodeID, uint16_t EEPROMstart){
 }
 
 MM_Sysbus::MM_Sysbus(uint8_t cfgButton, uint8_t statusLED, uint16_t EEPROMstart){
+    _transport._controller = this;
     _useEEPROM = true;
     _EEPROMaddr = EEPROMstart;
 
-    _cfgBtn = &ConfigButton(cfgButton, 5000);
+    _cfgBtn = new ConfigButton(cfgButton, 5000);
     _statusLED = statusLED;
     pinMode(_statusLED, OUTPUT);
 
     uint8_t cfg;
-    EEPROM.get(_EEPROMaddr, cfg);
-    if (cfg == 99) {
+    MM_EEPROM::get(_EEPROMaddr, cfg);
+    beginStorage(cfg);
+    if (cfg == MM_NODE_MARKER || cfg == MM_NODE_MARKER_PACKED || cfg == MM_NODE_MARKER_SLOTS) {
         uint16_t id = 0;
-        EEPROM.get(_EEPROMaddr + 1, id);
+        MM_EEPROM::get(_EEPROMaddr + 1, id);
         setNodeId(id);
         _firstboot = false;
         #ifdef MM_DEBUG
@@ -87,10 +92,12 @@ bool MM_Sysbus::setNodeId(uint16_t nodeID){
         Serial.println(_nodeID);
     #endif
     if(_useEEPROM){
-        EEPROM.update(_EEPROMaddr, (uint8_t)99);
-        EEPROM.put(_EEPROMaddr + 1, _nodeID);
+        MM_EEPROM::update(_EEPROMaddr, (uint8_t)MM_NODE_MARKER);
+        MM_EEPROM::put(_EEPROMaddr + 1, _nodeID);
     }
    
+    updateFilters();
+
     uint8_t data[1] = { MM_CMD::NODE_BOOT };
     Send(MM_MsgType::Broadcast, 0x00, 1, data);
 
@@ -119,8 +126,11 @@ bool MM_Sysbus::attachBus(MM_Interface* bus){
     for(int busId = 0; busId < MAX_INTERFACES; busId++){
         if(_interfaces[busId] == NULL){
             _interfaces[busId] = bus;
+            _rxWeights[busId] = 1;
 
             if (bus->begin()) {
+                _busCount++;
+                updateFilters();
                 if(_initialized){
                     //Boot message
                     uint8_t data[1] = { MM_CMD::NODE_BOOT };
@@ -149,6 +159,10 @@ bool MM_Sysbus::detachBus(MM_Interface* bus){
     for(int i = 0; i < MAX_INTERFACES; i++){
         if(_interfaces[i] == bus){
             _interfaces[i] = NULL;
+            _busCount--;
+            _routes.forget(i);
+            _txQueues[i].clear();
+            updateFilters();
             #ifdef MM_DEBUG
                 Serial.println("Bus detached");
             #endif
@@ -165,9 +179,25 @@ bool MM_Sysbus::detachBus(MM_Interface* bus){
 bool MM_Sysbus::Send(MM_Packet pkg){
     bool allSuccesfull = true;
 
+    //Unicast to a known node: send only to the interface the node was seen on
+    signed char routeId = -1;
+    if (pkg.meta.type == MM_MsgType::Unicast || pkg.meta.type == MM_MsgType::Streaming) {
+        routeId = _routes.lookup(pkg.meta.target);
+        if (routeId >= 0 && _interfaces[routeId] == NULL) routeId = -1;
+    }
+    if (routeId >= 0) {
+        _routes.stats.routed++;
+    }else{
+        _routes.stats.flooded++;
+    }
+
     for (signed char busId = 0; busId < MAX_INTERFACES; busId++) {
         if (_interfaces[busId] != NULL && busId != pkg.meta.busId) {
-            if(!_interfaces[busId]->Send(pkg.meta.type, pkg.meta.target, pkg.meta.source, pkg.meta.port, pkg.len, pkg.data)){
+            if (routeId >= 0 && busId != routeId) {
+                _routes.stats.framesSaved++;
+                continue;
+            }
+            if(!sendToInterface(busId, pkg)){
                 allSuccesfull = false;
                 #ifdef MM_DEBUG
                 Serial.println("---Send-Error---");
@@ -208,6 +238,52 @@ bool MM_Sysbus::Send(MM_Packet pkg){
     return allSuccesfull;
 }
 
+bool MM_Sysbus::sendToInterface(signed char busId, MM_Packet &pkg){
+    MM_TxQueue &queue = _txQueues[busId];
+
+    //Keep the order, if there are already packets waiting they go first
+    if(queue.empty()){
+        if(_interfaces[busId]->Send(pkg.meta.type, pkg.meta.target, pkg.meta.source, pkg.meta.port, pkg.len, pkg.data)){
+            queue.stats.sent++;
+            return true;
+        }
+        if(!queue.push(pkg)) return false;
+        queue.failed();
+        return true;
+    }
+    return queue.push(pkg);
+}
+
+void MM_Sysbus::flushTxQueues(){
+    for (signed char busId = 0; busId < MAX_INTERFACES; busId++) {
+        if (_interfaces[busId] == NULL) continue;
+        MM_TxQueue &queue = _txQueues[busId];
+
+        while (!queue.empty() && queue.ready()) {
+            //Hand over the backlog at once, interfaces like MM_UART pack it into one write
+            uint8_t count;
+            MM_Packet *pkgs = queue.front(count);
+            uint8_t sent = _interfaces[busId]->SendBatch(pkgs, count);
+            for (uint8_t i = 0; i < sent; i++) {
+                queue.pop();
+            }
+            if (sent < count) {
+                queue.failed();
+                #ifdef MM_DEBUG
+                    Serial.print("TX retry on interface ");
+                    Serial.println(busId);
+                #endif
+            }
+        }
+    }
+}
+
+MM_TxStats MM_Sysbus::txStats(uint8_t busId){
+    MM_TxStats empty;
+    if(busId >= MAX_INTERFACES) return empty;
+    return _txQueues[busId].stats;
+}
+
 bool MM_Sysbus::Send(MM_Meta meta, uint8_t len, uint8_t *data){
     return Send(meta.type, meta.target, meta.source, meta.port, len, data, meta.busId);
 }
@@ -240,12 +316,23 @@ bool MM_Sysbus::Receive(MM_Packet &pkg){
 
 bool MM_Sysbus::Receive(MM_Packet &pkg, bool routing){
     bool check = false;
+    uint8_t start = (_rxPolicy == RX_PRIORITY) ? 0 : _rxNext;
 
-    for (signed char busId = 0; busId < MAX_INTERFACES; busId++) {
+    for (uint8_t n = 0; n < MAX_INTERFACES; n++) {
+        signed char busId = (start + n) % MAX_INTERFACES;
         if (_interfaces[busId] != NULL) {
             check = _interfaces[busId]->Receive(pkg);
             if (check) {
                 pkg.meta.busId = busId;
+                rxScheduled(busId);
+                //Streams addressed to us are checked by their sequence numbers
+                bool ownStream = pkg.meta.type == MM_MsgType::Streaming && _initialized && pkg.meta.target == _nodeID;
+                if (_busCount > 1 && !ownStream && _dups.check(pkg)) {
+                    //Already seen, e.g. sent back by a second gateway
+                    _routes.stats.duplicates++;
+                    continue;
+                }
+                _routes.learn(pkg.meta.source, busId);
                 #ifdef MM_DEBUG
                     Serial.println("---Message Received---");
                     Serial.print("Type: ");
@@ -277,12 +364,45 @@ bool MM_Sysbus::Receive(MM_Packet &pkg, bool routing){
     return false;
 }
 
+void MM_Sysbus::rxScheduled(uint8_t busId){
+    if (busId != _rxNext) {
+        //The interface(s) in front had nothing, the turn starts over
+        _rxCredit = 0;
+    }
+    _rxCredit++;
+    if (_rxPolicy != RX_WEIGHTED || _rxCredit >= _rxWeights[busId]) {
+        _rxNext = (busId + 1) % MAX_INTERFACES;
+        _rxCredit = 0;
+    }else{
+        _rxNext = busId;
+    }
+}
+
+void MM_Sysbus::setReceivePolicy(MM_RxPolicy policy){
+    _rxPolicy = policy;
+    _rxNext = 0;
+    _rxCredit = 0;
+}
+
+bool MM_Sysbus::setInterfaceWeight(MM_Interface* bus, uint8_t weight){
+    for (uint8_t i = 0; i < MAX_INTERFACES; i++) {
+        if (_interfaces[i] == bus) {
+            _rxWeights[i] = weight > 0 ? weight : 1;
+            return true;
+        }
+    }
+    return false;
+}
+
 void MM_Sysbus::Process(MM_Packet& pkg) {
     uint8_t i;
     uint8_t data[8];
 
+    //Segmented streams addressed to this node
+    bool stream = pkg.meta.type == MM_MsgType::Streaming && _initialized && pkg.meta.target == _nodeID && _transport.process(pkg);
+
     //Internal logic
-    if (pkg.len >= 1) {
+    if (pkg.len >= 1 && !stream) {
         MM_CMD cmd = (MM_CMD)pkg.data[0];
         switch (cmd) {
             case NODE_PING:
@@ -331,8 +451,10 @@ void MM_Sysbus::Process(MM_Packet& pkg) {
                 else if((pkg.meta.type == MM_MsgType::Unicast || pkg.meta.type == MM_MsgType::Streaming) && pkg.meta.target == _nodeID){
                     for (int i = 0; i < MAX_MODULES; i++) {
                         if (_modules[i] != NULL && _modules[i]->port() == pkg.meta.port) {
-                            Serial.print("Process Module ");
-                            Serial.println(_modules[i]->port());
+                            #ifdef MM_DEBUG
+                                Serial.print("Process Module ");
+                                Serial.println(_modules[i]->port());
+                            #endif
                             _modules[i]->process(pkg);
                         }
                     }
@@ -369,6 +491,7 @@ bool MM_Sysbus::attachModule(MM_Module *module, uint8_t cfgId){
         _modules[cfgId] = module;
         module->_controller = this;
         module->begin(_useEEPROM, cfgId);
+        updateFilters();
         #ifdef MM_DEBUG
             Serial.println("Module attached");
         #endif
@@ -401,6 +524,7 @@ bool MM_Sysbus::detachModule(MM_Module *module){
     for(int i = 0; i < MAX_MODULES; i++){
         if(_modules[i] == module){
             _modules[i] = NULL;
+            updateFilters();
             #ifdef MM_DEBUG
                 Serial.println("Module detached");
             #endif
@@ -421,17 +545,118 @@ bool MM_Sysbus::attachHook(MM_MsgType msgType, uint16_t target, uint8_t port, MM
             _hooks[i].port = port;
             _hooks[i].cmd = cmd;
             _hooks[i].execute = function;
+            updateFilters();
             return true;
         }
     }
     return false;
 }
 
+MM_RoutingStats MM_Sysbus::routingStats(){
+    return _routes.stats;
+}
+
+void MM_Sysbus::setRouteAgingTime(uint32_t ms){
+    _routes.setAgingTime(ms);
+}
+
+void MM_Sysbus::setDuplicateWindow(uint16_t ms){
+    _dups.setWindow(ms);
+}
+
+void MM_Sysbus::setReceiveBudget(uint8_t maxPackets, uint16_t maxMicros){
+    _rxBudget = maxPackets > 0 ? maxPackets : 1;
+    _rxBudgetTime = maxMicros;
+}
+
+uint8_t MM_Sysbus::lastReceived(){
+    return _rxCount;
+}
+
+void MM_Sysbus::updateFilters(){
+    uint16_t groups[MAX_FILTER_GROUPS];
+    uint8_t count = 0;
+    bool promiscuous = !_initialized || _nodeID == 0;
+
+    //A router has to see everything
+    if (_busCount > 1) promiscuous = true;
+
+    for (uint8_t m = 0; m < MAX_MODULES && !promiscuous; m++) {
+        if (_modules[m] == NULL) continue;
+        const MM_Target *targets = _modules[m]->multicastTargets();
+        for (uint8_t t = 0; t < MULTICAST_TARGETS && !promiscuous; t++) {
+            if (targets[t].address == 0) continue;
+            promiscuous = !addFilterGroup(groups, count, targets[t].address);
+        }
+    }
+
+    for (uint8_t h = 0; h < MAX_HOOKS && !promiscuous; h++) {
+        if (_hooks[h].execute == NULL) continue;
+        if (_hooks[h].type == MM_MsgType::Multicast && _hooks[h].target != 0) {
+            promiscuous = !addFilterGroup(groups, count, _hooks[h].target);
+        }
+        else if (_hooks[h].type == MM_MsgType::Multicast || (_hooks[h].type == MM_MsgType::Unicast && _hooks[h].target != _nodeID)) {
+            //Hook listens to all groups or to unicasts of other nodes
+            promiscuous = true;
+        }
+    }
+
+    for (uint8_t i = 0; i < MAX_INTERFACES; i++) {
+        if (_interfaces[i] != NULL) {
+            if (promiscuous) {
+                _interfaces[i]->setFilter(0, NULL, 0);
+            }else{
+                _interfaces[i]->setFilter(_nodeID, groups, count);
+            }
+        }
+    }
+}
+
+bool MM_Sysbus::addFilterGroup(uint16_t *groups, uint8_t &count, uint16_t group){
+    for (uint8_t i = 0; i < count; i++) {
+        if (groups[i] == group) return true;
+    }
+    if (count >= MAX_FILTER_GROUPS) return false;
+    groups[count++] = group;
+    return true;
+}
+
+bool MM_Sysbus::SendLarge(uint16_t target, uint8_t port, MM_Stream streamType, const uint8_t *data, uint16_t len){
+    return _transport.send(target, port, streamType, data, len);
+}
+
+MM_StreamStatus MM_Sysbus::streamStatus(){
+    return _transport.status();
+}
+
+void MM_Sysbus::attachStreamHandler(void (*function)(uint16_t source, uint8_t port, MM_Stream type, uint8_t *data, uint16_t len)){
+    _transport.attachHandler(function);
+}
+
 MM_Packet MM_Sysbus::loop(void) {
     MM_Packet pkg;
 
-    //Packet handling
-    Receive(pkg);
+    //Feed the EEPROM write queue (cores without EEPROM-ready interrupt)
+    MM_EEPROM::tick();
+
+    //Background reset
+    resetStep();
+
+    //Retry packets the interfaces couldn't send before
+    flushTxQueues();
+
+    //Packet handling, drain up to _rxBudget packets or _rxBudgetTime microseconds
+    MM_Packet rx;
+    uint32_t start = micros();
+    _rxCount = 0;
+    while (_rxCount < _rxBudget && Receive(rx)) {
+        pkg = rx;
+        _rxCount++;
+        if (_rxBudgetTime != 0 && micros() - start >= _rxBudgetTime) break;
+    }
+
+    //Continue the outgoing stream, drop stale incoming streams
+    _transport.loop();
     
     if(_initialized && _nodeID == 0){
         return pkg;
@@ -455,9 +680,35 @@ MM_Packet MM_Sysbus::loop(void) {
         }
     }
 
+    //Deferred EEPROM writes
+    commitConfig();
+
     return pkg;
 }
 
+void MM_Sysbus::commitConfig(){
+    //Wait until the last commit is written, a commit into a partly full queue would block
+    if (resetting() || MM_EEPROM::busy()) return;
+    bool idle = _rxCount == 0;
+    for (uint8_t i = 0; i < MAX_INTERFACES; i++) {
+        if (_interfaces[i] != NULL && !_txQueues[i].empty()) idle = false;
+    }
+    for (int i = 0; i < MAX_MODULES; i++) {
+        if (_modules[i] != NULL && _modules[i]->configDue(idle)) {
+            _modules[i]->commitConfig();
+            return;
+        }
+    }
+}
+
+void MM_Sysbus::flushConfig(){
+    for (int i = 0; i < MAX_MODULES; i++) {
+        if (_modules[i] != NULL) {
+            _modules[i]->flushConfig();
+        }
+    }
+}
+
 void MM_Sysbus::initialization() {
     MM_Packet pkg;
     uint32_t exitTime = millis() + 60000;
@@ -468,6 +719,11 @@ void MM_Sysbus::initialization() {
                 reset();
             }
         }
+        if (resetting()) {
+            MM_EEPROM::tick();
+            resetStep();
+            continue;
+        }
 
         if (millis() % 1000 > 500) {
             digitalWrite(_statusLED, HIGH);
@@ -492,34 +748,124 @@ void MM_Sysbus::initialization() {
 
 }
 
-uint16_t MM_Sysbus::getEEPROMAddress(uint8_t cfgID) {
-    return (cfgID * (MAX_CONFIG_SIZE + 1 + (sizeof(MM_Target) * MULTICAST_TARGETS)) + _EEPROMaddr + 3);
+void MM_Sysbus::beginStorage(uint8_t marker){
+    uint16_t start = _EEPROMaddr + 3;
+    #ifdef MM_USE_JOURNAL
+        _journal.begin(start, MM_JOURNAL_SIZE > 0 ? MM_JOURNAL_SIZE : MM_EEPROM::length() - start);
+    #else
+        _layout.begin(start, MM_EEPROM::length() - start);
+        //No node header or an older layout, the directory is garbage
+        if(marker != MM_NODE_MARKER){
+            _layout.format();
+        }
+    #endif
+}
+
+bool MM_Sysbus::storeRecord(uint8_t cfgId, MM_RecordType kind, uint8_t moduleType, const uint8_t *data, uint8_t len){
+    if(!_useEEPROM) return false;
+    #ifdef MM_USE_JOURNAL
+        if(len > MM_JOURNAL_RECORD_MAX - 1) return false;
+        uint8_t buf[MM_JOURNAL_RECORD_MAX];
+        buf[0] = moduleType;
+        for(uint8_t i = 0; i < len; i++) buf[i + 1] = data[i];
+        return _journal.write(1 + cfgId * 2 + kind, buf, len + 1);
+    #else
+        return _layout.write(cfgId, kind, moduleType, data, len);
+    #endif
+}
+
+bool MM_Sysbus::storeRecordPart(uint8_t cfgId, MM_RecordType kind, uint8_t moduleType, uint8_t offset, const uint8_t *data, uint8_t len){
+    if(!_useEEPROM) return false;
+    #ifdef MM_USE_JOURNAL
+        //Journal records are always appended as a whole
+        return false;
+    #else
+        return _layout.writePart(cfgId, kind, moduleType, offset, data, len);
+    #endif
+}
+
+uint8_t MM_Sysbus::loadRecord(uint8_t cfgId, MM_RecordType kind, uint8_t moduleType, uint8_t *data, uint8_t maxLen){
+    if(!_useEEPROM) return 0;
+    #ifdef MM_USE_JOURNAL
+        uint8_t buf[MM_JOURNAL_RECORD_MAX];
+        uint8_t len = _journal.read(1 + cfgId * 2 + kind, buf, sizeof(buf));
+        if(len == 0 || buf[0] != moduleType || len - 1 > maxLen) return 0;
+        for(uint8_t i = 0; i < len - 1; i++) data[i] = buf[i + 1];
+        return len - 1;
+    #else
+        return _layout.read(cfgId, kind, moduleType, data, maxLen);
+    #endif
+}
+
+bool MM_Sysbus::eraseRecord(uint8_t cfgId, MM_RecordType kind){
+    if(!_useEEPROM) return false;
+    #ifdef MM_USE_JOURNAL
+        return _journal.erase(1 + cfgId * 2 + kind);
+    #else
+        return _layout.erase(cfgId, kind);
+    #endif
 }
 
 void MM_Sysbus::reset(){
     #ifdef MM_DEBUG
         Serial.println("Reset");
-    #endif    
-    if(_statusLED != 0){
-        for (int i = 0; i < 10; i++){
-            delay(50);
-            digitalWrite(_statusLED, HIGH);
-            delay(50);
-            digitalWrite(_statusLED, LOW);
+    #endif
+    for (int i = 0; i < MAX_MODULES; i++) {
+        if (_modules[i] != NULL) {
+            _modules[i]->discardConfig();
         }
     }
-    if(_useEEPROM){
-        for (int i = 0 ; i < EEPROM.length() ; i++) {
-            EEPROM.write(i, 0);
-        }
+    _resetIndex = 0;
+    _resetState = _useEEPROM ? RESET_HEADER : RESET_WAIT;
+}
+
+bool MM_Sysbus::resetting(){
+    return _resetState != RESET_IDLE;
+}
+
+void MM_Sysbus::resetStep(){
+    switch (_resetState) {
+        case RESET_HEADER:
+            MM_EEPROM::update(_EEPROMaddr, 0);
+            _resetState = RESET_MODULES;
+            break;
+        case RESET_MODULES:
+            #ifdef MM_USE_JOURNAL
+                _journal.invalidate();
+                _resetState = RESET_WAIT;
+            #else
+                _layout.invalidate(_resetIndex++);
+                if (_resetIndex >= MAX_MODULES) {
+                    _resetState = RESET_WAIT;
+                }
+            #endif
+            break;
+        case RESET_WAIT:
+            if(_statusLED != 0){
+                digitalWrite(_statusLED, (millis() / 50) % 2);
+            }
+            if (!MM_EEPROM::busy()) {
+                //Changes made during the reset must not be written back by reboot()
+                for (int i = 0; i < MAX_MODULES; i++) {
+                    if (_modules[i] != NULL) {
+                        _modules[i]->discardConfig();
+                    }
+                }
+                _resetState = RESET_IDLE;
+                reboot();
+            }
+            break;
+        default:
+            break;
     }
-    reboot();
 }
 
 void MM_Sysbus::reboot(){
     #ifdef MM_DEBUG
         Serial.println("Reboot");
     #endif
+    flushConfig();
+    MM_EEPROM::flush();
     delay(100);
     wdt_enable(WDTO_15MS);
     while (true);  
@@ -534,7 +880,7 @@ ConfigButton::ConfigButton(uint8_t buttonPin, uint16_t t_long_press){
 ButtonState ConfigButton::process(){
     uint32_t time = millis();
 
-    if(_triggerTime + 50 < time) return; //Debounce
+    if(time - _triggerTime < 50) return _pressed ? ButtonState::Pressed : ButtonState::Released; //Debounce
 
     bool btnPressed = !digitalRead(_pin);
 
@@ -33,18 +33,59 @@
     #define MAX_HOOKS 3
 #endif
 
+//Max packets received per loop() call
+#ifndef RX_BUDGET
+    #define RX_BUDGET 1
+#endif
+
+//Max number of distinct multicast groups passed to the interface filters, more groups disable filtering
+#ifndef MAX_FILTER_GROUPS
+    #define MAX_FILTER_GROUPS 16
+#endif
+
+//Order in which the interfaces are polled (MM_RxPolicy)
+#ifndef RX_POLICY
+    #define RX_POLICY RX_ROUND_ROBIN
+#endif
+
 //Max number of modules
 #ifndef MAX_MODULES
     #define MAX_MODULES 5
 #endif
 
+//Bytes of EEPROM behind the node header used by the journal (MM_USE_JOURNAL), 0 = up to the end of the EEPROM
+#ifndef MM_JOURNAL_SIZE
+    #define MM_JOURNAL_SIZE 0
+#endif
+
+//First byte of a valid node header (module layout with directory copies)
+#define MM_NODE_MARKER 101
+
+//Node header of the packed layout without directory copies, the node-id is kept, module configs are dropped
+#define MM_NODE_MARKER_PACKED 100
+
+//Node header of the old fixed slot layout, the node-id is kept, module configs are dropped
+#define MM_NODE_MARKER_SLOTS 99
+
+//Max size of a journal record (module type + config or multicast targets)
+#define MM_JOURNAL_RECORD_MAX (MAX_CONFIG_SIZE + 1)
+
 #include <Arduino.h>
-#include <EEPROM.h>
 #include <avr/wdt.h>
 
 #include "MM_Protocol.h"
+#include "MM_EEPROM.h"
+#include "MM_Journal.h"
+#include "MM_Layout.h"
+
+#if defined(MM_USE_JOURNAL) && (MAX_MODULES * 2 > MM_JOURNAL_KEYS)
+    #error "MM_JOURNAL_KEYS must be at least 2 * MAX_MODULES"
+#endif
 
 #include "MM_Interface.h"
+#include "MM_Routing.h"
+#include "MM_TxQueue.h"
+#include "MM_Transport.h"
 #include "MM_UART.h"
 #include "MM_CAN.h"
 
@@ -53,6 +94,25 @@
 
 #include "MM_BasicIO.h"
 
+/**
+ * Order in which Receive() polls the attached interfaces
+ */
+enum MM_RxPolicy{
+    RX_PRIORITY,    //Always start at interface 0, lower ids are preferred (can starve higher ids)
+    RX_ROUND_ROBIN, //Start after the interface that delivered the last packet
+    RX_WEIGHTED,    //Round robin, but an interface may deliver up to its weight packets in a row
+};
+
+/**
+ * Steps of the background reset (see MM_Sysbus::reset)
+ */
+enum MM_ResetState{
+    RESET_IDLE,     //No reset running
+    RESET_HEADER,   //Invalidate the node header
+    RESET_MODULES,  //Invalidate the module entries of the config store
+    RESET_WAIT,     //Wait until the EEPROM writes are done, then reboot
+};
+
 enum ButtonState{
     Released,
     Pressed,
@@ -119,16 +179,34 @@ private:
      */
     uint16_t _EEPROMaddr = 0;
 
+    #ifdef MM_USE_JOURNAL
+    /**
+     * Config store of the modules, behind the node header
+     */
+    MM_Journal _journal;
+    #else
+    /**
+     * Config store of the modules, behind the node header
+     */
+    MM_Layout _layout;
+    #endif
+
+    /**
+     * Set up the config store behind the node header
+     * @param marker first byte of the node header read at boot
+     */
+    void beginStorage(uint8_t marker);
+
     /**
      * this variable is set from the constructor and tells the firstboot() function if is the first boot;
      * If the controller is defined without eeprom firstboot is called every boot
      */
-    bool _firstboot;
+    bool _firstboot = false;
 
     /**
      * Pin number of status LED
      */
-    uint8_t _statusLED;
+    uint8_t _statusLED = 0;
 
     /**
      * Pin number of config Button
@@ -139,7 +217,33 @@ private:
     /**
      * Attached communication interfaces
      */
-    MM_Interface *_interfaces[MAX_INTERFACES];
+    MM_Interface *_interfaces[MAX_INTERFACES] = {};
+
+    /**
+     * Number of attached interfaces, with more than one the node routes between them
+     */
+    uint8_t _busCount = 0;
+
+    /**
+     * Learned routes: node address -> interface-id
+     */
+    MM_RoutingTable _routes;
+
+    /**
+     * Recently received packets, to drop packets looping between gateways
+     * Only checked if the node routes between interfaces
+     */
+    MM_DupCache _dups;
+
+    /**
+     * Packets waiting for a retry, one queue per interface
+     */
+    MM_TxQueue _txQueues[MAX_INTERFACES];
+
+    /**
+     * Segmented streams (SendLarge)
+     */
+    MM_Transport _transport;
 
     /**
      * Attached hooks
@@ -149,12 +253,98 @@ private:
     /**
      * Attached Modules
      */
-    MM_Module *_modules[MAX_MODULES];
+    MM_Module *_modules[MAX_MODULES] = {};
+
+    /**
+     * Max packets received per loop() call
+     */
+    uint8_t _rxBudget = RX_BUDGET;
+
+    /**
+     * Max microseconds spent receiving per loop() call, 0 = no time limit
+     */
+    uint16_t _rxBudgetTime = 0;
+
+    /**
+     * Packets received in the last loop() call
+     */
+    uint8_t _rxCount = 0;
+
+    /**
+     * Interface polling order
+     */
+    MM_RxPolicy _rxPolicy = RX_POLICY;
+
+    /**
+     * Interface-id Receive() starts polling at (round robin and weighted)
+     */
+    uint8_t _rxNext = 0;
+
+    /**
+     * Packets the interface _rxNext delivered in a row
+     */
+    uint8_t _rxCredit = 0;
+
+    /**
+     * Weight of every interface for RX_WEIGHTED
+     */
+    uint8_t _rxWeights[MAX_INTERFACES] = {};
+
+    /**
+     * Write at most one commit step per loop() call (a changed target slot or a debounced module config,
+     * preferably on an idle bus) and only into an empty EEPROM write queue,
+     * so a commit of up to MM_EEPROM_QUEUE_SIZE bytes never blocks
+     */
+    void commitConfig();
+
+    /**
+     * Advance the polling order after an interface delivered a packet
+     * @param busId interface-id that delivered the packet
+     */
+    void rxScheduled(uint8_t busId);
 
     /**
      * Indicates if the controller has a nodeId
      */
-    bool _initialized;
+    bool _initialized = false;
+
+    /**
+     * Step of the background reset
+     */
+    MM_ResetState _resetState = RESET_IDLE;
+
+    /**
+     * Module entry the reset invalidates next
+     */
+    uint8_t _resetIndex = 0;
+
+    /**
+     * Do the next step of a running reset, called from loop()
+     */
+    void resetStep();
+
+    /**
+     * Send a packet to one interface
+     * If the interface is busy or packets are already waiting the packet is queued
+     * @param busId interface-id
+     * @param pkg packet to send
+     * @return false if the packet was dropped because the queue is full
+     */
+    bool sendToInterface(signed char busId, MM_Packet &pkg);
+
+    /**
+     * Retry the queued packets of all interfaces whose backoff time is over
+     */
+    void flushTxQueues();
+
+    /**
+     * Add a group to the filter list if it isn't already in it
+     * @param groups filter list (MAX_FILTER_GROUPS entries)
+     * @param count number of groups in the list
+     * @param group multicast address to add
+     * @return false if the list is full
+     */
+    bool addFilterGroup(uint16_t *groups, uint8_t &count, uint16_t group);
 
     /**
      * Initialization Mode
@@ -218,8 +408,12 @@ public:
     bool detachBus(MM_Interface* bus);
 
     /**
-     * Send a message to all attached buses
+     * Send a message to the attached buses
+     * Unicast messages to a node with a learned route are only sent to the interface of the target,
+     * everything else is sent to all attached buses
+     * If an interface is busy the packet is queued and retried from loop()
      * @param pkg complete MM_Packet to send
+     * @return false if the packet was dropped on at least one interface (TX-queue full)
      */
     bool Send(MM_Packet pkg);
 
@@ -266,9 +460,35 @@ public:
      */
     bool Send(MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data, signed char skipInterface);
 
+    /**
+     * Send up to 65535 bytes as a segmented stream (STREAM_START, STREAM_DATA, flow control)
+     * The frames are sent from loop(), the data is not copied and must stay valid
+     * until streamStatus() is no longer STREAM_BUSY
+     * @param target node address
+     * @param port target port, 0-MM_STREAM_MAX_PORT (streams on CAN carry only 4 port bits)
+     * @param streamType type of the stream
+     * @param data data to send
+     * @param len length of data, the receiver accepts up to its MM_STREAM_MAX_LEN
+     * @return false if another stream is still being sent, the port is out of range
+     *         or the first frame couldn't be sent
+     */
+    bool SendLarge(uint16_t target, uint8_t port, MM_Stream streamType, const uint8_t *data, uint16_t len);
+
+    /**
+     * @return state of the stream started with SendLarge
+     */
+    MM_StreamStatus streamStatus();
+
+    /**
+     * Attach a function called with every completely received stream
+     * @param function handler, the data is only valid during the call
+     */
+    void attachStreamHandler(void (*function)(uint16_t source, uint8_t port, MM_Stream type, uint8_t *data, uint16_t len));
+
     /**
      * Receives a single message from the attached Interfaces
-     * The message from the interface with the lowest id that has a new message is stored in pkg
+     * The interfaces are polled in the order of the receive policy (see setReceivePolicy),
+     * the message of the first interface that has a new message is stored in pkg
      * The pkg received will be redistributed over all attached interfaces
      * @param pkg reference to store the received MM_Packet
      * @return true - a message was received, false - no new message 
@@ -277,7 +497,8 @@ public:
 
     /**
      * Receives a single message from the attached Interfaces
-     * The message from the interface with the lowest id that has a new message is stored in pkg
+     * The interfaces are polled in the order of the receive policy (see setReceivePolicy),
+     * the message of the first interface that has a new message is stored in pkg
      * @param pkg reference to store the received MM_Packet
      * @param routing if false the pkg will not be redistributed over all attached interfaces
      * @return true - a message was received, false - no new message
@@ -329,24 +550,137 @@ public:
      */
     bool attachHook(MM_MsgType msgType, uint16_t target, uint8_t port, MM_CMD cmd, void (*function)(MM_Packet&));
 
+    /**
+     * @return the routing counters (learned routes, routed/flooded packets and saved frames)
+     */
+    MM_RoutingStats routingStats();
+
+    /**
+     * Set the time after which a learned route expires
+     * @param ms aging time in milliseconds
+     */
+    void setRouteAgingTime(uint32_t ms);
+
+    /**
+     * @param busId interface-id
+     * @return the TX-queue counters (depth, high-water mark, drops, retries) of the interface
+     */
+    MM_TxStats txStats(uint8_t busId);
+
+    /**
+     * Set the window in which an identical packet received on another interface is dropped as duplicate
+     * Only used on nodes with more than one interface
+     * @param ms window in milliseconds, 0 disables duplicate suppression
+     */
+    void setDuplicateWindow(uint16_t ms);
+
+    /**
+     * Set the order in which the interfaces are polled
+     * @param policy RX_PRIORITY, RX_ROUND_ROBIN or RX_WEIGHTED
+     */
+    void setReceivePolicy(MM_RxPolicy policy);
+
+    /**
+     * Set the weight of an interface for RX_WEIGHTED
+     * The interface may deliver up to weight packets in a row before the next interface is polled
+     * @param bus attached bus object
+     * @param weight packets in a row (1 = plain round robin)
+     * @return false if the bus isn't attached
+     */
+    bool setInterfaceWeight(MM_Interface* bus, uint8_t weight);
+
+    /**
+     * Set how many packets loop() receives before the modules are looped
+     * Under bursts a larger budget drains the interfaces before their buffers overrun.
+     * Receiving stops at whichever limit is reached first or when no packet is left.
+     * @param maxPackets max packets per loop() call (1 = one packet per call)
+     * @param maxMicros max microseconds spent receiving per loop() call, 0 = no time limit
+     */
+    void setReceiveBudget(uint8_t maxPackets, uint16_t maxMicros);
+
+    /**
+     * @return number of packets received in the last loop() call
+     */
+    uint8_t lastReceived();
+
+    /**
+     * Program the acceptance filters of the attached interfaces
+     * Computed from the node-id, the multicast groups of all modules and the hooks.
+     * Filtering is disabled (everything is accepted) if the node is a gateway (node-id 0),
+     * not initialized, routes between several interfaces, has a hook for foreign unicasts
+     * or more than MAX_FILTER_GROUPS groups.
+     * Called automatically when the node-id, the modules or their groups change.
+     */
+    void updateFilters();
+
+    /**
+     * Write all dirty module configs to EEPROM now
+     * Call it before cutting the power, e.g. from a brown-out / power-fail detection.
+     * Takes a few ms per changed byte on AVR.
+     */
+    void flushConfig();
+
     /**
      * Main loop
-     * Receives and routes packets, loop attached modules, etc
+     * Receives and routes packets (up to the receive budget), loop attached modules, etc
      * @return Packet last received packet
      */
     MM_Packet loop();
 
     /**
-     *  returns the EEPROM Address for the register of the module
-     *  @param cfgID the Id of the Module
+     * Store a module record (in the packed layout or the journal)
+     * @param cfgId the Id of the Module
+     * @param kind config or multicast targets
+     * @param moduleType stored with the record, loadRecord() only returns records of the same type
+     * @param data record data
+     * @param len length of data, max MAX_CONFIG_SIZE
+     * @return true if successful
      */
-    uint16_t getEEPROMAddress(uint8_t cfgID);
-    
+    bool storeRecord(uint8_t cfgId, MM_RecordType kind, uint8_t moduleType, const uint8_t *data, uint8_t len);
+
+    /**
+     * Overwrite a part of a stored module record (packed layout only)
+     * @param cfgId the Id of the Module
+     * @param kind config or multicast targets
+     * @param moduleType type the record must have been stored with
+     * @param offset first byte in the record
+     * @param data new bytes
+     * @param len number of bytes
+     * @return false if the record doesn't exist or the store can't write parts - store the whole record then
+     */
+    bool storeRecordPart(uint8_t cfgId, MM_RecordType kind, uint8_t moduleType, uint8_t offset, const uint8_t *data, uint8_t len);
+
+    /**
+     * Load a module record
+     * @param cfgId the Id of the Module
+     * @param kind config or multicast targets
+     * @param moduleType type the record must have been stored with
+     * @param data buffer
+     * @param maxLen size of the buffer
+     * @return length of the record, 0 if no matching record was found
+     */
+    uint8_t loadRecord(uint8_t cfgId, MM_RecordType kind, uint8_t moduleType, uint8_t *data, uint8_t maxLen);
+
+    /**
+     * Invalidate a module record
+     * @param cfgId the Id of the Module
+     * @param kind config or multicast targets
+     * @return true if successful
+     */
+    bool eraseRecord(uint8_t cfgId, MM_RecordType kind);
+
     /**
-     * resets the whole controller - clears the eeprom, reboot and initialize the controller and modules
+     * resets the whole controller - invalidates the node header and the module configs, reboot and initialize the controller and modules
+     * Only the validity markers inside the sysbus EEPROM region are cleared, the reset runs in the
+     * background of loop() and reboots when the EEPROM writes are done
      */
     void reset();
 
+    /**
+     * @return true while a reset is running
+     */
+    bool resetting();
+
     /**
      * reboot the node
      */
@@ -355,7 +689,3 @@ public:
 };
 
 #endif
-
-
-
-
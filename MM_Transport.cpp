@@ -0,0 +1,220 @@
+#include "MM_Transport.h"
+#include "MM_Sysbus.h"
+
+bool MM_Transport::send(uint16_t target, uint8_t port, MM_Stream type, const uint8_t *data, uint16_t len){
+    if(_controller == NULL || _txStatus == STREAM_BUSY || port > MM_STREAM_MAX_PORT) return false;
+
+    uint8_t frame[8];
+    uint8_t n = (len < 4) ? len : 4;
+    frame[0] = MM_CMD::STREAM_START;
+    frame[1] = type;
+    frame[2] = highByte(len);
+    frame[3] = lowByte(len);
+    for(uint8_t i = 0; i < n; i++) frame[4 + i] = data[i];
+
+    if(!_controller->Send(MM_MsgType::Streaming, target, port, 4 + n, frame)) return false;
+
+    _txData = data;
+    _txLen = len;
+    _txOffset = n;
+    _txTarget = target;
+    _txPort = port;
+    _txSeq = 1;
+    _txTime = millis();
+
+    if(_txOffset >= _txLen){
+        _txStatus = STREAM_DONE;
+    }else{
+        _txStatus = STREAM_BUSY;
+        _txWaitFc = true;
+    }
+    return true;
+}
+
+MM_StreamStatus MM_Transport::status(){
+    return _txStatus;
+}
+
+void MM_Transport::attachHandler(void (*function)(uint16_t source, uint8_t port, MM_Stream type, uint8_t *data, uint16_t len)){
+    _handler = function;
+}
+
+bool MM_Transport::process(MM_Packet &pkg){
+    if(pkg.len < 1) return false;
+    uint8_t cmd = pkg.data[0];
+
+    if(cmd == MM_CMD::STREAM_START && pkg.len >= 4){
+        receiveStart(pkg);
+    }
+    else if((cmd & 0xF0) == MM_CMD::STREAM_DATA){
+        receiveData(pkg);
+    }
+    else if(cmd == MM_CMD::STREAM_FC && pkg.len >= 4){
+        receiveFlowControl(pkg);
+    }
+    else if(cmd == MM_CMD::STREAM_END){
+        MM_StreamRx *slot = findSlot(pkg.meta.source, pkg.meta.port);
+        if(slot != NULL) slot->source = 0;
+        if(_txStatus == STREAM_BUSY && pkg.meta.source == _txTarget && pkg.meta.port == _txPort){
+            _txStatus = STREAM_FAILED;
+        }
+    }
+    else{
+        return false;
+    }
+    return true;
+}
+
+void MM_Transport::receiveStart(MM_Packet &pkg){
+    uint16_t len = ((uint16_t)pkg.data[2] << 8) | pkg.data[3];
+    uint8_t n = pkg.len - 4;
+    if(n > len) n = len;
+
+    //A new start replaces an unfinished stream of the same sender
+    MM_StreamRx *slot = findSlot(pkg.meta.source, pkg.meta.port);
+    if(slot == NULL) slot = findSlot(0, 0);
+
+    if(slot == NULL || len > MM_STREAM_MAX_LEN){
+        #ifdef MM_DEBUG
+            Serial.println("Stream rejected");
+        #endif
+        sendFlowControl(pkg.meta.source, pkg.meta.port, FLOW_OVERFLOW, 0);
+        return;
+    }
+
+    slot->source = pkg.meta.source;
+    slot->port = pkg.meta.port;
+    slot->type = (MM_Stream)pkg.data[1];
+    slot->len = len;
+    slot->received = n;
+    slot->seq = 1;
+    slot->time = millis();
+    for(uint8_t i = 0; i < n; i++) slot->data[i] = pkg.data[4 + i];
+
+    if(slot->received >= slot->len){
+        complete(*slot);
+        return;
+    }
+    slot->blockLeft = MM_STREAM_BLOCK_SIZE;
+    slot->block = 0;
+    sendFlowControl(slot->source, slot->port, FLOW_CONTINUE, slot->block);
+}
+
+void MM_Transport::receiveData(MM_Packet &pkg){
+    MM_StreamRx *slot = findSlot(pkg.meta.source, pkg.meta.port);
+    if(slot == NULL) return;
+
+    if((pkg.data[0] & 0x0F) != slot->seq){
+        //Lost a frame, the stream can't be completed
+        #ifdef MM_DEBUG
+            Serial.println("Stream sequence error");
+        #endif
+        uint8_t data[1] = { MM_CMD::STREAM_END };
+        _controller->Send(MM_MsgType::Streaming, slot->source, slot->port, 1, data);
+        slot->source = 0;
+        return;
+    }
+
+    uint8_t n = pkg.len - 1;
+    if(n > slot->len - slot->received) n = slot->len - slot->received;
+    for(uint8_t i = 0; i < n; i++) slot->data[slot->received + i] = pkg.data[1 + i];
+    slot->received += n;
+    slot->seq = (slot->seq + 1) & 0x0F;
+    slot->time = millis();
+
+    if(slot->received >= slot->len){
+        complete(*slot);
+        return;
+    }
+    if(MM_STREAM_BLOCK_SIZE > 0 && --slot->blockLeft == 0){
+        slot->blockLeft = MM_STREAM_BLOCK_SIZE;
+        sendFlowControl(slot->source, slot->port, FLOW_CONTINUE, ++slot->block);
+    }
+}
+
+void MM_Transport::receiveFlowControl(MM_Packet &pkg){
+    if(_txStatus != STREAM_BUSY || pkg.meta.source != _txTarget || pkg.meta.port != _txPort) return;
+
+    _txTime = millis();
+    switch(pkg.data[1]){
+        case FLOW_CONTINUE:
+            _txWaitFc = false;
+            _txBlockLeft = pkg.data[2];
+            _txStMin = pkg.data[3];
+            break;
+        case FLOW_WAIT:
+            _txWaitFc = true;
+            break;
+        default:
+            _txStatus = STREAM_FAILED;
+            break;
+    }
+}
+
+void MM_Transport::sendFlowControl(uint16_t target, uint8_t port, MM_StreamFlow flow, uint8_t block){
+    uint8_t data[5] = { MM_CMD::STREAM_FC, flow, MM_STREAM_BLOCK_SIZE, MM_STREAM_ST_MIN, block };
+    _controller->Send(MM_MsgType::Streaming, target, port, sizeof(data), data);
+}
+
+MM_StreamRx *MM_Transport::findSlot(uint16_t source, uint8_t port){
+    for(uint8_t i = 0; i < MM_STREAM_RX_SLOTS; i++){
+        if(_rx[i].source == source && (source == 0 || _rx[i].port == port)){
+            return &_rx[i];
+        }
+    }
+    return NULL;
+}
+
+void MM_Transport::complete(MM_StreamRx &slot){
+    if(_handler != NULL){
+        _handler(slot.source, slot.port, slot.type, slot.data, slot.len);
+    }
+    slot.source = 0;
+}
+
+void MM_Transport::loop(){
+    uint32_t now = millis();
+
+    //Drop incoming streams whose sender went silent
+    for(uint8_t i = 0; i < MM_STREAM_RX_SLOTS; i++){
+        if(_rx[i].source != 0 && now - _rx[i].time > MM_STREAM_TIMEOUT){
+            #ifdef MM_DEBUG
+                Serial.println("Stream timeout");
+            #endif
+            _rx[i].source = 0;
+        }
+    }
+
+    if(_txStatus != STREAM_BUSY) return;
+
+    if(_txWaitFc){
+        if(now - _txTime > MM_STREAM_TIMEOUT) _txStatus = STREAM_FAILED;
+        return;
+    }
+
+    for(uint8_t burst = 0; burst < MM_STREAM_BURST; burst++){
+        if(_txStMin > 0 && millis() - _txTime < _txStMin) return;
+
+        uint8_t frame[8];
+        uint8_t n = (_txLen - _txOffset < 7) ? _txLen - _txOffset : 7;
+        frame[0] = MM_CMD::STREAM_DATA | _txSeq;
+        for(uint8_t i = 0; i < n; i++) frame[1 + i] = _txData[_txOffset + i];
+
+        //Interface queue full, try again next loop
+        if(!_controller->Send(MM_MsgType::Streaming, _txTarget, _txPort, 1 + n, frame)) return;
+
+        _txOffset += n;
+        _txSeq = (_txSeq + 1) & 0x0F;
+        _txTime = millis();
+
+        if(_txOffset >= _txLen){
+            _txStatus = STREAM_DONE;
+            return;
+        }
+        if(_txBlockLeft > 0 && --_txBlockLeft == 0){
+            _txWaitFc = true;
+            return;
+        }
+        if(_txStMin > 0) return;
+    }
+}
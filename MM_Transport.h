@@ -0,0 +1,241 @@
+/*
+    MM_Sysbus Transport
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Transport__
+#define __MM_Transport__
+
+#include <Arduino.h>
+#include "MM_Protocol.h"
+
+/**
+ * Because MM_Sysbus has not been defined yet
+ */
+class MM_Sysbus;
+
+//Max length of a stream
+#ifndef MM_STREAM_MAX_LEN
+    #define MM_STREAM_MAX_LEN 128
+#endif
+
+//Number of streams that can be received at the same time
+#ifndef MM_STREAM_RX_SLOTS
+    #define MM_STREAM_RX_SLOTS 1
+#endif
+
+//Consecutive frames the receiver accepts before the next flow control (0 = unlimited)
+#ifndef MM_STREAM_BLOCK_SIZE
+    #define MM_STREAM_BLOCK_SIZE 8
+#endif
+
+//Milliseconds the receiver wants between two consecutive frames
+#ifndef MM_STREAM_ST_MIN
+    #define MM_STREAM_ST_MIN 0
+#endif
+
+//Milliseconds without a frame until a stream is aborted
+#ifndef MM_STREAM_TIMEOUT
+    #define MM_STREAM_TIMEOUT 1000
+#endif
+
+//Max consecutive frames sent per loop() call
+#ifndef MM_STREAM_BURST
+    #define MM_STREAM_BURST 4
+#endif
+
+//Highest port of a stream, MM_CAN has only 4 port bits in Streaming frames
+#define MM_STREAM_MAX_PORT 15
+
+/**
+ * State of the outgoing stream
+ */
+enum MM_StreamStatus {
+    STREAM_IDLE,    //Nothing sent yet
+    STREAM_BUSY,    //Sending
+    STREAM_DONE,    //All data sent
+    STREAM_FAILED,  //Aborted by the receiver or timeout
+};
+
+/**
+ * Reassembly slot of an incoming stream
+ */
+struct MM_StreamRx {
+    /**
+     * Sender of the stream, 0 = free slot
+     */
+    uint16_t source = 0;
+
+    /**
+     * Port of the stream
+     */
+    uint8_t port = 0;
+
+    /**
+     * Type of the stream
+     */
+    MM_Stream type = STREAM_RAW;
+
+    /**
+     * Total length announced in STREAM_START
+     */
+    uint16_t len = 0;
+
+    /**
+     * Bytes received
+     */
+    uint16_t received = 0;
+
+    /**
+     * Expected sequence number of the next consecutive frame
+     */
+    uint8_t seq = 0;
+
+    /**
+     * Consecutive frames left in the current block
+     */
+    uint8_t blockLeft = 0;
+
+    /**
+     * Flow controls sent for this stream, makes every STREAM_FC frame unique
+     */
+    uint8_t block = 0;
+
+    /**
+     * Time(millis()) of the last frame
+     */
+    uint32_t time = 0;
+
+    /**
+     * Received data
+     */
+    uint8_t data[MM_STREAM_MAX_LEN];
+};
+
+/**
+ * Segmented transport over MM_MsgType::Streaming
+ *
+ * Sends and receives up to MM_STREAM_MAX_LEN bytes as a sequence of frames (ISO-TP like):
+ *  STREAM_START  [0xFC][MM_Stream][len high][len low][up to 4 bytes]
+ *  STREAM_DATA   [0x20 | seq][up to 7 bytes], seq counts 1..15, 0..15, ...
+ *  STREAM_FC     [0xFD][MM_StreamFlow][block size][separation time ms][block counter], receiver -> sender
+ *  STREAM_END    [0xFE], abort the stream
+ * The receiver sends a STREAM_FC after STREAM_START and after every block of consecutive frames,
+ * the block counter keeps identical flow controls apart (duplicate cache of routing nodes).
+ */
+class MM_Transport {
+public:
+    /**
+     * Pointer to our Controller
+     */
+    MM_Sysbus *_controller = NULL;
+
+    /**
+     * Start sending a stream
+     * The data is not copied, it must stay valid until status() is no longer STREAM_BUSY
+     * @param target node address
+     * @param port target port, 0-MM_STREAM_MAX_PORT
+     * @param type type of the stream
+     * @param data data to send
+     * @param len length of data (max 65535, the receiver may accept less)
+     * @return false if a stream is already being sent or the port is out of range
+     */
+    bool send(uint16_t target, uint8_t port, MM_Stream type, const uint8_t *data, uint16_t len);
+
+    /**
+     * @return state of the outgoing stream
+     */
+    MM_StreamStatus status();
+
+    /**
+     * Set the function called with every completely received stream
+     * @param function handler, the data is only valid during the call
+     */
+    void attachHandler(void (*function)(uint16_t source, uint8_t port, MM_Stream type, uint8_t *data, uint16_t len));
+
+    /**
+     * Process a received Streaming packet addressed to this node
+     * @param pkg received packet
+     * @return true if the packet was a transport frame
+     */
+    bool process(MM_Packet &pkg);
+
+    /**
+     * Send pending consecutive frames and handle timeouts, called from MM_Sysbus::loop()
+     */
+    void loop();
+
+private:
+    /**
+     * Incoming streams
+     */
+    MM_StreamRx _rx[MM_STREAM_RX_SLOTS];
+
+    /**
+     * Handler for received streams
+     */
+    void (*_handler)(uint16_t source, uint8_t port, MM_Stream type, uint8_t *data, uint16_t len) = NULL;
+
+    /**
+     * Outgoing stream
+     */
+    const uint8_t *_txData = NULL;
+    uint16_t _txLen = 0;
+    uint16_t _txOffset = 0;
+    uint16_t _txTarget = 0;
+    uint8_t _txPort = 0;
+    uint8_t _txSeq = 0;
+    uint8_t _txBlockLeft = 0;
+    uint8_t _txStMin = 0;
+    bool _txWaitFc = false;
+    uint32_t _txTime = 0;
+    MM_StreamStatus _txStatus = STREAM_IDLE;
+
+    /**
+     * Handle STREAM_START
+     */
+    void receiveStart(MM_Packet &pkg);
+
+    /**
+     * Handle STREAM_DATA
+     */
+    void receiveData(MM_Packet &pkg);
+
+    /**
+     * Handle STREAM_FC
+     */
+    void receiveFlowControl(MM_Packet &pkg);
+
+    /**
+     * Send a STREAM_FC to the sender of a stream
+     * @param block block counter of the stream
+     */
+    void sendFlowControl(uint16_t target, uint8_t port, MM_StreamFlow flow, uint8_t block);
+
+    /**
+     * Find the slot of a stream
+     * @return slot, NULL if not found
+     */
+    MM_StreamRx *findSlot(uint16_t source, uint8_t port);
+
+    /**
+     * Deliver a complete stream and free the slot
+     */
+    void complete(MM_StreamRx &slot);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "MM_TxQueue.h"
+
+bool MM_TxQueue::push(const MM_Packet &pkg){
+    if(stats.depth >= TX_QUEUE_SIZE){
+        stats.drops++;
+        return false;
+    }
+    if(stats.depth == 0){
+        _tries = 0;
+        _retryAt = millis();
+    }
+    _pkgs[(_head + stats.depth) % TX_QUEUE_SIZE] = pkg;
+    stats.depth++;
+    if(stats.depth > stats.highWater) stats.highWater = stats.depth;
+    return true;
+}
+
+MM_Packet *MM_TxQueue::front(){
+    if(stats.depth == 0) return NULL;
+    return &_pkgs[_head];
+}
+
+MM_Packet *MM_TxQueue::front(uint8_t &count){
+    count = stats.depth;
+    if(_head + count > TX_QUEUE_SIZE) count = TX_QUEUE_SIZE - _head;
+    return front();
+}
+
+void MM_TxQueue::pop(){
+    if(stats.depth == 0) return;
+    _head = (_head + 1) % TX_QUEUE_SIZE;
+    stats.depth--;
+    stats.sent++;
+    _tries = 0;
+    _retryAt = millis();
+}
+
+void MM_TxQueue::failed(){
+    if(stats.depth == 0) return;
+    _tries++;
+    if(_tries > TX_MAX_RETRIES){
+        //Give up on this packet, the bus seems to be down
+        _head = (_head + 1) % TX_QUEUE_SIZE;
+        stats.depth--;
+        stats.drops++;
+        _tries = 0;
+        _retryAt = millis();
+        return;
+    }
+    stats.retries++;
+    uint32_t backoff = (uint32_t)TX_RETRY_DELAY << (_tries - 1);
+    if(backoff > TX_RETRY_MAX_DELAY) backoff = TX_RETRY_MAX_DELAY;
+    _retryAt = millis() + backoff;
+}
+
+bool MM_TxQueue::empty(){
+    return stats.depth == 0;
+}
+
+bool MM_TxQueue::ready(){
+    return (int32_t)(millis() - _retryAt) >= 0;
+}
+
+void MM_TxQueue::clear(){
+    _head = 0;
+    _tries = 0;
+    stats.depth = 0;
+}
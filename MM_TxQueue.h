@@ -0,0 +1,154 @@
+/*
+    MM_Sysbus TX-Queue
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_TxQueue__
+#define __MM_TxQueue__
+
+#include <Arduino.h>
+#include "MM_Protocol.h"
+
+//Number of packets buffered per interface
+#ifndef TX_QUEUE_SIZE
+    #define TX_QUEUE_SIZE 4
+#endif
+
+//Number of retries before a queued packet is dropped
+#ifndef TX_MAX_RETRIES
+    #define TX_MAX_RETRIES 8
+#endif
+
+//Milliseconds before the first retry, doubled on every further retry
+#ifndef TX_RETRY_DELAY
+    #define TX_RETRY_DELAY 1
+#endif
+
+//Max milliseconds between two retries
+#ifndef TX_RETRY_MAX_DELAY
+    #define TX_RETRY_MAX_DELAY 64
+#endif
+
+/**
+ * TX-Queue counters
+ */
+struct MM_TxStats {
+    /**
+     * Packets currently queued
+     */
+    uint8_t depth = 0;
+
+    /**
+     * Max packets queued at the same time
+     */
+    uint8_t highWater = 0;
+
+    /**
+     * Packets dropped, because the queue was full or the retries were exhausted
+     */
+    uint16_t drops = 0;
+
+    /**
+     * Failed send attempts that were retried
+     */
+    uint16_t retries = 0;
+
+    /**
+     * Packets sent successfully
+     */
+    uint32_t sent = 0;
+};
+
+/**
+ * Bounded TX ring buffer of one interface
+ * Packets the interface can't send right now are queued here and retried
+ * with exponential backoff from MM_Sysbus::loop()
+ */
+class MM_TxQueue {
+public:
+    /**
+     * Queue counters
+     */
+    MM_TxStats stats;
+
+    /**
+     * Append a packet
+     * @param pkg packet to queue
+     * @return false if the queue is full and the packet was dropped
+     */
+    bool push(const MM_Packet &pkg);
+
+    /**
+     * @return the oldest queued packet, NULL if the queue is empty
+     */
+    MM_Packet *front();
+
+    /**
+     * @param count returns the number of queued packets stored in a row from the oldest one
+     * @return the oldest queued packet, NULL if the queue is empty
+     */
+    MM_Packet *front(uint8_t &count);
+
+    /**
+     * Remove the oldest packet after it was sent successfully
+     */
+    void pop();
+
+    /**
+     * The send of the oldest packet failed
+     * Schedules the next retry or drops the packet if the retries are exhausted
+     */
+    void failed();
+
+    /**
+     * @return true if the queue is empty
+     */
+    bool empty();
+
+    /**
+     * @return true if the backoff time of the oldest packet is over
+     */
+    bool ready();
+
+    /**
+     * Drop all queued packets
+     */
+    void clear();
+
+private:
+    /**
+     * Queued packets
+     */
+    MM_Packet _pkgs[TX_QUEUE_SIZE];
+
+    /**
+     * Index of the oldest packet
+     */
+    uint8_t _head = 0;
+
+    /**
+     * Failed attempts of the oldest packet
+     */
+    uint8_t _tries = 0;
+
+    /**
+     * Time(millis()) of the next retry
+     */
+    uint32_t _retryAt = 0;
+};
+
+#endif
@@ -1,185 +1,403 @@
 #include "MM_UART.h"
 
+//Value of an ASCII hex character, 0xFF = no hex character
+static const uint8_t MM_UART_HEX[256] PROGMEM = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+//Max hex digits of the fields: type, target, source, port, len, data
+static const uint8_t MM_UART_DIGITS[] = {1, 4, 3, 2, 1, 2};
+
 MM_UART::MM_UART(Stream &serial) {
     MM_UART::_interface = &serial;
-    MM_UART::_buf[0] = 0;
 }
 
 bool MM_UART::begin() {
     return true;
 }
 
-bool MM_UART::bufShift(uint8_t len) {
-    if(_buf[0] == 0) return false;
-    uint8_t i;
+void MM_UART::setFraming(MM_UARTFraming framing) {
+    _framing = framing;
+    _binaryTx = (framing == MM_UART_BINARY);
+    _batchTx = _binaryTx && MM_UART_BINARY_BATCH > 1;
+}
+
+bool MM_UART::binary() {
+    return _binaryTx;
+}
+
+bool MM_UART::Send(MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data) {
+    uint8_t buf[MM_UART_FRAME_MAX];
+
+    uint8_t n = encode(buf, msgType, target, source, port, len, data);
+    if(n == 0) return false;
+
+    return _interface->write(buf, n) == n;
+}
+
+uint8_t MM_UART::SendBatch(MM_Packet *pkgs, uint8_t count) {
+    uint8_t buf[MM_UART_BATCH_BUFFER];
+    uint8_t used = 0;
+    uint8_t queued = 0;
+    uint8_t sent = 0;
 
-    while (len > 0) {
-        for(i = (_buf[0]-1); i > 0; i--) {
-            _buf[i]     = _buf[(i+1)];
-            _buf[(i+1)] = 0;
+    uint8_t frameMax = _batchTx ? MM_UART_BINARY_BATCH_MAX + 2 : MM_UART_FRAME_MAX;
+
+    for(uint8_t i = 0; i < count; ) {
+        if(used + frameMax > (int)sizeof(buf)) {
+            if(_interface->write(buf, used) != used) return sent;
+            sent += queued;
+            used = 0;
+            queued = 0;
+        }
+        //Packets for one multi-packet frame, the others get a frame of their own
+        uint8_t group = 0;
+        if(_batchTx) {
+            while(group < MM_UART_BINARY_BATCH && i + group < count && batchPacket(pkgs[i + group])) group++;
+        }
+        uint8_t n;
+        if(group > 1) {
+            n = encodeBinaryBatch(&buf[used], &pkgs[i], group);
+        }else{
+            group = 1;
+            n = encode(&buf[used], pkgs[i].meta.type, pkgs[i].meta.target, pkgs[i].meta.source, pkgs[i].meta.port, pkgs[i].len, pkgs[i].data);
         }
-        len--;
-        _buf[0]--;
+        if(n == 0) break;
+        used += n;
+        queued += group;
+        i += group;
     }
+    if(used > 0 && _interface->write(buf, used) == used) {
+        sent += queued;
+    }
+    return sent;
+}
 
-    return true;
+bool MM_UART::batchPacket(const MM_Packet &pkg) {
+    //The short header has no room for empty packets, 11 bit unicast targets and ports of multicasts
+    if(pkg.len == 0 || pkg.len > 8 || pkg.meta.port > 0x1F || pkg.meta.source > 0x7FF) return false;
+    return pkg.meta.type == Multicast ? pkg.meta.port == 0 : pkg.meta.target <= 0x7FF;
 }
 
+uint8_t MM_UART::encode(uint8_t *buf, MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data) {
+    if(len > 8 || port > 0x1F || source > 0x7FF) return 0;
+    if(_binaryTx) return encodeBinary(buf, msgType, target, source, port, len, data);
+    _binarySent = false;
 
-bool MM_UART::bufShift() {
-    if(_buf[0] == 0) return false;
+    uint8_t n = 0;
+    buf[n++] = 0x01;
+    n += putHex(&buf[n], msgType);
+    buf[n++] = 0x1F;
+    n += putHex(&buf[n], target);
+    buf[n++] = 0x1F;
+    n += putHex(&buf[n], source);
+    buf[n++] = 0x1F;
+    n += putHex(&buf[n], port);
+    buf[n++] = 0x1F;
+    n += putHex(&buf[n], len);
 
-    uint8_t i;
+    buf[n++] = 0x02;
+    for(uint8_t i = 0; i < len; i++) {
+        n += putHex(&buf[n], data[i]);
+        buf[n++] = 0x1F;
+    }
+    buf[n++] = 0x04;
+    buf[n++] = '\r';
+    buf[n++] = '\n';
+    return n;
+}
 
-    do {
-        for(i = (_buf[0]-1); i > 0; i--) {
-            _buf[i]     = _buf[(i+1)];
-            _buf[(i+1)] = 0;
-        }
-        _buf[0]--;
-    }while(_buf[1] != 0x01 && _buf[0] > 0);
-    return true;
+uint8_t MM_UART::putHex(uint8_t *buf, uint16_t value) {
+    static const char digits[] = "0123456789ABCDEF";
+    uint8_t n = 0;
+    int8_t shift = 12;
+
+    //Like print(value, HEX): uppercase, without leading zeros
+    while(shift > 0 && ((value >> shift) & 0x0F) == 0) shift -= 4;
+    for(; shift >= 0; shift -= 4) {
+        buf[n++] = digits[(value >> shift) & 0x0F];
+    }
+    return n;
 }
 
-bool MM_UART::Send(MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data) {
-    uint8_t tlen = 0;
-    _interface->write(0x01);
-    _interface->print(msgType,HEX);
-    _interface->write(0x1F);
-    _interface->print(target,HEX);
-    _interface->write(0x1F);
-    _interface->print(source,HEX);
-    _interface->write(0x1F);
-    if(port >= 0) {
-        _interface->print(port,HEX);
-    }else{
-        //Arduino print internally casts to double :(
-        _interface->print(F("FF"));
+bool MM_UART::Receive(MM_Packet &pkg) {
+    //Rest of the last multi-packet frame
+    if(_binPending > 0) {
+        binaryNext(pkg);
+        return true;
     }
-    _interface->write(0x1F);
-    _interface->print(len,HEX);
+    while(_interface->available()) {
+        uint8_t read = _interface->read();
 
-    _interface->write(0x02);
-    if(len > 0) {
-        for(tlen = 0; tlen < len; tlen++) {
-            _interface->print(data[tlen], HEX);
-            _interface->write(0x1F);
+        if(binaryByte(read, pkg)) {
+            _rxState = RX_IDLE;
+            return true;
+        }
+        if(asciiByte(read, pkg)) {
+            _binLen = 0;
+            return true;
         }
     }
-    _interface->write(0x04);
-    _interface->println();
-    return true;
+    return false;
 }
 
-bool MM_UART::Receive(MM_Packet &pkg) {
-    uint8_t read;
-    uint8_t state;
-    uint8_t curwrite;
-    bool retry = false;
-    bool break2 = false;
+bool MM_UART::asciiByte(uint8_t read, MM_Packet &pkg) {
+    if(read == 0x01) {
+        //SOH, (re)start a frame
+        _rxState = RX_TYPE;
+        _rxValue = 0;
+        _rxDigits = 0;
+        _rxCount = 0;
+        return false;
+    }
+    if(_rxState == RX_IDLE) return false;
 
-    if(!_interface->available()) return false;
+    uint8_t hex = pgm_read_byte(&MM_UART_HEX[read]);
+    if(hex != 0xFF) {
+        if(++_rxDigits > MM_UART_DIGITS[_rxState - RX_TYPE]) {
+            _rxState = RX_IDLE;
+            return false;
+        }
+        _rxValue = (_rxValue << 4) | hex;
+        return false;
+    }
 
-    while(_interface->available()) {
-        read = _interface->read();
-
-        if(read == 0x01) bufShift(_buf[0]);
-
-        do {
-            if(_buf[0] == 0) {  //No active RX, ignore everything until SOH
-                if(read == 0x01) {
-                    _buf[0] = 2;
-                    _buf[1] = read;
-                }
-            }else{                
-                _buf[_buf[0]] = read;
-
-                _buf[0]++;
-                if(_buf[(_buf[0]-1)] == 0x04 && _buf[0] >= 10) {
-                    state = 0;
-                    break2 = false;
-                    for(read = 2; read <= _buf[0] && !break2; read++) {
-                        switch(state) {
-                            case 0:
-                                pkg.meta.type = (MM_MsgType)HexToByte(_buf[read]);
-                                state++;
-                                break;
-                            case 1:
-                                if(_buf[read] != 0x1F) {
-                                    retry = bufShift();
-                                    break2 = true;
-                                    break;
-                                }else{
-                                    state++;
-                                }
-                                break;
-                            case 2:
-                                if(_buf[read] == 0x1F) {
-                                    state++;
-                                }else{
-                                    pkg.meta.target <<=4;
-                                    pkg.meta.target |= HexToByte(_buf[read]);
-                                }
-                                break;
-                            case 3:
-                                if(_buf[read] == 0x1F) {
-                                    state++;
-                                    pkg.meta.port = 0;
-                                }else{
-                                    pkg.meta.source <<=4;
-                                    pkg.meta.source |= HexToByte(_buf[read]);
-                                }
-                                break;
-                            case 4:
-                                if(_buf[read] == 0x1F) {
-                                    state++;
-                                }else{
-                                    pkg.meta.port <<=4;
-                                    pkg.meta.port |= HexToByte(_buf[read]);
-                                }
-                                break;
-                            case 5:
-                                pkg.len = HexToByte(_buf[read]);
-                                state++;
-                                break;
-                            case 6:
-                                if(_buf[read] != 0x02) {
-                                    retry = bufShift();
-                                    break2 = true;
-                                    break;
-                                }else{
-                                    curwrite=0;
-                                    state++;
-                                }
-                                break;
-                            case 7:
-                                if(_buf[read] == 0x1F) {
-                                    curwrite++;
-                                    pkg.data[curwrite] = 0;
-                                }else if(_buf[read] == 0x04) {
-                                    state++;
-                                }else{
-                                    pkg.data[curwrite] <<=4;
-                                    pkg.data[curwrite] |= HexToByte(_buf[read]);
-                                }
-                                break;
-                            case 8:
-                                bufShift(read);
-                                return true;
-                        }
-                    }
-                }else if(_buf[0] > 35) {
-                    retry = bufShift();
-                }
+    switch(_rxState) {
+        case RX_TYPE:
+        case RX_TARGET:
+        case RX_SOURCE:
+        case RX_PORT:
+            if(read != 0x1F || _rxDigits == 0) break;
+            if(_rxState == RX_TYPE) _rx.meta.type = (MM_MsgType)(_rxValue & 0x03);
+            else if(_rxState == RX_TARGET) _rx.meta.target = _rxValue;
+            else if(_rxState == RX_SOURCE) _rx.meta.source = _rxValue;
+            else _rx.meta.port = _rxValue;
+            _rxState++;
+            _rxValue = 0;
+            _rxDigits = 0;
+            return false;
+        case RX_LEN:
+            if(read != 0x02 || _rxDigits == 0 || _rxValue > 8) break;
+            _rx.len = _rxValue;
+            _rxState = RX_DATA;
+            _rxValue = 0;
+            _rxDigits = 0;
+            return false;
+        case RX_DATA:
+            if(read == 0x1F && _rxDigits > 0 && _rxCount < _rx.len) {
+                _rx.data[_rxCount++] = _rxValue;
+                _rxValue = 0;
+                _rxDigits = 0;
+                return false;
+            }
+            if(read == 0x04 && _rxDigits == 0 && _rxCount == _rx.len) {
+                _rxState = RX_IDLE;
+                pkg.meta.type = _rx.meta.type;
+                pkg.meta.target = _rx.meta.target;
+                pkg.meta.source = _rx.meta.source;
+                pkg.meta.port = _rx.meta.port;
+                pkg.len = _rx.len;
+                for(uint8_t i = 0; i < _rxCount; i++) pkg.data[i] = _rx.data[i];
+                return true;
             }
-        }while(retry);
+            break;
     }
+
+    //Unexpected character, wait for the next SOH
+    _rxState = RX_IDLE;
     return false;
 }
 
 uint8_t MM_UART::HexToByte(uint8_t hex) {
-    if(hex >= '0' && hex <= '9') return hex-'0';
-    if(hex >= 'a' && hex <= 'f') return hex-'a'+10;
-    if(hex >= 'A' && hex <= 'F') return hex-'A'+10;
-    return 0;
-}
\ No newline at end of file
+    uint8_t value = pgm_read_byte(&MM_UART_HEX[hex]);
+    return value == 0xFF ? 0 : value;
+}
+
+uint8_t MM_UART::encodeBinary(uint8_t *buf, MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data) {
+    uint8_t raw[MM_UART_BINARY_MAX - 1];
+    uint8_t n = 0;
+
+    raw[n++] = (MM_UART_BINARY_VERSION << 6) | ((msgType & 0x03) << 4) | len;
+    raw[n++] = (port << 3) | ((source >> 8) & 0x07);
+    raw[n++] = lowByte(source);
+    raw[n++] = highByte(target);
+    raw[n++] = lowByte(target);
+    for(uint8_t i = 0; i < len; i++) raw[n++] = data[i];
+
+    uint16_t crc = MM_CRC16_INIT;
+    for(uint8_t i = 0; i < n; i++) crc = MM_CRC16(crc, raw[i]);
+    raw[n++] = highByte(crc);
+    raw[n++] = lowByte(crc);
+
+    uint8_t olen = 0;
+    if(!_binarySent) {
+        //Terminate whatever ASCII the peer has in its binary buffer
+        buf[olen++] = 0x00;
+        _binarySent = true;
+    }
+    olen += cobsEncode(raw, n, &buf[olen]);
+    buf[olen++] = 0x00;
+    return olen;
+}
+
+uint8_t MM_UART::encodeBinaryBatch(uint8_t *buf, MM_Packet *pkgs, uint8_t count) {
+    uint8_t raw[MM_UART_BINARY_BATCH_MAX - 1];
+    uint8_t n = 0;
+
+    raw[n++] = (MM_UART_BINARY_VERSION_BATCH << 6) | count;
+    for(uint8_t p = 0; p < count; p++) {
+        MM_Packet &pkg = pkgs[p];
+        //len - 1, type and the 27 bit address of the CAN ID: port, 11 bit target or 16 bit multicast target, source
+        uint32_t header = ((uint32_t)(pkg.len - 1) << 29) | ((uint32_t)(pkg.meta.type & 0x03) << 27) | pkg.meta.source;
+        if(pkg.meta.type == Multicast) {
+            header |= (uint32_t)pkg.meta.target << 11;
+        }else{
+            header |= ((uint32_t)pkg.meta.port << 22) | ((uint32_t)pkg.meta.target << 11);
+        }
+        raw[n++] = header >> 24;
+        raw[n++] = header >> 16;
+        raw[n++] = header >> 8;
+        raw[n++] = header;
+        for(uint8_t i = 0; i < pkg.len; i++) raw[n++] = pkg.data[i];
+    }
+
+    uint16_t crc = MM_CRC16_INIT;
+    for(uint8_t i = 0; i < n; i++) crc = MM_CRC16(crc, raw[i]);
+    raw[n++] = highByte(crc);
+    raw[n++] = lowByte(crc);
+
+    uint8_t olen = 0;
+    if(!_binarySent) {
+        buf[olen++] = 0x00;
+        _binarySent = true;
+    }
+    olen += cobsEncode(raw, n, &buf[olen]);
+    buf[olen++] = 0x00;
+    return olen;
+}
+
+void MM_UART::binaryNext(MM_Packet &pkg) {
+    _binPending--;
+    if((_bin[0] >> 6) == MM_UART_BINARY_VERSION) {
+        pkg.meta.type = (MM_MsgType)((_bin[0] >> 4) & 0x03);
+        pkg.meta.port = _bin[1] >> 3;
+        pkg.meta.source = ((uint16_t)(_bin[1] & 0x07) << 8) | _bin[2];
+        pkg.meta.target = ((uint16_t)_bin[3] << 8) | _bin[4];
+        pkg.len = _bin[0] & 0x0F;
+        for(uint8_t i = 0; i < pkg.len; i++) pkg.data[i] = _bin[5 + i];
+        return;
+    }
+
+    uint8_t *p = &_bin[_binNext];
+    uint32_t header = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint16_t)p[2] << 8) | p[3];
+    pkg.meta.type = (MM_MsgType)((header >> 27) & 0x03);
+    pkg.meta.source = header & 0x7FF;
+    if(pkg.meta.type == Multicast) {
+        pkg.meta.port = 0;
+        pkg.meta.target = (header >> 11) & 0xFFFF;
+    }else{
+        pkg.meta.port = (header >> 22) & 0x1F;
+        pkg.meta.target = (header >> 11) & 0x7FF;
+    }
+    pkg.len = (header >> 29) + 1;
+    for(uint8_t i = 0; i < pkg.len; i++) pkg.data[i] = p[4 + i];
+    _binNext += 4 + pkg.len;
+}
+
+bool MM_UART::binaryByte(uint8_t read, MM_Packet &pkg) {
+    if(read != 0x00) {
+        if(_binLen < MM_UART_BINARY_RX) {
+            _bin[_binLen++] = read;
+        }else{
+            _binLen = 0xFF;
+        }
+        return false;
+    }
+
+    //Delimiter, decode the frame
+    uint8_t encoded = _binLen;
+    _binLen = 0;
+    if(encoded == 0 || encoded > MM_UART_BINARY_RX) return false;
+
+    uint8_t n = cobsDecode(_bin, encoded, _bin);
+    if(n < 7) return false;
+
+    uint16_t crc = MM_CRC16_INIT;
+    for(uint8_t i = 0; i < n - 2; i++) crc = MM_CRC16(crc, _bin[i]);
+    if(highByte(crc) != _bin[n - 2] || lowByte(crc) != _bin[n - 1]) return false;
+
+    uint8_t version = _bin[0] >> 6;
+    if(version == MM_UART_BINARY_VERSION) {
+        uint8_t len = _bin[0] & 0x0F;
+        if(len > 8 || n != 7 + len) return false;
+        _binPending = 1;
+    }
+    else if(version == MM_UART_BINARY_VERSION_BATCH) {
+        //Every packet must end inside the frame and the last one right before the CRC
+        uint8_t count = _bin[0] & 0x3F;
+        uint8_t end = 1;
+        for(uint8_t p = 0; p < count; p++) {
+            if(end + 4 > n - 2) return false;
+            end += 4 + (_bin[end] >> 5) + 1;
+        }
+        if(count == 0 || end != n - 2) return false;
+        _binNext = 1;
+        _binPending = count;
+        if(_framing == MM_UART_AUTO && MM_UART_BINARY_BATCH > 1) _batchTx = true;
+    }
+    else{
+        return false;
+    }
+    binaryNext(pkg);
+
+    //The peer speaks binary
+    if(_framing == MM_UART_AUTO) _binaryTx = true;
+    return true;
+}
+
+uint8_t MM_UART::cobsEncode(const uint8_t *in, uint8_t len, uint8_t *out) {
+    uint8_t codePos = 0;
+    uint8_t code = 1;
+    uint8_t o = 1;
+
+    for(uint8_t i = 0; i < len; i++) {
+        if(in[i] == 0x00) {
+            out[codePos] = code;
+            codePos = o++;
+            code = 1;
+        }else{
+            out[o++] = in[i];
+            code++;
+        }
+    }
+    out[codePos] = code;
+    return o;
+}
+
+uint8_t MM_UART::cobsDecode(const uint8_t *in, uint8_t len, uint8_t *out) {
+    uint8_t i = 0;
+    uint8_t o = 0;
+
+    while(i < len) {
+        uint8_t code = in[i++];
+        if(code == 0x00 || i + code - 1 > len) return 0;
+        for(uint8_t j = 1; j < code; j++) out[o++] = in[i++];
+        if(code < 0xFF && i < len) out[o++] = 0x00;
+    }
+    return o;
+}
@@ -22,6 +22,56 @@
 #include <Arduino.h>
 #include <MM_Sysbus.h>
 #include "Stream.h"
+#include "MM_CRC.h"
+
+//Version of the binary framing, sent in every binary frame
+#define MM_UART_BINARY_VERSION 1
+
+//Version of a binary frame that carries several packets
+#define MM_UART_BINARY_VERSION_BATCH 2
+
+//Max length of a COBS encoded binary frame (5 byte header, 8 data, 2 crc, 1 COBS overhead)
+#define MM_UART_BINARY_MAX 16
+
+//Packets SendBatch() packs into one binary frame, 1 = one packet per frame
+#ifndef MM_UART_BINARY_BATCH
+    #define MM_UART_BINARY_BATCH 6
+#endif
+
+#if MM_UART_BINARY_BATCH < 1 || MM_UART_BINARY_BATCH > 20
+    #error "MM_UART_BINARY_BATCH must be 1 to 20 (a COBS block holds 254 bytes)"
+#endif
+
+//Max length of a COBS encoded multi-packet frame (count, 4 byte header and 8 data per packet, 2 crc, 1 COBS overhead)
+#define MM_UART_BINARY_BATCH_MAX (1 + MM_UART_BINARY_BATCH * 12 + 2 + 1)
+
+//Receive buffer of the binary decoder
+#if MM_UART_BINARY_BATCH > 1
+    #define MM_UART_BINARY_RX MM_UART_BINARY_BATCH_MAX
+#else
+    #define MM_UART_BINARY_RX MM_UART_BINARY_MAX
+#endif
+
+//Max length of an ASCII frame (SOH, 5 fields with separators, STX, 8 data bytes with separators, EOT, CR, LF)
+#define MM_UART_FRAME_MAX 44
+
+//Size of the stack buffer SendBatch() packs frames into before one write
+#ifndef MM_UART_BATCH_BUFFER
+    #define MM_UART_BATCH_BUFFER 128
+#endif
+
+#if MM_UART_BATCH_BUFFER < MM_UART_BINARY_BATCH_MAX + 2
+    #error "MM_UART_BATCH_BUFFER must hold a multi-packet frame with its delimiters"
+#endif
+
+/**
+ * Framing used on the serial line
+ */
+enum MM_UARTFraming {
+    MM_UART_ASCII,  //ASCII hex frames (default, compatible to older nodes)
+    MM_UART_BINARY, //COBS encoded binary frames with CRC-16
+    MM_UART_AUTO,   //Send ASCII until the peer sends a valid binary frame, then binary
+};
 
 /**
  * UART Communication Interface
@@ -36,21 +86,140 @@ class MM_UART : public MM_Interface {
         Stream *_interface;
 
         /**
-         * Incoming data buffer
+         * States of the ASCII parser, one per field of the frame
+         */
+        enum {
+            RX_IDLE,    //Wait for SOH
+            RX_TYPE,
+            RX_TARGET,
+            RX_SOURCE,
+            RX_PORT,
+            RX_LEN,
+            RX_DATA,
+        };
+
+        /**
+         * Current field of the ASCII parser
+         */
+        uint8_t _rxState = RX_IDLE;
+
+        /**
+         * Value of the current field
+         */
+        uint16_t _rxValue = 0;
+
+        /**
+         * Hex digits of the current field
+         */
+        uint8_t _rxDigits = 0;
+
+        /**
+         * Data bytes received
+         */
+        uint8_t _rxCount = 0;
+
+        /**
+         * Packet under construction
+         */
+        MM_Packet _rx;
+
+        /**
+         * Feed a received byte to the ASCII parser
+         * Every byte is looked at once, no buffer is shifted or parsed again.
+         * @param read received byte
+         * @param pkg Packet-Reference to store a completed packet
+         * @return true if a frame was completed
+         */
+        bool asciiByte(uint8_t read, MM_Packet &pkg);
+
+        /**
+         * Framing selected with setFraming()
+         */
+        MM_UARTFraming _framing = MM_UART_ASCII;
+
+        /**
+         * Send binary frames (MM_UART_BINARY or negotiated in MM_UART_AUTO)
+         */
+        bool _binaryTx = false;
+
+        /**
+         * SendBatch() packs several packets into one binary frame (MM_UART_BINARY, or the peer sent one)
+         */
+        bool _batchTx = false;
+
+        /**
+         * The last frame sent was binary, otherwise the next binary frame starts with a delimiter
          */
-        uint8_t _buf[35];
+        bool _binarySent = false;
 
         /**
-         * Search for next start byte and shift buffer
-         * @return byte start byte found
+         * Incoming binary frame (COBS encoded, up to the 0x00 delimiter), decoded in place
          */
-        bool bufShift();
+        uint8_t _bin[MM_UART_BINARY_RX];
 
         /**
-         * Remove len bytes from the buffer
-         * @return byte start byte found
+         * Packets of a decoded multi-packet frame not returned by Receive() yet
          */
-        bool bufShift(byte len);
+        uint8_t _binPending = 0;
+
+        /**
+         * Offset of the next pending packet in _bin
+         */
+        uint8_t _binNext = 0;
+
+        /**
+         * Bytes in _bin, 0xFF = frame too long, skip until the next delimiter
+         */
+        uint8_t _binLen = 0;
+
+        /**
+         * Feed a received byte to the binary decoder
+         * @param read received byte
+         * @param pkg Packet-Reference to store a completed packet
+         * @return true if a valid binary frame was completed
+         */
+        bool binaryByte(uint8_t read, MM_Packet &pkg);
+
+        /**
+         * Take the next packet of the decoded binary frame
+         * @param pkg Packet-Reference to store the packet
+         */
+        void binaryNext(MM_Packet &pkg);
+
+        /**
+         * Assemble a complete frame in the selected framing
+         * @param buf buffer for the frame, at least MM_UART_FRAME_MAX bytes
+         * @return length of the frame, 0 on errors
+         */
+        uint8_t encode(uint8_t *buf, MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data);
+
+        /**
+         * Assemble a binary frame (including a leading delimiter after ASCII frames)
+         * @param buf buffer for the frame, at least MM_UART_BINARY_MAX + 2 bytes
+         * @return length of the frame, 0 on errors
+         */
+        uint8_t encodeBinary(uint8_t *buf, MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data);
+
+        /**
+         * Assemble a multi-packet binary frame (including a leading delimiter after ASCII frames)
+         * @param buf buffer for the frame, at least MM_UART_BINARY_BATCH_MAX + 2 bytes
+         * @param count packets, 2 to MM_UART_BINARY_BATCH, all valid
+         * @return length of the frame
+         */
+        uint8_t encodeBinaryBatch(uint8_t *buf, MM_Packet *pkgs, uint8_t count);
+
+        /**
+         * @return true if the packet fits the short header of a multi-packet frame
+         *         (1-8 data bytes, the address fits a CAN ID)
+         */
+        static bool batchPacket(const MM_Packet &pkg);
+
+        /**
+         * Write a value as uppercase hex without leading zeros (like print(value, HEX))
+         * @param buf buffer, at least 4 bytes
+         * @return number of characters written
+         */
+        static uint8_t putHex(uint8_t *buf, uint16_t value);
 
     public:
         /**
@@ -59,6 +228,29 @@ class MM_UART : public MM_Interface {
          */
         MM_UART(Stream &serial);
 
+        /**
+         * Select the framing
+         *
+         * ASCII: every field as hex text, about 45 bytes per 8 byte frame
+         * BINARY: 5 byte header (version, type, len, port, source, target), data and CRC-16,
+         *         COBS encoded and terminated by 0x00, 17 bytes per 8 byte frame.
+         *         SendBatch() packs up to MM_UART_BINARY_BATCH packets into one frame
+         *         (version 2: count byte, then per packet a 4 byte header with len - 1, type and
+         *         the 27 bit address of the CAN ID and the data, one CRC-16 at the end),
+         *         12.8 bytes per 8 byte frame with 6 packets per frame
+         * AUTO: like ASCII, but switches to binary when a binary frame is received,
+         *       and to multi-packet frames when the peer sends one
+         *
+         * Both framings are always accepted on receive.
+         * @param framing MM_UART_ASCII, MM_UART_BINARY or MM_UART_AUTO
+         */
+        void setFraming(MM_UARTFraming framing);
+
+        /**
+         * @return true if frames are sent binary
+         */
+        bool binary();
+
         /**
          * Initialize UART, just a dummy
          * @return byte error code, always 0/success
@@ -67,6 +259,7 @@ class MM_UART : public MM_Interface {
 
         /**
          * Send message to UART-bus
+         * The frame is assembled in a stack buffer and written with a single write()
          * @param type 2 bit message type (MM_PKGTYPE_*)
          * @param target address between 0x0001 and 0x07FF/0xFFFF
          * @param source source address between 0x0001 and 0x07FF
@@ -76,6 +269,14 @@ class MM_UART : public MM_Interface {
          */
         bool Send(MM_MsgType msgType, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data);
 
+        /**
+         * Send several packets with as few write() calls as possible
+         * The frames are packed into a MM_UART_BATCH_BUFFER byte stack buffer,
+         * binary frames carry up to MM_UART_BINARY_BATCH packets each (see setFraming())
+         * @see MM_Interface::SendBatch
+         */
+        uint8_t SendBatch(MM_Packet *pkgs, uint8_t count);
+
         /**
          * Receive a message from the UART-bus
          *
@@ -92,12 +293,30 @@ class MM_UART : public MM_Interface {
          * Convert ASCII hex to byte
          *
          * This will convert the characters 0-9, A-F and a-f to an
-         * byte-value between 0 and 15. Other inputs will return 0
+         * byte-value between 0 and 15 (lookup table). Other inputs will return 0
          *
          * @param byte single ASCII hex character
          * @return corresponding numeric byte value
          */
         uint8_t HexToByte(uint8_t hex);
+
+        /**
+         * COBS encode a buffer (max 253 bytes)
+         * @param in data to encode
+         * @param len length of data
+         * @param out buffer for the encoded data, len + 1 bytes
+         * @return length of the encoded data
+         */
+        static uint8_t cobsEncode(const uint8_t *in, uint8_t len, uint8_t *out);
+
+        /**
+         * COBS decode a buffer (without the 0x00 delimiter)
+         * @param in encoded data
+         * @param len length of the encoded data
+         * @param out buffer for the decoded data, may be in
+         * @return length of the decoded data, 0 on errors
+         */
+        static uint8_t cobsDecode(const uint8_t *in, uint8_t len, uint8_t *out);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+/*
+    MM_Sysbus Host HAL - Arduino core subset for Linux builds
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Host_Arduino__
+#define __MM_Host_Arduino__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define F(string_literal) (string_literal)
+
+#define highByte(w) ((uint8_t) ((w) >> 8))
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) (p)
+
+//There are no real interrupts on the host, ISRs are called synchronously (see MM_HostPins)
+#define noInterrupts()
+#define interrupts()
+
+/**
+ * Time since start, backed by MM_HostClock
+ * Both wrap around at 32 bit like on the target
+ */
+unsigned long millis();
+unsigned long micros();
+
+/**
+ * Advance the virtual clock (or sleep with MM_HostClock::setRealtime(true))
+ */
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/**
+ * Pins, backed by MM_HostPins
+ */
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
+void detachInterrupt(uint8_t interruptNum);
+
+#include "Stream.h"
+#include "MM_Host.h"
+
+/**
+ * Serial monitor, echoes to stdout
+ */
+extern MM_HostStream Serial;
+
+#endif
@@ -0,0 +1,129 @@
+/*
+    MM_Sysbus Host HAL - RAM backed EEPROM
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Host_EEPROM__
+#define __MM_Host_EEPROM__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Size of the emulated EEPROM (ATmega328P)
+#ifndef MM_HOST_EEPROM_SIZE
+    #define MM_HOST_EEPROM_SIZE 1024
+#endif
+
+//Microseconds a byte write blocks (AVR: 3.4ms), advances the virtual clock
+#ifndef MM_HOST_EEPROM_WRITE_US
+    #define MM_HOST_EEPROM_WRITE_US 3400
+#endif
+
+//No write limit, see EEPROMClass::setWriteLimit()
+#define MM_HOST_EEPROM_NO_LIMIT 0xFFFFFFFFUL
+
+/**
+ * EEPROM emulation in RAM
+ * Erased cells read 0xFF. Every write costs the write latency on the clock
+ * and is counted per cell, so tests can check timing and wear.
+ * The cells are allocated on first use, so global MM_Sysbus objects can use
+ * the EEPROM in their constructors regardless of the initialization order.
+ */
+class EEPROMClass {
+public:
+    uint8_t read(int idx);
+    void write(int idx, uint8_t val);
+    void update(int idx, uint8_t val);
+    uint16_t length();
+
+    template <typename T> T &get(int idx, T &t){
+        uint8_t *p = (uint8_t*)&t;
+        for(unsigned int i = 0; i < sizeof(T); i++){
+            p[i] = read(idx + i);
+        }
+        return t;
+    }
+
+    template <typename T> const T &put(int idx, const T &t){
+        const uint8_t *p = (const uint8_t*)&t;
+        for(unsigned int i = 0; i < sizeof(T); i++){
+            update(idx + i, p[i]);
+        }
+        return t;
+    }
+
+    /**
+     * Resize and erase the EEPROM
+     * @param size bytes
+     */
+    void setSize(uint16_t size);
+
+    /**
+     * Fill every cell with 0xFF and clear the statistics
+     */
+    void erase();
+
+    /**
+     * Set the time a byte write blocks
+     * @param us microseconds, 0 = writes are free
+     */
+    void setWriteLatency(uint32_t us);
+
+    /**
+     * Simulate a power loss: only the next count writes reach the cells, later ones are lost
+     * @param count writes, MM_HOST_EEPROM_NO_LIMIT = all writes are stored again
+     */
+    void setWriteLimit(uint32_t count);
+
+    /**
+     * Number of writes of a cell
+     */
+    uint32_t writeCount(uint16_t idx);
+
+    /**
+     * Highest write count of all cells
+     */
+    uint32_t maxWriteCount();
+
+    /**
+     * Total number of byte writes
+     */
+    uint32_t writes();
+
+    /**
+     * Direct access to the cells (e.g. to save or load an image)
+     * @return length() bytes
+     */
+    uint8_t *data();
+
+private:
+    /**
+     * Allocate the cells on first use
+     */
+    void ensure();
+
+    uint8_t *_data = NULL;
+    uint32_t *_wear = NULL;
+    uint16_t _size = MM_HOST_EEPROM_SIZE;
+    uint32_t _writes = 0;
+    uint32_t _latency = MM_HOST_EEPROM_WRITE_US;
+    uint32_t _writeLimit = MM_HOST_EEPROM_NO_LIMIT;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
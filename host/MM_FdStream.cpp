@@ -0,0 +1,153 @@
+#include "MM_FdStream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+MM_FdStream::MM_FdStream(int fd){
+    _fd = fd;
+    if(_fd >= 0){
+        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+    }
+}
+
+MM_FdStream::~MM_FdStream(){
+    if(_fd >= 0) close(_fd);
+}
+
+int MM_FdStream::fill(){
+    if(_closed) return -1;
+
+    //Keep unread bytes, make room behind them
+    if(_rxPos > 0){
+        memmove(_rx, _rx + _rxPos, _rxLen - _rxPos);
+        _rxLen -= _rxPos;
+        _rxPos = 0;
+    }
+    if(_rxLen == sizeof(_rx)) return 0;
+
+    ssize_t n = ::read(_fd, _rx + _rxLen, sizeof(_rx) - _rxLen);
+    if(n > 0){
+        _rxLen += n;
+        rxBytes += n;
+        return n;
+    }
+    if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+        //A pty without a peer returns EIO
+        _closed = true;
+        return -1;
+    }
+    return 0;
+}
+
+int MM_FdStream::available(){
+    if(_rxPos == _rxLen) fill();
+    return _rxLen - _rxPos;
+}
+
+int MM_FdStream::read(){
+    if(available() == 0) return -1;
+    return _rx[_rxPos++];
+}
+
+int MM_FdStream::peek(){
+    if(available() == 0) return -1;
+    return _rx[_rxPos];
+}
+
+size_t MM_FdStream::write(uint8_t b){
+    return write(&b, 1);
+}
+
+size_t MM_FdStream::write(const uint8_t *buffer, size_t size){
+    if(_closed) return 0;
+
+    //Compact the buffer if the data doesn't fit behind the pending bytes
+    if(_txLen + size > sizeof(_tx)) flush();
+    if(_txLen + size > sizeof(_tx) && _txPos > 0){
+        memmove(_tx, _tx + _txPos, _txLen - _txPos);
+        _txLen -= _txPos;
+        _txPos = 0;
+    }
+    if(_txLen + size > sizeof(_tx)){
+        txFull++;
+        return 0;
+    }
+    memcpy(_tx + _txLen, buffer, size);
+    _txLen += size;
+    return size;
+}
+
+int MM_FdStream::availableForWrite(){
+    return sizeof(_tx) - (_txLen - _txPos);
+}
+
+void MM_FdStream::flush(){
+    while(_txPos < _txLen && !_closed){
+        ssize_t n = ::write(_fd, _tx + _txPos, _txLen - _txPos);
+        if(n > 0){
+            _txPos += n;
+            txBytes += n;
+            continue;
+        }
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
+            _closed = true;
+        }
+        break;
+    }
+    if(_txPos == _txLen){
+        _txPos = 0;
+        _txLen = 0;
+    }
+}
+
+bool MM_FdStream::wantsWrite(){
+    return _txPos < _txLen;
+}
+
+bool MM_FdStream::closed(){
+    return _closed;
+}
+
+int MM_FdStream::fd(){
+    return _fd;
+}
+
+int MM_FdStream::openSerial(const char *path, uint32_t baud){
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0) return -1;
+
+    struct termios tio;
+    if(tcgetattr(fd, &tio) == 0){
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        //VMIN 0 would make read() return 0 (EOF) instead of EAGAIN
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+
+        speed_t speed = 0;
+        switch(baud){
+            case 9600: speed = B9600; break;
+            case 19200: speed = B19200; break;
+            case 38400: speed = B38400; break;
+            case 57600: speed = B57600; break;
+            case 115200: speed = B115200; break;
+            case 230400: speed = B230400; break;
+            case 460800: speed = B460800; break;
+            case 500000: speed = B500000; break;
+            case 921600: speed = B921600; break;
+            case 1000000: speed = B1000000; break;
+        }
+        if(baud != 0 && speed == 0){
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        if(speed != 0) cfsetspeed(&tio, speed);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
@@ -0,0 +1,122 @@
+/*
+    MM_Sysbus Stream over a file descriptor (Linux)
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_FdStream__
+#define __MM_FdStream__
+
+#include <Arduino.h>
+
+//Bytes read with one read() call
+#ifndef MM_FDSTREAM_RX_SIZE
+    #define MM_FDSTREAM_RX_SIZE 4096
+#endif
+
+//Bytes that can wait for the descriptor to get writable, writes that don't fit fail
+#ifndef MM_FDSTREAM_TX_SIZE
+    #define MM_FDSTREAM_TX_SIZE 16384
+#endif
+
+/**
+ * Stream over a non-blocking file descriptor (serial TTY, pty, Unix or TCP socket),
+ * e.g. for MM_UART on Linux
+ *
+ * Reads fill a buffer with one read() call. Written data is only buffered, the owner calls
+ * flush() once per round so many frames go out with one write() call. A write that doesn't
+ * fit into the buffer fails as a whole, so frames are never cut and MM_Sysbus queues and
+ * retries the packet.
+ */
+class MM_FdStream : public Stream {
+public:
+    /**
+     * @param fd descriptor, set to non-blocking, closed by the destructor
+     */
+    MM_FdStream(int fd);
+    ~MM_FdStream();
+
+    /**
+     * Buffered bytes, reads the descriptor if the buffer is empty
+     */
+    int available();
+    int read();
+    int peek();
+
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    int availableForWrite();
+
+    /**
+     * Write buffered data to the descriptor, as far as it takes it
+     */
+    void flush();
+
+    /**
+     * Read once from the descriptor into the buffer
+     * @return bytes read, 0 if nothing is waiting, -1 if the descriptor was closed or failed
+     */
+    int fill();
+
+    /**
+     * true if written data waits for the descriptor to get writable (EPOLLOUT)
+     */
+    bool wantsWrite();
+
+    /**
+     * true after end of file or an error, the descriptor should be closed
+     */
+    bool closed();
+
+    /**
+     * Descriptor
+     */
+    int fd();
+
+    /**
+     * Bytes read from / written to the descriptor
+     */
+    uint64_t rxBytes = 0;
+    uint64_t txBytes = 0;
+
+    /**
+     * Writes rejected because the buffer was full
+     */
+    uint32_t txFull = 0;
+
+    /**
+     * Open a serial port in raw mode
+     * @param path device, e.g. /dev/ttyUSB0 or a pty
+     * @param baud baudrate, 0 = don't change
+     * @return descriptor, -1 on errors
+     */
+    static int openSerial(const char *path, uint32_t baud);
+
+private:
+    int _fd;
+    bool _closed = false;
+
+    uint8_t _rx[MM_FDSTREAM_RX_SIZE];
+    uint16_t _rxPos = 0;
+    uint16_t _rxLen = 0;
+
+    uint8_t _tx[MM_FDSTREAM_TX_SIZE];
+    uint16_t _txPos = 0;
+    uint16_t _txLen = 0;
+};
+
+#endif
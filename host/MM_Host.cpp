@@ -0,0 +1,400 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <SPI.h>
+#include <avr/wdt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//-----------Clock---------------------
+
+uint64_t MM_HostClock::_now = 0;
+uint64_t MM_HostClock::_offset = 0;
+bool MM_HostClock::_realtime = false;
+
+static uint64_t monotonicMicros(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+uint64_t MM_HostClock::now(){
+    if(_realtime) return monotonicMicros() - _offset;
+    return _now;
+}
+
+void MM_HostClock::set(uint64_t us){
+    if(_realtime){
+        _offset = monotonicMicros() - us;
+    }
+    _now = us;
+}
+
+void MM_HostClock::advance(uint64_t us){
+    if(_realtime){
+        struct timespec ts;
+        ts.tv_sec = us / 1000000ULL;
+        ts.tv_nsec = (us % 1000000ULL) * 1000;
+        nanosleep(&ts, NULL);
+        return;
+    }
+    _now += us;
+}
+
+void MM_HostClock::setRealtime(bool realtime){
+    if(realtime == _realtime) return;
+    if(realtime){
+        _offset = monotonicMicros() - _now;
+    }
+    else{
+        _now = monotonicMicros() - _offset;
+    }
+    _realtime = realtime;
+}
+
+bool MM_HostClock::realtime(){
+    return _realtime;
+}
+
+unsigned long millis(){
+    return (uint32_t)(MM_HostClock::now() / 1000);
+}
+
+unsigned long micros(){
+    return (uint32_t)MM_HostClock::now();
+}
+
+void delay(unsigned long ms){
+    MM_HostClock::advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us){
+    MM_HostClock::advance(us);
+}
+
+//-----------Pins---------------------
+
+uint8_t MM_HostPins::_level[MM_HOST_PINS];
+uint8_t MM_HostPins::_mode[MM_HOST_PINS];
+void (*MM_HostPins::_isr[MM_HOST_PINS])(void);
+int MM_HostPins::_isrMode[MM_HOST_PINS];
+
+void MM_HostPins::set(uint8_t pin, uint8_t value){
+    if(pin >= MM_HOST_PINS) return;
+    value = value ? HIGH : LOW;
+    uint8_t old = _level[pin];
+    _level[pin] = value;
+    if(_isr[pin] == NULL || old == value) return;
+
+    if(_isrMode[pin] == CHANGE
+        || (_isrMode[pin] == RISING && value == HIGH)
+        || (_isrMode[pin] == FALLING && value == LOW)){
+        _isr[pin]();
+    }
+}
+
+uint8_t MM_HostPins::get(uint8_t pin){
+    if(pin >= MM_HOST_PINS) return LOW;
+    return _level[pin];
+}
+
+uint8_t MM_HostPins::mode(uint8_t pin){
+    if(pin >= MM_HOST_PINS) return INPUT;
+    return _mode[pin];
+}
+
+void MM_HostPins::reset(){
+    for(uint8_t i = 0; i < MM_HOST_PINS; i++){
+        _level[i] = LOW;
+        _mode[i] = INPUT;
+        _isr[i] = NULL;
+        _isrMode[i] = 0;
+    }
+}
+
+void pinMode(uint8_t pin, uint8_t mode){
+    if(pin >= MM_HOST_PINS) return;
+    MM_HostPins::_mode[pin] = mode;
+    //Pullup inputs read HIGH when nothing drives them
+    if(mode == INPUT_PULLUP) MM_HostPins::_level[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val){
+    if(pin >= MM_HOST_PINS) return;
+    MM_HostPins::_level[pin] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin){
+    return MM_HostPins::get(pin);
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode){
+    if(interruptNum >= MM_HOST_PINS) return;
+    MM_HostPins::_isr[interruptNum] = userFunc;
+    MM_HostPins::_isrMode[interruptNum] = mode;
+}
+
+void detachInterrupt(uint8_t interruptNum){
+    if(interruptNum >= MM_HOST_PINS) return;
+    MM_HostPins::_isr[interruptNum] = NULL;
+}
+
+//-----------Watchdog---------------------
+
+void (*MM_HostWatchdog::_handler)(void) = NULL;
+uint32_t MM_HostWatchdog::_resets = 0;
+
+void MM_HostWatchdog::setHandler(void (*handler)(void)){
+    _handler = handler;
+}
+
+uint32_t MM_HostWatchdog::resets(){
+    return _resets;
+}
+
+void wdt_enable(uint8_t timeout){
+    MM_HostWatchdog::_resets++;
+    if(MM_HostWatchdog::_handler != NULL){
+        MM_HostWatchdog::_handler();
+        return;
+    }
+    fflush(stdout);
+    exit(0);
+}
+
+void wdt_disable(){
+}
+
+void wdt_reset(){
+}
+
+//-----------Print / Stream---------------------
+
+size_t Print::write(const uint8_t *buffer, size_t size){
+    size_t n = 0;
+    while(size--){
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::write(const char *str){
+    if(str == NULL) return 0;
+    return write((const uint8_t*)str, strlen(str));
+}
+
+size_t Print::printNumber(unsigned long n, int base){
+    char buf[8 * sizeof(long) + 1];
+    char *str = &buf[sizeof(buf) - 1];
+    *str = '\0';
+    if(base < 2) base = 10;
+    do{
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    }while(n);
+    return write(str);
+}
+
+size_t Print::print(const char *str){ return write(str); }
+size_t Print::print(char c){ return write((uint8_t)c); }
+size_t Print::print(unsigned char n, int base){ return print((unsigned long)n, base); }
+size_t Print::print(int n, int base){ return print((long)n, base); }
+size_t Print::print(unsigned int n, int base){ return print((unsigned long)n, base); }
+
+size_t Print::print(long n, int base){
+    if(base == 10 && n < 0){
+        return write((uint8_t)'-') + printNumber(-(unsigned long)n, 10);
+    }
+    return printNumber((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base){ return printNumber(n, base); }
+
+size_t Print::print(double n, int digits){
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+}
+
+size_t Print::println(){ return write("\r\n"); }
+size_t Print::println(const char *str){ return print(str) + println(); }
+size_t Print::println(char c){ return print(c) + println(); }
+size_t Print::println(unsigned char n, int base){ return print(n, base) + println(); }
+size_t Print::println(int n, int base){ return print(n, base) + println(); }
+size_t Print::println(unsigned int n, int base){ return print(n, base) + println(); }
+size_t Print::println(long n, int base){ return print(n, base) + println(); }
+size_t Print::println(unsigned long n, int base){ return print(n, base) + println(); }
+size_t Print::println(double n, int digits){ return print(n, digits) + println(); }
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length){
+    size_t n = 0;
+    while(n < length && available() > 0){
+        buffer[n++] = read();
+    }
+    return n;
+}
+
+MM_HostStream::MM_HostStream(bool echo) : _echo(echo) {
+}
+
+int MM_HostStream::available(){
+    return _rx.size();
+}
+
+int MM_HostStream::read(){
+    if(_rx.empty()) return -1;
+    uint8_t b = _rx.front();
+    _rx.pop_front();
+    return b;
+}
+
+int MM_HostStream::peek(){
+    if(_rx.empty()) return -1;
+    return _rx.front();
+}
+
+size_t MM_HostStream::write(uint8_t b){
+    if(_echo) fputc(b, stdout);
+    if(_peer != NULL){
+        _peer->inject(&b, 1);
+    }
+    else{
+        _tx.push_back(b);
+    }
+    return 1;
+}
+
+int MM_HostStream::availableForWrite(){
+    return 64;
+}
+
+void MM_HostStream::inject(const uint8_t *data, size_t len){
+    for(size_t i = 0; i < len; i++){
+        if(_rxSize != 0 && _rx.size() >= _rxSize){
+            _overruns++;
+            continue;
+        }
+        _rx.push_back(data[i]);
+    }
+}
+
+void MM_HostStream::inject(const char *str){
+    inject((const uint8_t*)str, strlen(str));
+}
+
+const std::string &MM_HostStream::output(){
+    return _tx;
+}
+
+void MM_HostStream::clearOutput(){
+    _tx.clear();
+}
+
+void MM_HostStream::connect(MM_HostStream *peer){
+    _peer = peer;
+}
+
+void MM_HostStream::link(MM_HostStream &a, MM_HostStream &b){
+    a.connect(&b);
+    b.connect(&a);
+}
+
+void MM_HostStream::setRxSize(size_t size){
+    _rxSize = size;
+}
+
+uint32_t MM_HostStream::overruns(){
+    return _overruns;
+}
+
+//-----------EEPROM---------------------
+
+void EEPROMClass::ensure(){
+    if(_data != NULL) return;
+    _data = new uint8_t[_size];
+    _wear = new uint32_t[_size];
+    memset(_data, 0xFF, _size);
+    memset(_wear, 0, _size * sizeof(uint32_t));
+}
+
+uint8_t EEPROMClass::read(int idx){
+    ensure();
+    if(idx < 0 || idx >= _size) return 0xFF;
+    return _data[idx];
+}
+
+void EEPROMClass::write(int idx, uint8_t val){
+    ensure();
+    if(idx < 0 || idx >= _size) return;
+    if(_writeLimit != MM_HOST_EEPROM_NO_LIMIT){
+        //Power is gone
+        if(_writeLimit == 0) return;
+        _writeLimit--;
+    }
+    _data[idx] = val;
+    _wear[idx]++;
+    _writes++;
+    if(_latency) MM_HostClock::advance(_latency);
+}
+
+void EEPROMClass::update(int idx, uint8_t val){
+    if(read(idx) != val) write(idx, val);
+}
+
+uint16_t EEPROMClass::length(){
+    return _size;
+}
+
+void EEPROMClass::setSize(uint16_t size){
+    delete[] _data;
+    delete[] _wear;
+    _data = NULL;
+    _wear = NULL;
+    _size = size;
+    _writes = 0;
+    ensure();
+}
+
+void EEPROMClass::erase(){
+    setSize(_size);
+}
+
+void EEPROMClass::setWriteLatency(uint32_t us){
+    _latency = us;
+}
+
+void EEPROMClass::setWriteLimit(uint32_t count){
+    _writeLimit = count;
+}
+
+uint32_t EEPROMClass::writeCount(uint16_t idx){
+    ensure();
+    if(idx >= _size) return 0;
+    return _wear[idx];
+}
+
+uint32_t EEPROMClass::maxWriteCount(){
+    ensure();
+    uint32_t max = 0;
+    for(uint16_t i = 0; i < _size; i++){
+        if(_wear[i] > max) max = _wear[i];
+    }
+    return max;
+}
+
+uint32_t EEPROMClass::writes(){
+    return _writes;
+}
+
+uint8_t *EEPROMClass::data(){
+    ensure();
+    return _data;
+}
+
+//-----------Globals---------------------
+
+MM_HostStream Serial(true);
+EEPROMClass EEPROM;
+SPIClass SPI;
@@ -0,0 +1,208 @@
+/*
+    MM_Sysbus Host HAL - clock, pins, watchdog and in-memory streams
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Host__
+#define __MM_Host__
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include "Stream.h"
+
+//Number of emulated pins
+#ifndef MM_HOST_PINS
+    #define MM_HOST_PINS 64
+#endif
+
+/**
+ * Clock behind millis()/micros()
+ * Virtual by default: time only moves with advance(), delay() and EEPROM writes,
+ * which makes runs reproducible. In realtime mode the monotonic clock is used.
+ */
+class MM_HostClock {
+public:
+    /**
+     * Current time
+     * @return microseconds since start (64 bit, never wraps)
+     */
+    static uint64_t now();
+
+    /**
+     * Set the virtual time
+     * @param us microseconds since start
+     */
+    static void set(uint64_t us);
+
+    /**
+     * Advance the virtual time, in realtime mode this sleeps
+     * @param us microseconds
+     */
+    static void advance(uint64_t us);
+
+    /**
+     * Switch between virtual and realtime clock
+     * The virtual clock continues from the current time
+     */
+    static void setRealtime(bool realtime);
+
+    /**
+     * true if the monotonic clock is used
+     */
+    static bool realtime();
+
+private:
+    static uint64_t _now;
+    static uint64_t _offset;
+    static bool _realtime;
+};
+
+/**
+ * Emulated GPIO pins
+ * Outputs are stored, inputs are driven with set() which also calls
+ * the interrupt handler attached to the pin.
+ */
+class MM_HostPins {
+public:
+    /**
+     * Drive an input from outside (button, interrupt line...)
+     * @param pin pin number
+     * @param value HIGH or LOW
+     */
+    static void set(uint8_t pin, uint8_t value);
+
+    /**
+     * Current level of a pin
+     */
+    static uint8_t get(uint8_t pin);
+
+    /**
+     * Mode set with pinMode()
+     */
+    static uint8_t mode(uint8_t pin);
+
+    /**
+     * Reset all pins to LOW inputs and detach all interrupts
+     */
+    static void reset();
+
+private:
+    friend void pinMode(uint8_t pin, uint8_t mode);
+    friend void digitalWrite(uint8_t pin, uint8_t val);
+    friend void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
+    friend void detachInterrupt(uint8_t interruptNum);
+
+    static uint8_t _level[MM_HOST_PINS];
+    static uint8_t _mode[MM_HOST_PINS];
+    static void (*_isr[MM_HOST_PINS])(void);
+    static int _isrMode[MM_HOST_PINS];
+};
+
+/**
+ * Watchdog stub
+ * The firmware only arms the watchdog to reboot (MM_Sysbus::reboot()),
+ * so arming it calls the reset handler.
+ */
+class MM_HostWatchdog {
+public:
+    /**
+     * Set the function called when the watchdog is armed
+     * @param handler reset handler, NULL = exit(0)
+     */
+    static void setHandler(void (*handler)(void));
+
+    /**
+     * Number of times the watchdog was armed
+     */
+    static uint32_t resets();
+
+private:
+    friend void wdt_enable(uint8_t timeout);
+
+    static void (*_handler)(void);
+    static uint32_t _resets;
+};
+
+/**
+ * In-memory Stream
+ * Bytes given to inject() can be read by the firmware, written bytes are
+ * collected in output() or, if connected, delivered to the peer stream.
+ * Two connected streams form a serial line (e.g. for MM_UART).
+ */
+class MM_HostStream : public Stream {
+public:
+    /**
+     * @param echo also write output to stdout
+     */
+    MM_HostStream(bool echo = false);
+
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t b);
+    using Print::write;
+    int availableForWrite();
+
+    /**
+     * Add bytes to the receive buffer
+     */
+    void inject(const uint8_t *data, size_t len);
+    void inject(const char *str);
+
+    /**
+     * Bytes written and not delivered to a peer
+     */
+    const std::string &output();
+
+    /**
+     * Clear the output buffer
+     */
+    void clearOutput();
+
+    /**
+     * Deliver written bytes to the receive buffer of another stream
+     * @param peer stream, NULL to disconnect
+     */
+    void connect(MM_HostStream *peer);
+
+    /**
+     * Connect two streams in both directions
+     */
+    static void link(MM_HostStream &a, MM_HostStream &b);
+
+    /**
+     * Limit the receive buffer, further bytes are dropped like on a UART
+     * @param size bytes, 0 = unlimited
+     */
+    void setRxSize(size_t size);
+
+    /**
+     * Number of received bytes dropped because the buffer was full
+     */
+    uint32_t overruns();
+
+private:
+    std::deque<uint8_t> _rx;
+    std::string _tx;
+    MM_HostStream *_peer = NULL;
+    bool _echo;
+    size_t _rxSize = 0;
+    uint32_t _overruns = 0;
+};
+
+#endif
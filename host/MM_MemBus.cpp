@@ -0,0 +1,339 @@
+#include "MM_MemBus.h"
+#include "MM_CAN.h"
+
+//Bits after the CRC: CRC delimiter, ACK slot + delimiter, EOF, interframe space
+#define MEMBUS_TAIL_BITS (1 + 2 + 7 + 3)
+
+//Error flag, echo of the other nodes, delimiter and interframe space after a bus error
+#define MEMBUS_ERROR_BITS (6 + 6 + 8 + 3)
+
+MM_MemBus::MM_MemBus(uint32_t bitrate){
+    setBitrate(bitrate);
+}
+
+void MM_MemBus::setBitrate(uint32_t bitrate){
+    _bitrate = bitrate > 0 ? bitrate : MM_MEMBUS_BITRATE;
+}
+
+uint32_t MM_MemBus::bitrate(){
+    return _bitrate;
+}
+
+void MM_MemBus::setErrorRate(double rate){
+    _errorRate = rate;
+}
+
+void MM_MemBus::setLossRate(double rate){
+    _lossRate = rate;
+}
+
+void MM_MemBus::setSeed(uint32_t seed){
+    _seed = seed != 0 ? seed : 2463534242UL;
+}
+
+void MM_MemBus::attachFrameHandler(void (*function)(const MM_MemBusFrame &frame)){
+    _onFrame = function;
+}
+
+void MM_MemBus::attachWakeHandler(void (*function)(MM_MemBusPort *port)){
+    _onWake = function;
+}
+
+uint16_t MM_MemBus::ports(){
+    return _ports.size();
+}
+
+double MM_MemBus::random(){
+    //xorshift32
+    _seed ^= _seed << 13;
+    _seed ^= _seed >> 17;
+    _seed ^= _seed << 5;
+    return _seed / 4294967296.0;
+}
+
+uint16_t MM_MemBus::attach(MM_MemBusPort *port){
+    _ports.push_back(port);
+    return _ports.size() - 1;
+}
+
+void MM_MemBus::pending(MM_MemBusPort *port){
+    //The arbitration starts in run(), so all frames queued at the same time compete
+    if(port->_txCount == 1) _active.push_back(port);
+}
+
+uint16_t MM_MemBus::frameBits(uint32_t id, uint8_t len, const uint8_t *data){
+    //SOF up to the CRC: SOF, id A, SRR, IDE, id B, RTR, r1, r0, DLC, data, CRC
+    uint8_t bits[1 + 11 + 1 + 1 + 18 + 1 + 2 + 4 + 64 + 15];
+    uint8_t n = 0;
+
+    bits[n++] = 0;
+    for(int8_t i = 28; i >= 18; i--) bits[n++] = (id >> i) & 1;
+    bits[n++] = 1;
+    bits[n++] = 1;
+    for(int8_t i = 17; i >= 0; i--) bits[n++] = (id >> i) & 1;
+    bits[n++] = 0;
+    bits[n++] = 0;
+    bits[n++] = 0;
+    for(int8_t i = 3; i >= 0; i--) bits[n++] = (len >> i) & 1;
+    for(uint8_t b = 0; b < len && b < 8; b++){
+        for(int8_t i = 7; i >= 0; i--) bits[n++] = (data[b] >> i) & 1;
+    }
+
+    //CRC-15/CAN
+    uint16_t crc = 0;
+    for(uint8_t i = 0; i < n; i++){
+        bool next = bits[i] ^ ((crc >> 14) & 1);
+        crc = (crc << 1) & 0x7FFF;
+        if(next) crc ^= 0x4599;
+    }
+    for(int8_t i = 14; i >= 0; i--) bits[n++] = (crc >> i) & 1;
+
+    //A stuff bit follows five equal bits, it counts for the next run
+    uint16_t stuffed = 0;
+    uint8_t run = 1;
+    uint8_t last = bits[0];
+    for(uint8_t i = 1; i < n; i++){
+        if(bits[i] == last){
+            run++;
+        }else{
+            last = bits[i];
+            run = 1;
+        }
+        if(run == 5){
+            stuffed++;
+            last = !last;
+            run = 1;
+        }
+    }
+
+    return n + stuffed + MEMBUS_TAIL_BITS;
+}
+
+void MM_MemBus::arbitrate(uint64_t start){
+    if(_busy || _active.empty()) return;
+
+    MM_MemBusFrame *winner = NULL;
+    for(size_t i = 0; i < _active.size(); i++){
+        MM_MemBusFrame *frame = _active[i]->next();
+        if(frame->queued > start) continue;
+        if(winner == NULL || frame->id < winner->id){
+            if(winner != NULL) winner->contended = true;
+            winner = frame;
+        }else{
+            frame->contended = true;
+        }
+    }
+    if(winner == NULL) return;
+
+    _current = *winner;
+    _busy = true;
+    _corrupted = _errorRate > 0 && random() < _errorRate;
+
+    uint32_t bits = frameBits(_current.id, _current.len, _current.data);
+    if(_corrupted){
+        //The error is detected somewhere in the frame, followed by the error frame
+        bits = 1 + (uint32_t)(random() * (bits - MEMBUS_TAIL_BITS)) + MEMBUS_ERROR_BITS;
+    }
+    uint64_t duration = ((uint64_t)bits * 1000000ULL + _bitrate - 1) / _bitrate;
+    _busyUntil = start + duration;
+    stats.busyTime += duration;
+}
+
+void MM_MemBus::complete(){
+    _busy = false;
+    _idleSince = _busyUntil;
+
+    if(_corrupted){
+        //The sender repeats the frame in the next arbitration
+        stats.errors++;
+        return;
+    }
+
+    MM_MemBusPort *sender = _current.port;
+    sender->sent();
+    if(sender->_txCount == 0){
+        for(size_t i = 0; i < _active.size(); i++){
+            if(_active[i] == sender){
+                _active[i] = _active.back();
+                _active.pop_back();
+                break;
+            }
+        }
+    }
+
+    _current.done = _busyUntil;
+    stats.frames++;
+    if(_current.contended) stats.arbitrationLost++;
+    if(_onFrame != NULL) _onFrame(_current);
+
+    for(size_t i = 0; i < _ports.size(); i++){
+        MM_MemBusPort *port = _ports[i];
+        if(port == sender) continue;
+        if(!port->accepts(_current.id)){
+            stats.filtered++;
+            continue;
+        }
+        if(_lossRate > 0 && random() < _lossRate){
+            stats.lost++;
+            continue;
+        }
+        if(port->_rxCount >= MM_MEMBUS_RX_SIZE){
+            port->overruns++;
+            stats.overruns++;
+            continue;
+        }
+        port->deliver(_current);
+        if(_onWake != NULL) _onWake(port);
+    }
+
+    //A mailbox got free
+    if(_onWake != NULL) _onWake(sender);
+}
+
+void MM_MemBus::run(uint64_t until){
+    while(true){
+        if(_busy){
+            if(_busyUntil > until) return;
+            complete();
+        }
+        if(_active.empty()) return;
+
+        //Frames queued while the bus was busy start together at the end of the transmission
+        uint64_t start = _idleSince;
+        uint64_t first = UINT64_MAX;
+        for(size_t i = 0; i < _active.size(); i++){
+            uint64_t queued = _active[i]->next()->queued;
+            if(queued < first) first = queued;
+        }
+        if(first > start) start = first;
+        if(start > until) return;
+        arbitrate(start);
+    }
+}
+
+void MM_MemBus::run(){
+    run(MM_HostClock::now());
+}
+
+uint64_t MM_MemBus::nextEvent(){
+    if(_busy) return _busyUntil;
+    if(!_active.empty()) return MM_HostClock::now();
+    return UINT64_MAX;
+}
+
+bool MM_MemBus::idle(){
+    return !_busy && _active.empty();
+}
+
+double MM_MemBus::utilization(){
+    uint64_t now = MM_HostClock::now();
+    if(now <= _statsSince) return 0;
+    return (double)stats.busyTime / (now - _statsSince);
+}
+
+void MM_MemBus::resetStats(){
+    stats = MM_MemBusStats();
+    _statsSince = MM_HostClock::now();
+    //The running transmission counts from now on
+    if(_busy && _busyUntil > _statsSince) stats.busyTime = _busyUntil - _statsSince;
+}
+
+//-----------Port---------------------
+
+MM_MemBusPort::MM_MemBusPort(MM_MemBus &bus) : _bus(bus) {
+}
+
+bool MM_MemBusPort::begin(){
+    if(!_attached){
+        _index = _bus.attach(this);
+        _attached = true;
+    }
+    return true;
+}
+
+bool MM_MemBusPort::Send(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data){
+    uint32_t addr = MM_CAN::CanAddrAssemble(type, target, source, port);
+    if(addr == 0 || len > 8){
+        lastErr = 1;
+        return false;
+    }
+    if(!_attached || _txCount >= MM_MEMBUS_TX_SIZE){
+        _bus.stats.txFull++;
+        lastErr = 2;
+        return false;
+    }
+
+    MM_MemBusFrame &frame = _tx[_txCount++];
+    frame.id = addr & 0x1FFFFFFF;
+    frame.len = len;
+    memcpy(frame.data, data, len);
+    frame.queued = MM_HostClock::now();
+    frame.done = 0;
+    frame.port = this;
+    frame.contended = false;
+
+    lastErr = 0;
+    _bus.pending(this);
+    return true;
+}
+
+bool MM_MemBusPort::Receive(MM_Packet &pkg){
+    if(_rxCount == 0) return false;
+
+    MM_MemBusFrame &frame = _rx[_rxHead];
+    pkg.meta = MM_CAN::CanAddrParse(frame.id);
+    pkg.len = frame.len;
+    memcpy(pkg.data, frame.data, frame.len);
+
+    _rxHead = (_rxHead + 1) % MM_MEMBUS_RX_SIZE;
+    _rxCount--;
+    received++;
+    return true;
+}
+
+bool MM_MemBusPort::setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count){
+    _maskCount = MM_CANFilterPlan(nodeID, groups, count, _masks, MM_MEMBUS_FILTER_BANKS);
+    return true;
+}
+
+bool MM_MemBusPort::accepts(uint32_t id){
+    if(_maskCount == 0) return true;
+    for(uint8_t i = 0; i < _maskCount; i++){
+        if((id & _masks[i].mask) == (_masks[i].id & _masks[i].mask)) return true;
+    }
+    return false;
+}
+
+uint16_t MM_MemBusPort::index(){
+    return _index;
+}
+
+uint8_t MM_MemBusPort::rxPending(){
+    return _rxCount;
+}
+
+uint8_t MM_MemBusPort::txPending(){
+    return _txCount;
+}
+
+MM_MemBusFrame *MM_MemBusPort::next(){
+    uint8_t best = 0;
+    for(uint8_t i = 1; i < _txCount; i++){
+        if(_tx[i].id < _tx[best].id) best = i;
+    }
+    return &_tx[best];
+}
+
+void MM_MemBusPort::sent(){
+    MM_MemBusFrame *frame = next();
+    uint8_t i = frame - _tx;
+    for(; i + 1 < _txCount; i++){
+        _tx[i] = _tx[i + 1];
+    }
+    _txCount--;
+}
+
+void MM_MemBusPort::deliver(const MM_MemBusFrame &frame){
+    _rx[(_rxHead + _rxCount) % MM_MEMBUS_RX_SIZE] = frame;
+    _rxCount++;
+}
@@ -0,0 +1,396 @@
+/*
+    MM_Sysbus In-memory CAN bus for host simulations
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_MemBus__
+#define __MM_MemBus__
+
+#include <Arduino.h>
+#include <vector>
+#include "MM_Interface.h"
+#include "MM_CANFilter.h"
+
+//Transmit mailboxes per port (MCP2515: 3), a full mailbox makes Send() fail
+#ifndef MM_MEMBUS_TX_SIZE
+    #define MM_MEMBUS_TX_SIZE 3
+#endif
+
+//Received frames buffered per port (like MM_CAN_RX_BUFFER)
+#ifndef MM_MEMBUS_RX_SIZE
+    #define MM_MEMBUS_RX_SIZE 8
+#endif
+
+//Acceptance filter banks per port (id/mask pairs, see MM_CANFilterPlan)
+#ifndef MM_MEMBUS_FILTER_BANKS
+    #define MM_MEMBUS_FILTER_BANKS 6
+#endif
+
+//Default bitrate in bit/s
+#ifndef MM_MEMBUS_BITRATE
+    #define MM_MEMBUS_BITRATE 125000
+#endif
+
+class MM_MemBusPort;
+
+/**
+ * Frame on the bus
+ */
+struct MM_MemBusFrame {
+    /**
+     * 29 bit CAN id (MM_CAN::CanAddrAssemble without the extended flag), lower wins arbitration
+     */
+    uint32_t id;
+    uint8_t len;
+    uint8_t data[8];
+
+    /**
+     * Time (µs, MM_HostClock) the frame was handed to the port
+     */
+    uint64_t queued;
+
+    /**
+     * Time the transmission ended
+     */
+    uint64_t done;
+
+    /**
+     * Sending port
+     */
+    MM_MemBusPort *port;
+
+    /**
+     * true if the frame lost an arbitration
+     */
+    bool contended;
+};
+
+/**
+ * Bus counters
+ */
+struct MM_MemBusStats {
+    /**
+     * Frames transmitted successfully
+     */
+    uint32_t frames = 0;
+
+    /**
+     * Transmissions destroyed by a bus error and repeated
+     */
+    uint32_t errors = 0;
+
+    /**
+     * Frames a receiver missed (loss rate)
+     */
+    uint32_t lost = 0;
+
+    /**
+     * Frames a receiver dropped because its RX buffer was full
+     */
+    uint32_t overruns = 0;
+
+    /**
+     * Frames rejected by the acceptance filters
+     */
+    uint32_t filtered = 0;
+
+    /**
+     * Send() calls that failed because all mailboxes were full
+     */
+    uint32_t txFull = 0;
+
+    /**
+     * Frames that lost at least one arbitration
+     */
+    uint32_t arbitrationLost = 0;
+
+    /**
+     * Microseconds the bus was busy (frames, error frames and interframe space)
+     */
+    uint64_t busyTime = 0;
+};
+
+/**
+ * Shared medium of MM_MemBusPort interfaces
+ *
+ * Models a CAN bus on the virtual clock (MM_HostClock): when the bus is idle the pending
+ * frame with the lowest id wins the arbitration, it occupies the bus for its exact bit count
+ * (extended frame incl. stuff bits, CRC, ACK, EOF and interframe space) at the bitrate and is
+ * then delivered to all other ports whose acceptance filter passes it.
+ * A bus error destroys a transmission (the sender repeats it), a loss makes a single receiver
+ * miss a frame.
+ *
+ * The bus does not run by itself, run() has to be called whenever the clock moved
+ * or frames were sent.
+ */
+class MM_MemBus {
+public:
+    /**
+     * Bus counters
+     */
+    MM_MemBusStats stats;
+
+    /**
+     * @param bitrate bit/s
+     */
+    MM_MemBus(uint32_t bitrate = MM_MEMBUS_BITRATE);
+
+    /**
+     * Set the bitrate
+     * @param bitrate bit/s
+     */
+    void setBitrate(uint32_t bitrate);
+
+    /**
+     * @return bitrate in bit/s
+     */
+    uint32_t bitrate();
+
+    /**
+     * Probability that a transmission is destroyed by a bus error
+     * @param rate 0.0 - 1.0
+     */
+    void setErrorRate(double rate);
+
+    /**
+     * Probability that a receiver misses a frame
+     * @param rate 0.0 - 1.0
+     */
+    void setLossRate(double rate);
+
+    /**
+     * Seed of the random generator for errors and losses
+     */
+    void setSeed(uint32_t seed);
+
+    /**
+     * Called for every frame transmitted successfully (before it is delivered)
+     */
+    void attachFrameHandler(void (*function)(const MM_MemBusFrame &frame));
+
+    /**
+     * Called when a port received a frame or a mailbox of the port got free,
+     * so the owner knows the node has work to do
+     */
+    void attachWakeHandler(void (*function)(MM_MemBusPort *port));
+
+    /**
+     * Run the bus up to a time
+     * Completes the frames that end until then and starts the next arbitration
+     * @param until time in µs (MM_HostClock)
+     */
+    void run(uint64_t until);
+
+    /**
+     * Run the bus up to the current time
+     */
+    void run();
+
+    /**
+     * Time of the next bus event
+     * @return end of the current transmission, the current time if frames wait for an idle bus,
+     * UINT64_MAX if there is nothing to do
+     */
+    uint64_t nextEvent();
+
+    /**
+     * true if no frame is on the bus or waiting for it
+     */
+    bool idle();
+
+    /**
+     * Bus load since the last resetStats()
+     * @return busy time / elapsed time (0.0 - 1.0)
+     */
+    double utilization();
+
+    /**
+     * Clear the counters and restart the utilization measurement
+     */
+    void resetStats();
+
+    /**
+     * Number of bits on the bus for an extended data frame, incl. stuff bits and interframe space
+     * @param id 29 bit id
+     * @param len data length
+     * @param data data
+     */
+    static uint16_t frameBits(uint32_t id, uint8_t len, const uint8_t *data);
+
+    /**
+     * Attached ports
+     */
+    uint16_t ports();
+
+private:
+    friend class MM_MemBusPort;
+
+    /**
+     * Add a port, called by MM_MemBusPort::begin()
+     * @return index of the port
+     */
+    uint16_t attach(MM_MemBusPort *port);
+
+    /**
+     * A port got a frame to send
+     */
+    void pending(MM_MemBusPort *port);
+
+    /**
+     * Start the next transmission at time start if frames wait
+     */
+    void arbitrate(uint64_t start);
+
+    /**
+     * Finish the current transmission
+     */
+    void complete();
+
+    /**
+     * Random number 0.0 - 1.0
+     */
+    double random();
+
+    std::vector<MM_MemBusPort*> _ports;
+
+    /**
+     * Ports with frames in their mailboxes
+     */
+    std::vector<MM_MemBusPort*> _active;
+
+    /**
+     * Frame on the bus, valid if _busy
+     */
+    MM_MemBusFrame _current;
+    bool _busy = false;
+
+    /**
+     * true if the current transmission gets destroyed by an error
+     */
+    bool _corrupted = false;
+
+    /**
+     * End of the current transmission
+     */
+    uint64_t _busyUntil = 0;
+
+    /**
+     * Time the bus got idle
+     */
+    uint64_t _idleSince = 0;
+
+    /**
+     * Start of the utilization measurement
+     */
+    uint64_t _statsSince = 0;
+
+    uint32_t _bitrate;
+    double _errorRate = 0;
+    double _lossRate = 0;
+    uint32_t _seed = 2463534242UL;
+
+    void (*_onFrame)(const MM_MemBusFrame &frame) = NULL;
+    void (*_onWake)(MM_MemBusPort *port) = NULL;
+};
+
+/**
+ * MM_Interface of a node on a MM_MemBus
+ * Uses the MM_CAN address layout, the mailboxes and buffers of a CAN controller
+ * and acceptance filters planned with MM_CANFilterPlan().
+ * @see MM_Interface
+ */
+class MM_MemBusPort : public MM_Interface {
+public:
+    /**
+     * @param bus bus to connect to in begin()
+     */
+    MM_MemBusPort(MM_MemBus &bus);
+
+    bool begin();
+    bool Send(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data);
+    bool Receive(MM_Packet &pkg);
+    bool setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count);
+
+    /**
+     * true if the filter passes the id
+     */
+    bool accepts(uint32_t id);
+
+    /**
+     * Index of the port on the bus
+     */
+    uint16_t index();
+
+    /**
+     * Received frames waiting for Receive()
+     */
+    uint8_t rxPending();
+
+    /**
+     * Frames waiting in the mailboxes
+     */
+    uint8_t txPending();
+
+    /**
+     * Number of frames taken by Receive(), e.g. to charge processing time
+     */
+    uint32_t received = 0;
+
+    /**
+     * Frames dropped because the RX buffer was full
+     */
+    uint32_t overruns = 0;
+
+    /**
+     * Free pointer for the owner (e.g. the simulated node)
+     */
+    void *user = NULL;
+
+private:
+    friend class MM_MemBus;
+
+    /**
+     * Frame in the mailboxes with the lowest id (the one the controller sends next)
+     */
+    MM_MemBusFrame *next();
+
+    /**
+     * Remove the frame returned by next()
+     */
+    void sent();
+
+    /**
+     * Deliver a frame from the bus
+     */
+    void deliver(const MM_MemBusFrame &frame);
+
+    MM_MemBus &_bus;
+    uint16_t _index = 0;
+    bool _attached = false;
+
+    MM_MemBusFrame _tx[MM_MEMBUS_TX_SIZE];
+    uint8_t _txCount = 0;
+
+    MM_MemBusFrame _rx[MM_MEMBUS_RX_SIZE];
+    uint8_t _rxHead = 0;
+    uint8_t _rxCount = 0;
+
+    MM_CANMask _masks[MM_MEMBUS_FILTER_BANKS];
+    uint8_t _maskCount = 0;
+};
+
+#endif
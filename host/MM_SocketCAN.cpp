@@ -0,0 +1,286 @@
+#include "MM_SocketCAN.h"
+#include "MM_CAN.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+MM_SocketCAN::MM_SocketCAN(const char *ifname){
+    strncpy(_ifname, ifname, sizeof(_ifname) - 1);
+    _ifname[sizeof(_ifname) - 1] = '\0';
+}
+
+MM_SocketCAN::~MM_SocketCAN(){
+    end();
+}
+
+bool MM_SocketCAN::begin(){
+    if(_fd >= 0) return true;
+
+    _fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+    if(_fd < 0){
+        lastErr = errno;
+        return false;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", _ifname);
+    if(ioctl(_fd, SIOCGIFINDEX, &ifr) < 0){
+        lastErr = errno;
+        end();
+        return false;
+    }
+
+    struct sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if(bind(_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        lastErr = errno;
+        end();
+        return false;
+    }
+
+    //Hardware timestamps if the controller has them, software timestamps otherwise
+    int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE
+        | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if(setsockopt(_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0){
+        int on = 1;
+        setsockopt(_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    }
+
+    //Count the frames the kernel drops on a full receive buffer
+    int on = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+
+    _rxCount = 0;
+    _rxPos = 0;
+    lastErr = 0;
+    return true;
+}
+
+void MM_SocketCAN::end(){
+    if(_fd >= 0){
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+bool MM_SocketCAN::packetToFrame(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port,
+        uint8_t len, const uint8_t *data, struct can_frame &frame){
+    uint32_t addr = MM_CAN::CanAddrAssemble(type, target, source, port);
+    if(addr == 0 || len > 8) return false;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = (addr & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    frame.can_dlc = len;
+    memcpy(frame.data, data, len);
+    return true;
+}
+
+bool MM_SocketCAN::frameToPacket(const struct can_frame &frame, MM_Packet &pkg){
+    if(!(frame.can_id & CAN_EFF_FLAG) || (frame.can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG))) return false;
+    if(frame.can_dlc > 8) return false;
+
+    pkg.meta = MM_CAN::CanAddrParse(frame.can_id & CAN_EFF_MASK);
+    pkg.len = frame.can_dlc;
+    memcpy(pkg.data, frame.data, frame.can_dlc);
+    return true;
+}
+
+bool MM_SocketCAN::Send(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data){
+    struct can_frame frame;
+    if(!packetToFrame(type, target, source, port, len, data, frame)){
+        lastErr = EINVAL;
+        return false;
+    }
+    if(_fd < 0){
+        lastErr = EBADF;
+        return false;
+    }
+
+    if(write(_fd, &frame, sizeof(frame)) != sizeof(frame)){
+        lastErr = errno;
+        //The TX queue of the device is full, MM_Sysbus retries later
+        if(errno == ENOBUFS || errno == EAGAIN) stats.txFull++;
+        return false;
+    }
+    stats.txFrames++;
+    lastErr = 0;
+    return true;
+}
+
+uint8_t MM_SocketCAN::SendBatch(MM_Packet *pkgs, uint8_t count){
+    if(_fd < 0){
+        lastErr = EBADF;
+        return 0;
+    }
+
+    struct can_frame frames[MM_SOCKETCAN_BATCH];
+    struct iovec iov[MM_SOCKETCAN_BATCH];
+    struct mmsghdr msgs[MM_SOCKETCAN_BATCH];
+    uint8_t done = 0;
+
+    while(done < count){
+        uint8_t n = 0;
+        while(n < MM_SOCKETCAN_BATCH && done + n < count){
+            MM_Packet &pkg = pkgs[done + n];
+            if(!packetToFrame(pkg.meta.type, pkg.meta.target, pkg.meta.source, pkg.meta.port, pkg.len, pkg.data, frames[n])){
+                break;
+            }
+            iov[n].iov_base = &frames[n];
+            iov[n].iov_len = sizeof(struct can_frame);
+            memset(&msgs[n], 0, sizeof(struct mmsghdr));
+            msgs[n].msg_hdr.msg_iov = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            n++;
+        }
+        if(n == 0){
+            lastErr = EINVAL;
+            return done;
+        }
+
+        int sent = sendmmsg(_fd, msgs, n, MSG_DONTWAIT);
+        stats.txBatches++;
+        if(sent <= 0){
+            lastErr = errno;
+            if(errno == ENOBUFS || errno == EAGAIN) stats.txFull++;
+            return done;
+        }
+        stats.txFrames += sent;
+        done += sent;
+        if(sent < n){
+            //Device queue full, the rest is retried by MM_Sysbus
+            stats.txFull++;
+            lastErr = ENOBUFS;
+            return done;
+        }
+    }
+    lastErr = 0;
+    return done;
+}
+
+int MM_SocketCAN::fill(){
+    if(_fd < 0) return -1;
+
+    struct iovec iov[MM_SOCKETCAN_BATCH];
+    struct mmsghdr msgs[MM_SOCKETCAN_BATCH];
+    uint8_t control[MM_SOCKETCAN_BATCH][MM_SOCKETCAN_CMSG_SIZE];
+
+    for(uint8_t i = 0; i < MM_SOCKETCAN_BATCH; i++){
+        iov[i].iov_base = &_rxFrames[i];
+        iov[i].iov_len = sizeof(struct can_frame);
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+
+    int n = recvmmsg(_fd, msgs, MM_SOCKETCAN_BATCH, MSG_DONTWAIT, NULL);
+    if(n < 0){
+        _rxCount = 0;
+        _rxPos = 0;
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        lastErr = errno;
+        return -1;
+    }
+
+    for(int i = 0; i < n; i++){
+        _rxStamps[i] = 0;
+        _rxHardware[i] = false;
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)){
+            if(cmsg->cmsg_level != SOL_SOCKET) continue;
+            if(cmsg->cmsg_type == SO_TIMESTAMPING){
+                //[0] software, [1] deprecated, [2] raw hardware
+                struct timespec ts[3];
+                memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+                if(ts[2].tv_sec != 0 || ts[2].tv_nsec != 0){
+                    _rxStamps[i] = (uint64_t)ts[2].tv_sec * 1000000000ULL + ts[2].tv_nsec;
+                    _rxHardware[i] = true;
+                }else{
+                    _rxStamps[i] = (uint64_t)ts[0].tv_sec * 1000000000ULL + ts[0].tv_nsec;
+                }
+            }
+            else if(cmsg->cmsg_type == SO_TIMESTAMPNS){
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                _rxStamps[i] = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+            }
+            else if(cmsg->cmsg_type == SO_RXQ_OVFL){
+                //Total drops of the socket, count the difference
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                stats.rxDrops += drops - _dropCounter;
+                _dropCounter = drops;
+            }
+        }
+    }
+
+    _rxCount = n;
+    _rxPos = 0;
+    if(n > 0) stats.rxBatches++;
+    return n;
+}
+
+bool MM_SocketCAN::Receive(MM_Packet &pkg){
+    while(true){
+        if(_rxPos >= _rxCount && fill() <= 0) return false;
+
+        uint8_t i = _rxPos++;
+        if(!frameToPacket(_rxFrames[i], pkg)) continue;
+
+        _stamp = _rxStamps[i];
+        _stampHardware = _rxHardware[i];
+        stats.rxFrames++;
+        return true;
+    }
+}
+
+bool MM_SocketCAN::setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count){
+    if(_fd < 0) return false;
+
+    MM_CANMask masks[MM_SOCKETCAN_FILTERS];
+    uint8_t n = MM_CANFilterPlan(nodeID, groups, count, masks, MM_SOCKETCAN_FILTERS);
+
+    struct can_filter filters[MM_SOCKETCAN_FILTERS];
+    for(uint8_t i = 0; i < n; i++){
+        //Extended frames only, like MM_CAN
+        filters[i].can_id = (masks[i].id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+        filters[i].can_mask = (masks[i].mask & CAN_EFF_MASK) | CAN_EFF_FLAG | CAN_RTR_FLAG;
+    }
+    if(setsockopt(_fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, n * sizeof(struct can_filter)) < 0){
+        lastErr = errno;
+        return false;
+    }
+    return true;
+}
+
+int MM_SocketCAN::fd(){
+    return _fd;
+}
+
+uint8_t MM_SocketCAN::pending(){
+    return _rxCount - _rxPos;
+}
+
+uint64_t MM_SocketCAN::timestamp(){
+    return _stamp;
+}
+
+bool MM_SocketCAN::hardwareTimestamp(){
+    return _stampHardware;
+}
+
+const char *MM_SocketCAN::name(){
+    return _ifname;
+}
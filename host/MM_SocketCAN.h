@@ -0,0 +1,205 @@
+/*
+    MM_Sysbus SocketCAN interface (Linux)
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_SocketCAN__
+#define __MM_SocketCAN__
+
+#include <Arduino.h>
+#include "MM_Interface.h"
+#include "MM_CANFilter.h"
+
+#include <linux/can.h>
+#include <sys/socket.h>
+
+//Frames read or written with one recvmmsg()/sendmmsg() call
+#ifndef MM_SOCKETCAN_BATCH
+    #define MM_SOCKETCAN_BATCH 32
+#endif
+
+//Max number of id/mask pairs given to the kernel filter
+#ifndef MM_SOCKETCAN_FILTERS
+    #define MM_SOCKETCAN_FILTERS 32
+#endif
+
+//Space for the control messages (timestamps, drop counter) of a received frame
+#define MM_SOCKETCAN_CMSG_SIZE (CMSG_SPACE(3 * sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+
+/**
+ * SocketCAN counters
+ */
+struct MM_SocketCANStats {
+    /**
+     * Frames received
+     */
+    uint32_t rxFrames = 0;
+
+    /**
+     * Frames sent
+     */
+    uint32_t txFrames = 0;
+
+    /**
+     * Frames the kernel dropped because the socket receive buffer was full (SO_RXQ_OVFL)
+     */
+    uint32_t rxDrops = 0;
+
+    /**
+     * Sends that failed because the TX queue of the device was full
+     */
+    uint32_t txFull = 0;
+
+    /**
+     * recvmmsg() calls that returned frames
+     */
+    uint32_t rxBatches = 0;
+
+    /**
+     * sendmmsg() calls
+     */
+    uint32_t txBatches = 0;
+};
+
+/**
+ * CAN interface over a Linux raw CAN socket (AF_CAN, CAN_RAW)
+ *
+ * Uses the MM_CAN address layout (extended frames), so it talks to MM_CAN and MM_STM32_CAN nodes.
+ * The acceptance filter from setFilter() is installed in the kernel (CAN_RAW_FILTER),
+ * frames are read in batches with recvmmsg() and SendBatch() writes with one sendmmsg().
+ * The socket is non-blocking, fd() can be watched with poll/epoll.
+ *
+ * Test without hardware on a virtual bus:
+ *   ip link add dev vcan0 type vcan && ip link set up vcan0
+ *
+ * @see MM_Interface
+ */
+class MM_SocketCAN : public MM_Interface {
+public:
+    /**
+     * Counters
+     */
+    MM_SocketCANStats stats;
+
+    /**
+     * @param ifname network interface, e.g. "can0" or "vcan0"
+     */
+    MM_SocketCAN(const char *ifname);
+    ~MM_SocketCAN();
+
+    /**
+     * Open and bind the socket, enables timestamps
+     * @return false if the socket can't be opened (lastErr = errno & 0xFF)
+     */
+    bool begin();
+
+    /**
+     * Close the socket
+     */
+    void end();
+
+    bool Send(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data);
+
+    /**
+     * Send the packets with as few sendmmsg() calls as possible
+     * @see MM_Interface::SendBatch
+     */
+    uint8_t SendBatch(MM_Packet *pkgs, uint8_t count);
+
+    /**
+     * Take a packet from the receive batch, reads the next batch if it is empty
+     */
+    bool Receive(MM_Packet &pkg);
+
+    /**
+     * Install the filter plan (MM_CANFilterPlan) as kernel filter
+     */
+    bool setFilter(uint16_t nodeID, const uint16_t *groups, uint8_t count);
+
+    /**
+     * Socket descriptor for poll/epoll, -1 if not open
+     */
+    int fd();
+
+    /**
+     * Read the next batch of frames from the socket
+     * Receive() does this itself when its batch is empty, an event loop can call it
+     * when fd() is readable.
+     * @return number of frames read, 0 if none are waiting, -1 on errors
+     */
+    int fill();
+
+    /**
+     * Packets read from the socket and not yet taken by Receive()
+     */
+    uint8_t pending();
+
+    /**
+     * Timestamp of the last packet returned by Receive()
+     * @return nanoseconds (CLOCK_REALTIME), 0 if the kernel gave none
+     */
+    uint64_t timestamp();
+
+    /**
+     * true if timestamp() comes from the CAN controller
+     */
+    bool hardwareTimestamp();
+
+    /**
+     * Interface name
+     */
+    const char *name();
+
+    /**
+     * Convert a raw frame to a packet
+     * @return false for frames that don't use the MM_CAN layout (standard, RTR, error frames)
+     */
+    static bool frameToPacket(const struct can_frame &frame, MM_Packet &pkg);
+
+    /**
+     * Convert a packet to a raw frame
+     * @return false if the address can't be assembled
+     */
+    static bool packetToFrame(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port,
+        uint8_t len, const uint8_t *data, struct can_frame &frame);
+
+private:
+    char _ifname[16];
+    int _fd = -1;
+
+    /**
+     * Receive batch
+     */
+    struct can_frame _rxFrames[MM_SOCKETCAN_BATCH];
+    uint64_t _rxStamps[MM_SOCKETCAN_BATCH];
+    bool _rxHardware[MM_SOCKETCAN_BATCH];
+    uint8_t _rxCount = 0;
+    uint8_t _rxPos = 0;
+
+    /**
+     * Timestamp of the last returned packet
+     */
+    uint64_t _stamp = 0;
+    bool _stampHardware = false;
+
+    /**
+     * Last value of the kernel drop counter
+     */
+    uint32_t _dropCounter = 0;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+    MM_Sysbus single producer single consumer queue
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_SpscQueue__
+#define __MM_SpscQueue__
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+//Size of a cache line, producer and consumer indices are kept on separate lines
+#ifndef MM_CACHE_LINE
+    #define MM_CACHE_LINE 64
+#endif
+
+/**
+ * Lock-free ring buffer for exactly one producer and one consumer thread
+ *
+ * The producer only writes _head, the consumer only writes _tail, both publish with
+ * release stores. Each side caches the index of the other side, so the shared cache line
+ * is only read when the queue looks full (producer) or empty (consumer).
+ * @tparam T element type, copied in and out
+ * @tparam SIZE capacity, a power of two
+ */
+template <typename T, uint32_t SIZE>
+class MM_SpscQueue {
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+public:
+    /**
+     * Append an element (producer thread only)
+     * @return false if the queue is full
+     */
+    bool push(const T &item){
+        uint32_t head = _head.load(std::memory_order_relaxed);
+        if(head - _tailCache == SIZE){
+            _tailCache = _tail.load(std::memory_order_acquire);
+            if(head - _tailCache == SIZE) return false;
+        }
+        _items[head & (SIZE - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Free slots (producer thread only), at least this many push() calls will succeed
+     */
+    uint32_t space(){
+        _tailCache = _tail.load(std::memory_order_acquire);
+        return SIZE - (_head.load(std::memory_order_relaxed) - _tailCache);
+    }
+
+    /**
+     * Take up to max elements (consumer thread only)
+     * @param items buffer for at least max elements
+     * @return number of elements taken
+     */
+    uint32_t pop(T *items, uint32_t max){
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        if(_headCache == tail){
+            _headCache = _head.load(std::memory_order_acquire);
+            if(_headCache == tail) return 0;
+        }
+        uint32_t count = _headCache - tail;
+        if(count > max) count = max;
+        for(uint32_t i = 0; i < count; i++){
+            items[i] = _items[(tail + i) & (SIZE - 1)];
+        }
+        _tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * true if the queue holds elements, may be outdated as soon as it returns
+     */
+    bool pending() const {
+        return _head.load(std::memory_order_acquire) != _tail.load(std::memory_order_acquire);
+    }
+
+private:
+    //Producer side
+    alignas(MM_CACHE_LINE) std::atomic<uint32_t> _head{0};
+    uint32_t _tailCache = 0;
+
+    //Consumer side
+    alignas(MM_CACHE_LINE) std::atomic<uint32_t> _tail{0};
+    uint32_t _headCache = 0;
+
+    alignas(MM_CACHE_LINE) T _items[SIZE];
+};
+
+#endif
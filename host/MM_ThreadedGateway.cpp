@@ -0,0 +1,420 @@
+#include "MM_ThreadedGateway.h"
+#include "MM_FdStream.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <new>
+
+//Minimum milliseconds between two refreshes of the last seen time of a node
+#define MM_GW_SEEN_REFRESH 1000
+
+//Quiescent epoch of a thread that sleeps and holds no snapshot
+#define MM_GW_OFFLINE UINT64_MAX
+
+struct MM_ThreadedGateway::Worker {
+    uint8_t id = 0;
+    MM_Interface *iface = NULL;
+    int fd = -1;
+    MM_FdStream *stream = NULL;
+    int wakeFd = -1;
+    std::thread thread;
+
+    /**
+     * The thread sleeps (or is about to), producers have to write to wakeFd
+     */
+    std::atomic<bool> sleeping{false};
+
+    /**
+     * The stream was closed, the thread ended and nothing is queued for it anymore
+     */
+    std::atomic<bool> closed{false};
+
+    /**
+     * Epoch of the last quiescent state
+     */
+    std::atomic<uint64_t> seen{MM_GW_OFFLINE};
+
+    /**
+     * Packets taken from a queue and not sent yet
+     */
+    MM_Packet pending[MM_GW_BATCH];
+    uint8_t pendingPos = 0;
+    uint8_t pendingCount = 0;
+
+    /**
+     * First source interface served in the next round
+     */
+    uint8_t txNext = 0;
+
+    //Counters, every one is only written by the thread of this interface
+    std::atomic<uint32_t> rx{0};
+    std::atomic<uint32_t> tx{0};
+    std::atomic<uint32_t> queueFull{0};
+    std::atomic<uint32_t> sleeps{0};
+    std::atomic<uint32_t> routed{0};
+    std::atomic<uint32_t> flooded{0};
+    std::atomic<uint32_t> saved{0};
+    std::atomic<uint32_t> duplicates{0};
+};
+
+/**
+ * Add to a counter with a single writer
+ */
+static inline void count(std::atomic<uint32_t> &counter, uint32_t n){
+    if(n != 0) counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+MM_ThreadedGateway::MM_ThreadedGateway(){
+    void *mem = NULL;
+    size_t size = sizeof(MM_SpscQueue<MM_Packet, MM_GW_QUEUE_SIZE>) * MM_GW_MAX_INTERFACES * MM_GW_MAX_INTERFACES;
+    if(posix_memalign(&mem, MM_CACHE_LINE, size) != 0) throw std::bad_alloc();
+    _queues = (MM_SpscQueue<MM_Packet, MM_GW_QUEUE_SIZE>*)mem;
+    for(uint16_t i = 0; i < MM_GW_MAX_INTERFACES * MM_GW_MAX_INTERFACES; i++){
+        new (&_queues[i]) MM_SpscQueue<MM_Packet, MM_GW_QUEUE_SIZE>();
+    }
+
+    MM_RouteSnapshot *routes = new MM_RouteSnapshot();
+    memset(routes->busId, -1, sizeof(routes->busId));
+    _routes.store(routes);
+
+    for(uint16_t i = 0; i < MM_GW_NODES; i++) _lastSeen[i].store(0, std::memory_order_relaxed);
+    for(uint16_t i = 0; i < MM_GW_DUP_CACHE_SIZE; i++) _dups[i].store(0, std::memory_order_relaxed);
+}
+
+MM_ThreadedGateway::~MM_ThreadedGateway(){
+    stop();
+    for(uint8_t i = 0; i < _count; i++){
+        if(_workers[i]->wakeFd >= 0) close(_workers[i]->wakeFd);
+        delete _workers[i];
+    }
+    for(uint16_t i = 0; i < MM_GW_MAX_INTERFACES * MM_GW_MAX_INTERFACES; i++){
+        _queues[i].~MM_SpscQueue();
+    }
+    free(_queues);
+    for(size_t i = 0; i < _retired.size(); i++) delete _retired[i];
+    delete _routes.load();
+}
+
+bool MM_ThreadedGateway::attach(MM_Interface *iface, int fd, MM_FdStream *stream){
+    if(_running || _count == MM_GW_MAX_INTERFACES || iface == NULL) return false;
+    if(!iface->begin()) return false;
+
+    //A router has to see everything
+    iface->setFilter(0, NULL, 0);
+
+    Worker *w = new Worker();
+    w->id = _count;
+    w->iface = iface;
+    w->fd = fd;
+    w->stream = stream;
+    _workers[_count++] = w;
+    return true;
+}
+
+bool MM_ThreadedGateway::start(bool spin, uint8_t cpus){
+    if(_running || _count == 0) return false;
+    _spin = spin;
+
+    for(uint8_t i = 0; i < _count; i++){
+        if(_workers[i]->wakeFd < 0){
+            _workers[i]->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if(_workers[i]->wakeFd < 0) return false;
+        }
+    }
+
+    _running = true;
+    for(uint8_t i = 0; i < _count; i++){
+        Worker *w = _workers[i];
+        w->closed = false;
+        w->seen = _epoch.load();
+        w->thread = std::thread(&MM_ThreadedGateway::run, this, w);
+        if(cpus > 0){
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % cpus, &set);
+            pthread_setaffinity_np(w->thread.native_handle(), sizeof(set), &set);
+        }
+    }
+    return true;
+}
+
+void MM_ThreadedGateway::stop(){
+    if(!_running) return;
+    _running = false;
+
+    uint64_t one = 1;
+    for(uint8_t i = 0; i < _count; i++){
+        if(write(_workers[i]->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) continue;
+    }
+    for(uint8_t i = 0; i < _count; i++){
+        if(_workers[i]->thread.joinable()) _workers[i]->thread.join();
+    }
+}
+
+uint8_t MM_ThreadedGateway::interfaces(){
+    return _count;
+}
+
+MM_GatewayPortStats MM_ThreadedGateway::portStats(uint8_t busId){
+    MM_GatewayPortStats stats;
+    if(busId >= _count) return stats;
+
+    Worker *w = _workers[busId];
+    stats.rx = w->rx.load(std::memory_order_relaxed);
+    stats.tx = w->tx.load(std::memory_order_relaxed);
+    stats.queueFull = w->queueFull.load(std::memory_order_relaxed);
+    stats.sleeps = w->sleeps.load(std::memory_order_relaxed);
+    return stats;
+}
+
+MM_RoutingStats MM_ThreadedGateway::routingStats(){
+    MM_RoutingStats stats;
+    stats.learned = _learned.load(std::memory_order_relaxed);
+    for(uint8_t i = 0; i < _count; i++){
+        stats.routed += _workers[i]->routed.load(std::memory_order_relaxed);
+        stats.flooded += _workers[i]->flooded.load(std::memory_order_relaxed);
+        stats.framesSaved += _workers[i]->saved.load(std::memory_order_relaxed);
+        stats.duplicates += _workers[i]->duplicates.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void MM_ThreadedGateway::setRouteAgingTime(uint32_t ms){
+    _agingTime = ms;
+}
+
+void MM_ThreadedGateway::setDuplicateWindow(uint16_t ms){
+    _dupWindow = ms;
+}
+
+MM_SpscQueue<MM_Packet, MM_GW_QUEUE_SIZE> &MM_ThreadedGateway::queue(uint8_t src, uint8_t dst){
+    return _queues[src * MM_GW_MAX_INTERFACES + dst];
+}
+
+void MM_ThreadedGateway::run(Worker *w){
+    MM_Packet pkg;
+
+    while(_running.load(std::memory_order_relaxed)){
+        uint32_t rx = 0;
+        uint32_t wakeMask = 0;
+        uint32_t room = rxRoom(w);
+        if(room == 0) count(w->queueFull, 1);
+        while(rx < room && w->iface->Receive(pkg)){
+            route(w, pkg, wakeMask);
+            rx++;
+        }
+        count(w->rx, rx);
+        if(wakeMask != 0) wake(wakeMask);
+
+        uint32_t tx = transmit(w);
+        if(w->stream != NULL && w->stream->closed()){
+            w->closed.store(true);
+            break;
+        }
+
+        quiescent(w);
+        if(rx == 0 && tx == 0){
+            if(_spin || room == 0){
+                //Spinning, or waiting for the other threads to drain the queues
+                sched_yield();
+            }else{
+                sleep(w);
+            }
+        }
+    }
+    w->seen.store(MM_GW_OFFLINE);
+}
+
+uint32_t MM_ThreadedGateway::rxRoom(Worker *w){
+    uint32_t room = MM_GW_BATCH;
+    for(uint8_t busId = 0; busId < _count && room > 0; busId++){
+        if(busId == w->id || _workers[busId]->closed.load(std::memory_order_relaxed)) continue;
+        uint32_t space = queue(w->id, busId).space();
+        if(space < room) room = space;
+    }
+    return room;
+}
+
+void MM_ThreadedGateway::route(Worker *w, MM_Packet &pkg, uint32_t &wake){
+    pkg.meta.busId = w->id;
+    if(duplicate(pkg)){
+        //Already seen, e.g. sent back by a second gateway
+        count(w->duplicates, 1);
+        return;
+    }
+
+    uint32_t now = millis();
+    MM_RouteSnapshot *routes = _routes.load();
+
+    uint16_t source = pkg.meta.source;
+    if(source != 0 && source < MM_GW_NODES){
+        if(routes->busId[source] != w->id){
+            learn(source, w->id);
+            routes = _routes.load();
+        }
+        if(now - _lastSeen[source].load(std::memory_order_relaxed) >= MM_GW_SEEN_REFRESH){
+            _lastSeen[source].store(now, std::memory_order_relaxed);
+        }
+    }
+
+    //Unicast to a known node: queue only for the interface the node was seen on
+    signed char routeId = -1;
+    uint16_t target = pkg.meta.target;
+    if((pkg.meta.type == MM_MsgType::Unicast || pkg.meta.type == MM_MsgType::Streaming) && target < MM_GW_NODES){
+        routeId = routes->busId[target];
+        if(routeId >= 0 && now - _lastSeen[target].load(std::memory_order_relaxed) > _agingTime) routeId = -1;
+    }
+
+    if(routeId >= 0){
+        count(w->routed, 1);
+        count(w->saved, _count - (routeId == w->id ? 1 : 2));
+    }else{
+        count(w->flooded, 1);
+    }
+
+    for(uint8_t busId = 0; busId < _count; busId++){
+        if(busId == w->id || (routeId >= 0 && busId != routeId)) continue;
+        if(_workers[busId]->closed.load(std::memory_order_relaxed)) continue;
+        //Room was checked before receiving
+        queue(w->id, busId).push(pkg);
+        wake |= 1UL << busId;
+    }
+}
+
+uint32_t MM_ThreadedGateway::transmit(Worker *w){
+    uint32_t sent = 0;
+
+    //One batch of every source interface per round, the packets left from the last round first
+    for(uint8_t n = 0; n < _count; n++){
+        if(w->pendingPos == w->pendingCount){
+            uint8_t src = (w->txNext + n) % _count;
+            if(src == w->id) continue;
+            w->pendingCount = queue(src, w->id).pop(w->pending, MM_GW_BATCH);
+            w->pendingPos = 0;
+            if(w->pendingCount == 0) continue;
+        }
+        uint8_t done = w->iface->SendBatch(&w->pending[w->pendingPos], w->pendingCount - w->pendingPos);
+        w->pendingPos += done;
+        sent += done;
+        if(w->pendingPos < w->pendingCount) break;  //Interface busy, retry the rest later
+    }
+    w->txNext = (w->txNext + 1) % _count;
+
+    if(w->stream != NULL) w->stream->flush();
+    count(w->tx, sent);
+    return sent;
+}
+
+void MM_ThreadedGateway::sleep(Worker *w){
+    //Announce the sleep before checking the queues, a producer checks the flag after pushing
+    w->sleeping.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for(uint8_t src = 0; src < _count; src++){
+        if(src != w->id && queue(src, w->id).pending()){
+            w->sleeping.store(false, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    struct pollfd fds[2];
+    nfds_t n = 0;
+    fds[n].fd = w->wakeFd;
+    fds[n++].events = POLLIN;
+    if(w->fd >= 0){
+        fds[n].fd = w->fd;
+        fds[n++].events = POLLIN | (w->stream != NULL && w->stream->wantsWrite() ? POLLOUT : 0);
+    }
+
+    int timeout = -1;
+    if(w->pendingPos < w->pendingCount || w->fd < 0) timeout = MM_GW_RETRY_DELAY;
+
+    w->seen.store(MM_GW_OFFLINE);
+    count(w->sleeps, 1);
+    if(_running.load()) poll(fds, n, timeout);
+
+    if(fds[0].revents & POLLIN){
+        uint64_t value;
+        if(read(w->wakeFd, &value, sizeof(value)) < 0) value = 0;
+    }
+    w->sleeping.store(false, std::memory_order_relaxed);
+    quiescent(w);
+}
+
+void MM_ThreadedGateway::wake(uint32_t mask){
+    //Pairs with the fence in sleep(): either the sleeper sees the packets or we see the flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t one = 1;
+    for(uint8_t busId = 0; busId < _count; busId++){
+        if((mask & (1UL << busId)) && _workers[busId]->sleeping.load(std::memory_order_relaxed)){
+            if(write(_workers[busId]->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) continue;
+        }
+    }
+}
+
+bool MM_ThreadedGateway::duplicate(const MM_Packet &pkg){
+    if(_dupWindow == 0) return false;
+
+    uint32_t h = MM_DupCache::hash(pkg);
+    uint64_t tag = h >> 16;
+    if(tag == 0) tag = 1;   //0 marks a free entry
+    uint8_t busId = pkg.meta.busId;
+    uint16_t now = millis();
+
+    //Racing threads may overwrite each others entries, that only costs a missed duplicate
+    std::atomic<uint64_t> &entry = _dups[h & (MM_GW_DUP_CACHE_SIZE - 1)];
+    uint64_t old = entry.load(std::memory_order_relaxed);
+    if((old >> 24) == tag && (uint16_t)(now - (old & 0xFFFF)) < _dupWindow){
+        //Same interface: the sender repeated the packet, not a loop
+        if(((old >> 16) & 0xFF) != busId) return true;
+    }
+    entry.store((tag << 24) | ((uint64_t)busId << 16) | now, std::memory_order_relaxed);
+    return false;
+}
+
+void MM_ThreadedGateway::learn(uint16_t node, signed char busId){
+    std::lock_guard<std::mutex> lock(_routeLock);
+
+    MM_RouteSnapshot *current = _routes.load();
+    if(current->busId[node] == busId) return;   //Learned by another thread meanwhile
+
+    MM_RouteSnapshot *next = new MM_RouteSnapshot(*current);
+    next->busId[node] = busId;
+    next->retired = 0;
+    _lastSeen[node].store(millis(), std::memory_order_relaxed);
+    _routes.store(next);
+
+    //Threads quiescent after this epoch can't hold the old snapshot anymore
+    current->retired = _epoch.fetch_add(1) + 1;
+    _retired.push_back(current);
+    _learned.fetch_add(1, std::memory_order_relaxed);
+
+    reclaim();
+}
+
+void MM_ThreadedGateway::reclaim(){
+    uint64_t oldest = MM_GW_OFFLINE;
+    for(uint8_t i = 0; i < _count; i++){
+        uint64_t seen = _workers[i]->seen.load();
+        if(seen < oldest) oldest = seen;
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < _retired.size(); i++){
+        if(_retired[i]->retired <= oldest){
+            delete _retired[i];
+        }else{
+            _retired[kept++] = _retired[i];
+        }
+    }
+    _retired.resize(kept);
+}
+
+void MM_ThreadedGateway::quiescent(Worker *w){
+    w->seen.store(_epoch.load());
+}
@@ -0,0 +1,284 @@
+/*
+    MM_Sysbus threaded gateway (Linux)
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_ThreadedGateway__
+#define __MM_ThreadedGateway__
+
+#include <Arduino.h>
+#include "MM_Interface.h"
+#include "MM_Routing.h"
+#include "MM_SpscQueue.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class MM_FdStream;
+
+//Max number of interfaces of the threaded gateway
+#ifndef MM_GW_MAX_INTERFACES
+    #define MM_GW_MAX_INTERFACES 16
+#endif
+
+//Packets in the queue between two interfaces, a power of two
+#ifndef MM_GW_QUEUE_SIZE
+    #define MM_GW_QUEUE_SIZE 256
+#endif
+
+//Packets a thread receives (or sends) in a row before it serves the other direction
+#ifndef MM_GW_BATCH
+    #define MM_GW_BATCH 32
+#endif
+
+//Milliseconds a thread sleeps while a packet waits for a retry
+#ifndef MM_GW_RETRY_DELAY
+    #define MM_GW_RETRY_DELAY 1
+#endif
+
+//Entries of the shared duplicate cache, a power of two
+#ifndef MM_GW_DUP_CACHE_SIZE
+    #define MM_GW_DUP_CACHE_SIZE 256
+#endif
+
+static_assert((MM_GW_DUP_CACHE_SIZE & (MM_GW_DUP_CACHE_SIZE - 1)) == 0, "MM_GW_DUP_CACHE_SIZE must be a power of two");
+static_assert(MM_GW_MAX_INTERFACES <= 32, "the wakeup mask has 32 bit");
+
+//Node addresses covered by the routing table (source addresses are 11 bit)
+#define MM_GW_NODES 2048
+
+/**
+ * Immutable routing table, replaced as a whole when a route changes
+ */
+struct MM_RouteSnapshot {
+    /**
+     * Interface-id of every node address, -1 = unknown
+     */
+    signed char busId[MM_GW_NODES];
+
+    /**
+     * Epoch in which the snapshot was replaced, it can be freed when all threads
+     * passed a quiescent state in a later epoch
+     */
+    uint64_t retired = 0;
+};
+
+/**
+ * Counters of one interface of the threaded gateway
+ */
+struct MM_GatewayPortStats {
+    /**
+     * Packets received / sent
+     */
+    uint32_t rx = 0;
+    uint32_t tx = 0;
+
+    /**
+     * Rounds in which the thread didn't receive because a queue to another interface was full
+     */
+    uint32_t queueFull = 0;
+
+    /**
+     * Times the thread went to sleep
+     */
+    uint32_t sleeps = 0;
+};
+
+/**
+ * Router with one thread per interface, for Linux gateways bridging many buses
+ *
+ * Every thread receives from its interface, looks up the target in the routing table and
+ * hands the packet to the threads of the target interfaces through a lock-free SPSC queue
+ * (one queue per pair of interfaces), then sends what the other threads queued for it.
+ * A thread only receives as many packets as all its outgoing queues can take, so a slow
+ * interface backs up into the buffers of the others instead of losing packets in between.
+ *
+ * The routing table is an immutable snapshot read without locks. A thread that learns a
+ * new route copies the snapshot, changes the copy and publishes it, the old snapshot is
+ * freed once every thread passed a quiescent state (RCU with quiescent states: a thread is
+ * quiescent between two rounds of its loop and while it sleeps).
+ *
+ * Threads sleep in poll() on the descriptor of their interface and an eventfd the other
+ * threads write to when they queue packets for a sleeping thread.
+ * The gateway is a pure router (node id 0), it doesn't process packets itself.
+ */
+class MM_ThreadedGateway {
+public:
+    MM_ThreadedGateway();
+    ~MM_ThreadedGateway();
+
+    /**
+     * Attach an interface, only before start()
+     * The interface is started with begin() and set to receive everything.
+     * @param iface interface, only used by its thread once started
+     * @param fd descriptor to wait for received data, -1 = poll every millisecond
+     * @param stream stream under the interface, flushed after every batch (MM_UART over a MM_FdStream)
+     * @return false if the interface can't be started or all MM_GW_MAX_INTERFACES are used
+     */
+    bool attach(MM_Interface *iface, int fd = -1, MM_FdStream *stream = NULL);
+
+    /**
+     * Start one thread per interface
+     * @param spin never sleep, poll the interfaces continuously (lowest latency, one core per interface)
+     * @param cpus pin the threads round robin to the first cpus cores, 0 = don't pin
+     * @return false if a thread or eventfd couldn't be created
+     */
+    bool start(bool spin = false, uint8_t cpus = 0);
+
+    /**
+     * Stop and join the threads
+     */
+    void stop();
+
+    /**
+     * Number of attached interfaces
+     */
+    uint8_t interfaces();
+
+    /**
+     * Counters of an interface
+     */
+    MM_GatewayPortStats portStats(uint8_t busId);
+
+    /**
+     * Routing counters of all threads
+     */
+    MM_RoutingStats routingStats();
+
+    /**
+     * Set the time after which a learned route expires, only before start()
+     * @param ms aging time in milliseconds
+     */
+    void setRouteAgingTime(uint32_t ms);
+
+    /**
+     * Set the window in which an identical packet is dropped as duplicate, only before start()
+     * @param ms window in milliseconds, 0 disables the duplicate cache
+     */
+    void setDuplicateWindow(uint16_t ms);
+
+private:
+    struct Worker;
+
+    /**
+     * Thread function of an interface
+     */
+    void run(Worker *w);
+
+    /**
+     * Packets that can be received without overflowing a queue to another interface
+     */
+    uint32_t rxRoom(Worker *w);
+
+    /**
+     * Learn, look up and queue a received packet for the target interfaces
+     */
+    void route(Worker *w, MM_Packet &pkg, uint32_t &wake);
+
+    /**
+     * Send the pending and queued packets of an interface
+     * @return packets sent
+     */
+    uint32_t transmit(Worker *w);
+
+    /**
+     * Sleep until data arrives, another thread queues packets or a retry is due
+     */
+    void sleep(Worker *w);
+
+    /**
+     * Wake the threads in the bitmask that sleep
+     */
+    void wake(uint32_t mask);
+
+    /**
+     * Check and remember a packet in the shared duplicate cache
+     * @return true if the packet is a duplicate
+     */
+    bool duplicate(const MM_Packet &pkg);
+
+    /**
+     * Publish a snapshot with the new route of a node
+     */
+    void learn(uint16_t node, signed char busId);
+
+    /**
+     * Free the replaced snapshots no thread can read anymore, called with _routeLock held
+     */
+    void reclaim();
+
+    /**
+     * Mark the thread quiescent: it holds no snapshot pointer from before this call
+     */
+    void quiescent(Worker *w);
+
+    /**
+     * Queue of the packets from interface src to interface dst
+     */
+    MM_SpscQueue<MM_Packet, MM_GW_QUEUE_SIZE> &queue(uint8_t src, uint8_t dst);
+
+    Worker *_workers[MM_GW_MAX_INTERFACES] = {};
+    uint8_t _count = 0;
+
+    /**
+     * MM_GW_MAX_INTERFACES x MM_GW_MAX_INTERFACES queues, cache line aligned
+     */
+    MM_SpscQueue<MM_Packet, MM_GW_QUEUE_SIZE> *_queues = NULL;
+
+    std::atomic<bool> _running{false};
+
+    /**
+     * Current routing table
+     */
+    std::atomic<MM_RouteSnapshot*> _routes{NULL};
+
+    /**
+     * Time(millis()) a node was last seen, refreshed at most once a second
+     */
+    std::atomic<uint32_t> _lastSeen[MM_GW_NODES];
+
+    uint32_t _agingTime = ROUTING_AGING_TIME;
+    uint16_t _dupWindow = DUP_CACHE_WINDOW;
+    bool _spin = false;
+
+    /**
+     * Serializes route changes, readers never take it
+     */
+    std::mutex _routeLock;
+
+    /**
+     * Replaced snapshots waiting for the grace period
+     */
+    std::vector<MM_RouteSnapshot*> _retired;
+
+    /**
+     * Incremented whenever a snapshot is replaced
+     */
+    std::atomic<uint64_t> _epoch{1};
+
+    std::atomic<uint32_t> _learned{0};
+
+    /**
+     * Shared duplicate cache: upper 16 bit of the packet hash, the interface-id
+     * it was first received on and 16 bit of millis() per entry
+     */
+    std::atomic<uint64_t> _dups[MM_GW_DUP_CACHE_SIZE];
+};
+
+#endif
@@ -0,0 +1,65 @@
+/*
+    MM_Sysbus Host HAL - Print
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Host_Print__
+#define __MM_Host_Print__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Formatted output like the Arduino Print class
+ */
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str);
+
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const char *str);
+    size_t print(char c);
+    size_t print(unsigned char n, int base = DEC_BASE);
+    size_t print(int n, int base = DEC_BASE);
+    size_t print(unsigned int n, int base = DEC_BASE);
+    size_t print(long n, int base = DEC_BASE);
+    size_t print(unsigned long n, int base = DEC_BASE);
+    size_t print(double n, int digits = 2);
+
+    size_t println();
+    size_t println(const char *str);
+    size_t println(char c);
+    size_t println(unsigned char n, int base = DEC_BASE);
+    size_t println(int n, int base = DEC_BASE);
+    size_t println(unsigned int n, int base = DEC_BASE);
+    size_t println(long n, int base = DEC_BASE);
+    size_t println(unsigned long n, int base = DEC_BASE);
+    size_t println(double n, int digits = 2);
+
+private:
+    static const int DEC_BASE = 10;
+
+    size_t printNumber(unsigned long n, int base);
+};
+
+#endif
@@ -0,0 +1,37 @@
+/*
+    MM_Sysbus Host HAL - SPI stub
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Host_SPI__
+#define __MM_Host_SPI__
+
+#include <stdint.h>
+
+/**
+ * No SPI bus on the host
+ */
+class SPIClass {
+public:
+    void begin() {}
+    void end() {}
+    void usingInterrupt(uint8_t interruptNumber) {}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,76 @@
+/*
+    MM_Sysbus Host HAL - MCP_CAN stub
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Host_mcp_can__
+#define __MM_Host_mcp_can__
+
+#include <stdint.h>
+
+#define CAN_OK          0
+#define CAN_FAILINIT    1
+#define CAN_FAILTX      2
+#define CAN_MSGAVAIL    3
+#define CAN_NOMSG       4
+
+#define MCP_ANY     0
+#define MCP_STD     1
+#define MCP_EXT     2
+#define MCP_STDEXT  3
+
+#define MCP_NORMAL      0x00
+#define MCP_SLEEP       0x20
+#define MCP_LOOPBACK    0x40
+#define MCP_LISTENONLY  0x60
+
+#define MCP_20MHZ   0
+#define MCP_16MHZ   1
+#define MCP_8MHZ    2
+
+#define CAN_5KBPS     1
+#define CAN_10KBPS    2
+#define CAN_20KBPS    3
+#define CAN_31K25BPS  4
+#define CAN_33K3BPS   5
+#define CAN_40KBPS    6
+#define CAN_50KBPS    7
+#define CAN_80KBPS    8
+#define CAN_100KBPS   9
+#define CAN_125KBPS  10
+#define CAN_200KBPS  11
+#define CAN_250KBPS  12
+#define CAN_500KBPS  13
+#define CAN_1000KBPS 14
+
+/**
+ * There is no MCP2515 on the host, begin() fails and nothing is received
+ * Use an in-memory or SocketCAN interface instead of MM_CAN
+ */
+class MCP_CAN {
+public:
+    MCP_CAN(uint8_t cs) {}
+    uint8_t begin(uint8_t idmodeset, uint8_t speedset, uint8_t clockset) { return CAN_FAILINIT; }
+    uint8_t setMode(uint8_t opMode) { return CAN_OK; }
+    uint8_t init_Mask(uint8_t num, uint8_t ext, uint32_t ulData) { return CAN_OK; }
+    uint8_t init_Filt(uint8_t num, uint8_t ext, uint32_t ulData) { return CAN_OK; }
+    uint8_t sendMsgBuf(uint32_t id, uint8_t ext, uint8_t len, uint8_t *buf) { return CAN_FAILTX; }
+    uint8_t readMsgBuf(uint32_t *id, uint8_t *len, uint8_t *buf) { return CAN_NOMSG; }
+    uint8_t checkReceive() { return CAN_NOMSG; }
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+    MM_Sysbus CAN filter plan tests
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MM_Test.h"
+#include <MM_CANFilter.h>
+
+//Filter banks of the tested controller: broadcast, unicast and 3 groups fit exactly
+#define BANKS 5
+
+/**
+ * 29 bit frame id, layout of MM_CAN::CanAddrAssemble without the extended flag
+ */
+static uint32_t frameId(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port){
+    uint32_t id = (uint32_t)type << 27;
+    if(type != Multicast) id |= (uint32_t)port << 23;
+    return id | ((uint32_t)target << 11) | source;
+}
+
+static bool accepted(const MM_CANMask *masks, uint8_t used, uint32_t id){
+    for(uint8_t i = 0; i < used; i++){
+        if((id & masks[i].mask) == (masks[i].id & masks[i].mask)) return true;
+    }
+    return false;
+}
+
+/**
+ * Frames node 5 needs: broadcasts, streams, unicasts to 5 on any port and the groups
+ */
+static void checkNeeded(const MM_CANMask *masks, uint8_t used, const uint16_t *groups, uint8_t count){
+    for(uint8_t port = 0; port < 32; port += 7){
+        MM_CHECK(accepted(masks, used, frameId(Broadcast, 0, 12, port)));
+        MM_CHECK(accepted(masks, used, frameId(Streaming, 5, 12, port)));
+        MM_CHECK(accepted(masks, used, frameId(Unicast, 5, 0x7FF, port)));
+    }
+    for(uint8_t i = 0; i < count; i++){
+        MM_CHECK(accepted(masks, used, frameId(Multicast, groups[i], 12, 0)));
+    }
+}
+
+static void testPlanFits(){
+    const uint16_t groups[3] = {0x100, 0x8001, 0xFFFF};
+    MM_CANMask masks[BANKS];
+    for(uint8_t count = 0; count <= 3; count++){
+        uint8_t used = MM_CANFilterPlan(5, groups, count, masks, BANKS);
+        MM_CHECK_EQ(used, 2 + count);
+        checkNeeded(masks, used, groups, count);
+
+        //Exact pairs, nothing else passes
+        MM_CHECK(!accepted(masks, used, frameId(Unicast, 6, 12, 0)));
+        MM_CHECK(!accepted(masks, used, frameId(Unicast, 5 | 0x400, 12, 0)));
+        MM_CHECK(!accepted(masks, used, frameId(Multicast, 0x101, 12, 0)));
+    }
+
+    //A group already covered takes no bank
+    const uint16_t twice[2] = {0x100, 0x100};
+    MM_CHECK_EQ(MM_CANFilterPlan(5, twice, 2, masks, BANKS), 3);
+}
+
+static void testPlanOverflow(){
+    const uint16_t groups[8] = {0x100, 0x101, 0x8001, 0x0F00, 0x102, 0x4000, 0xFFFF, 0x103};
+    MM_CANMask masks[BANKS];
+    for(uint8_t count = 4; count <= 8; count++){
+        uint8_t used = MM_CANFilterPlan(5, groups, count, masks, BANKS);
+        MM_CHECK_EQ(used, BANKS);
+        //Merged pairs are wider, but never drop a needed frame
+        checkNeeded(masks, used, groups, count);
+    }
+
+    //The neighbours 0x100/0x101 are merged first and cost a single mask bit
+    uint8_t used = MM_CANFilterPlan(5, groups, 4, masks, BANKS);
+    MM_CHECK(!accepted(masks, used, frameId(Multicast, 0x102, 12, 0)));
+    MM_CHECK(!accepted(masks, used, frameId(Unicast, 6, 12, 0)));
+
+    //Down to a single bank
+    for(uint8_t banks = 1; banks < BANKS; banks++){
+        used = MM_CANFilterPlan(5, groups, 8, masks, banks);
+        MM_CHECK_EQ(used, banks);
+        checkNeeded(masks, used, groups, 8);
+    }
+}
+
+static void testPlanPromiscuous(){
+    const uint16_t groups[1] = {0x100};
+    MM_CANMask masks[BANKS];
+
+    //No node-id yet or no group list: a single pair that accepts everything
+    MM_CHECK_EQ(MM_CANFilterPlan(0, groups, 1, masks, BANKS), 1);
+    MM_CHECK_EQ(masks[0].mask, 0);
+    MM_CHECK(accepted(masks, 1, frameId(Unicast, 77, 12, 3)));
+    MM_CHECK(accepted(masks, 1, frameId(Multicast, 0x1234, 12, 0)));
+
+    MM_CHECK_EQ(MM_CANFilterPlan(5, NULL, 0, masks, BANKS), 1);
+    MM_CHECK_EQ(masks[0].mask, 0);
+
+    MM_CHECK_EQ(MM_CANFilterPlan(5, groups, 1, masks, 0), 0);
+}
+
+int main(){
+    MM_RUN(testPlanFits);
+    MM_RUN(testPlanOverflow);
+    MM_RUN(testPlanPromiscuous);
+    return MM_TEST_RESULT();
+}
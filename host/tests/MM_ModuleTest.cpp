@@ -0,0 +1,128 @@
+/*
+    MM_Sysbus module tests
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MM_Test.h"
+#include <MM_Sysbus.h>
+#include <MM_BasicIO.h>
+
+//Registers of MM_Digital_Out
+#define REG_INVERTED 1
+#define REG_POWER_BACK 2
+
+/**
+ * Node 5 with a MM_Digital_Out on port 2
+ */
+struct Node {
+    MM_Sysbus sysbus;
+    MM_TestInterface bus;
+    MM_Digital_Out out;
+
+    Node() : sysbus(5), out(13, 2, false){
+        sysbus.attachBus(&bus);
+        sysbus.attachModule(&out, 0);
+        //begin() restores the output state, which marks the config dirty
+        sysbus.flushConfig();
+        bus.clearSent();
+    }
+
+    /**
+     * Deliver a command from node 10 to the module
+     */
+    void command(uint8_t len, const uint8_t *data){
+        MM_Packet pkg;
+        bus.inject(Unicast, 5, 10, 2, len, data);
+        MM_CHECK(sysbus.Receive(pkg));
+    }
+
+    uint8_t reg(uint8_t index){
+        uint8_t value = 0xFF;
+        MM_CHECK(out.getRegister(index, value));
+        return value;
+    }
+};
+
+static void testSetAndGetReply(){
+    Node node;
+    uint8_t set[3] = {MM_CMD::CFG_REG_SET, REG_POWER_BACK, 2};
+    node.command(3, set);
+    MM_CHECK_EQ(node.reg(REG_POWER_BACK), 2);
+    MM_CHECK(node.out.configDirty());
+
+    uint8_t get[2] = {MM_CMD::CFG_REG_GET, REG_POWER_BACK};
+    node.command(2, get);
+
+    //Both answered with a CFG_REG_COMMIT broadcast to 0, port 0
+    MM_CHECK_EQ(node.bus.sent.size(), 2);
+    for(uint8_t i = 0; i < node.bus.sent.size(); i++){
+        MM_Packet &reply = node.bus.sent[i];
+        MM_CHECK_EQ(reply.meta.type, Broadcast);
+        MM_CHECK_EQ(reply.meta.target, 0);
+        MM_CHECK_EQ(reply.meta.port, 0);
+        MM_CHECK_EQ(reply.len, 3);
+        MM_CHECK_EQ(reply.data[0], MM_CMD::CFG_REG_COMMIT);
+        MM_CHECK_EQ(reply.data[1], REG_POWER_BACK);
+        MM_CHECK_EQ(reply.data[2], 2);
+    }
+}
+
+static void testSetMulti(){
+    Node node;
+    uint8_t set[5] = {MM_CMD::CFG_REG_SET_MULTI, REG_INVERTED, 1, REG_POWER_BACK, 0};
+    node.command(5, set);
+    MM_CHECK_EQ(node.reg(REG_INVERTED), 1);
+    MM_CHECK_EQ(node.reg(REG_POWER_BACK), 0);
+    MM_CHECK(node.out.configDirty());
+    MM_CHECK_EQ(node.bus.sent.size(), 1);
+    MM_CHECK_EQ(node.bus.sent[0].data[0], MM_CMD::ACK);
+    MM_CHECK_EQ(node.bus.sent[0].data[2], 2);
+}
+
+static void testSetMultiRollsBack(){
+    Node node;
+    uint8_t inverted = node.reg(REG_INVERTED);
+    uint8_t powerBack = node.reg(REG_POWER_BACK);
+
+    //The second value is out of range, the first pair must not stay applied
+    uint8_t set[5] = {MM_CMD::CFG_REG_SET_MULTI, REG_INVERTED, !inverted, REG_POWER_BACK, 3};
+    node.command(5, set);
+    MM_CHECK_EQ(node.reg(REG_INVERTED), inverted);
+    MM_CHECK_EQ(node.reg(REG_POWER_BACK), powerBack);
+    MM_CHECK(!node.out.configDirty());
+    MM_CHECK_EQ(node.bus.sent.size(), 1);
+    MM_CHECK_EQ(node.bus.sent[0].data[0], MM_CMD::ERROR);
+
+    //The same register twice, the last valid value is restored
+    uint8_t twice[7] = {MM_CMD::CFG_REG_SET_MULTI, REG_POWER_BACK, 2, REG_POWER_BACK, 0, REG_POWER_BACK, 7};
+    node.command(7, twice);
+    MM_CHECK_EQ(node.reg(REG_POWER_BACK), powerBack);
+    MM_CHECK(!node.out.configDirty());
+
+    //Unknown register, nothing applied
+    uint8_t unknown[5] = {MM_CMD::CFG_REG_SET_MULTI, REG_INVERTED, !inverted, 9, 0};
+    node.command(5, unknown);
+    MM_CHECK_EQ(node.reg(REG_INVERTED), inverted);
+    MM_CHECK(!node.out.configDirty());
+}
+
+int main(){
+    MM_RUN(testSetAndGetReply);
+    MM_RUN(testSetMulti);
+    MM_RUN(testSetMultiRollsBack);
+    return MM_TEST_RESULT();
+}
@@ -0,0 +1,138 @@
+/*
+    MM_Sysbus receive policy tests
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MM_Test.h"
+#include <MM_Sysbus.h>
+
+#define FLOOD_PACKETS 60
+#define QUIET_PACKETS 5
+
+/**
+ * Node 5 with a flooded interface 0 and a quiet interface 1
+ */
+struct Node {
+    MM_Sysbus sysbus;
+    MM_TestInterface flood;
+    MM_TestInterface quiet;
+
+    Node() : sysbus(5){
+        MM_HostClock::set(0);
+        sysbus.attachBus(&flood);
+        sysbus.attachBus(&quiet);
+        flood.clearSent();
+        quiet.clearSent();
+
+        //Multicasts nobody listens to, distinct payloads so none is a duplicate
+        for(uint8_t i = 0; i < FLOOD_PACKETS; i++){
+            uint8_t data[2] = {0, i};
+            flood.inject(Multicast, 999, 20, 1, 2, data);
+        }
+        for(uint8_t i = 0; i < QUIET_PACKETS; i++){
+            uint8_t data[2] = {1, i};
+            quiet.inject(Multicast, 999, 30, 1, 2, data);
+        }
+    }
+
+    /**
+     * Number of receives until the quiet interface delivered all its packets
+     */
+    uint16_t quietLatency(){
+        MM_Packet pkg;
+        uint16_t received = 0;
+        uint8_t quietReceived = 0;
+        while(quietReceived < QUIET_PACKETS && sysbus.Receive(pkg, false)){
+            received++;
+            if(pkg.meta.busId == 1) quietReceived++;
+        }
+        MM_CHECK_EQ(quietReceived, QUIET_PACKETS);
+        return received;
+    }
+};
+
+static void testPriorityStarves(){
+    Node node;
+    node.sysbus.setReceivePolicy(RX_PRIORITY);
+    //The quiet interface waits until the flood is over
+    MM_CHECK_EQ(node.quietLatency(), FLOOD_PACKETS + QUIET_PACKETS);
+}
+
+static void testRoundRobinAlternates(){
+    Node node;
+    node.sysbus.setReceivePolicy(RX_ROUND_ROBIN);
+    MM_CHECK_EQ(node.quietLatency(), 2 * QUIET_PACKETS);
+    MM_CHECK_EQ(node.flood.rx.size(), FLOOD_PACKETS - QUIET_PACKETS);
+}
+
+static void testWeightedShares(){
+    Node node;
+    node.sysbus.setReceivePolicy(RX_WEIGHTED);
+    MM_CHECK(node.sysbus.setInterfaceWeight(&node.flood, 3));
+    MM_TestInterface detached;
+    MM_CHECK(!node.sysbus.setInterfaceWeight(&detached, 3));
+    //Three flood packets, then one quiet packet
+    MM_CHECK_EQ(node.quietLatency(), 4 * QUIET_PACKETS);
+    MM_CHECK_EQ(node.flood.rx.size(), FLOOD_PACKETS - 3 * QUIET_PACKETS);
+}
+
+static void testWeightedIdleInterface(){
+    Node node;
+    node.sysbus.setReceivePolicy(RX_WEIGHTED);
+    node.sysbus.setInterfaceWeight(&node.quiet, 4);
+    //Four quiet packets in a row until the quiet interface runs dry, then the flood gets every turn
+    MM_CHECK_EQ(node.quietLatency(), 2 + QUIET_PACKETS);
+
+    MM_Packet pkg;
+    uint16_t received = 0;
+    while(node.sysbus.Receive(pkg, false)){
+        MM_CHECK_EQ(pkg.meta.busId, 0);
+        received++;
+    }
+    MM_CHECK_EQ(received, FLOOD_PACKETS - 2);
+}
+
+static void testLoopBudget(){
+    Node node;
+    node.sysbus.setReceivePolicy(RX_ROUND_ROBIN);
+    node.sysbus.setReceiveBudget(4, 0);
+
+    //Every loop() call drains the budget, both interfaces take turns
+    uint16_t calls = 0;
+    while(!node.quiet.rx.empty()){
+        node.sysbus.loop();
+        MM_CHECK_EQ(node.sysbus.lastReceived(), 4);
+        calls++;
+    }
+    MM_CHECK_EQ(calls, (2 * QUIET_PACKETS + 3) / 4);
+
+    //Only the remaining packets are received
+    node.flood.rx.resize(1);
+    node.sysbus.loop();
+    MM_CHECK_EQ(node.sysbus.lastReceived(), 1);
+    node.sysbus.loop();
+    MM_CHECK_EQ(node.sysbus.lastReceived(), 0);
+}
+
+int main(){
+    MM_RUN(testPriorityStarves);
+    MM_RUN(testRoundRobinAlternates);
+    MM_RUN(testWeightedShares);
+    MM_RUN(testWeightedIdleInterface);
+    MM_RUN(testLoopBudget);
+    return MM_TEST_RESULT();
+}
@@ -0,0 +1,215 @@
+/*
+    MM_Sysbus routing tests
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MM_Test.h"
+#include <MM_Sysbus.h>
+
+static const uint8_t payload[2] = {1, 2};
+
+static void testLearnAndLookup(){
+    MM_HostClock::set(0);
+    MM_RoutingTable table;
+    MM_CHECK_EQ(table.lookup(5), -1);
+
+    table.learn(5, 1);
+    table.learn(6, 2);
+    MM_CHECK_EQ(table.lookup(5), 1);
+    MM_CHECK_EQ(table.lookup(6), 2);
+    MM_CHECK_EQ(table.stats.learned, 2);
+
+    //Node moved to another interface
+    table.learn(5, 0);
+    MM_CHECK_EQ(table.lookup(5), 0);
+    MM_CHECK_EQ(table.stats.learned, 3);
+
+    //Node 0 and unknown interfaces are never learned
+    table.learn(0, 1);
+    table.learn(7, -1);
+    MM_CHECK_EQ(table.lookup(0), -1);
+    MM_CHECK_EQ(table.lookup(7), -1);
+
+    table.forget(2);
+    MM_CHECK_EQ(table.lookup(6), -1);
+    MM_CHECK_EQ(table.lookup(5), 0);
+}
+
+static void testAging(){
+    MM_HostClock::set(0);
+    MM_RoutingTable table;
+    table.setAgingTime(1000);
+    table.learn(5, 1);
+
+    MM_HostClock::set(900000ULL);
+    MM_CHECK_EQ(table.lookup(5), 1);
+    MM_HostClock::set(1001000ULL);
+    MM_CHECK_EQ(table.lookup(5), -1);
+}
+
+static void testFullTableReplacesOldest(){
+    MM_HostClock::set(0);
+    MM_RoutingTable table;
+    for(uint16_t n = 1; n <= ROUTING_TABLE_SIZE; n++){
+        MM_HostClock::set(n * 1000ULL);
+        table.learn(n, n % 3);
+    }
+    MM_HostClock::set((ROUTING_TABLE_SIZE + 1) * 1000ULL);
+    table.learn(100, 2);
+    MM_CHECK_EQ(table.lookup(100), 2);
+    MM_CHECK_EQ(table.lookup(1), -1);
+    MM_CHECK_EQ(table.lookup(2), 2 % 3);
+}
+
+static void testGatewayRoutesLearnedUnicast(){
+    MM_HostClock::set(0);
+    MM_Sysbus gateway(0);
+    MM_TestInterface a, b, c;
+    gateway.attachBus(&a);
+    gateway.attachBus(&b);
+    gateway.attachBus(&c);
+    a.clearSent();
+    b.clearSent();
+    c.clearSent();
+    MM_RoutingStats before = gateway.routingStats();
+    MM_Packet pkg;
+
+    //Unknown target: flooded to all other interfaces
+    a.inject(Unicast, 20, 10, 1, 2, payload);
+    MM_CHECK(gateway.Receive(pkg));
+    MM_CHECK_EQ(a.sent.size(), 0);
+    MM_CHECK_EQ(b.sent.size(), 1);
+    MM_CHECK_EQ(c.sent.size(), 1);
+
+    //Node 20 answers from interface c, node 10 is known to be on a
+    c.inject(Unicast, 10, 20, 1, 2, payload);
+    MM_CHECK(gateway.Receive(pkg));
+    MM_CHECK_EQ(a.sent.size(), 1);
+    MM_CHECK_EQ(b.sent.size(), 1);
+
+    //Now both are known
+    a.inject(Unicast, 20, 10, 2, 2, payload);
+    MM_CHECK(gateway.Receive(pkg));
+    MM_CHECK_EQ(b.sent.size(), 1);
+    MM_CHECK_EQ(c.sent.size(), 2);
+
+    //Broadcasts are always flooded
+    a.inject(Broadcast, 0, 10, 0, 2, payload);
+    MM_CHECK(gateway.Receive(pkg));
+    MM_CHECK_EQ(b.sent.size(), 2);
+    MM_CHECK_EQ(c.sent.size(), 3);
+
+    MM_RoutingStats stats = gateway.routingStats();
+    MM_CHECK_EQ(stats.routed - before.routed, 2);
+    MM_CHECK_EQ(stats.flooded - before.flooded, 2);
+    MM_CHECK_EQ(stats.framesSaved - before.framesSaved, 2);
+}
+
+static void testDetachForgetsRoutes(){
+    MM_HostClock::set(0);
+    MM_Sysbus gateway(0);
+    MM_TestInterface a, b, c;
+    gateway.attachBus(&a);
+    gateway.attachBus(&b);
+    gateway.attachBus(&c);
+    a.clearSent();
+    b.clearSent();
+    c.clearSent();
+    MM_Packet pkg;
+
+    c.inject(Unicast, 10, 20, 1, 2, payload);
+    MM_CHECK(gateway.Receive(pkg));
+    gateway.detachBus(&c);
+
+    //Route to node 20 is gone, the packet is flooded to the remaining interface
+    a.inject(Unicast, 20, 10, 1, 2, payload);
+    MM_CHECK(gateway.Receive(pkg));
+    MM_CHECK_EQ(b.sent.size(), 2);
+}
+
+static void testDupCacheDropsCopyFromOtherInterface(){
+    MM_HostClock::set(0);
+    MM_DupCache cache;
+    MM_Packet pkg = mmPacket(Multicast, 300, 10, 0, 2, payload);
+
+    pkg.meta.busId = 0;
+    MM_CHECK(!cache.check(pkg));
+    //Repeated by the sender on the same segment
+    MM_CHECK(!cache.check(pkg));
+    //Looped back by another gateway
+    pkg.meta.busId = 1;
+    MM_CHECK(cache.check(pkg));
+
+    //Window over
+    MM_HostClock::advance((DUP_CACHE_WINDOW + 1) * 1000ULL);
+    MM_CHECK(!cache.check(pkg));
+
+    cache.setWindow(0);
+    pkg.meta.busId = 2;
+    MM_CHECK(!cache.check(pkg));
+}
+
+static void testLeafNodeKeepsRepeats(){
+    MM_HostClock::set(0);
+    MM_Sysbus node(5);
+    MM_TestInterface bus;
+    node.attachBus(&bus);
+    MM_Packet pkg;
+
+    //A switch sending the same command twice within the window
+    bus.inject(Unicast, 5, 10, 1, 2, payload);
+    bus.inject(Unicast, 5, 10, 1, 2, payload);
+    MM_CHECK(node.Receive(pkg));
+    MM_CHECK(node.Receive(pkg));
+    MM_CHECK_EQ(node.routingStats().duplicates, 0);
+}
+
+static void testGatewayDropsLoopedCopies(){
+    MM_HostClock::set(0);
+    MM_Sysbus gateway(0);
+    MM_TestInterface a, b;
+    gateway.attachBus(&a);
+    gateway.attachBus(&b);
+    a.clearSent();
+    b.clearSent();
+    MM_Packet pkg;
+
+    //Repeats on the same segment are forwarded
+    a.inject(Multicast, 300, 10, 0, 2, payload);
+    a.inject(Multicast, 300, 10, 0, 2, payload);
+    MM_CHECK(gateway.Receive(pkg));
+    MM_CHECK(gateway.Receive(pkg));
+    MM_CHECK_EQ(b.sent.size(), 2);
+
+    //A second gateway bridging a and b sends the copy back on b
+    b.inject(Multicast, 300, 10, 0, 2, payload);
+    MM_CHECK(!gateway.Receive(pkg));
+    MM_CHECK_EQ(a.sent.size(), 0);
+    MM_CHECK_EQ(gateway.routingStats().duplicates, 1);
+}
+
+int main(){
+    MM_RUN(testLearnAndLookup);
+    MM_RUN(testAging);
+    MM_RUN(testFullTableReplacesOldest);
+    MM_RUN(testGatewayRoutesLearnedUnicast);
+    MM_RUN(testDetachForgetsRoutes);
+    MM_RUN(testDupCacheDropsCopyFromOtherInterface);
+    MM_RUN(testLeafNodeKeepsRepeats);
+    MM_RUN(testGatewayDropsLoopedCopies);
+    return MM_TEST_RESULT();
+}
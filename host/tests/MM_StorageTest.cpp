@@ -0,0 +1,531 @@
+/*
+    MM_Sysbus EEPROM storage tests
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MM_Test.h"
+#include <MM_Journal.h>
+#include <MM_Layout.h>
+#include <MM_Sysbus.h>
+#include <MM_BasicIO.h>
+#include <string.h>
+#include <algorithm>
+
+/**
+ * Erased EEPROM without write latency
+ */
+static void freshEEPROM(){
+    MM_EEPROM::flush();
+    EEPROM.setWriteLatency(0);
+    EEPROM.erase();
+}
+
+static void fill(uint8_t *buf, uint8_t len, uint8_t seed){
+    for(uint8_t i = 0; i < len; i++) buf[i] = seed + i * 3;
+}
+
+static void testEEPROMQueueIsCoherent(){
+    freshEEPROM();
+    MM_EEPROM::update(10, 1);
+    MM_EEPROM::update(11, 2);
+    MM_EEPROM::update(10, 3);
+    MM_CHECK(MM_EEPROM::busy());
+    MM_CHECK_EQ(MM_EEPROM::read(10), 3);
+    MM_CHECK_EQ(EEPROM.read(10), 0xFF);
+
+    MM_EEPROM::flush();
+    MM_CHECK(!MM_EEPROM::busy());
+    MM_CHECK_EQ(EEPROM.read(10), 3);
+    MM_CHECK_EQ(EEPROM.read(11), 2);
+
+    //Unchanged bytes cost no write
+    uint32_t writes = EEPROM.writes();
+    MM_EEPROM::update(10, 3);
+    MM_EEPROM::flush();
+    MM_CHECK_EQ(EEPROM.writes(), writes);
+
+    //A barrier keeps both values in order instead of changing the queued one
+    MM_EEPROM::update(20, 1);
+    MM_EEPROM::update(21, 1);
+    MM_EEPROM::barrier();
+    MM_EEPROM::update(20, 2);
+    MM_EEPROM::update(21, 1);
+    MM_EEPROM::update(20, 4);
+    MM_CHECK_EQ(MM_EEPROM::read(20), 4);
+    writes = EEPROM.writes();
+    MM_EEPROM::tick();
+    MM_CHECK_EQ(EEPROM.read(20), 1);
+    MM_EEPROM::flush();
+    MM_CHECK_EQ(EEPROM.read(20), 4);
+    MM_CHECK_EQ(EEPROM.writes() - writes, 3);
+}
+
+static void testJournalRoundTrip(){
+    freshEEPROM();
+    uint8_t data[20];
+    uint8_t buf[20];
+    {
+        MM_Journal journal;
+        journal.begin(0, 128);
+        fill(data, 10, 1);
+        MM_CHECK(journal.write(1, data, 10));
+        fill(data, 3, 50);
+        MM_CHECK(journal.write(2, data, 3));
+        fill(data, 10, 9);
+        MM_CHECK(journal.write(1, data, 10));
+        MM_CHECK(journal.erase(2));
+        MM_CHECK(!journal.write(0, data, 1));
+        MM_CHECK(!journal.write(MM_JOURNAL_KEYS + 1, data, 1));
+        MM_EEPROM::flush();
+    }
+
+    //Reopened from EEPROM
+    MM_Journal journal;
+    journal.begin(0, 128);
+    MM_CHECK_EQ(journal.read(1, buf, sizeof(buf)), 10);
+    MM_CHECK(memcmp(buf, data, 10) == 0);
+    MM_CHECK_EQ(journal.read(2, buf, sizeof(buf)), 0);
+}
+
+static void testJournalCompacts(){
+    freshEEPROM();
+    uint8_t data[8];
+    uint8_t buf[8];
+    MM_Journal journal;
+    journal.begin(0, 128);
+
+    //Far more writes than fit in one bank
+    for(uint8_t i = 0; i < 100; i++){
+        fill(data, 8, i);
+        MM_CHECK(journal.write(1 + i % 3, data, 8));
+    }
+    MM_CHECK(journal.generation() > 0);
+    MM_EEPROM::flush();
+
+    MM_Journal reopened;
+    reopened.begin(0, 128);
+    for(uint8_t key = 1; key <= 3; key++){
+        //Last write of the key
+        fill(data, 8, 99 - (99 - (key - 1)) % 3);
+        MM_CHECK_EQ(reopened.read(key, buf, sizeof(buf)), 8);
+        MM_CHECK(memcmp(buf, data, 8) == 0);
+    }
+    MM_CHECK_EQ(reopened.generation(), journal.generation());
+}
+
+static void testJournalPowerLoss(){
+    uint8_t old[2] = {0x11, 0x12};
+    uint8_t next[2] = {0x21, 0x22};
+    uint8_t buf[2];
+    bool completed = false;
+    int failures = mmTestFailures;
+
+    //Power fails after every possible number of writes of a compaction and a following write
+    for(uint32_t limit = 0; !completed; limit++){
+        //Leftovers of an older layout, the unused bank looks like generation 5
+        freshEEPROM();
+        memset(EEPROM.data(), 5, 64);
+        {
+            MM_Journal journal;
+            journal.begin(0, 64);
+            for(uint8_t key = 1; key <= 3; key++){
+                old[0] = 0x10 + key;
+                MM_CHECK(journal.write(key, old, 2));
+            }
+            MM_EEPROM::flush();
+            uint32_t writes = EEPROM.writes();
+
+            EEPROM.setWriteLimit(limit);
+            //Writes of key 1 crossing several compactions, with the queue drained in between
+            //The results don't matter once the power is gone
+            for(uint8_t i = 0; i < 12; i++){
+                next[1] = 0x22 + i;
+                journal.write(1, next, 2);
+                if(i % 3 == 0) journal.compact();
+                if(i % 4 == 0) MM_EEPROM::flush();
+            }
+            MM_EEPROM::flush();
+            EEPROM.setWriteLimit(MM_HOST_EEPROM_NO_LIMIT);
+
+            //All writes got through
+            completed = EEPROM.writes() - writes < limit;
+        }
+
+        MM_Journal journal;
+        journal.begin(0, 64);
+        MM_CHECK_EQ(journal.read(1, buf, sizeof(buf)), 2);
+        bool isNew = buf[0] == next[0] && buf[1] == next[1];
+        MM_CHECK(isNew || (buf[0] == 0x11 && buf[1] == old[1]) || (buf[0] == next[0] && buf[1] >= 0x22 && buf[1] < next[1]));
+        for(uint8_t key = 2; key <= 3; key++){
+            MM_CHECK_EQ(journal.read(key, buf, sizeof(buf)), 2);
+            MM_CHECK_EQ(buf[0], 0x10 + key);
+        }
+        if(completed) MM_CHECK(isNew);
+        if(mmTestFailures != failures){
+            fprintf(stderr, "  power lost after %u writes\n", limit);
+            return;
+        }
+    }
+}
+
+static void testLayoutRoundTrip(){
+    freshEEPROM();
+    uint8_t data[32];
+    uint8_t buf[32];
+    {
+        MM_Layout layout;
+        layout.begin(100, 200);
+        layout.format();
+        for(uint8_t id = 0; id < 3; id++){
+            fill(data, 10, id * 10);
+            MM_CHECK(layout.write(id, 0, 7 + id, data, 10));
+            fill(data, 4, id * 20);
+            MM_CHECK(layout.write(id, 1, 7 + id, data, 4));
+        }
+
+        //Module 0 grows, module 1 shrinks, the others must be untouched
+        fill(data, 20, 99);
+        MM_CHECK(layout.write(0, 0, 7, data, 20));
+        fill(data, 2, 77);
+        MM_CHECK(layout.write(1, 0, 8, data, 2));
+        MM_EEPROM::flush();
+    }
+
+    MM_Layout layout;
+    layout.begin(100, 200);
+    fill(data, 20, 99);
+    MM_CHECK_EQ(layout.read(0, 0, 7, buf, sizeof(buf)), 20);
+    MM_CHECK(memcmp(buf, data, 20) == 0);
+    fill(data, 2, 77);
+    MM_CHECK_EQ(layout.read(1, 0, 8, buf, sizeof(buf)), 2);
+    MM_CHECK(memcmp(buf, data, 2) == 0);
+    fill(data, 10, 20);
+    MM_CHECK_EQ(layout.read(2, 0, 9, buf, sizeof(buf)), 10);
+    MM_CHECK(memcmp(buf, data, 10) == 0);
+    for(uint8_t id = 0; id < 3; id++){
+        fill(data, 4, id * 20);
+        MM_CHECK_EQ(layout.read(id, 1, 7 + id, buf, sizeof(buf)), 4);
+        MM_CHECK(memcmp(buf, data, 4) == 0);
+    }
+
+    //Wrong module type or erased record
+    MM_CHECK_EQ(layout.read(2, 0, 8, buf, sizeof(buf)), 0);
+    MM_CHECK(layout.erase(2, 0));
+    MM_CHECK_EQ(layout.read(2, 0, 9, buf, sizeof(buf)), 0);
+    MM_CHECK_EQ(layout.read(2, 1, 9, buf, sizeof(buf)), 4);
+
+    //A new module type drops the records of the old one, also after a second reset
+    layout.invalidate(1);
+    MM_CHECK_EQ(layout.read(1, 0, 8, buf, sizeof(buf)), 0);
+    layout.invalidate(1);
+    MM_EEPROM::flush();
+    MM_Layout reloaded;
+    reloaded.begin(100, 200);
+    MM_CHECK_EQ(reloaded.read(1, 0, 8, buf, sizeof(buf)), 0);
+    MM_CHECK_EQ(reloaded.read(1, 1, 8, buf, sizeof(buf)), 0);
+    MM_CHECK_EQ(reloaded.read(0, 1, 7, buf, sizeof(buf)), 4);
+}
+
+static void testLayoutWritePart(){
+    freshEEPROM();
+    uint8_t data[16];
+    uint8_t buf[16];
+    MM_Layout layout;
+    layout.begin(0, 200);
+    layout.format();
+
+    fill(data, 8, 1);
+    MM_CHECK(layout.write(0, 0, 3, data, 8));
+    MM_CHECK(layout.write(1, 0, 4, data, 8));
+    uint8_t part[4] = {0xA0, 0xA1, 0xA2, 0xA3};
+    MM_CHECK(layout.writePart(0, 0, 3, 2, part, 2));
+    MM_CHECK(!layout.writePart(0, 0, 9, 2, part, 2));
+
+    //Growing part
+    MM_CHECK(layout.writePart(0, 0, 3, 6, part, 4));
+    MM_CHECK_EQ(layout.read(0, 0, 3, buf, sizeof(buf)), 10);
+    MM_CHECK_EQ(buf[1], data[1]);
+    MM_CHECK_EQ(buf[2], 0xA0);
+    MM_CHECK_EQ(buf[3], 0xA1);
+    MM_CHECK_EQ(buf[5], data[5]);
+    MM_CHECK_EQ(buf[9], 0xA3);
+    MM_CHECK_EQ(layout.read(1, 0, 4, buf, sizeof(buf)), 8);
+    MM_CHECK(memcmp(buf, data, 8) == 0);
+}
+
+static void testLayoutFull(){
+    freshEEPROM();
+    uint8_t data[200];
+    MM_Layout layout;
+    layout.begin(0, 200);
+    layout.format();
+    fill(data, 200, 0);
+    MM_CHECK(!layout.write(0, 0, 1, data, 200));
+    MM_CHECK(layout.write(0, 0, 1, data, 8));
+    MM_CHECK(layout.used() <= 200);
+}
+
+/**
+ * true if the record holds len bytes of fill(seed)
+ */
+static bool holds(MM_Layout &layout, uint8_t cfgId, uint8_t kind, uint8_t type, uint8_t len, uint8_t seed){
+    uint8_t data[32];
+    uint8_t buf[32];
+    fill(data, len, seed);
+    return layout.read(cfgId, kind, type, buf, sizeof(buf)) == len && memcmp(buf, data, len) == 0;
+}
+
+static void testLayoutDefragments(){
+    freshEEPROM();
+    uint8_t data[16];
+    MM_Layout layout;
+    //40 bytes behind the directory
+    layout.begin(0, 160);
+    layout.format();
+    for(uint8_t id = 0; id < 3; id++){
+        fill(data, 10, id * 10);
+        MM_CHECK(layout.write(id, 0, 7 + id, data, 10));
+    }
+
+    //Neither the freed front nor the end has room for 16 bytes
+    layout.invalidate(0);
+    fill(data, 16, 50);
+    MM_CHECK(layout.write(0, 0, 7, data, 16));
+    MM_CHECK(holds(layout, 0, 0, 7, 16, 50));
+    MM_CHECK(holds(layout, 1, 0, 8, 10, 10));
+    MM_CHECK(holds(layout, 2, 0, 9, 10, 20));
+    MM_CHECK(!layout.write(1, 0, 8, data, 16));
+}
+
+static void testLayoutPowerLoss(){
+    uint8_t data[32];
+    bool completed = false;
+    int failures = mmTestFailures;
+
+    //Power fails after every possible number of writes of growing records
+    for(uint32_t limit = 0; !completed; limit++){
+        freshEEPROM();
+        {
+            MM_Layout layout;
+            layout.begin(0, 220);
+            layout.format();
+            for(uint8_t id = 0; id < 3; id++){
+                fill(data, 8, id * 10);
+                MM_CHECK(layout.write(id, 0, 7 + id, data, 8));
+                fill(data, 4, id * 20);
+                MM_CHECK(layout.write(id, 1, 7 + id, data, 4));
+            }
+            MM_EEPROM::flush();
+            uint32_t writes = EEPROM.writes();
+
+            EEPROM.setWriteLimit(limit);
+            //The results don't matter once the power is gone
+            fill(data, 24, 100);
+            layout.write(0, 0, 7, data, 24);
+            fill(data, 8, 0);
+            layout.writePart(0, 1, 7, 4, data + 4, 4);
+            MM_EEPROM::flush();
+            EEPROM.setWriteLimit(MM_HOST_EEPROM_NO_LIMIT);
+
+            completed = EEPROM.writes() - writes < limit;
+        }
+
+        MM_Layout layout;
+        layout.begin(0, 220);
+        bool grown = holds(layout, 0, 0, 7, 24, 100);
+        bool appended = holds(layout, 0, 1, 7, 8, 0);
+        MM_CHECK(grown || holds(layout, 0, 0, 7, 8, 0));
+        MM_CHECK(appended || holds(layout, 0, 1, 7, 4, 0));
+        for(uint8_t id = 1; id < 3; id++){
+            MM_CHECK(holds(layout, id, 0, 7 + id, 8, id * 10));
+            MM_CHECK(holds(layout, id, 1, 7 + id, 4, id * 20));
+        }
+        if(completed) MM_CHECK(grown && appended);
+        if(mmTestFailures != failures){
+            fprintf(stderr, "  power lost after %u writes\n", limit);
+            return;
+        }
+    }
+}
+
+static void testLayoutRewritePowerLoss(){
+    uint8_t data[32];
+    bool completed = false;
+    int failures = mmTestFailures;
+
+    //Power fails after every possible number of writes of records that keep their size or shrink
+    for(uint32_t limit = 0; !completed; limit++){
+        freshEEPROM();
+        {
+            MM_Layout layout;
+            layout.begin(0, 220);
+            layout.format();
+            for(uint8_t id = 0; id < 3; id++){
+                fill(data, 8, id * 10);
+                MM_CHECK(layout.write(id, 0, 7 + id, data, 8));
+            }
+            MM_EEPROM::flush();
+            uint32_t writes = EEPROM.writes();
+
+            //Unchanged
+            fill(data, 8, 20);
+            MM_CHECK(layout.write(2, 0, 9, data, 8));
+            MM_EEPROM::flush();
+            MM_CHECK_EQ(EEPROM.writes(), writes);
+
+            EEPROM.setWriteLimit(limit);
+            fill(data, 8, 100);
+            layout.write(0, 0, 7, data, 8);
+            fill(data, 5, 150);
+            layout.write(1, 0, 8, data, 5);
+            MM_EEPROM::flush();
+            EEPROM.setWriteLimit(MM_HOST_EEPROM_NO_LIMIT);
+
+            completed = EEPROM.writes() - writes < limit;
+        }
+
+        MM_Layout layout;
+        layout.begin(0, 220);
+        bool rewritten = holds(layout, 0, 0, 7, 8, 100);
+        bool shrunk = holds(layout, 1, 0, 8, 5, 150);
+        MM_CHECK(rewritten || holds(layout, 0, 0, 7, 8, 0));
+        MM_CHECK(shrunk || holds(layout, 1, 0, 8, 8, 10));
+        MM_CHECK(holds(layout, 2, 0, 9, 8, 20));
+        if(completed) MM_CHECK(rewritten && shrunk);
+        if(mmTestFailures != failures){
+            fprintf(stderr, "  power lost after %u writes\n", limit);
+            return;
+        }
+    }
+}
+
+static void testCommitWaitsForQueue(){
+    //Every module commits in the same loop, together they need more than the write queue
+    freshEEPROM();
+    EEPROM.setWriteLatency(MM_HOST_EEPROM_WRITE_US);
+    MM_HostClock::set(0);
+    MM_Sysbus node(5, 0);
+    MM_TestInterface bus;
+    MM_Digital_Out *outs[MAX_MODULES];
+    node.attachBus(&bus);
+    for(uint8_t i = 0; i < MAX_MODULES; i++){
+        outs[i] = new MM_Digital_Out(10 + i, 2 + i, false);
+        node.attachModule(outs[i], i);
+    }
+    node.flushConfig();
+    MM_EEPROM::flush();
+
+    for(uint8_t i = 0; i < MAX_MODULES; i++){
+        uint8_t inverted[3] = {MM_CMD::CFG_REG_SET, 1, 1};
+        uint8_t powerBack[3] = {MM_CMD::CFG_REG_SET, 2, 2};
+        bus.inject(Unicast, 5, 10, 2 + i, 3, inverted);
+        bus.inject(Unicast, 5, 10, 2 + i, 3, powerBack);
+    }
+
+    uint32_t writes = EEPROM.writes();
+    uint64_t longest = 0;
+    for(uint32_t ms = 0; ms < CONFIG_COMMIT_DELAY + 1000; ms++){
+        uint64_t start = MM_HostClock::now();
+        node.loop();
+        longest = std::max(longest, MM_HostClock::now() - start);
+        MM_HostClock::advance(1000);
+    }
+    MM_CHECK(EEPROM.writes() - writes > MM_EEPROM_QUEUE_SIZE);
+    MM_CHECK(longest <= MM_HOST_EEPROM_WRITE_US);
+    MM_CHECK(!MM_EEPROM::busy());
+
+    for(uint8_t i = 0; i < MAX_MODULES; i++){
+        MM_CHECK(!outs[i]->configDirty());
+        delete outs[i];
+    }
+}
+
+/**
+ * Digital output that exposes its multicast targets
+ */
+class TargetOut : public MM_Digital_Out {
+public:
+    TargetOut(uint8_t pin, uint8_t port) : MM_Digital_Out(pin, port, false) {}
+    using MM_Module::checkMulticastTarget;
+};
+
+static void testGroupBatchCommitsBySlot(){
+    //A full batch of targets, stored one slot per loop after GROUPS_BATCH 0
+    freshEEPROM();
+    EEPROM.setWriteLatency(MM_HOST_EEPROM_WRITE_US);
+    MM_HostClock::set(0);
+    MM_TestInterface bus;
+    uint8_t count = MULTICAST_TARGETS;
+    #ifdef MM_USE_JOURNAL
+        //Host targets are padded, a journal record doesn't hold all of them
+        count = std::min<uint8_t>(count, (MM_JOURNAL_RECORD_MAX - 1) / sizeof(MM_Target));
+    #endif
+    {
+        MM_Sysbus node(5, 0);
+        TargetOut out(10, 2);
+        node.attachBus(&bus);
+        node.attachModule(&out, 0);
+        node.flushConfig();
+        MM_EEPROM::flush();
+
+        uint8_t begin[2] = {MM_CMD::GROUPS_BATCH, 1};
+        uint8_t end[2] = {MM_CMD::GROUPS_BATCH, 0};
+        bus.inject(Unicast, 5, 10, 2, 2, begin);
+        for(uint8_t i = 0; i < count; i++){
+            uint8_t add[4] = {MM_CMD::GROUP_ADD, 0x40, i, MM_CMD::ALL_CMDS};
+            bus.inject(Unicast, 5, 10, 2, 4, add);
+        }
+        bus.inject(Unicast, 5, 10, 2, 2, end);
+
+        uint64_t longest = 0;
+        for(uint32_t ms = 0; ms < 1000; ms++){
+            uint64_t start = MM_HostClock::now();
+            node.loop();
+            longest = std::max(longest, MM_HostClock::now() - start);
+            MM_HostClock::advance(1000);
+        }
+        MM_CHECK(!out.configDirty());
+        MM_CHECK(!MM_EEPROM::busy());
+        #ifndef MM_USE_JOURNAL
+            //The journal appends the whole record, the layout writes single slots
+            MM_CHECK(longest <= MM_HOST_EEPROM_WRITE_US);
+        #endif
+    }
+
+    MM_Sysbus node(5, 0);
+    TargetOut out(10, 2);
+    node.attachModule(&out, 0);
+    for(uint8_t i = 0; i < count; i++){
+        MM_CHECK(out.checkMulticastTarget(0x4000 + i, MM_CMD::ALL_CMDS));
+    }
+}
+
+int main(){
+    MM_RUN(testEEPROMQueueIsCoherent);
+    MM_RUN(testJournalRoundTrip);
+    MM_RUN(testJournalCompacts);
+    MM_RUN(testJournalPowerLoss);
+    MM_RUN(testLayoutRoundTrip);
+    MM_RUN(testLayoutWritePart);
+    MM_RUN(testLayoutFull);
+    MM_RUN(testLayoutDefragments);
+    MM_RUN(testLayoutPowerLoss);
+    MM_RUN(testLayoutRewritePowerLoss);
+    MM_RUN(testCommitWaitsForQueue);
+    MM_RUN(testGroupBatchCommitsBySlot);
+    return MM_TEST_RESULT();
+}
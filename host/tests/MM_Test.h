@@ -0,0 +1,144 @@
+/*
+    MM_Sysbus host test helpers
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MM_Test__
+#define __MM_Test__
+
+#include <Arduino.h>
+#include "MM_Interface.h"
+
+#include <stdio.h>
+#include <deque>
+#include <vector>
+
+/**
+ * Minimal test helpers, every test program is one translation unit run by ctest
+ *
+ *   static void testSomething(){ MM_CHECK_EQ(value(), 3); }
+ *   int main(){ MM_RUN(testSomething); return MM_TEST_RESULT(); }
+ */
+
+static int mmTestFailures = 0;
+
+#define MM_CHECK(cond) do{ \
+    if(!(cond)){ \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        mmTestFailures++; \
+    } \
+}while(0)
+
+#define MM_CHECK_EQ(actual, expected) do{ \
+    long long mmActual = (long long)(actual); \
+    long long mmExpected = (long long)(expected); \
+    if(mmActual != mmExpected){ \
+        fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, mmActual, mmExpected); \
+        mmTestFailures++; \
+    } \
+}while(0)
+
+#define MM_RUN(test) do{ \
+    int mmBefore = mmTestFailures; \
+    test(); \
+    fprintf(stderr, "%s %s\n", mmBefore == mmTestFailures ? "PASS" : "FAIL", #test); \
+}while(0)
+
+#define MM_TEST_RESULT() (mmTestFailures == 0 ? 0 : 1)
+
+/**
+ * Build a packet
+ */
+static inline MM_Packet mmPacket(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, const uint8_t *data){
+    MM_Packet pkg;
+    pkg.meta.type = type;
+    pkg.meta.target = target;
+    pkg.meta.source = source;
+    pkg.meta.port = port;
+    pkg.meta.busId = -1;
+    pkg.len = len;
+    for(uint8_t i = 0; i < 8; i++) pkg.data[i] = i < len ? data[i] : 0;
+    return pkg;
+}
+
+/**
+ * Interface fed by the test: received packets are queued in rx, sent packets are recorded
+ */
+class MM_TestInterface : public MM_Interface {
+public:
+    std::deque<MM_Packet> rx;
+    std::vector<MM_Packet> sent;
+
+    /**
+     * Number of the next Send() calls that fail
+     */
+    uint16_t failSends = 0;
+
+    /**
+     * Send() calls, including failed ones
+     */
+    uint32_t attempts = 0;
+
+    /**
+     * Interface on the other end of the wire, gets every sent packet in its rx
+     */
+    MM_TestInterface *peer = NULL;
+
+    /**
+     * Wire two interfaces together
+     */
+    static void link(MM_TestInterface &a, MM_TestInterface &b){
+        a.peer = &b;
+        b.peer = &a;
+    }
+
+    bool begin(){
+        return true;
+    }
+
+    bool Send(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data){
+        attempts++;
+        if(failSends > 0){
+            failSends--;
+            return false;
+        }
+        sent.push_back(mmPacket(type, target, source, port, len, data));
+        if(peer != NULL) peer->rx.push_back(sent.back());
+        return true;
+    }
+
+    bool Receive(MM_Packet &pkg){
+        if(rx.empty()) return false;
+        pkg = rx.front();
+        rx.pop_front();
+        return true;
+    }
+
+    /**
+     * Forget the sent packets, e.g. the boot message of attachBus()
+     */
+    void clearSent(){
+        sent.clear();
+        attempts = 0;
+    }
+
+    void inject(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, const uint8_t *data){
+        rx.push_back(mmPacket(type, target, source, port, len, data));
+    }
+};
+
+#endif
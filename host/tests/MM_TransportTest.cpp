@@ -0,0 +1,182 @@
+/*
+    MM_Sysbus transport tests
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MM_Test.h"
+#include <MM_Sysbus.h>
+#include <string.h>
+
+static uint8_t received[MM_STREAM_MAX_LEN];
+static uint16_t receivedLen = 0;
+static uint16_t receivedFrom = 0;
+static uint8_t receivedPort = 0;
+static uint8_t streams = 0;
+
+static void onStream(uint16_t source, uint8_t port, MM_Stream type, uint8_t *data, uint16_t len){
+    memcpy(received, data, len);
+    receivedLen = len;
+    receivedFrom = source;
+    receivedPort = port;
+    streams++;
+}
+
+/**
+ * Run the nodes until the stream of sender is finished
+ * @return final stream status
+ */
+static MM_StreamStatus pump(MM_Sysbus **nodes, uint8_t count, MM_Sysbus &sender){
+    for(uint16_t ms = 0; ms < 5000; ms++){
+        for(uint8_t i = 0; i < count; i++) nodes[i]->loop();
+        if(sender.streamStatus() != STREAM_BUSY) break;
+        MM_HostClock::advance(1000);
+    }
+    //Let the last frames arrive, loop() only takes a few packets per call
+    for(uint8_t round = 0; round < 50; round++){
+        for(uint8_t i = 0; i < count; i++) nodes[i]->loop();
+    }
+    return sender.streamStatus();
+}
+
+static void fill(uint8_t *data, uint16_t len, uint8_t pattern){
+    for(uint16_t i = 0; i < len; i++){
+        //Pattern 0 repeats the same data frame, only the sequence number differs
+        data[i] = pattern == 0 ? 0 : (uint8_t)(i * 7 + pattern);
+    }
+}
+
+/**
+ * Send streams of different lengths and check them on the receiver
+ */
+static void sendStreams(MM_Sysbus **nodes, uint8_t count, MM_Sysbus &sender, MM_Sysbus &receiver){
+    const uint16_t lengths[] = {3, 40, 60, 61, 100, 128, 200, MM_STREAM_MAX_LEN};
+    uint8_t data[MM_STREAM_MAX_LEN];
+    receiver.attachStreamHandler(onStream);
+
+    for(uint8_t pattern = 0; pattern < 2; pattern++){
+        for(uint8_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++){
+            uint16_t len = lengths[i];
+            fill(data, len, pattern);
+            streams = 0;
+            receivedLen = 0;
+
+            MM_CHECK(sender.SendLarge(receiver.nodeID(), 3, STREAM_RAW, data, len));
+            MM_StreamStatus status = pump(nodes, count, sender);
+            if(status != STREAM_DONE) fprintf(stderr, "  %u bytes: status %d\n", len, status);
+            MM_CHECK_EQ(status, STREAM_DONE);
+            MM_CHECK_EQ(streams, 1);
+            MM_CHECK_EQ(receivedLen, len);
+            MM_CHECK_EQ(receivedFrom, sender.nodeID());
+            MM_CHECK(memcmp(received, data, len) == 0);
+        }
+    }
+}
+
+static void testLeafToLeaf(){
+    MM_HostClock::set(0);
+    MM_Sysbus a(10), b(20);
+    MM_TestInterface ab, ba;
+    MM_TestInterface::link(ab, ba);
+    a.attachBus(&ab);
+    b.attachBus(&ba);
+
+    MM_Sysbus *nodes[2] = {&a, &b};
+    sendStreams(nodes, 2, a, b);
+}
+
+static void testRoutingNodes(){
+    //Both nodes route to a second segment, so their duplicate caches are active
+    MM_HostClock::set(0);
+    MM_Sysbus a(10), b(20);
+    MM_TestInterface ab, ba, ax, bx;
+    MM_TestInterface::link(ab, ba);
+    a.attachBus(&ab);
+    a.attachBus(&ax);
+    b.attachBus(&ba);
+    b.attachBus(&bx);
+
+    MM_Sysbus *nodes[2] = {&a, &b};
+    sendStreams(nodes, 2, a, b);
+}
+
+static void testThroughGateway(){
+    MM_HostClock::set(0);
+    MM_Sysbus a(10), gateway(0), b(20);
+    MM_TestInterface ag, ga, gb, bg;
+    MM_TestInterface::link(ag, ga);
+    MM_TestInterface::link(gb, bg);
+    a.attachBus(&ag);
+    gateway.attachBus(&ga);
+    gateway.attachBus(&gb);
+    b.attachBus(&bg);
+
+    MM_Sysbus *nodes[3] = {&a, &gateway, &b};
+    sendStreams(nodes, 3, a, b);
+    MM_CHECK_EQ(gateway.routingStats().duplicates, 0);
+}
+
+static void testTooLongIsRejected(){
+    MM_HostClock::set(0);
+    MM_Sysbus a(10), b(20);
+    MM_TestInterface ab, ba;
+    MM_TestInterface::link(ab, ba);
+    a.attachBus(&ab);
+    b.attachBus(&ba);
+    b.attachStreamHandler(onStream);
+
+    static uint8_t data[MM_STREAM_MAX_LEN + 1];
+    streams = 0;
+    MM_CHECK(a.SendLarge(20, 3, STREAM_RAW, data, sizeof(data)));
+    MM_Sysbus *nodes[2] = {&a, &b};
+    MM_CHECK_EQ(pump(nodes, 2, a), STREAM_FAILED);
+    MM_CHECK_EQ(streams, 0);
+}
+
+static void testPortRange(){
+    //MM_CAN keeps only 4 port bits of a Streaming frame
+    MM_HostClock::set(0);
+    MM_Sysbus a(10), b(20);
+    MM_TestInterface ab, ba;
+    MM_TestInterface::link(ab, ba);
+    a.attachBus(&ab);
+    b.attachBus(&ba);
+    b.attachStreamHandler(onStream);
+
+    uint8_t data[40];
+    fill(data, sizeof(data), 1);
+    size_t sent = ab.sent.size();
+    MM_CHECK(!a.SendLarge(20, MM_STREAM_MAX_PORT + 1, STREAM_RAW, data, sizeof(data)));
+    MM_CHECK(!a.SendLarge(20, 255, STREAM_RAW, data, sizeof(data)));
+    MM_CHECK_EQ(ab.sent.size(), sent);
+    MM_CHECK(a.streamStatus() != STREAM_BUSY);
+
+    streams = 0;
+    MM_CHECK(a.SendLarge(20, MM_STREAM_MAX_PORT, STREAM_RAW, data, sizeof(data)));
+    MM_Sysbus *nodes[2] = {&a, &b};
+    MM_CHECK_EQ(pump(nodes, 2, a), STREAM_DONE);
+    MM_CHECK_EQ(streams, 1);
+    MM_CHECK_EQ(receivedPort, MM_STREAM_MAX_PORT);
+}
+
+int main(){
+    MM_RUN(testLeafToLeaf);
+    MM_RUN(testRoutingNodes);
+    MM_RUN(testThroughGateway);
+    MM_RUN(testTooLongIsRejected);
+    MM_RUN(testPortRange);
+    return MM_TEST_RESULT();
+}
@@ -0,0 +1,130 @@
+/*
+    MM_Sysbus TX queue tests
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MM_Test.h"
+#include <MM_Sysbus.h>
+
+static uint8_t payload[2] = {1, 2};
+
+static void testBackoffDoubles(){
+    MM_HostClock::set(0);
+    MM_TxQueue queue;
+    MM_Packet pkg = mmPacket(Unicast, 7, 5, 1, 2, payload);
+
+    MM_CHECK(queue.push(pkg));
+    MM_CHECK(queue.ready());
+
+    uint32_t expected = TX_RETRY_DELAY;
+    for(uint8_t i = 0; i < 4; i++){
+        queue.failed();
+        MM_CHECK(!queue.ready());
+        MM_HostClock::advance(expected * 1000ULL - 1);
+        MM_CHECK(!queue.ready());
+        MM_HostClock::advance(1);
+        MM_CHECK(queue.ready());
+        expected *= 2;
+    }
+    MM_CHECK_EQ(queue.stats.retries, 4);
+    MM_CHECK_EQ(queue.stats.depth, 1);
+}
+
+static void testDropAfterMaxRetries(){
+    MM_HostClock::set(0);
+    MM_TxQueue queue;
+    MM_Packet pkg = mmPacket(Unicast, 7, 5, 1, 2, payload);
+    queue.push(pkg);
+
+    for(uint8_t i = 0; i < TX_MAX_RETRIES; i++){
+        queue.failed();
+    }
+    MM_CHECK_EQ(queue.stats.depth, 1);
+    queue.failed();
+    MM_CHECK(queue.empty());
+    MM_CHECK_EQ(queue.stats.drops, 1);
+}
+
+static void testFullQueueDrops(){
+    MM_TxQueue queue;
+    MM_Packet pkg = mmPacket(Unicast, 7, 5, 1, 2, payload);
+    for(uint8_t i = 0; i < TX_QUEUE_SIZE; i++){
+        MM_CHECK(queue.push(pkg));
+    }
+    MM_CHECK(!queue.push(pkg));
+    MM_CHECK_EQ(queue.stats.drops, 1);
+    MM_CHECK_EQ(queue.stats.highWater, TX_QUEUE_SIZE);
+}
+
+static void testSysbusRetriesInOrder(){
+    MM_HostClock::set(0);
+    MM_Sysbus node(5);
+    MM_TestInterface bus;
+    node.attachBus(&bus);
+    bus.clearSent();
+
+    //The interface is busy for the first three attempts
+    bus.failSends = 3;
+    for(uint8_t i = 0; i < 3; i++){
+        payload[0] = i;
+        MM_CHECK(node.Send(Unicast, 7, 1, 2, payload));
+    }
+    MM_CHECK_EQ(bus.sent.size(), 0);
+    MM_CHECK_EQ(node.txStats(0).depth, 3);
+
+    //Retries with backoff from loop() until everything is out
+    for(uint16_t ms = 0; ms < 100 && bus.sent.size() < 3; ms++){
+        node.loop();
+        MM_HostClock::advance(1000);
+    }
+    MM_CHECK_EQ(bus.sent.size(), 3);
+    for(uint8_t i = 0; i < bus.sent.size(); i++){
+        MM_CHECK_EQ(bus.sent[i].data[0], i);
+    }
+    MM_TxStats stats = node.txStats(0);
+    MM_CHECK_EQ(stats.depth, 0);
+    MM_CHECK_EQ(stats.drops, 0);
+    MM_CHECK_EQ(stats.retries, 3);
+}
+
+static void testSysbusDropsWhenBusIsDown(){
+    MM_HostClock::set(0);
+    MM_Sysbus node(5);
+    MM_TestInterface bus;
+    node.attachBus(&bus);
+    bus.clearSent();
+
+    bus.failSends = 0xFFFF;
+    MM_CHECK(node.Send(Unicast, 7, 1, 2, payload));
+    for(uint16_t ms = 0; ms < 1000; ms++){
+        node.loop();
+        MM_HostClock::advance(1000);
+    }
+    MM_TxStats stats = node.txStats(0);
+    MM_CHECK_EQ(stats.depth, 0);
+    MM_CHECK_EQ(stats.drops, 1);
+    MM_CHECK_EQ(bus.attempts, TX_MAX_RETRIES + 1);
+}
+
+int main(){
+    MM_RUN(testBackoffDoubles);
+    MM_RUN(testDropAfterMaxRetries);
+    MM_RUN(testFullQueueDrops);
+    MM_RUN(testSysbusRetriesInOrder);
+    MM_RUN(testSysbusDropsWhenBusIsDown);
+    return MM_TEST_RESULT();
+}
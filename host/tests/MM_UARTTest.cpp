@@ -0,0 +1,271 @@
+/*
+    MM_Sysbus UART framing tests
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MM_Test.h"
+#include <MM_UART.h>
+#include <string.h>
+#include <algorithm>
+
+static uint8_t payload[8] = {0x00, 0x01, 0x7F, 0x80, 0xFF, 0x00, 0x12, 0x34};
+
+static bool samePacket(const MM_Packet &pkg, MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, const uint8_t *data){
+    if(pkg.meta.type != type || pkg.meta.target != target || pkg.meta.source != source) return false;
+    if(pkg.meta.port != port || pkg.len != len) return false;
+    return memcmp(pkg.data, data, len) == 0;
+}
+
+static void testCobsRoundTrip(){
+    uint8_t in[253];
+    uint8_t enc[255];
+    uint8_t dec[255];
+
+    //All zeros, no zeros and a full 254 byte block
+    for(uint8_t pattern = 0; pattern < 3; pattern++){
+        for(uint16_t i = 0; i < sizeof(in); i++){
+            in[i] = pattern == 0 ? 0 : (pattern == 1 ? (i % 255) + 1 : i * 7);
+        }
+        for(uint16_t len = 1; len <= sizeof(in); len += 13){
+            uint8_t n = MM_UART::cobsEncode(in, len, enc);
+            MM_CHECK(n <= len + 1 + len / 254);
+            MM_CHECK(memchr(enc, 0, n) == NULL);
+            MM_CHECK_EQ(MM_UART::cobsDecode(enc, n, dec), len);
+            MM_CHECK(memcmp(in, dec, len) == 0);
+        }
+    }
+}
+
+static void testCobsRejectsGarbage(){
+    //Code byte points behind the end of the buffer
+    uint8_t bad[3] = {0x05, 0x01, 0x02};
+    uint8_t out[8];
+    MM_CHECK_EQ(MM_UART::cobsDecode(bad, sizeof(bad), out), 0);
+}
+
+static void testCrc16(){
+    //CRC-16/CCITT-FALSE check value
+    const char *check = "123456789";
+    uint16_t crc = MM_CRC16_INIT;
+    for(uint8_t i = 0; i < 9; i++) crc = MM_CRC16(crc, check[i]);
+    MM_CHECK_EQ(crc, 0x29B1);
+}
+
+static void testFramingRoundTrip(){
+    MM_UARTFraming framings[2] = {MM_UART_ASCII, MM_UART_BINARY};
+    for(uint8_t f = 0; f < 2; f++){
+        MM_HostStream a, b;
+        MM_HostStream::link(a, b);
+        MM_UART tx(a), rx(b);
+        tx.setFraming(framings[f]);
+        MM_Packet pkg;
+
+        for(uint8_t len = 0; len <= 8; len++){
+            MM_CHECK(tx.Send(Unicast, 2047, 1025, 31, len, payload));
+            MM_CHECK(rx.Receive(pkg));
+            MM_CHECK(samePacket(pkg, Unicast, 2047, 1025, 31, len, payload));
+        }
+        MM_CHECK(tx.Send(Multicast, 65535, 3, 0, 2, payload));
+        MM_CHECK(rx.Receive(pkg));
+        MM_CHECK(samePacket(pkg, Multicast, 65535, 3, 0, 2, payload));
+        MM_CHECK(!rx.Receive(pkg));
+    }
+}
+
+static void testBinaryCrcError(){
+    MM_HostStream a, b;
+    MM_UART tx(a), rx(b);
+    tx.setFraming(MM_UART_BINARY);
+    MM_CHECK(tx.Send(Unicast, 20, 10, 1, 4, payload));
+
+    std::string frame = a.output();
+    MM_Packet pkg;
+    for(size_t i = 1; i + 1 < frame.size(); i++){
+        //Flip one bit of every byte in turn, the frame must never pass
+        std::string broken = frame;
+        broken[i] ^= 0x10;
+        b.inject((const uint8_t *)broken.data(), broken.size());
+        while(rx.Receive(pkg)){
+            MM_CHECK(!samePacket(pkg, Unicast, 20, 10, 1, 4, payload));
+        }
+    }
+
+    //The parser recovers for the next good frame
+    b.inject((const uint8_t *)frame.data(), frame.size());
+    MM_CHECK(rx.Receive(pkg));
+    MM_CHECK(samePacket(pkg, Unicast, 20, 10, 1, 4, payload));
+}
+
+static void testAsciiParser(){
+    MM_HostStream s;
+    MM_UART uart(s);
+    MM_Packet pkg;
+    uint8_t data[3] = {0x0A, 0xFF, 0x00};
+
+    //Lower and upper case hex, no leading zeros
+    s.inject("\x01" "0\x1F" "7ff\x1F" "1\x1F" "1F\x1F" "3\x02" "a\x1F" "FF\x1F" "0\x1F" "\x04\r\n");
+    MM_CHECK(uart.Receive(pkg));
+    MM_CHECK(samePacket(pkg, Unicast, 0x7FF, 1, 0x1F, 3, data));
+
+    //Noise in front and a frame cut off by a new SOH
+    s.inject("garbage\x01" "0\x1F" "5\x1F" "\x01" "2\x1F" "0\x1F" "9\x1F" "0\x1F" "0\x02\x04\r\n");
+    MM_CHECK(uart.Receive(pkg));
+    MM_CHECK(samePacket(pkg, Broadcast, 0, 9, 0, 0, data));
+
+    //Rejected: length > 8, too many digits, fewer data bytes than announced, missing separator
+    s.inject("\x01" "0\x1F" "5\x1F" "1\x1F" "0\x1F" "9\x02\x04\r\n");
+    s.inject("\x01" "0\x1F" "12345\x1F" "1\x1F" "0\x1F" "0\x02\x04\r\n");
+    s.inject("\x01" "0\x1F" "5\x1F" "1\x1F" "0\x1F" "2\x02" "1\x1F\x04\r\n");
+    s.inject("\x01" "0\x1F" "5\x1F" "1\x1F" "0\x1F" "1\x02" "1\x04\r\n");
+    MM_CHECK(!uart.Receive(pkg));
+}
+
+static void testBatchKeepsOrder(){
+    MM_HostStream a, b;
+    MM_HostStream::link(a, b);
+    MM_UART tx(a), rx(b);
+    tx.setFraming(MM_UART_BINARY);
+
+    MM_Packet pkgs[6];
+    for(uint8_t i = 0; i < 6; i++){
+        payload[0] = i;
+        pkgs[i] = mmPacket(Unicast, 20, 10, 1, 8, payload);
+    }
+    MM_CHECK_EQ(tx.SendBatch(pkgs, 6), 6);
+
+    MM_Packet pkg;
+    for(uint8_t i = 0; i < 6; i++){
+        MM_CHECK(rx.Receive(pkg));
+        MM_CHECK_EQ(pkg.data[0], i);
+    }
+    payload[0] = 0;
+}
+
+static void testBinaryBatchFrames(){
+    MM_HostStream a, b;
+    MM_UART tx(a), rx(b);
+    tx.setFraming(MM_UART_BINARY);
+    MM_MsgType types[4] = {Unicast, Multicast, Broadcast, Streaming};
+
+    //All types and lengths, more packets than one frame holds
+    MM_Packet pkgs[9];
+    for(uint8_t i = 0; i < 9; i++){
+        MM_MsgType type = types[i % 4];
+        pkgs[i] = mmPacket(type, type == Multicast ? 60000 + i : 2040 + i % 8, 2047 - i, type == Multicast ? 0 : 31 - i, 1 + i % 8, payload);
+    }
+    MM_CHECK_EQ(tx.SendBatch(pkgs, 9), 9);
+
+    //One delimiter in front, one per frame
+    std::string wire = a.output();
+    uint8_t frames = (9 + MM_UART_BINARY_BATCH - 1) / MM_UART_BINARY_BATCH;
+    MM_CHECK_EQ((size_t)std::count(wire.begin(), wire.end(), '\0'), (size_t)frames + 1);
+
+    MM_Packet pkg;
+    for(uint8_t round = 0; round < 2; round++){
+        b.inject((const uint8_t *)wire.data(), wire.size());
+        for(uint8_t i = 0; i < 9; i++){
+            MM_Packet &sent = pkgs[i];
+            MM_CHECK(rx.Receive(pkg));
+            MM_CHECK(samePacket(pkg, sent.meta.type, sent.meta.target, sent.meta.source, sent.meta.port, sent.len, payload));
+        }
+        MM_CHECK(!rx.Receive(pkg));
+        if(round > 0) break;
+
+        //Packets the short header can't describe get a frame of their own, the order stays
+        pkgs[1].len = 0;
+        pkgs[4].meta.target = 0x800;
+        pkgs[5].meta.port = 3;
+        a.clearOutput();
+        MM_CHECK_EQ(tx.SendBatch(pkgs, 9), 9);
+        wire = a.output();
+    }
+
+    //An invalid packet ends the batch, the packets in front of it are sent
+    a.clearOutput();
+    pkgs[2].len = 9;
+    MM_CHECK_EQ(tx.SendBatch(pkgs, 9), 2);
+    wire = a.output();
+    b.inject((const uint8_t *)wire.data(), wire.size());
+    MM_CHECK(rx.Receive(pkg));
+    MM_CHECK(rx.Receive(pkg));
+    MM_CHECK(samePacket(pkg, Multicast, 60001, 2046, 0, 0, payload));
+    MM_CHECK(!rx.Receive(pkg));
+}
+
+static void testBinaryBatchCrcError(){
+    MM_HostStream a, b;
+    MM_UART tx(a), rx(b);
+    tx.setFraming(MM_UART_BINARY);
+    MM_Packet pkgs[2] = {mmPacket(Unicast, 20, 10, 1, 4, payload), mmPacket(Unicast, 21, 10, 1, 8, payload)};
+    MM_CHECK_EQ(tx.SendBatch(pkgs, 2), 2);
+
+    std::string frame = a.output();
+    MM_Packet pkg;
+    for(size_t i = 1; i + 1 < frame.size(); i++){
+        //No packet of a broken frame gets through
+        std::string broken = frame;
+        broken[i] ^= 0x10;
+        b.inject((const uint8_t *)broken.data(), broken.size());
+        MM_CHECK(!rx.Receive(pkg));
+    }
+
+    b.inject((const uint8_t *)frame.data(), frame.size());
+    MM_CHECK(rx.Receive(pkg));
+    MM_CHECK(samePacket(pkg, Unicast, 20, 10, 1, 4, payload));
+    MM_CHECK(rx.Receive(pkg));
+    MM_CHECK(samePacket(pkg, Unicast, 21, 10, 1, 8, payload));
+}
+
+static void testAutoBatch(){
+    MM_HostStream a, b;
+    a.connect(&b);
+    MM_UART binary(a), peer(b);
+    binary.setFraming(MM_UART_BINARY);
+    peer.setFraming(MM_UART_AUTO);
+    MM_Packet pkgs[3] = {mmPacket(Unicast, 20, 10, 1, 1, payload), mmPacket(Unicast, 21, 10, 1, 1, payload),
+        mmPacket(Unicast, 22, 10, 1, 1, payload)};
+    MM_Packet pkg;
+
+    //Single binary frames switch to binary, a multi-packet frame to multi-packet frames
+    MM_CHECK(binary.Send(Unicast, 20, 10, 1, 1, payload));
+    MM_CHECK(peer.Receive(pkg));
+    MM_CHECK(peer.binary());
+    MM_CHECK_EQ(peer.SendBatch(pkgs, 3), 3);
+    std::string wire = b.output();
+    MM_CHECK_EQ((size_t)std::count(wire.begin(), wire.end(), '\0'), (size_t)4);
+
+    MM_CHECK_EQ(binary.SendBatch(pkgs, 3), 3);
+    for(uint8_t i = 0; i < 3; i++) MM_CHECK(peer.Receive(pkg));
+    b.clearOutput();
+    MM_CHECK_EQ(peer.SendBatch(pkgs, 3), 3);
+    wire = b.output();
+    MM_CHECK_EQ((size_t)std::count(wire.begin(), wire.end(), '\0'), (size_t)1);
+}
+
+int main(){
+    MM_RUN(testCobsRoundTrip);
+    MM_RUN(testCobsRejectsGarbage);
+    MM_RUN(testCrc16);
+    MM_RUN(testFramingRoundTrip);
+    MM_RUN(testBinaryCrcError);
+    MM_RUN(testAsciiParser);
+    MM_RUN(testBatchKeepsOrder);
+    MM_RUN(testBinaryBatchFrames);
+    MM_RUN(testBinaryBatchCrcError);
+    MM_RUN(testAutoBatch);
+    return MM_TEST_RESULT();
+}
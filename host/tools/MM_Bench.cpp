@@ -0,0 +1,902 @@
+/*
+    MM_Sysbus hot path benchmarks
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Measures ns/packet of the hot paths on the host and prints the results as JSON:
+ *
+ *  routing_<n>if       MM_Sysbus::Receive() of a gateway with n interfaces (learning,
+ *                      duplicate check, forwarding with Send(), Process())
+ *  process_full        MM_Sysbus::Process() with all hook and module slots used
+ *  checkmsg_full       MM_Module::checkMsg() with a full multicast table
+ *  can_addr_parse      MM_CAN::CanAddrParse()
+ *  can_addr_assemble   MM_CAN::CanAddrAssemble()
+ *  uart_encode_*       MM_UART::Send() (SendBatch() for binary_batch) to a stream that discards the bytes
+ *  uart_parse_*        MM_UART::Receive() from a stream of encoded frames
+ *  uart_bytes_*        MM_UART::Receive() fed a single byte per call (ns/byte): valid ascii/binary
+ *                      frames, random bytes, ascii frames broken at the end and binary frames
+ *                      with a wrong CRC (the parser does all the work and gets nothing)
+ *
+ * Rates derived from the traffic mix are printed in "rates":
+ *
+ *  uart_wire_*         frames/s the framing fits on a line with --baud (8N1, 10 bits per byte),
+ *                      *_8byte for the same packets with 8 data bytes, binary_batch sends
+ *                      MM_UART_BINARY_BATCH packets per SendBatch() (multi-packet frames)
+ *  uart_bytes_*        bytes/s the parser handles
+ *  loop_jitter_*       loop() duration (virtual clock, MM_HOST_EEPROM_WRITE_US per EEPROM write)
+ *                      of a node that commits a changed config now and then: queued writes
+ *                      (one byte per loop) against writing the whole record in the loop that commits it,
+ *                      *_full with all MAX_MODULES modules changed together (more than the write queue holds)
+ *  provision_*         time until MULTICAST_TARGETS GROUP_ADDs (one per ms) to each of MAX_MODULES modules
+ *                      are stored in the EEPROM: each slot on its own, the changed slots at the end of a
+ *                      GROUPS_BATCH, or the whole record on every add (baseline)
+ *
+ * The traffic is a fixed pseudo-random mix of unicast, multicast and broadcast packets
+ * (see the mix functions), so results of different builds are comparable.
+ * The library is compiled for this target with MAX_INTERFACES 8.
+ */
+
+#include <Arduino.h>
+#include <MM_Sysbus.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+//Packets in a traffic mix, a power of two
+#define BENCH_MIX_SIZE 4096
+
+//Nodes behind the interfaces of the gateway
+#define BENCH_NODES 200
+
+//Address of the node running the benchmarks
+#define BENCH_NODE_ID 1
+
+//First multicast group used by the modules
+#define BENCH_GROUP_BASE 0x2000
+
+//loop() calls of the jitter benchmark, one per millisecond
+#define BENCH_LOOPS 60000
+
+//A config change every BENCH_CHANGE_PERIOD loops
+#define BENCH_CHANGE_PERIOD 3000
+
+//Config registers of the module in the jitter benchmark
+#define BENCH_CONFIG_SIZE 16
+
+struct BenchConfig {
+    uint32_t minTime = 200;
+    uint8_t repeats = 5;
+    const char *filter = NULL;
+    const char *output = NULL;
+    uint32_t baud = 115200;
+};
+
+struct BenchResult {
+    std::string name;
+    double median;
+    double min;
+    double max;
+    uint64_t packets;
+};
+
+/**
+ * Rate derived from the traffic mix, not a time measurement
+ */
+struct BenchRate {
+    std::string name;
+    double value;
+    const char *unit;
+};
+
+/**
+ * Packet arriving on an interface
+ */
+struct BenchItem {
+    uint8_t busId;
+    MM_Packet pkg;
+};
+
+static BenchConfig config;
+static std::vector<BenchResult> results;
+static std::vector<BenchRate> rates;
+static volatile uint32_t sink;
+static uint32_t rnd = 1;
+
+static uint32_t random32(){
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 17;
+    rnd ^= rnd << 5;
+    return rnd;
+}
+
+static MM_Packet packet(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t cmd){
+    MM_Packet pkg;
+    pkg.meta.type = type;
+    pkg.meta.target = target;
+    pkg.meta.source = source;
+    pkg.meta.port = port;
+    pkg.meta.busId = -1;
+    pkg.len = 2 + random32() % 7;
+    pkg.data[0] = cmd;
+    for(uint8_t i = 1; i < 8; i++) pkg.data[i] = random32();
+    return pkg;
+}
+
+/**
+ * Interface fed by the benchmark, sent packets are only counted
+ */
+class BenchInterface : public MM_Interface {
+public:
+    const MM_Packet *next = NULL;
+    uint32_t sent = 0;
+
+    bool begin(){
+        return true;
+    }
+
+    bool Send(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data){
+        sent++;
+        return true;
+    }
+
+    bool Receive(MM_Packet &pkg){
+        if(next == NULL) return false;
+        pkg = *next;
+        next = NULL;
+        return true;
+    }
+};
+
+/**
+ * Module with a full multicast table that only checks packets
+ */
+class BenchModule : public MM_Module {
+public:
+    uint32_t hits = 0;
+
+    BenchModule(uint8_t port){
+        _port = port;
+        _moduleType = Digital_Out;
+    }
+
+    void fill(uint16_t firstGroup){
+        for(uint8_t i = 0; i < MULTICAST_TARGETS; i++){
+            addMulticastTarget(firstGroup + i, i % 2 ? BOOL : ALL_CMDS);
+        }
+    }
+
+    bool process(MM_Packet &pkg){
+        if(checkMsg(pkg)) hits++;
+        return true;
+    }
+
+    bool loop(){
+        return true;
+    }
+
+    bool broadcastState(){
+        return true;
+    }
+
+    using MM_Module::checkMsg;
+};
+
+/**
+ * Module with size byte registers as its config, like a dimmer with a level per channel
+ */
+class ConfigModule : public MM_Module {
+public:
+    uint8_t config[MAX_CONFIG_SIZE] = {};
+    uint8_t size;
+
+    ConfigModule(uint8_t port, uint8_t size) : size(size){
+        _port = port;
+        _moduleType = Digital_Out;
+    }
+
+    //Store the whole target record on every change, like saveMulticastTargets() did
+    bool rewriteTargets = false;
+
+    bool process(MM_Packet &pkg){
+        checkMsg(pkg);
+        if(rewriteTargets && configDirty()){
+            saveMulticastTargets();
+            discardConfig();
+        }
+        return true;
+    }
+
+    bool loop(){
+        return true;
+    }
+
+    bool broadcastState(){
+        return true;
+    }
+
+    uint8_t registerCount(){
+        return size;
+    }
+
+    bool getRegister(uint8_t reg, uint8_t &value){
+        if(reg == 0 || reg > size) return false;
+        value = config[reg - 1];
+        return true;
+    }
+
+    bool setRegister(uint8_t reg, uint8_t value){
+        if(reg == 0 || reg > size) return false;
+        config[reg - 1] = value;
+        return true;
+    }
+
+    bool saveConfig(){
+        return writeConfigData(config, size);
+    }
+};
+
+/**
+ * Stream that discards written bytes
+ */
+class NullStream : public Stream {
+public:
+    int available(){ return 0; }
+    int read(){ return -1; }
+    int peek(){ return -1; }
+    size_t write(uint8_t b){ return 1; }
+    size_t write(const uint8_t *buffer, size_t size){ return size; }
+};
+
+/**
+ * Stream that reads a buffer over and over
+ */
+class LoopStream : public Stream {
+public:
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+
+    int available(){
+        if(pos == data.size()) pos = 0;
+        return data.size() - pos;
+    }
+    int read(){
+        if(pos == data.size()) pos = 0;
+        return data[pos++];
+    }
+    int peek(){
+        if(pos == data.size()) pos = 0;
+        return data[pos];
+    }
+    size_t write(uint8_t b){ return 1; }
+};
+
+/**
+ * Stream that offers a single byte of a buffer whenever next() is called
+ */
+class ByteStream : public Stream {
+public:
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    bool ready = false;
+
+    void next(){ ready = true; }
+    int available(){ return ready ? 1 : 0; }
+    int read(){
+        ready = false;
+        if(pos == data.size()) pos = 0;
+        return data[pos++];
+    }
+    int peek(){ return data[pos == data.size() ? 0 : pos]; }
+    size_t write(uint8_t b){ return 1; }
+};
+
+/**
+ * Stream that keeps the written bytes
+ */
+class CaptureStream : public NullStream {
+public:
+    std::vector<uint8_t> data;
+    size_t write(uint8_t b){ data.push_back(b); return 1; }
+    size_t write(const uint8_t *buffer, size_t size){ data.insert(data.end(), buffer, buffer + size); return size; }
+};
+
+static bool selected(const char *name){
+    return config.filter == NULL || strstr(name, config.filter) != NULL;
+}
+
+/**
+ * Run fn(i) for packet i until minTime passed, config.repeats times
+ */
+template <typename F> static void run(const std::string &name, F fn){
+    typedef std::chrono::steady_clock clock;
+
+    //Warm up caches and tables
+    for(uint32_t i = 0; i < BENCH_MIX_SIZE; i++) fn(i);
+
+    std::vector<double> samples;
+    uint64_t total = 0;
+    for(uint8_t r = 0; r < config.repeats; r++){
+        uint64_t packets = 0;
+        clock::time_point start = clock::now();
+        double elapsed = 0;
+        do{
+            for(uint32_t i = 0; i < BENCH_MIX_SIZE; i++) fn(i);
+            packets += BENCH_MIX_SIZE;
+            elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        }while(elapsed < config.minTime * 1e6);
+        samples.push_back(elapsed / packets);
+        total += packets;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult result;
+    result.name = name;
+    result.median = samples[samples.size() / 2];
+    result.min = samples.front();
+    result.max = samples.back();
+    result.packets = total;
+    results.push_back(result);
+    fprintf(stderr, "%-22s %10.1f ns/packet\n", name.c_str(), result.median);
+}
+
+/**
+ * Traffic of a gateway: 55% unicast (5% of them to unknown nodes), 25% multicast, 20% broadcast
+ * from the nodes behind the interfaces
+ */
+static void routingMix(std::vector<BenchItem> &mix, uint8_t interfaces){
+    mix.resize(BENCH_MIX_SIZE);
+    for(uint32_t i = 0; i < BENCH_MIX_SIZE; i++){
+        uint16_t source = 2 + random32() % BENCH_NODES;
+        uint32_t kind = random32() % 100;
+        BenchItem &item = mix[i];
+        //Node n sits behind interface n % interfaces
+        item.busId = source % interfaces;
+        if(kind < 50){
+            item.pkg = packet(Unicast, 2 + random32() % BENCH_NODES, source, random32() % 4, BOOL);
+        }else if(kind < 55){
+            item.pkg = packet(Unicast, 1000 + random32() % 1000, source, 0, BOOL);
+        }else if(kind < 80){
+            item.pkg = packet(Multicast, BENCH_GROUP_BASE + random32() % 64, source, 0, BOOL);
+        }else{
+            item.pkg = packet(Broadcast, 0, source, random32() % 4, BOOL);
+        }
+    }
+}
+
+static void benchRouting(uint8_t interfaces){
+    char name[32];
+    snprintf(name, sizeof(name), "routing_%uif", interfaces);
+    if(!selected(name)) return;
+
+    MM_Sysbus gateway(BENCH_NODE_ID);
+    BenchInterface ifs[MAX_INTERFACES];
+    for(uint8_t i = 0; i < interfaces; i++) gateway.attachBus(&ifs[i]);
+
+    std::vector<BenchItem> mix;
+    routingMix(mix, interfaces);
+
+    uint32_t seq = 0;
+    MM_Packet pkg;
+    run(name, [&](uint32_t i){
+        BenchItem &item = mix[i];
+        //A new sequence number per packet, so the duplicate cache doesn't drop the mix
+        item.pkg.data[1] = seq;
+        item.pkg.data[2] = seq >> 8;
+        seq++;
+        ifs[item.busId].next = &item.pkg;
+        sink += gateway.Receive(pkg);
+    });
+}
+
+static void hookHandler(MM_Packet &pkg){
+    sink++;
+}
+
+/**
+ * Traffic of a node: 40% multicast (half of them to groups of its modules),
+ * 30% unicast to its ports or other nodes, 30% broadcast
+ */
+static void nodeMix(std::vector<MM_Packet> &mix){
+    mix.resize(BENCH_MIX_SIZE);
+    for(uint32_t i = 0; i < BENCH_MIX_SIZE; i++){
+        uint16_t source = 2 + random32() % BENCH_NODES;
+        uint32_t kind = random32() % 100;
+        uint16_t groups = MAX_MODULES * MULTICAST_TARGETS;
+        if(kind < 20){
+            mix[i] = packet(Multicast, BENCH_GROUP_BASE + random32() % groups, source, 0, random32() % 2 ? BOOL : NODE_PING);
+        }else if(kind < 40){
+            mix[i] = packet(Multicast, BENCH_GROUP_BASE + groups + random32() % 256, source, 0, BOOL);
+        }else if(kind < 60){
+            mix[i] = packet(Unicast, BENCH_NODE_ID, source, random32() % MAX_MODULES, BOOL);
+        }else if(kind < 70){
+            mix[i] = packet(Unicast, 2 + random32() % BENCH_NODES, source, 0, BOOL);
+        }else{
+            mix[i] = packet(Broadcast, 0, source, random32() % 4, BOOL);
+        }
+    }
+}
+
+static void benchProcess(){
+    if(!selected("process_full")) return;
+
+    MM_Sysbus node(BENCH_NODE_ID);
+    BenchInterface bus;
+    node.attachBus(&bus);
+
+    std::vector<BenchModule*> modules;
+    for(uint8_t i = 0; i < MAX_MODULES; i++){
+        BenchModule *module = new BenchModule(i);
+        node.attachModule(module);
+        module->fill(BENCH_GROUP_BASE + i * MULTICAST_TARGETS);
+        modules.push_back(module);
+    }
+    for(uint8_t i = 0; i < MAX_HOOKS; i++){
+        node.attachHook(i % 2 ? Multicast : Broadcast, i % 2 ? BENCH_GROUP_BASE + i : 0, -1, i % 3 ? BOOL : ALL_CMDS, hookHandler);
+    }
+
+    std::vector<MM_Packet> mix;
+    nodeMix(mix);
+
+    run("process_full", [&](uint32_t i){
+        node.Process(mix[i]);
+    });
+
+    for(size_t i = 0; i < modules.size(); i++) delete modules[i];
+}
+
+static void benchCheckMsg(){
+    if(!selected("checkmsg_full")) return;
+
+    MM_Sysbus node(BENCH_NODE_ID);
+    BenchModule module(0);
+    node.attachModule(&module);
+    module.fill(BENCH_GROUP_BASE);
+
+    //70% multicast, 3 of 7 to the table, 30% unicast to the module
+    std::vector<MM_Packet> mix(BENCH_MIX_SIZE);
+    for(uint32_t i = 0; i < BENCH_MIX_SIZE; i++){
+        uint32_t kind = random32() % 10;
+        uint16_t source = 2 + random32() % BENCH_NODES;
+        if(kind < 3){
+            mix[i] = packet(Multicast, BENCH_GROUP_BASE + random32() % MULTICAST_TARGETS, source, 0, BOOL);
+        }else if(kind < 7){
+            mix[i] = packet(Multicast, BENCH_GROUP_BASE + MULTICAST_TARGETS + random32() % 256, source, 0, BOOL);
+        }else{
+            mix[i] = packet(Unicast, BENCH_NODE_ID, source, 0, BOOL);
+        }
+    }
+
+    run("checkmsg_full", [&](uint32_t i){
+        sink += module.checkMsg(mix[i]);
+    });
+}
+
+static void benchCanAddr(){
+    std::vector<MM_Packet> mix;
+    nodeMix(mix);
+
+    if(selected("can_addr_parse")){
+        std::vector<uint32_t> ids(BENCH_MIX_SIZE);
+        for(uint32_t i = 0; i < BENCH_MIX_SIZE; i++) ids[i] = MM_CAN::CanAddrAssemble(mix[i].meta);
+        run("can_addr_parse", [&](uint32_t i){
+            MM_Meta meta = MM_CAN::CanAddrParse(ids[i]);
+            sink += meta.target + meta.source;
+        });
+    }
+    if(selected("can_addr_assemble")){
+        run("can_addr_assemble", [&](uint32_t i){
+            sink += MM_CAN::CanAddrAssemble(mix[i].meta);
+        });
+    }
+}
+
+static void addRate(const std::string &name, double value, const char *unit){
+    BenchRate rate;
+    rate.name = name;
+    rate.value = value;
+    rate.unit = unit;
+    rates.push_back(rate);
+    fprintf(stderr, "%-22s %10.0f %s\n", name.c_str(), value, unit);
+}
+
+/**
+ * Send the packets like the TX queue does: one by one, or MM_UART_BINARY_BATCH at a time with SendBatch()
+ */
+static uint32_t sendMix(MM_UART &uart, std::vector<MM_Packet> &mix, bool batch){
+    uint32_t sent = 0;
+    for(uint32_t i = 0; i < mix.size(); ){
+        if(batch){
+            uint8_t count = std::min<uint32_t>(MM_UART_BINARY_BATCH, mix.size() - i);
+            sent += uart.SendBatch(&mix[i], count);
+            i += count;
+        }else{
+            MM_Packet &pkg = mix[i++];
+            sent += uart.Send(pkg.meta.type, pkg.meta.target, pkg.meta.source, pkg.meta.port, pkg.len, pkg.data);
+        }
+    }
+    return sent;
+}
+
+/**
+ * Line rate of a framing for the packets
+ */
+static void addWireRate(const std::string &name, MM_UARTFraming framing, bool batch, std::vector<MM_Packet> &mix){
+    CaptureStream capture;
+    MM_UART writer(capture);
+    writer.setFraming(framing);
+    sendMix(writer, mix, batch);
+    //Start and stop bit per byte
+    double bytesPerFrame = (double)capture.data.size() / mix.size();
+    addRate(name, config.baud / 10.0 / bytesPerFrame, "frames/s");
+    addRate(name + "_bytes", bytesPerFrame, "bytes/frame");
+}
+
+/**
+ * @param batch send MM_UART_BINARY_BATCH packets per SendBatch() (multi-packet binary frames)
+ */
+static void benchUART(MM_UARTFraming framing, const char *suffix, bool batch = false){
+    std::vector<MM_Packet> mix;
+    nodeMix(mix);
+
+    std::string wire = std::string("uart_wire_") + suffix;
+    if(selected(wire.c_str())){
+        addWireRate(wire, framing, batch, mix);
+
+        //The same packets with 8 data bytes each
+        std::vector<MM_Packet> full = mix;
+        for(MM_Packet &pkg : full){
+            pkg.len = 8;
+            for(uint8_t i = 0; i < 8; i++) pkg.data[i] = random32();
+        }
+        addWireRate(wire + "_8byte", framing, batch, full);
+    }
+
+    std::string encode = std::string("uart_encode_") + suffix;
+    if(selected(encode.c_str())){
+        NullStream stream;
+        MM_UART uart(stream);
+        uart.setFraming(framing);
+        run(encode, [&](uint32_t i){
+            if(!batch){
+                MM_Packet &pkg = mix[i];
+                sink += uart.Send(pkg.meta.type, pkg.meta.target, pkg.meta.source, pkg.meta.port, pkg.len, pkg.data);
+            }else if(i % MM_UART_BINARY_BATCH == MM_UART_BINARY_BATCH - 1){
+                sink += uart.SendBatch(&mix[i + 1 - MM_UART_BINARY_BATCH], MM_UART_BINARY_BATCH);
+            }
+        });
+    }
+
+    std::string parse = std::string("uart_parse_") + suffix;
+    if(selected(parse.c_str())){
+        CaptureStream capture;
+        MM_UART writer(capture);
+        writer.setFraming(framing);
+        sendMix(writer, mix, batch);
+
+        LoopStream stream;
+        stream.data = capture.data;
+        MM_UART uart(stream);
+        MM_Packet pkg;
+        run(parse, [&](uint32_t i){
+            sink += uart.Receive(pkg);
+        });
+    }
+}
+
+/**
+ * Encoded frames of the node mix
+ */
+static std::vector<uint8_t> encodeMix(MM_UARTFraming framing){
+    std::vector<MM_Packet> mix;
+    nodeMix(mix);
+    CaptureStream capture;
+    MM_UART writer(capture);
+    writer.setFraming(framing);
+    for(uint32_t i = 0; i < BENCH_MIX_SIZE; i++){
+        MM_Packet &pkg = mix[i];
+        writer.Send(pkg.meta.type, pkg.meta.target, pkg.meta.source, pkg.meta.port, pkg.len, pkg.data);
+    }
+    return capture.data;
+}
+
+static void benchUARTBytes(const char *name, const std::vector<uint8_t> &data){
+    if(!selected(name)) return;
+
+    ByteStream stream;
+    stream.data = data;
+    MM_UART uart(stream);
+    MM_Packet pkg;
+    run(name, [&](uint32_t i){
+        stream.next();
+        sink += uart.Receive(pkg);
+    });
+    addRate(name, 1e9 / results.back().median, "bytes/s");
+}
+
+static void benchUARTStreams(){
+    benchUARTBytes("uart_bytes_ascii", encodeMix(MM_UART_ASCII));
+    benchUARTBytes("uart_bytes_binary", encodeMix(MM_UART_BINARY));
+
+    std::vector<uint8_t> data(BENCH_MIX_SIZE * 16);
+    for(size_t i = 0; i < data.size(); i++) data[i] = random32();
+    benchUARTBytes("uart_bytes_random", data);
+
+    //Every ascii frame runs through all states, then ends with a data separator instead of EOT
+    data = encodeMix(MM_UART_ASCII);
+    for(size_t i = 0; i < data.size(); i++){
+        if(data[i] == 0x04) data[i] = 0x1F;
+    }
+    benchUARTBytes("uart_bytes_ascii_broken", data);
+
+    //Every binary frame is decoded and fails the CRC check, the first byte of a frame is its COBS code
+    data = encodeMix(MM_UART_BINARY);
+    for(size_t i = 2; i < data.size(); i++){
+        if(data[i - 2] == 0x00 && data[i] != 0x00 && data[i] != 0xFF) data[i]++;
+    }
+    benchUARTBytes("uart_bytes_binary_badcrc", data);
+}
+
+/**
+ * Node with ConfigModules of BENCH_CONFIG_SIZE registers on ports 2, 3, ... and its config store in an erased EEPROM
+ */
+struct BenchNode {
+    MM_Sysbus node;
+    BenchInterface bus;
+    ConfigModule *modules[MAX_MODULES] = {};
+    uint8_t count;
+    MM_Packet cmd;
+
+    /**
+     * Call before the constructor
+     */
+    static void freshEEPROM(){
+        MM_EEPROM::flush();
+        EEPROM.erase();
+        EEPROM.setWriteLatency(MM_HOST_EEPROM_WRITE_US);
+        MM_HostClock::set(0);
+    }
+
+    BenchNode(uint8_t count = 1) : node(BENCH_NODE_ID, 0), count(count){
+        node.attachBus(&bus);
+        for(uint8_t i = 0; i < count; i++){
+            modules[i] = new ConfigModule(2 + i, BENCH_CONFIG_SIZE);
+            node.attachModule(modules[i], i);
+        }
+        node.flushConfig();
+        MM_EEPROM::flush();
+    }
+
+    ~BenchNode(){
+        for(uint8_t i = 0; i < count; i++) delete modules[i];
+    }
+
+    /**
+     * Command to a module, received with the next loop()
+     */
+    void command(uint8_t module, uint8_t len, const uint8_t *data){
+        cmd = packet(Unicast, BENCH_NODE_ID, 2, modules[module]->port(), data[0]);
+        cmd.len = len;
+        memcpy(cmd.data, data, len);
+        bus.next = &cmd;
+    }
+
+    /**
+     * @return true if a module has an uncommitted change
+     */
+    bool dirty(){
+        for(uint8_t i = 0; i < count; i++){
+            if(modules[i]->configDirty()) return true;
+        }
+        return false;
+    }
+
+    /**
+     * One millisecond of the main loop
+     * @return duration of loop() on the virtual clock in µs
+     */
+    uint32_t loop(bool blocking = false){
+        MM_HostClock::advance(1000);
+        uint64_t start = MM_HostClock::now();
+        node.loop();
+        if(blocking) MM_EEPROM::flush();
+        return MM_HostClock::now() - start;
+    }
+};
+
+/**
+ * Loop durations of a node whose BENCH_CONFIG_SIZE config registers all change every BENCH_CHANGE_PERIOD ms
+ * @param blocking write all queued bytes in the same loop, like EEPROM.update() did
+ * @param modules number of modules changed together, they commit in consecutive loops
+ */
+static void benchLoopJitter(bool blocking, uint8_t modules){
+    std::string name = std::string("loop_jitter_") + (blocking ? "blocking" : "queued") + (modules > 1 ? "_full" : "");
+    if(!selected(name.c_str())) return;
+
+    BenchNode::freshEEPROM();
+    BenchNode node(modules);
+    //CFG_REG_SET_MULTI packets to set all registers of a module, three per packet
+    const uint32_t packets = (BENCH_CONFIG_SIZE + 2) / 3;
+    std::vector<uint32_t> durations;
+    uint32_t writes = EEPROM.writes();
+    for(uint32_t i = 0; i < BENCH_LOOPS; i++){
+        //One packet per loop until all registers of all modules have the value of this period
+        uint32_t n = i % BENCH_CHANGE_PERIOD;
+        if(n < packets * modules){
+            uint32_t reg = 1 + (n % packets) * 3;
+            uint8_t data[7] = {MM_CMD::CFG_REG_SET_MULTI};
+            uint8_t len = 1;
+            for(; reg <= BENCH_CONFIG_SIZE && len < 7; reg++){
+                data[len++] = reg;
+                data[len++] = 1 + i / BENCH_CHANGE_PERIOD;
+            }
+            node.command(n / packets, len, data);
+        }
+        durations.push_back(node.loop(blocking));
+    }
+    writes = EEPROM.writes() - writes;
+
+    std::sort(durations.begin(), durations.end());
+    uint32_t busy = durations.end() - std::upper_bound(durations.begin(), durations.end(), 0);
+    addRate(name + "_max", durations.back(), "us");
+    addRate(name + "_slow_loops", busy, "loops");
+    addRate(name + "_writes", writes, "bytes");
+}
+
+/**
+ * Provisioning of all multicast targets of every module, one GROUP_ADD per millisecond
+ * @param mode "single", "batch" (wrapped in GROUPS_BATCH 1/0) or "baseline" (whole record per add)
+ */
+static void benchProvisioning(const char *mode){
+    std::string name = std::string("provision_") + mode;
+    if(!selected(name.c_str())) return;
+    bool batch = strcmp(mode, "batch") == 0;
+
+    BenchNode::freshEEPROM();
+    BenchNode node(MAX_MODULES);
+    for(uint8_t m = 0; m < MAX_MODULES; m++){
+        node.modules[m]->rewriteTargets = strcmp(mode, "baseline") == 0;
+    }
+    uint32_t writes = EEPROM.writes();
+    uint64_t start = MM_HostClock::now();
+    uint32_t longest = 0;
+
+    for(uint8_t m = 0; m < MAX_MODULES; m++){
+        if(batch){
+            uint8_t data[2] = {MM_CMD::GROUPS_BATCH, 1};
+            node.command(m, 2, data);
+            longest = std::max(longest, node.loop());
+        }
+        for(uint8_t i = 0; i < MULTICAST_TARGETS; i++){
+            uint16_t group = BENCH_GROUP_BASE + i;
+            uint8_t data[4] = {MM_CMD::GROUP_ADD, highByte(group), lowByte(group), MM_CMD::ALL_CMDS};
+            node.command(m, 4, data);
+            longest = std::max(longest, node.loop());
+        }
+        if(batch){
+            uint8_t data[2] = {MM_CMD::GROUPS_BATCH, 0};
+            node.command(m, 2, data);
+            longest = std::max(longest, node.loop());
+        }
+    }
+    //Until every byte is in the EEPROM
+    while(MM_EEPROM::busy() || node.dirty()){
+        longest = std::max(longest, node.loop());
+    }
+
+    addRate(name + "_time", (MM_HostClock::now() - start) / 1000.0, "ms");
+    addRate(name + "_writes", EEPROM.writes() - writes, "bytes");
+    addRate(name + "_max", longest, "us");
+}
+
+static void printJSON(FILE *out){
+    fprintf(out, "{\n");
+    fprintf(out, "  \"suite\": \"mm_sysbus\",\n");
+    fprintf(out, "  \"unit\": \"ns/packet\",\n");
+    fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(out, "  \"config\": {\"MAX_INTERFACES\": %d, \"MAX_HOOKS\": %d, \"MAX_MODULES\": %d, "
+        "\"MULTICAST_TARGETS\": %d, \"ROUTING_TABLE_SIZE\": %d, \"DUP_CACHE_SIZE\": %d, "
+        "\"min_time_ms\": %lu, \"repeats\": %u, \"baud\": %lu},\n",
+        MAX_INTERFACES, MAX_HOOKS, MAX_MODULES, MULTICAST_TARGETS, ROUTING_TABLE_SIZE, DUP_CACHE_SIZE,
+        (unsigned long)config.minTime, config.repeats, (unsigned long)config.baud);
+    fprintf(out, "  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); i++){
+        BenchResult &r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"median\": %.2f, \"min\": %.2f, \"max\": %.2f, \"packets\": %llu}%s\n",
+            r.name.c_str(), r.median, r.min, r.max, (unsigned long long)r.packets, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    fprintf(out, "  \"rates\": [\n");
+    for(size_t i = 0; i < rates.size(); i++){
+        BenchRate &r = rates[i];
+        fprintf(out, "    {\"name\": \"%s\", \"value\": %.2f, \"unit\": \"%s\"}%s\n",
+            r.name.c_str(), r.value, r.unit, i + 1 < rates.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void usage(const char *name){
+    printf("Usage: %s [options]\n"
+        "  --filter TEXT     only run benchmarks whose name contains TEXT\n"
+        "  --min-time MS     minimum time per repetition (default 200)\n"
+        "  --repeats N       repetitions, the median is reported (default 5)\n"
+        "  --baud N          line speed for the uart_wire rates (default 115200)\n"
+        "  --output FILE     write the JSON to FILE instead of stdout\n", name);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"filter", required_argument, NULL, 'f'},
+        {"min-time", required_argument, NULL, 't'},
+        {"repeats", required_argument, NULL, 'r'},
+        {"baud", required_argument, NULL, 'b'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "h", options, NULL)) != -1){
+        switch(opt){
+            case 'f': config.filter = optarg; break;
+            case 't': config.minTime = atol(optarg); break;
+            case 'r': config.repeats = atoi(optarg); break;
+            case 'b': config.baud = atol(optarg); break;
+            case 'o': config.output = optarg; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if(config.repeats == 0) config.repeats = 1;
+
+    for(uint8_t n = 2; n <= 8 && n <= MAX_INTERFACES; n++){
+        benchRouting(n);
+    }
+    benchProcess();
+    benchCheckMsg();
+    benchCanAddr();
+    benchUART(MM_UART_ASCII, "ascii");
+    benchUART(MM_UART_BINARY, "binary");
+    benchUART(MM_UART_BINARY, "binary_batch", true);
+    benchUARTStreams();
+    benchLoopJitter(true, 1);
+    benchLoopJitter(false, 1);
+    benchLoopJitter(true, MAX_MODULES);
+    benchLoopJitter(false, MAX_MODULES);
+    benchProvisioning("baseline");
+    benchProvisioning("single");
+    benchProvisioning("batch");
+
+    FILE *out = stdout;
+    if(config.output != NULL){
+        out = fopen(config.output, "w");
+        if(out == NULL){
+            perror(config.output);
+            return 1;
+        }
+    }
+    printJSON(out);
+    if(out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,483 @@
+/*
+    MM_Sysbus bus simulator
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Discrete-event simulation of many MM_Sysbus nodes on one MM_MemBus.
+ *
+ * Every node is a real MM_Sysbus with a MM_Digital_Out on port 0. The clock jumps from
+ * event to event (bus transmissions, node wakeups, scenario actions). A node runs its
+ * loop() when it received a frame or got a free mailbox and is busy for
+ * --loop-us + --frame-us per received frame afterwards, frames arriving meanwhile wait
+ * in the RX buffer of its port (and get lost if it overflows).
+ *
+ * Scenarios:
+ *  boot       all nodes power up within --boot-window and announce themselves
+ *  scene      a controller recalls a scene (multicast to a group) --scenes times,
+ *             every member switches and broadcasts its new state
+ *  telemetry  every node broadcasts its state every --period ms for --duration ms
+ *
+ * Latency is measured from the scenario action (power up, recall, report) to the end
+ * of the transmission of the resulting frame, "bus access" from the hand-over to the
+ * port to the end of the transmission.
+ */
+
+#include <Arduino.h>
+#include <MM_Sysbus.h>
+#include <MM_MemBus.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+//Pin of the simulated outputs, all nodes share it
+#define SIM_PIN 7
+
+//Multicast group of the scene
+#define SIM_SCENE_GROUP 0x1000
+
+//Address of the controller recalling scenes
+#define SIM_CONTROLLER 1
+
+#define SIM_NONE UINT64_MAX
+
+enum SimScenario{
+    SCENARIO_BOOT,
+    SCENARIO_SCENE,
+    SCENARIO_TELEMETRY,
+};
+
+static const char *scenarioNames[] = {"boot", "scene", "telemetry"};
+
+struct SimConfig {
+    uint16_t nodes = 500;
+    uint32_t bitrate = MM_MEMBUS_BITRATE;
+    double errorRate = 0;
+    double lossRate = 0;
+    uint32_t seed = 1;
+    uint32_t bootWindow = 100;
+    uint16_t sceneSize = 0;
+    uint16_t scenes = 10;
+    uint32_t sceneInterval = 2000;
+    uint32_t period = 10000;
+    uint32_t duration = 60000;
+    uint32_t loopUs = 50;
+    uint32_t frameUs = 100;
+};
+
+/**
+ * Digital output that can be put into a group directly
+ */
+class SimOutput : public MM_Digital_Out {
+public:
+    SimOutput() : MM_Digital_Out(SIM_PIN, 0, false) {}
+    using MM_Module::addMulticastTarget;
+};
+
+struct SimNode {
+    MM_Sysbus *sysbus;
+    MM_MemBusPort *port;
+    SimOutput *output;
+
+    /**
+     * Node is busy processing until then
+     */
+    uint64_t busyUntil = 0;
+
+    /**
+     * A wakeup is scheduled
+     */
+    bool scheduled = false;
+
+    /**
+     * Time of the action the next state frame answers, SIM_NONE = nothing outstanding
+     */
+    uint64_t trigger = SIM_NONE;
+
+    uint32_t received = 0;
+};
+
+enum SimEventType{
+    EVENT_WAKE,
+    EVENT_BOOT,
+    EVENT_SCENE,
+    EVENT_REPORT,
+};
+
+struct SimEvent {
+    uint64_t time;
+    uint64_t seq;
+    SimEventType type;
+    uint32_t node;
+
+    bool operator>(const SimEvent &other) const {
+        if(time != other.time) return time > other.time;
+        return seq > other.seq;
+    }
+};
+
+/**
+ * Latency samples in µs
+ */
+struct SimLatency {
+    const char *name;
+    std::vector<uint64_t> samples;
+
+    void print(){
+        if(samples.empty()){
+            printf("  %-12s %8u\n", name, 0);
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        double sum = 0;
+        for(size_t i = 0; i < samples.size(); i++) sum += samples[i];
+        printf("  %-12s %8zu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, samples.size(),
+            samples.front() / 1000.0, percentile(0.5), percentile(0.9), percentile(0.99),
+            samples.back() / 1000.0, sum / samples.size() / 1000.0);
+    }
+
+    double percentile(double p){
+        size_t i = (size_t)(p * (samples.size() - 1) + 0.5);
+        return samples[i] / 1000.0;
+    }
+};
+
+static SimConfig config;
+static MM_MemBus *bus;
+static std::vector<SimNode> nodes;
+static std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent> > events;
+static uint64_t eventSeq = 0;
+static uint32_t rnd = 1;
+
+static SimLatency actionLatency;
+static SimLatency accessLatency;
+static SimLatency commandLatency;
+
+static uint32_t random32(){
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 17;
+    rnd ^= rnd << 5;
+    return rnd;
+}
+
+static void schedule(uint64_t time, SimEventType type, uint32_t node){
+    SimEvent ev;
+    ev.time = time;
+    ev.seq = eventSeq++;
+    ev.type = type;
+    ev.node = node;
+    events.push(ev);
+}
+
+static void wake(uint32_t i, uint64_t time){
+    SimNode &node = nodes[i];
+    if(node.scheduled) return;
+    node.scheduled = true;
+    schedule(std::max(time, node.busyUntil), EVENT_WAKE, i);
+}
+
+static void onWake(MM_MemBusPort *port){
+    if(port->user == NULL) return;
+    wake((SimNode*)port->user - &nodes[0], MM_HostClock::now());
+}
+
+static void onFrame(const MM_MemBusFrame &frame){
+    accessLatency.samples.push_back(frame.done - frame.queued);
+
+    SimNode *node = (SimNode*)frame.port->user;
+    if(node == NULL){
+        commandLatency.samples.push_back(frame.done - frame.queued);
+        return;
+    }
+    if(node->trigger == SIM_NONE) return;
+    actionLatency.samples.push_back(frame.done - node->trigger);
+    //The state is the last frame of every action
+    if(frame.len > 0 && frame.data[0] == BOOL) node->trigger = SIM_NONE;
+}
+
+static void runNode(uint32_t i){
+    SimNode &node = nodes[i];
+    uint64_t now = MM_HostClock::now();
+    node.scheduled = false;
+
+    uint32_t before = node.port->received;
+    node.sysbus->loop();
+    uint32_t frames = node.port->received - before;
+    node.busyUntil = now + config.loopUs + (uint64_t)config.frameUs * frames;
+
+    if(node.port->rxPending() > 0){
+        wake(i, node.busyUntil);
+    }
+    else if(node.sysbus->txStats(0).depth > 0){
+        //Packets wait for a retry in the TX queue of MM_Sysbus
+        wake(i, now + 1000);
+    }
+}
+
+static void bootNode(uint32_t i){
+    SimNode &node = nodes[i];
+    node.trigger = MM_HostClock::now();
+    node.sysbus->attachBus(node.port);
+    node.sysbus->attachModule(node.output);
+    node.busyUntil = MM_HostClock::now() + config.loopUs;
+}
+
+/**
+ * Process events up to end
+ * @return time of the last event
+ */
+static uint64_t simulate(uint64_t end){
+    MM_MemBus &b = *bus;
+    while(true){
+        uint64_t next = b.nextEvent();
+        if(!events.empty() && events.top().time < next) next = events.top().time;
+        if(next == UINT64_MAX || next > end) break;
+
+        MM_HostClock::set(next);
+        b.run(next);
+        while(!events.empty() && events.top().time <= next){
+            SimEvent ev = events.top();
+            events.pop();
+            switch(ev.type){
+                case EVENT_WAKE:
+                    runNode(ev.node);
+                    break;
+                case EVENT_BOOT:
+                    bootNode(ev.node);
+                    break;
+                case EVENT_REPORT:
+                    nodes[ev.node].trigger = next;
+                    nodes[ev.node].output->broadcastState();
+                    schedule(next + (uint64_t)config.period * 1000, EVENT_REPORT, ev.node);
+                    break;
+                case EVENT_SCENE:
+                    break;
+            }
+        }
+        b.run(next);
+    }
+    return MM_HostClock::now();
+}
+
+static void recallScene(MM_Sysbus &controller, MM_MemBusPort &port, bool state){
+    uint64_t now = MM_HostClock::now();
+    uint16_t members = config.sceneSize ? config.sceneSize : config.nodes;
+    for(uint16_t i = 0; i < members && i < nodes.size(); i++){
+        nodes[i].trigger = now;
+    }
+    uint8_t data[2] = {BOOL, state};
+    controller.Send(Multicast, SIM_SCENE_GROUP, 2, data);
+}
+
+static void runScenario(SimScenario scenario){
+    MM_HostClock::set(0);
+    rnd = config.seed;
+    bus = new MM_MemBus(config.bitrate);
+    bus->setErrorRate(config.errorRate);
+    bus->setLossRate(config.lossRate);
+    bus->setSeed(config.seed);
+    bus->attachFrameHandler(onFrame);
+    bus->attachWakeHandler(onWake);
+
+    nodes.clear();
+    nodes.resize(config.nodes);
+    for(uint16_t i = 0; i < config.nodes; i++){
+        nodes[i].sysbus = new MM_Sysbus(SIM_CONTROLLER + 1 + i);
+        nodes[i].port = new MM_MemBusPort(*bus);
+        nodes[i].port->user = &nodes[i];
+        nodes[i].output = new SimOutput();
+    }
+
+    MM_Sysbus controller(SIM_CONTROLLER);
+    MM_MemBusPort controllerPort(*bus);
+    controller.attachBus(&controllerPort);
+
+    actionLatency.samples.clear();
+    accessLatency.samples.clear();
+    commandLatency.samples.clear();
+    actionLatency.name = scenario == SCENARIO_BOOT ? "boot" : scenario == SCENARIO_SCENE ? "scene" : "telemetry";
+    accessLatency.name = "bus access";
+    commandLatency.name = "command";
+
+    uint64_t start = 0;
+    if(scenario == SCENARIO_BOOT){
+        for(uint16_t i = 0; i < config.nodes; i++){
+            uint64_t at = config.bootWindow ? random32() % ((uint64_t)config.bootWindow * 1000) : 0;
+            schedule(at, EVENT_BOOT, i);
+        }
+    }
+    else{
+        //Boot everything and let the bus settle before measuring
+        for(uint16_t i = 0; i < config.nodes; i++){
+            schedule(0, EVENT_BOOT, i);
+        }
+        simulate(UINT64_MAX);
+        for(uint16_t i = 0; i < config.nodes; i++){
+            nodes[i].trigger = SIM_NONE;
+            if(scenario == SCENARIO_SCENE && (config.sceneSize == 0 || i < config.sceneSize)){
+                nodes[i].output->addMulticastTarget(SIM_SCENE_GROUP, ALL_CMDS);
+            }
+        }
+        simulate(UINT64_MAX);
+        start = MM_HostClock::now() + 1000;
+        MM_HostClock::set(start);
+        bus->resetStats();
+        actionLatency.samples.clear();
+        accessLatency.samples.clear();
+        commandLatency.samples.clear();
+    }
+
+    uint64_t last = start;
+    if(scenario == SCENARIO_SCENE){
+        for(uint16_t s = 0; s < config.scenes; s++){
+            MM_HostClock::set(start + (uint64_t)s * config.sceneInterval * 1000);
+            recallScene(controller, controllerPort, s % 2 == 0);
+            last = simulate(start + (uint64_t)(s + 1) * config.sceneInterval * 1000 - 1);
+        }
+    }
+    else if(scenario == SCENARIO_TELEMETRY){
+        for(uint16_t i = 0; i < config.nodes; i++){
+            schedule(start + random32() % ((uint64_t)config.period * 1000), EVENT_REPORT, i);
+        }
+        last = simulate(start + (uint64_t)config.duration * 1000);
+        MM_HostClock::set(start + (uint64_t)config.duration * 1000);
+    }
+    else{
+        last = simulate(UINT64_MAX);
+    }
+    if(scenario != SCENARIO_TELEMETRY) MM_HostClock::set(last);
+
+    uint32_t queueDrops = 0;
+    uint32_t portOverruns = 0;
+    for(uint16_t i = 0; i < config.nodes; i++){
+        queueDrops += nodes[i].sysbus->txStats(0).drops;
+        portOverruns += nodes[i].port->overruns;
+    }
+    queueDrops += controller.txStats(0).drops;
+
+    MM_MemBusStats &stats = bus->stats;
+    printf("scenario %s: %u nodes, %lu bit/s, %.1f ms simulated\n", scenarioNames[scenario],
+        config.nodes, (unsigned long)bus->bitrate(), (MM_HostClock::now() - start) / 1000.0);
+    printf("  frames %u, bus utilization %.1f %%\n", stats.frames, bus->utilization() * 100.0);
+    printf("  drops: lost %u, rx overruns %u, tx queue %u\n", stats.lost, portOverruns, queueDrops);
+    printf("  bus errors %u, arbitration lost %u, mailboxes full %u\n", stats.errors, stats.arbitrationLost, stats.txFull);
+    printf("  latency [ms]    count       min       p50       p90       p99       max      mean\n");
+    actionLatency.print();
+    if(scenario == SCENARIO_SCENE) commandLatency.print();
+    accessLatency.print();
+    printf("\n");
+
+    while(!events.empty()) events.pop();
+    for(uint16_t i = 0; i < config.nodes; i++){
+        delete nodes[i].output;
+        delete nodes[i].port;
+        delete nodes[i].sysbus;
+    }
+    nodes.clear();
+    delete bus;
+    bus = NULL;
+}
+
+static void usage(const char *name){
+    printf("Usage: %s [options]\n"
+        "  --scenario NAME        boot, scene, telemetry or all (default all)\n"
+        "  --nodes N              number of nodes, max 2046 (default 500)\n"
+        "  --bitrate BPS          bus bitrate (default %u)\n"
+        "  --error-rate P         probability of a bus error per transmission\n"
+        "  --loss-rate P          probability that a receiver misses a frame\n"
+        "  --seed N               random seed\n"
+        "  --boot-window MS       nodes power up within this time (default 100)\n"
+        "  --scene-size N         nodes in the scene group (default all)\n"
+        "  --scenes N             number of scene recalls (default 10)\n"
+        "  --scene-interval MS    time between recalls (default 2000)\n"
+        "  --period MS            telemetry interval per node (default 10000)\n"
+        "  --duration MS          telemetry run time (default 60000)\n"
+        "  --loop-us US           processing time of a node loop (default 50)\n"
+        "  --frame-us US          processing time per received frame (default 100)\n",
+        name, MM_MEMBUS_BITRATE);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"scenario", required_argument, NULL, 's'},
+        {"nodes", required_argument, NULL, 'n'},
+        {"bitrate", required_argument, NULL, 'b'},
+        {"error-rate", required_argument, NULL, 'e'},
+        {"loss-rate", required_argument, NULL, 'l'},
+        {"seed", required_argument, NULL, 'r'},
+        {"boot-window", required_argument, NULL, 'w'},
+        {"scene-size", required_argument, NULL, 'g'},
+        {"scenes", required_argument, NULL, 'c'},
+        {"scene-interval", required_argument, NULL, 'i'},
+        {"period", required_argument, NULL, 'p'},
+        {"duration", required_argument, NULL, 'd'},
+        {"loop-us", required_argument, NULL, 'L'},
+        {"frame-us", required_argument, NULL, 'F'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int scenario = -1;
+    int opt;
+    while((opt = getopt_long(argc, argv, "h", options, NULL)) != -1){
+        switch(opt){
+            case 's':
+                scenario = -1;
+                for(int i = 0; i < 3; i++){
+                    if(strcmp(optarg, scenarioNames[i]) == 0) scenario = i;
+                }
+                if(scenario < 0 && strcmp(optarg, "all") != 0){
+                    fprintf(stderr, "Unknown scenario %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n': config.nodes = atoi(optarg); break;
+            case 'b': config.bitrate = atol(optarg); break;
+            case 'e': config.errorRate = atof(optarg); break;
+            case 'l': config.lossRate = atof(optarg); break;
+            case 'r': config.seed = atol(optarg); break;
+            case 'w': config.bootWindow = atol(optarg); break;
+            case 'g': config.sceneSize = atoi(optarg); break;
+            case 'c': config.scenes = atoi(optarg); break;
+            case 'i': config.sceneInterval = atol(optarg); break;
+            case 'p': config.period = atol(optarg); break;
+            case 'd': config.duration = atol(optarg); break;
+            case 'L': config.loopUs = atol(optarg); break;
+            case 'F': config.frameUs = atol(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    //Unicast addresses are 11 bit, the controller uses 1
+    if(config.nodes == 0 || config.nodes > 2046 || config.period == 0 || config.sceneInterval == 0){
+        fprintf(stderr, "Invalid options\n");
+        return 1;
+    }
+    if(config.seed == 0) config.seed = 1;
+
+    for(int i = 0; i < 3; i++){
+        if(scenario < 0 || scenario == i) runScenario((SimScenario)i);
+    }
+    return 0;
+}
@@ -0,0 +1,579 @@
+/*
+    MM_Sysbus Linux gateway
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Event driven gateway, the Linux counterpart of examples/Gateway.ino
+ *
+ * Routes packets between SocketCAN buses, serial ports (MM_UART framing) and clients on
+ * Unix or TCP sockets (MM_UART framing as well). The process sleeps in epoll_wait() until
+ * a descriptor is readable/writable, a wait timeout is only used while packets wait for
+ * a retry in the TX queues of MM_Sysbus.
+ *
+ *   mm_gateway --can can0 --can can1 --tty /dev/ttyUSB0:115200 --tcp 5000 --unix /run/mm.sock
+ *
+ * Testing without hardware:
+ *   vcan:    ip link add dev vcan0 type vcan && ip link set up vcan0
+ *   pty:     socat -d -d pty,raw,echo=0 pty,raw,echo=0  (use one end as --tty)
+ *   sockets: --tcp 5000 and nc 127.0.0.1 5000
+ *
+ * With --threads every CAN bus and serial port gets its own thread (MM_ThreadedGateway),
+ * for gateways bridging many busy buses. Socket clients need the event loop and aren't
+ * available in this mode.
+ */
+
+#include <Arduino.h>
+#include <MM_Sysbus.h>
+#include <MM_FdStream.h>
+#include <MM_SocketCAN.h>
+#include <MM_ThreadedGateway.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+//Events taken with one epoll_wait()
+#define GW_EVENTS 64
+
+//Packets routed per round before the TX queues are served again
+#define GW_DRAIN 256
+
+//Pending connections of a listening socket
+#define GW_BACKLOG 16
+
+enum GwPortType{
+    PORT_CAN,
+    PORT_TTY,
+    PORT_CLIENT,
+    PORT_LISTEN,
+};
+
+struct GwPort {
+    GwPortType type;
+    std::string name;
+    MM_Interface *iface = NULL;
+    MM_SocketCAN *can = NULL;
+    MM_FdStream *stream = NULL;
+    MM_UART *uart = NULL;
+    int fd = -1;
+
+    /**
+     * EPOLLOUT is registered
+     */
+    bool watchWrite = false;
+};
+
+static MM_Sysbus *sysbus;
+static MM_ThreadedGateway *threaded = NULL;
+static int epfd = -1;
+static std::vector<GwPort*> ports;
+static MM_UARTFraming framing = MM_UART_AUTO;
+static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t dump = 0;
+static bool verbose = false;
+
+static void onSignal(int sig){
+    if(sig == SIGUSR1){
+        dump = 1;
+    }else{
+        stop = 1;
+    }
+}
+
+static bool watch(GwPort *port, uint32_t events, int op){
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = port;
+    if(epoll_ctl(epfd, op, port->fd, &ev) < 0){
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+static bool addInterface(GwPort *port){
+    if(threaded != NULL){
+        if(!threaded->attach(port->iface, port->fd, port->stream)){
+            fprintf(stderr, "%s: can't attach, all %d interfaces used\n", port->name.c_str(), MM_GW_MAX_INTERFACES);
+            return false;
+        }
+        ports.push_back(port);
+        return true;
+    }
+    if(!sysbus->attachBus(port->iface)){
+        fprintf(stderr, "%s: can't attach, all %d interfaces used\n", port->name.c_str(), MAX_INTERFACES);
+        return false;
+    }
+    if(!watch(port, EPOLLIN, EPOLL_CTL_ADD)){
+        sysbus->detachBus(port->iface);
+        return false;
+    }
+    ports.push_back(port);
+    if(verbose) fprintf(stderr, "%s: attached\n", port->name.c_str());
+    return true;
+}
+
+static void freePort(GwPort *port){
+    delete port->uart;
+    delete port->stream;
+    delete port->can;
+    if(port->type == PORT_LISTEN && port->fd >= 0) close(port->fd);
+    delete port;
+}
+
+static void removePort(GwPort *port){
+    if(verbose) fprintf(stderr, "%s: closed\n", port->name.c_str());
+    if(threaded == NULL){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, port->fd, NULL);
+        if(port->iface != NULL) sysbus->detachBus(port->iface);
+    }
+    for(size_t i = 0; i < ports.size(); i++){
+        if(ports[i] == port){
+            ports.erase(ports.begin() + i);
+            break;
+        }
+    }
+    freePort(port);
+}
+
+static GwPort *streamPort(GwPortType type, const std::string &name, int fd){
+    GwPort *port = new GwPort();
+    port->type = type;
+    port->name = name;
+    port->fd = fd;
+    port->stream = new MM_FdStream(fd);
+    port->uart = new MM_UART(*port->stream);
+    port->uart->setFraming(framing);
+    port->iface = port->uart;
+    return port;
+}
+
+static bool openCAN(const char *ifname){
+    GwPort *port = new GwPort();
+    port->type = PORT_CAN;
+    port->name = std::string("can:") + ifname;
+    port->can = new MM_SocketCAN(ifname);
+    port->iface = port->can;
+    if(!port->can->begin()){
+        fprintf(stderr, "%s: %s\n", port->name.c_str(), strerror(port->can->lastErr));
+        freePort(port);
+        return false;
+    }
+    port->fd = port->can->fd();
+    if(!addInterface(port)){
+        freePort(port);
+        return false;
+    }
+    return true;
+}
+
+static bool openTTY(const char *arg){
+    std::string path = arg;
+    uint32_t baud = 115200;
+    size_t colon = path.rfind(':');
+    if(colon != std::string::npos){
+        baud = atol(path.c_str() + colon + 1);
+        path = path.substr(0, colon);
+    }
+    int fd = MM_FdStream::openSerial(path.c_str(), baud);
+    if(fd < 0){
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    GwPort *port = streamPort(PORT_TTY, "tty:" + path, fd);
+    if(!addInterface(port)){
+        freePort(port);
+        return false;
+    }
+    return true;
+}
+
+static bool listenOn(int fd, const std::string &name){
+    if(listen(fd, GW_BACKLOG) < 0){
+        fprintf(stderr, "%s: %s\n", name.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
+    GwPort *port = new GwPort();
+    port->type = PORT_LISTEN;
+    port->name = name;
+    port->fd = fd;
+    if(!watch(port, EPOLLIN, EPOLL_CTL_ADD)){
+        freePort(port);
+        return false;
+    }
+    ports.push_back(port);
+    return true;
+}
+
+static bool openUnix(const char *path){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "%s: path too long\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        perror("socket");
+        return false;
+    }
+    unlink(path);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    return listenOn(fd, std::string("unix:") + path);
+}
+
+static bool openTCP(const char *arg){
+    std::string host = "127.0.0.1";
+    std::string service = arg;
+    size_t colon = service.rfind(':');
+    if(colon != std::string::npos){
+        host = service.substr(0, colon);
+        service = service.substr(colon + 1);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *res;
+    int err = getaddrinfo(host.empty() ? NULL : host.c_str(), service.c_str(), &hints, &res);
+    if(err != 0){
+        fprintf(stderr, "%s: %s\n", arg, gai_strerror(err));
+        return false;
+    }
+
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        perror("socket");
+        freeaddrinfo(res);
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(bind(fd, res->ai_addr, res->ai_addrlen) < 0){
+        fprintf(stderr, "%s: %s\n", arg, strerror(errno));
+        close(fd);
+        freeaddrinfo(res);
+        return false;
+    }
+    freeaddrinfo(res);
+    return listenOn(fd, std::string("tcp:") + arg);
+}
+
+static void acceptClients(GwPort *listener){
+    while(true){
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0){
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                perror("accept");
+            }
+            return;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        char name[32];
+        snprintf(name, sizeof(name), ":%d", fd);
+        GwPort *port = streamPort(PORT_CLIENT, listener->name + name, fd);
+        if(!addInterface(port)){
+            freePort(port);
+        }
+    }
+}
+
+/**
+ * Write the frames routed in this round, watch streams that couldn't take everything
+ * for EPOLLOUT and close streams that failed
+ */
+static void flushStreams(){
+    for(size_t i = 0; i < ports.size(); ){
+        GwPort *port = ports[i];
+        if(port->stream == NULL){
+            i++;
+            continue;
+        }
+        port->stream->flush();
+        if(port->stream->closed()){
+            removePort(port);
+            continue;
+        }
+        bool want = port->stream->wantsWrite();
+        if(want != port->watchWrite){
+            port->watchWrite = want;
+            watch(port, want ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+        }
+        i++;
+    }
+}
+
+/**
+ * true if packets wait for a retry in a TX queue of MM_Sysbus
+ */
+static bool txBacklog(){
+    for(uint8_t i = 0; i < MAX_INTERFACES; i++){
+        if(sysbus->txStats(i).depth > 0) return true;
+    }
+    return false;
+}
+
+static void printStats(){
+    MM_RoutingStats routing = threaded != NULL ? threaded->routingStats() : sysbus->routingStats();
+    fprintf(stderr, "routing: learned %lu, routed %lu, flooded %lu, saved %lu, duplicates %lu\n",
+        (unsigned long)routing.learned, (unsigned long)routing.routed, (unsigned long)routing.flooded,
+        (unsigned long)routing.framesSaved, (unsigned long)routing.duplicates);
+    if(threaded != NULL){
+        //The interface counters belong to the threads, only the gateway counters are shared
+        for(size_t i = 0; i < ports.size(); i++){
+            MM_GatewayPortStats stats = threaded->portStats(i);
+            fprintf(stderr, "%s: rx %lu, tx %lu, queue full %lu, sleeps %lu\n", ports[i]->name.c_str(),
+                (unsigned long)stats.rx, (unsigned long)stats.tx, (unsigned long)stats.queueFull, (unsigned long)stats.sleeps);
+        }
+        return;
+    }
+    for(size_t i = 0; i < ports.size(); i++){
+        GwPort *port = ports[i];
+        if(port->can != NULL){
+            MM_SocketCANStats &s = port->can->stats;
+            fprintf(stderr, "%s: rx %lu, tx %lu, rx drops %lu, tx full %lu, rx batches %lu\n", port->name.c_str(),
+                (unsigned long)s.rxFrames, (unsigned long)s.txFrames, (unsigned long)s.rxDrops,
+                (unsigned long)s.txFull, (unsigned long)s.rxBatches);
+        }
+        else if(port->stream != NULL){
+            fprintf(stderr, "%s: rx %llu bytes, tx %llu bytes, tx full %lu\n", port->name.c_str(),
+                (unsigned long long)port->stream->rxBytes, (unsigned long long)port->stream->txBytes,
+                (unsigned long)port->stream->txFull);
+        }
+    }
+    for(uint8_t i = 0; i < MAX_INTERFACES; i++){
+        MM_TxStats tx = sysbus->txStats(i);
+        if(tx.sent == 0 && tx.drops == 0 && tx.retries == 0) continue;
+        fprintf(stderr, "tx queue %u: sent %lu, retries %u, drops %u, high water %u\n", i,
+            (unsigned long)tx.sent, tx.retries, tx.drops, tx.highWater);
+    }
+}
+
+static void usage(const char *name){
+    printf("Usage: %s [options]\n"
+        "  --can IF              SocketCAN interface (repeatable)\n"
+        "  --tty PATH[:BAUD]     serial port with MM_UART framing, default 115200 baud (repeatable)\n"
+        "  --unix PATH           accept MM_UART clients on a Unix socket (repeatable)\n"
+        "  --tcp [HOST:]PORT     accept MM_UART clients on TCP, default host 127.0.0.1 (repeatable)\n"
+        "  --framing MODE        ascii, binary or auto (default auto)\n"
+        "  --node-id N           node id of the gateway, 0 = routing only (default 0)\n"
+        "  --threads             one thread per CAN bus / serial port, no socket clients\n"
+        "  --cpus N              with --threads: pin the threads to the first N cores\n"
+        "  --verbose             log attached/closed interfaces\n"
+        "Statistics are printed on SIGUSR1 and on exit.\n", name);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"can", required_argument, NULL, 'c'},
+        {"tty", required_argument, NULL, 't'},
+        {"unix", required_argument, NULL, 'u'},
+        {"tcp", required_argument, NULL, 'p'},
+        {"framing", required_argument, NULL, 'f'},
+        {"node-id", required_argument, NULL, 'n'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"threads", no_argument, NULL, 'T'},
+        {"cpus", required_argument, NULL, 'C'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    std::vector<std::pair<int, const char*> > opens;
+    uint16_t nodeID = 0;
+    bool useThreads = false;
+    uint8_t cpus = 0;
+    int opt;
+    while((opt = getopt_long(argc, argv, "h", options, NULL)) != -1){
+        switch(opt){
+            case 'c':
+            case 't':
+            case 'u':
+            case 'p':
+                opens.push_back(std::make_pair(opt, optarg));
+                break;
+            case 'f':
+                if(strcmp(optarg, "ascii") == 0) framing = MM_UART_ASCII;
+                else if(strcmp(optarg, "binary") == 0) framing = MM_UART_BINARY;
+                else if(strcmp(optarg, "auto") == 0) framing = MM_UART_AUTO;
+                else{
+                    fprintf(stderr, "Unknown framing %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n': nodeID = atoi(optarg); break;
+            case 'v': verbose = true; break;
+            case 'T': useThreads = true; break;
+            case 'C': cpus = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if(opens.empty()){
+        usage(argv[0]);
+        return 1;
+    }
+    if(useThreads){
+        for(size_t i = 0; i < opens.size(); i++){
+            if(opens[i].first == 'u' || opens[i].first == 'p'){
+                fprintf(stderr, "--unix and --tcp aren't available with --threads\n");
+                return 1;
+            }
+        }
+        if(nodeID != 0){
+            fprintf(stderr, "--threads only routes, the node id has to be 0\n");
+            return 1;
+        }
+    }
+
+    MM_HostClock::setRealtime(true);
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0){
+        perror("epoll_create1");
+        return 1;
+    }
+
+    if(useThreads){
+        threaded = new MM_ThreadedGateway();
+    }else{
+        sysbus = new MM_Sysbus(nodeID);
+        sysbus->setReceiveBudget(GW_DRAIN > 255 ? 255 : GW_DRAIN, 0);
+    }
+
+    for(size_t i = 0; i < opens.size(); i++){
+        bool ok = false;
+        switch(opens[i].first){
+            case 'c': ok = openCAN(opens[i].second); break;
+            case 't': ok = openTTY(opens[i].second); break;
+            case 'u': ok = openUnix(opens[i].second); break;
+            case 'p': ok = openTCP(opens[i].second); break;
+        }
+        if(!ok) return 1;
+    }
+
+    if(threaded != NULL){
+        //Only this thread takes the signals, the gateway threads inherit the blocked mask
+        sigset_t block, old;
+        sigemptyset(&block);
+        sigaddset(&block, SIGINT);
+        sigaddset(&block, SIGTERM);
+        sigaddset(&block, SIGUSR1);
+        sigprocmask(SIG_BLOCK, &block, &old);
+        if(!threaded->start(false, cpus)){
+            perror("start");
+            return 1;
+        }
+        while(!stop){
+            sigsuspend(&old);
+            if(dump){
+                dump = 0;
+                printStats();
+            }
+        }
+        threaded->stop();
+        printStats();
+        while(!ports.empty()) removePort(ports.back());
+        delete threaded;
+        close(epfd);
+        return 0;
+    }
+
+    struct epoll_event events[GW_EVENTS];
+    MM_Packet pkg;
+    while(!stop){
+        //Sleep until something happens, wake up for retries only while packets are queued
+        int timeout = txBacklog() ? TX_RETRY_DELAY : -1;
+        int n = epoll_wait(epfd, events, GW_EVENTS, timeout);
+        if(n < 0){
+            if(errno != EINTR){
+                perror("epoll_wait");
+                break;
+            }
+            n = 0;
+        }
+
+        for(int i = 0; i < n; i++){
+            GwPort *port = (GwPort*)events[i].data.ptr;
+            if(port->type == PORT_LISTEN){
+                acceptClients(port);
+                continue;
+            }
+            if(port->stream != NULL){
+                if(events[i].events & EPOLLOUT) port->stream->flush();
+                if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) port->stream->fill();
+            }
+            else if(port->can != NULL && (events[i].events & EPOLLERR)){
+                fprintf(stderr, "%s: error\n", port->name.c_str());
+            }
+        }
+
+        //Route everything that arrived, the interfaces read in batches when their buffer is empty
+        uint16_t routed = 0;
+        while(routed < GW_DRAIN && sysbus->Receive(pkg)) routed++;
+
+        //TX queue retries and housekeeping
+        sysbus->loop();
+
+        flushStreams();
+
+        if(dump){
+            dump = 0;
+            printStats();
+        }
+    }
+
+    printStats();
+    while(!ports.empty()) removePort(ports.back());
+    delete sysbus;
+    close(epfd);
+    return 0;
+}
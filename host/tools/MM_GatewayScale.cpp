@@ -0,0 +1,374 @@
+/*
+    MM_Sysbus gateway scaling benchmark
+
+    Copyright (C) 2021  Markus Mair, https://github.com/Maggge/MM_Sysbus
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Measures the throughput (frames/s) of a gateway depending on the number of buses and
+ * cores and prints the results as JSON:
+ *
+ *  single_<n>bus         MM_Sysbus with n interfaces, routed by one thread
+ *  threaded_<n>bus_<c>cpu MM_ThreadedGateway with n interfaces, the threads pinned to c cores
+ *
+ * Every interface always has a packet to receive and accepts everything sent to it, so
+ * the numbers are the routing capacity without bus limits. The traffic is a fixed mix of
+ * 55% unicast (5% of them to unknown nodes), 25% multicast and 20% broadcast.
+ * frames/s counts the sent frames of all interfaces, stalls are rounds in which a thread of
+ * the threaded gateway didn't receive because the thread of a target interface fell behind.
+ * The library is compiled for this target with MAX_INTERFACES 16.
+ */
+
+#include <Arduino.h>
+#include <MM_Sysbus.h>
+#include <MM_ThreadedGateway.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Packets in the traffic mix of an interface, a power of two
+#define SCALE_MIX_SIZE 4096
+
+//Nodes behind every interface
+#define SCALE_NODES_PER_BUS 100
+
+//First multicast group
+#define SCALE_GROUP_BASE 0x2000
+
+struct ScaleConfig {
+    std::vector<int> buses;
+    std::vector<int> cpus;
+    uint32_t time = 1000;
+    bool spin = false;
+    const char *output = NULL;
+};
+
+struct ScaleResult {
+    std::string name;
+    int buses;
+    int cpus;
+    double frames;
+    double received;
+    uint64_t stalls;
+};
+
+static ScaleConfig config;
+static std::vector<ScaleResult> results;
+static uint32_t rnd = 1;
+
+static uint32_t random32(){
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 17;
+    rnd ^= rnd << 5;
+    return rnd;
+}
+
+/**
+ * Interface that always receives the next packet of its mix and counts sent packets
+ * Only used by one thread at a time
+ */
+class ScaleInterface : public MM_Interface {
+public:
+    std::vector<MM_Packet> mix;
+    uint32_t seq = 0;
+    uint8_t id = 0;
+    uint64_t received = 0;
+    uint64_t sent = 0;
+
+    bool begin(){
+        return true;
+    }
+
+    bool Send(MM_MsgType type, uint16_t target, uint16_t source, uint8_t port, uint8_t len, uint8_t *data){
+        sent++;
+        return true;
+    }
+
+    uint8_t SendBatch(MM_Packet *pkgs, uint8_t count){
+        sent += count;
+        return count;
+    }
+
+    bool Receive(MM_Packet &pkg){
+        pkg = mix[seq & (SCALE_MIX_SIZE - 1)];
+        //Unique payload, so the duplicate cache doesn't drop the mix
+        pkg.data[1] = seq;
+        pkg.data[2] = seq >> 8;
+        pkg.data[3] = seq >> 16;
+        pkg.data[4] = id;
+        seq++;
+        received++;
+        return true;
+    }
+};
+
+static MM_Packet packet(MM_MsgType type, uint16_t target, uint16_t source){
+    MM_Packet pkg;
+    pkg.meta.type = type;
+    pkg.meta.target = target;
+    pkg.meta.source = source;
+    pkg.meta.port = random32() % 4;
+    pkg.meta.busId = -1;
+    pkg.len = 5 + random32() % 4;
+    for(uint8_t i = 0; i < 8; i++) pkg.data[i] = random32();
+    return pkg;
+}
+
+/**
+ * Node n sits behind interface (n - 1) / SCALE_NODES_PER_BUS
+ */
+static void scaleMix(ScaleInterface &iface, uint8_t busId, uint8_t buses){
+    uint16_t nodes = buses * SCALE_NODES_PER_BUS;
+    iface.id = busId;
+    iface.mix.resize(SCALE_MIX_SIZE);
+    for(uint32_t i = 0; i < SCALE_MIX_SIZE; i++){
+        uint16_t source = 1 + busId * SCALE_NODES_PER_BUS + random32() % SCALE_NODES_PER_BUS;
+        uint32_t kind = random32() % 100;
+        if(i < SCALE_NODES_PER_BUS){
+            //Every node announces itself first, so the routes are learned
+            iface.mix[i] = packet(Broadcast, 0, 1 + busId * SCALE_NODES_PER_BUS + i);
+        }else if(kind < 50){
+            iface.mix[i] = packet(Unicast, 1 + random32() % nodes, source);
+        }else if(kind < 55){
+            iface.mix[i] = packet(Unicast, 1 + nodes + random32() % (2000 - nodes), source);
+        }else if(kind < 80){
+            iface.mix[i] = packet(Multicast, SCALE_GROUP_BASE + random32() % 64, source);
+        }else{
+            iface.mix[i] = packet(Broadcast, 0, source);
+        }
+    }
+}
+
+static double seconds(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, int buses, int cpus, double frames, double received, uint64_t stalls){
+    ScaleResult result;
+    result.name = name;
+    result.buses = buses;
+    result.cpus = cpus;
+    result.frames = frames;
+    result.received = received;
+    result.stalls = stalls;
+    results.push_back(result);
+    fprintf(stderr, "%-24s %12.0f frames/s %12.0f rx/s %10llu stalls\n", name, frames, received, (unsigned long long)stalls);
+}
+
+static void pin(int cpu){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void unpin(){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(long i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); i++) CPU_SET(i, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void scaleSingle(uint8_t buses){
+    char name[32];
+    snprintf(name, sizeof(name), "single_%ubus", buses);
+
+    MM_Sysbus gateway(0);
+    std::vector<ScaleInterface> ifs(buses);
+    for(uint8_t i = 0; i < buses; i++){
+        scaleMix(ifs[i], i, buses);
+        gateway.attachBus(&ifs[i]);
+    }
+    gateway.setReceiveBudget(255, 0);
+
+    pin(0);
+    MM_Packet pkg;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool measuring = false;
+    while(true){
+        for(uint16_t i = 0; i < 1024; i++) gateway.Receive(pkg);
+        gateway.loop();
+
+        //Warm up for a tenth of the time, then count
+        double elapsed = seconds(start);
+        if(!measuring && elapsed >= config.time / 10000.0){
+            measuring = true;
+            start = std::chrono::steady_clock::now();
+            for(uint8_t i = 0; i < buses; i++){
+                sent -= ifs[i].sent;
+                received -= ifs[i].received;
+            }
+        }
+        else if(measuring && elapsed >= config.time / 1000.0){
+            for(uint8_t i = 0; i < buses; i++){
+                sent += ifs[i].sent;
+                received += ifs[i].received;
+            }
+            report(name, buses, 1, sent / elapsed, received / elapsed, 0);
+            break;
+        }
+    }
+    unpin();
+}
+
+static void scaleThreaded(uint8_t buses, uint8_t cpus){
+    char name[32];
+    snprintf(name, sizeof(name), "threaded_%ubus_%ucpu", buses, cpus);
+
+    MM_ThreadedGateway gateway;
+    std::vector<ScaleInterface> ifs(buses);
+    for(uint8_t i = 0; i < buses; i++){
+        scaleMix(ifs[i], i, buses);
+        gateway.attach(&ifs[i]);
+    }
+    if(!gateway.start(config.spin, cpus)){
+        fprintf(stderr, "%s: can't start the threads\n", name);
+        return;
+    }
+
+    //Warm up for a tenth of the time, then count
+    std::this_thread::sleep_for(std::chrono::milliseconds(config.time / 10));
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t stalls = 0;
+    for(uint8_t i = 0; i < buses; i++){
+        MM_GatewayPortStats stats = gateway.portStats(i);
+        sent -= stats.tx;
+        received -= stats.rx;
+        stalls -= stats.queueFull;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(config.time));
+    for(uint8_t i = 0; i < buses; i++){
+        MM_GatewayPortStats stats = gateway.portStats(i);
+        sent += stats.tx;
+        received += stats.rx;
+        stalls += stats.queueFull;
+    }
+    double elapsed = seconds(start);
+    gateway.stop();
+    report(name, buses, cpus, sent / elapsed, received / elapsed, stalls);
+}
+
+static void printJSON(FILE *out){
+    fprintf(out, "{\n");
+    fprintf(out, "  \"suite\": \"mm_gateway_scale\",\n");
+    fprintf(out, "  \"unit\": \"frames/s\",\n");
+    fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(out, "  \"config\": {\"MM_GW_QUEUE_SIZE\": %d, \"MM_GW_BATCH\": %d, \"cores\": %ld, \"spin\": %s, \"time_ms\": %u},\n",
+        MM_GW_QUEUE_SIZE, MM_GW_BATCH, sysconf(_SC_NPROCESSORS_ONLN), config.spin ? "true" : "false", config.time);
+    fprintf(out, "  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); i++){
+        const ScaleResult &r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"buses\": %d, \"cpus\": %d, \"frames_per_s\": %.0f, \"rx_per_s\": %.0f, \"stalls\": %llu}%s\n",
+            r.name.c_str(), r.buses, r.cpus, r.frames, r.received, (unsigned long long)r.stalls, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+/**
+ * Parse a comma separated list of numbers
+ */
+static std::vector<int> parseList(const char *arg){
+    std::vector<int> list;
+    char *end;
+    while(*arg != 0){
+        long value = strtol(arg, &end, 10);
+        if(end == arg) break;
+        if(value > 0) list.push_back(value);
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return list;
+}
+
+static void usage(const char *name){
+    printf("Usage: %s [options]\n"
+        "  --buses LIST     bus counts, default 2,4,8,16\n"
+        "  --cpus LIST      core counts for the threaded gateway, default 1,2,4... up to the online cores\n"
+        "  --time MS        measuring time per run (default 1000)\n"
+        "  --spin           threads poll instead of sleeping when idle\n"
+        "  --output FILE    write the JSON results to FILE instead of stdout\n", name);
+}
+
+int main(int argc, char **argv){
+    static const struct option options[] = {
+        {"buses", required_argument, NULL, 'b'},
+        {"cpus", required_argument, NULL, 'c'},
+        {"time", required_argument, NULL, 't'},
+        {"spin", no_argument, NULL, 's'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "h", options, NULL)) != -1){
+        switch(opt){
+            case 'b': config.buses = parseList(optarg); break;
+            case 'c': config.cpus = parseList(optarg); break;
+            case 't': config.time = atol(optarg); break;
+            case 's': config.spin = true; break;
+            case 'o': config.output = optarg; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if(config.buses.empty()){
+        for(int n = 2; n <= MM_GW_MAX_INTERFACES && n <= MAX_INTERFACES; n *= 2) config.buses.push_back(n);
+    }
+    if(config.cpus.empty()){
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        for(int n = 1; n < cores; n *= 2) config.cpus.push_back(n);
+        config.cpus.push_back(cores);
+    }
+    if(config.time < 10) config.time = 10;
+
+    MM_HostClock::setRealtime(true);
+
+    for(size_t b = 0; b < config.buses.size(); b++){
+        int buses = config.buses[b];
+        if(buses < 2 || buses > MM_GW_MAX_INTERFACES || buses > MAX_INTERFACES){
+            fprintf(stderr, "%d buses: not between 2 and %d\n", buses, MM_GW_MAX_INTERFACES);
+            continue;
+        }
+        scaleSingle(buses);
+        for(size_t c = 0; c < config.cpus.size(); c++){
+            scaleThreaded(buses, config.cpus[c]);
+        }
+    }
+
+    FILE *out = stdout;
+    if(config.output != NULL){
+        out = fopen(config.output, "w");
+        if(out == NULL){
+            perror(config.output);
+            return 1;
+        }
+    }
+    printJSON(out);
+    if(out != stdout) fclose(out);
+    return 0;
+}